@@ -0,0 +1,1265 @@
+/*
+ * codec.c: record codecs between C-ISAM records and Postgres values
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// For keydesc
+#include <isam.h>
+
+#include <libpq-fe.h>
+
+#include "sys.h"
+#include "schema.h"
+#include "codec.h"
+#include "pgres.h"
+#include "numeric.h"
+#include "xstring.h"
+
+// Postgres type oids accepted for binary results
+#define PGTYPE_BOOL		16
+#define PGTYPE_BYTEA	17
+#define PGTYPE_INT8		20
+#define PGTYPE_INT2		21
+#define PGTYPE_INT4		23
+#define PGTYPE_TEXT		25
+#define PGTYPE_OID		26
+#define PGTYPE_BPCHAR	1042
+#define PGTYPE_VARCHAR	1043
+
+// Decimal strings parsed without an allocation
+#define DECSTRMAX 128
+
+// Static function prototypes
+static void map_types (SCHEMA * s, RES * res, const int * fieldv);
+
+
+// CODE STARTS HERE
+
+
+// _____/ CODEC functions \__________
+/*
+ * CODEC_attach
+ * Attach the generated codec matching a schema's name and fingerprint
+ * schema		Schema to attach to
+ */
+void CODEC_attach (SCHEMA * schema)
+{
+	const CODEC **codec = codec_registry;
+
+__STACK(CODEC_attach)
+
+	schema->codec = NULL;
+
+	while (*codec) {
+		if (! strcmp((*codec)->name, schema->name)) {
+
+			// The .def changed since the codec was generated
+			if ((*codec)->fingerprint != schema->fingerprint ||
+				(*codec)->nfields != schema->ncols) {
+				pgout(mDEBUG1, "codec for [%s] is stale (fingerprint=%llx,"
+					" expected %llx); using interpreter"
+					,schema->name
+					,(*codec)->fingerprint
+					,schema->fingerprint
+					);
+				__return;
+			}
+
+			pgout(mDEBUG2, "using generated codec for [%s]", schema->name);
+			schema->codec = *codec;
+			__return;
+		}
+
+		codec++;
+	}
+
+	__return;
+
+} /* CODEC_attach */
+
+
+/*
+ * CODEC_map_res
+ * Map a context's schema columns to the fields of a res
+ * cx			Context holding the field map
+ * res			Resource to map
+ *
+ * NOTE: every select is "SELECT *" on the schema's table, so the map
+ * is only rebuilt when the context pivots to another schema.
+ */
+bool CODEC_map_res (CONTEXT * cx, RES * res)
+{
+	SCHEMA *s = cx->schema;
+	unsigned int x;
+
+__STACK(CODEC_map_res)
+
+	if (cx->fieldv && cx->fieldv_schema == s &&
+		cx->fieldv_nfields == res->nfields) {
+		__return cx->fieldv_complete;
+	}
+
+	xfree(cx->fieldv);
+	cx->fieldv = (int *)xalloc(sizeof(int) * (s->ncols + 1));
+	cx->fieldv_schema = s;
+	cx->fieldv_nfields = res->nfields;
+	cx->fieldv_complete = true;
+
+	for (x=0; x < s->ncols; x++) {
+		COLUMN *c = s->colv[x];
+		int colidx;
+
+		cx->fieldv[x] = -1;
+
+		for (colidx=0; colidx < res->nfields; colidx++) {
+			if (! strcmp(c->name, PQfname(res->pgres, colidx))) {
+				cx->fieldv[x] = colidx;
+				break;
+			}
+		}
+
+		// Every record column should come back from the table
+		if (cx->fieldv[x] < 0 && (! c->is_phantom)) {
+			pgout(mDEBUG2, "schema [%s]: no field [%s] in res"
+				,s->name
+				,c->name
+				);
+			cx->fieldv_complete = false;
+		}
+	}
+
+	// Schemas are shared by every session
+	if (! s->binary_checked && (! PQbinaryTuples(res->pgres))) {
+		SCHEMA_lock();
+		if (! s->binary_checked) {
+			map_types(s, res, cx->fieldv);
+		}
+		SCHEMA_unlock();
+	}
+
+	__return cx->fieldv_complete;
+
+} /* CODEC_map_res */
+
+
+/*
+ * map_types
+ * Decide whether a schema's table can be fetched as binary results:
+ * every mapped column must have a type the _bin_to_record helpers know
+ * s			Schema being mapped
+ * res			Resource (text) from the schema's table
+ * fieldv		Field of each schema column
+ */
+static void map_types (SCHEMA * s, RES * res, const int * fieldv)
+{
+	bool ok = true;
+	unsigned int x;
+	int field;
+
+	for (x=0; x < s->ncols && ok; x++) {
+		COLUMN *c = s->colv[x];
+		Oid type;
+
+		if (c->is_phantom || fieldv[x] < 0) {
+			continue;
+		}
+
+		type = PQftype(res->pgres, fieldv[x]);
+
+		switch (c->datatype) {
+		case ISAM_TYPE_DECIMAL:
+			ok = (type == NUMERIC_OID) ? true : false;
+			break;
+		case ISAM_TYPE_INTEGER:
+			ok = (type == PGTYPE_INT2 || type == PGTYPE_INT4 ||
+				type == PGTYPE_INT8) ? true : false;
+			break;
+		case ISAM_TYPE_BINARY:
+			ok = (type == PGTYPE_BYTEA) ? true : false;
+			break;
+		case ISAM_TYPE_BOOLEAN:
+			ok = (type == PGTYPE_BOOL) ? true : false;
+			break;
+		default:
+			ok = (type == PGTYPE_TEXT || type == PGTYPE_BPCHAR ||
+				type == PGTYPE_VARCHAR) ? true : false;
+		}
+	}
+
+	// RES_get_oid_row decodes the oid column
+	if ((field = PQfnumber(res->pgres, "oid")) >= 0) {
+		Oid type = PQftype(res->pgres, field);
+
+		ok &= (type == PGTYPE_INT4 || type == PGTYPE_INT8 ||
+			type == PGTYPE_OID) ? true : false;
+	}
+
+	s->binary_res = ok;
+	s->binary_checked = true;
+
+	pgout(mDEBUG2, "schema [%s]: %s results"
+		,s->name
+		,ok ? "binary" : "text"
+		);
+
+} /* map_types */
+
+
+/*
+ * CODEC_raw_abi
+ * Native integer layout of raw records: L<sizeof(long)><e|b>
+ * buf			Receives the abi (8 bytes)
+ */
+void CODEC_raw_abi (char * buf)
+{
+	long one = 1;
+
+__STACK(CODEC_raw_abi)
+
+	sprintf(buf, "L%d%c", (int)sizeof(long), (*(char *)&one) ? 'e' : 'b');
+
+	__return;
+
+} /* CODEC_raw_abi */
+
+
+/*
+ * CODEC_raw_to_records
+ * Copy the records of a res selected with pgisam_record
+ * res			Resource object containing records (binary results)
+ * records		Records receiving values (res->tuples * reclen)
+ * reclen		Record length
+ */
+bool CODEC_raw_to_records (RES * res, char * records, unsigned int reclen)
+{
+	PGresult *pgres = res->pgres;
+	int field, row;
+
+__STACK(CODEC_raw_to_records)
+
+	if ((field = PQfnumber(pgres, CODEC_RAW_FIELD)) < 0 ||
+		(! PQfformat(pgres, field))) {
+		__return false;
+	}
+
+	for (row=0; row < res->tuples; row++) {
+		int len = PQgetlength(pgres, row, field);
+
+		if (len != reclen) {
+			pgout(0, "raw record length %d, expected %u", len, reclen);
+			len = (len < reclen) ? len : reclen;
+		}
+
+		memcpy(&records[(size_t)row * reclen], PQgetvalue(pgres, row, field), len);
+	}
+
+	__return true;
+
+} /* CODEC_raw_to_records */
+
+
+// _____/ record > value \__________
+/*
+ * CODEC_char_from_record
+ * CHAR/VARCHAR: trailing spaces are trimmed
+ */
+unsigned char * CODEC_char_from_record (char * field, unsigned int length)
+{
+	size_t padlength;
+	char *unescaped;
+	unsigned char *value;
+
+__STACK(CODEC_char_from_record)
+
+	if (str_is_blank(field, length)) {
+		__return (unsigned char *)NULL;
+	}
+
+	padlength = str_padlength(field, length);
+
+	// Allocate enough memory to hold the value + the null terminator
+	unescaped = (char *)xalloc((length - padlength) + 1);
+	value = (unsigned char *)xalloc(((length - padlength) * 2) + 1);
+
+	memcpy(unescaped, field, length - padlength);
+
+	PQescapeString((char *)value, (const char *)unescaped, strlen(unescaped));
+
+	str_free(&unescaped);
+
+	__return value;
+
+} /* CODEC_char_from_record */
+
+
+/*
+ * CODEC_decimal_from_record
+ * DECIMAL: packed C-ISAM decimal
+ */
+unsigned char * CODEC_decimal_from_record (char * field, unsigned int length)
+{
+	unsigned char numeric[NUMERIC_PACKEDSZ(NUMERIC_MAXLEN)];
+	unsigned char *value;
+	int size;
+
+__STACK(CODEC_decimal_from_record)
+
+	if (str_is_blank(field, length)) {
+		__return (unsigned char *)NULL;
+	}
+
+	size = NUMERIC_from_packed((unsigned char *)field, length, numeric);
+
+	// A null (or unreadable) decimal is NULL
+	if (size < 0) {
+		if (size < -1) {
+			pgout(mDEBUG1, "bad packed decimal (length=%u)", length);
+		}
+		__return (unsigned char *)NULL;
+	}
+
+	value = (unsigned char *)xalloc(NUMERIC_strlen(numeric) + 1);
+
+	NUMERIC_to_str(numeric, (char *)value);
+
+	__return value;
+
+} /* CODEC_decimal_from_record */
+
+
+/*
+ * CODEC_integer_from_record
+ * INTEGER: native long
+ */
+unsigned char * CODEC_integer_from_record (char * field, unsigned int length)
+{
+	unsigned char *value = NULL;
+	long l_number;
+
+__STACK(CODEC_integer_from_record)
+
+	if (str_is_blank(field, length)) {
+		__return (unsigned char *)NULL;
+	}
+
+	memcpy(&l_number, field, sizeof(long));
+
+	asprintf((char **)&value, "%ld", l_number);
+
+	__return value;
+
+} /* CODEC_integer_from_record */
+
+
+/*
+ * CODEC_binary_from_record
+ * BINARY: escaped bytea
+ */
+unsigned char * CODEC_binary_from_record (char * field, unsigned int length)
+{
+	size_t vallen = 0;
+
+	CONN *conn = CONN_current();
+
+__STACK(CODEC_binary_from_record)
+
+	if (str_is_blank(field, length)) {
+		__return (unsigned char *)NULL;
+	}
+
+	// Escaping depends on the server's settings
+	if (! conn || ! pg_ready(conn)) {
+		__return PQescapeBytea((const unsigned char *)field, length, &vallen);
+	}
+
+	__return PQescapeByteaConn(conn->pgconn,
+		(const unsigned char *)field, length, &vallen);
+
+} /* CODEC_binary_from_record */
+
+
+/*
+ * CODEC_boolean_from_record
+ * BOOLEAN: Y/N, blank is null
+ */
+unsigned char * CODEC_boolean_from_record (char * field, unsigned int length)
+{
+__STACK(CODEC_boolean_from_record)
+
+	// Blank booleans are treated differently
+	if (str_is_blank(field, length)) {
+		__return (unsigned char *)str_dup("null");
+	}
+
+	if (field[0] == 'Y') {
+		__return (unsigned char *)str_dup("true");
+	}
+
+	if (field[0] == 'N') {
+		__return (unsigned char *)str_dup("false");
+	}
+
+	__return (unsigned char *)NULL;
+
+} /* CODEC_boolean_from_record */
+
+
+/*
+ * CODEC_code_from_record
+ * CODE: only codelength bytes are significant
+ */
+unsigned char * CODEC_code_from_record (char * field, unsigned int length,
+	unsigned int codelength)
+{
+	char *unescaped;
+	unsigned char *value;
+	unsigned int startpos = 0;
+
+__STACK(CODEC_code_from_record)
+
+	if (str_is_blank(field, length)) {
+		__return (unsigned char *)NULL;
+	}
+
+	// If numeric, start at the end of code minus the actual length
+	if (str_is_block_numeric(field, length)) {
+		startpos += (length - codelength);
+	}
+
+	// Allocate enough memory to hold the value + the null terminator
+	unescaped = (char *)xalloc(codelength + 1);
+	value = (unsigned char *)xalloc((codelength * 2) + 1);
+
+	memcpy(unescaped, &field[startpos], codelength);
+
+	PQescapeString((char *)value, (const char *)unescaped, strlen(unescaped));
+
+	str_free(&unescaped);
+
+	__return value;
+
+} /* CODEC_code_from_record */
+
+
+/*
+ * CODEC_codeblank_from_record
+ * CODEBLANK: like CHAR, but a blank field is kept as spaces
+ */
+unsigned char * CODEC_codeblank_from_record (char * field, unsigned int length)
+{
+	unsigned char *value;
+
+__STACK(CODEC_codeblank_from_record)
+
+	if (! str_is_blank(field, length)) {
+		__return CODEC_char_from_record(field, length);
+	}
+
+	// Allocate enough memory to hold the spaces plus one
+	value = (unsigned char *)xalloc(length + 1);
+
+	// Set spaces into the code length value
+	memset(value, 0x20, length);
+
+	__return value;
+
+} /* CODEC_codeblank_from_record */
+
+
+// _____/ value > record \__________
+/*
+ * CODEC_char_to_record
+ * CHAR/VARCHAR
+ */
+bool CODEC_char_to_record (char * value, int vallen, char * field,
+	unsigned int length)
+{
+__STACK(CODEC_char_to_record)
+
+	if (vallen > length) {
+		__return false;
+	}
+
+	memcpy(field, value, vallen);
+
+	__return true;
+
+} /* CODEC_char_to_record */
+
+
+/*
+ * CODEC_decimal_to_record
+ * DECIMAL
+ */
+bool CODEC_decimal_to_record (char * value, int vallen, char * field,
+	unsigned int length)
+{
+	unsigned char local[NUMERIC_STRSZ(DECSTRMAX)];
+	unsigned char *numeric = local;
+	int size;
+	bool ok;
+
+__STACK(CODEC_decimal_to_record)
+
+	if (vallen > DECSTRMAX) {
+		numeric = (unsigned char *)xalloc(NUMERIC_STRSZ(vallen));
+	}
+
+	// An empty (null) or bad value is stored as a null decimal
+	size = NUMERIC_from_str(value, vallen, numeric);
+
+	ok = NUMERIC_to_packed(numeric, (size < 0) ? 0 : size,
+		(unsigned char *)field, length);
+
+	if (numeric != local) {
+		xfree(numeric);
+	}
+
+	__return ok;
+
+} /* CODEC_decimal_to_record */
+
+
+/*
+ * CODEC_integer_to_record
+ * INTEGER
+ */
+bool CODEC_integer_to_record (char * value, int vallen, char * field,
+	unsigned int length)
+{
+	long number;
+
+__STACK(CODEC_integer_to_record)
+
+	number = atol(value);
+
+	memcpy(field, &number, sizeof(long));
+
+	__return true;
+
+} /* CODEC_integer_to_record */
+
+
+/*
+ * CODEC_binary_to_record
+ * BINARY
+ */
+bool CODEC_binary_to_record (char * value, int vallen, char * field,
+	unsigned int length)
+{
+	unsigned char *bytea_lit = NULL;
+	size_t lit_size = 0;
+
+__STACK(CODEC_binary_to_record)
+
+	// A new string is allocated which contains the actual binary data
+	bytea_lit = PQunescapeBytea((unsigned char *)value, &lit_size);
+
+	if (! bytea_lit) {
+		__return true;
+	}
+
+	// The size of the byte array cannot be greater than the field size
+	if (lit_size > length) {
+		// Don't use str_free... binary data could include a NULL
+		pg_free(bytea_lit);
+		__return false;
+	}
+
+	// Copy the bytea literal to the record
+	memcpy(field, bytea_lit, lit_size);
+
+	pg_free(bytea_lit);
+
+	__return true;
+
+} /* CODEC_binary_to_record */
+
+
+/*
+ * CODEC_boolean_to_record
+ * BOOLEAN
+ */
+bool CODEC_boolean_to_record (char * value, int vallen, char * field,
+	unsigned int length)
+{
+__STACK(CODEC_boolean_to_record)
+
+	if (value[0] == 't') {
+		field[0] = 'Y';
+	} else
+	if (value[0] == 'f') {
+		field[0] = 'N';
+	} else {
+		field[0] = ' ';
+	}
+
+	__return true;
+
+} /* CODEC_boolean_to_record */
+
+
+/*
+ * CODEC_code_to_record
+ * CODE|CODEBLANK with a codelength
+ */
+bool CODEC_code_to_record (char * value, int vallen, char * field,
+	unsigned int length, unsigned int codelength)
+{
+	unsigned int startpos = 0;
+
+__STACK(CODEC_code_to_record)
+
+	if (vallen > codelength) {
+		__return false;
+	}
+
+	// If numeric, start at the end of code minus the actual length
+	if (str_is_block_numeric(value, vallen)) {
+		startpos += (length - codelength);
+	}
+
+	memcpy(&field[startpos], value, vallen);
+
+	__return true;
+
+} /* CODEC_code_to_record */
+
+
+// _____/ binary value > record \__________
+/*
+ * CODEC_decimal_bin_to_record
+ * DECIMAL: binary NUMERIC
+ */
+bool CODEC_decimal_bin_to_record (char * value, int vallen, char * field,
+	unsigned int length)
+{
+__STACK(CODEC_decimal_bin_to_record)
+
+	__return NUMERIC_to_packed((unsigned char *)value, vallen,
+		(unsigned char *)field, length);
+
+} /* CODEC_decimal_bin_to_record */
+
+
+/*
+ * CODEC_integer_bin_to_record
+ * INTEGER: int2/int4/int8
+ */
+bool CODEC_integer_bin_to_record (char * value, int vallen, char * field,
+	unsigned int length)
+{
+	unsigned char *p = (unsigned char *)value;
+	long long number = 0;
+	long l_number;
+	int x;
+
+__STACK(CODEC_integer_bin_to_record)
+
+	// Sign extended, big endian
+	if (vallen) {
+		number = (p[0] & 0x80) ? -1 : 0;
+	}
+
+	for (x=0; x < vallen; x++) {
+		number = (number << 8) | p[x];
+	}
+
+	l_number = (long)number;
+
+	memcpy(field, &l_number, sizeof(long));
+
+	__return true;
+
+} /* CODEC_integer_bin_to_record */
+
+
+/*
+ * CODEC_binary_bin_to_record
+ * BINARY: raw bytea
+ */
+bool CODEC_binary_bin_to_record (char * value, int vallen, char * field,
+	unsigned int length)
+{
+__STACK(CODEC_binary_bin_to_record)
+
+	if (vallen > length) {
+		__return false;
+	}
+
+	memcpy(field, value, vallen);
+
+	__return true;
+
+} /* CODEC_binary_bin_to_record */
+
+
+/*
+ * CODEC_boolean_bin_to_record
+ * BOOLEAN: one byte, null is blank
+ */
+bool CODEC_boolean_bin_to_record (char * value, int vallen, char * field,
+	unsigned int length)
+{
+__STACK(CODEC_boolean_bin_to_record)
+
+	if (! vallen) {
+		field[0] = ' ';
+	} else {
+		field[0] = value[0] ? 'Y' : 'N';
+	}
+
+	__return true;
+
+} /* CODEC_boolean_bin_to_record */
+
+
+// _____/ CODEC_batch functions \__________
+/*
+ * colbuf_reserve
+ * Make room for need more bytes in a column buffer (NULL = out of memory;
+ * the buffer is left as it was)
+ */
+static char * colbuf_reserve (CODEC_COLBUF * cb, unsigned int row, size_t need)
+{
+	if (cb->size + need > cb->alloc) {
+		size_t alloc = cb->alloc;
+		char *data;
+
+		while (cb->size + need > alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+		}
+		if ((data = (char *)xrealloc(cb->data, alloc)) == (char *)NULL) {
+			return NULL;
+		}
+		cb->data = data;
+		cb->alloc = alloc;
+	}
+
+	cb->off[row] = cb->size;
+
+	return &cb->data[cb->size];
+
+} /* colbuf_reserve */
+
+
+/*
+ * colbuf_commit
+ * Account for len bytes written after colbuf_reserve
+ */
+static void colbuf_commit (CODEC_COLBUF * cb, unsigned int row, size_t len)
+{
+	cb->len[row] = (int)len;
+	cb->size += len;
+
+} /* colbuf_commit */
+
+
+/*
+ * colbuf_put
+ * Copy an already converted value into a column buffer
+ */
+static bool colbuf_put (CODEC_COLBUF * cb, unsigned int row, char * value)
+{
+	size_t len;
+	char *d;
+
+	if (! value) {
+		cb->len[row] = CODEC_DEFAULT;
+		return true;
+	}
+
+	len = strlen(value);
+	if ((d = colbuf_reserve(cb, row, len)) == (char *)NULL) {
+		return false;
+	}
+	memcpy(d, value, len);
+	colbuf_commit(cb, row, len);
+
+	return true;
+
+} /* colbuf_put */
+
+
+/*
+ * copy_escape
+ * Escape text for COPY (text format); dst must hold len * 2 bytes
+ */
+static size_t copy_escape (char * dst, const char * src, size_t len)
+{
+	char *d = dst;
+	size_t x;
+
+	for (x=0; x < len; x++) {
+		switch (src[x]) {
+		case '\\':
+			*d++ = '\\'; *d++ = '\\';
+			break;
+		case '\t':
+			*d++ = '\\'; *d++ = 't';
+			break;
+		case '\n':
+			*d++ = '\\'; *d++ = 'n';
+			break;
+		case '\r':
+			*d++ = '\\'; *d++ = 'r';
+			break;
+		default:
+			*d++ = src[x];
+		}
+	}
+
+	return d - dst;
+
+} /* copy_escape */
+
+
+/*
+ * batch_text
+ * CHAR/VARCHAR/CODE/CODEBLANK columns (false = out of memory)
+ */
+static bool batch_text (CODEC_COLBUF * cb, COLUMN * c, char * records,
+	unsigned int reclen, unsigned int nrows)
+{
+	bool is_code = (c->datatype == ISAM_TYPE_CODE && c->codelength);
+	unsigned int row;
+	char *d;
+
+	for (row=0; row < nrows; row++) {
+		char *field = &records[(size_t)row * reclen + c->startpos];
+		size_t start = 0, len;
+
+		if (str_is_blank(field, c->length)) {
+			// Blank "CODEBLANK" values are kept as spaces
+			if (c->datatype == ISAM_TYPE_CODEBLANK) {
+				if ((d = colbuf_reserve(cb, row, c->length)) == (char *)NULL) {
+					return false;
+				}
+				memset(d, 0x20, c->length);
+				colbuf_commit(cb, row, c->length);
+			} else {
+				cb->len[row] = CODEC_DEFAULT;
+			}
+			continue;
+		}
+
+		if (is_code) {
+			// If numeric, start at the end of code minus the actual length
+			if (str_is_block_numeric(field, c->length)) {
+				start = c->length - c->codelength;
+			}
+			len = c->codelength;
+		} else {
+			len = c->length - str_padlength(field, c->length);
+		}
+
+		// Values stop at an embedded NULL (as PQescapeString would)
+		len = strnlen(&field[start], len);
+
+		if ((d = colbuf_reserve(cb, row, len * 2)) == (char *)NULL) {
+			return false;
+		}
+		colbuf_commit(cb, row, copy_escape(d, &field[start], len));
+	}
+
+	return true;
+
+} /* batch_text */
+
+
+/*
+ * batch_binary
+ * BINARY columns (bytea hex format; false = out of memory)
+ */
+static bool batch_binary (CODEC_COLBUF * cb, COLUMN * c, char * records,
+	unsigned int reclen, unsigned int nrows)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned int row;
+
+	for (row=0; row < nrows; row++) {
+		unsigned char *field = (unsigned char *)
+			&records[(size_t)row * reclen + c->startpos];
+		char *d;
+		unsigned int x;
+
+		if (str_is_blank((char *)field, c->length)) {
+			cb->len[row] = CODEC_DEFAULT;
+			continue;
+		}
+
+		// \\x is an escaped \x in COPY text
+		if ((d = colbuf_reserve(cb, row, (c->length * 2) + 3)) == (char *)NULL) {
+			return false;
+		}
+		*d++ = '\\'; *d++ = '\\'; *d++ = 'x';
+
+		for (x=0; x < c->length; x++) {
+			*d++ = hex[field[x] >> 4];
+			*d++ = hex[field[x] & 0x0f];
+		}
+
+		colbuf_commit(cb, row, (c->length * 2) + 3);
+	}
+
+	return true;
+
+} /* batch_binary */
+
+
+/*
+ * batch_value
+ * DECIMAL/INTEGER/BOOLEAN columns (values never need escaping; false = out
+ * of memory)
+ */
+static bool batch_value (CODEC_COLBUF * cb, COLUMN * c, char * records,
+	unsigned int reclen, unsigned int nrows,
+	unsigned char * (*from_record) (char *, unsigned int))
+{
+	unsigned int row;
+
+	for (row=0; row < nrows; row++) {
+		char *value = (char *)from_record(
+			&records[(size_t)row * reclen + c->startpos], c->length);
+
+		// A blank boolean is "null" (written as such, not left out)
+		if (value && (! strcmp(value, "null"))) {
+			cb->len[row] = -1;
+			str_free(&value);
+			continue;
+		}
+
+		if (! colbuf_put(cb, row, value)) {
+			str_free(&value);
+			return false;
+		}
+		str_free(&value);
+	}
+
+	return true;
+
+} /* batch_value */
+
+
+/*
+ * CODEC_batch_new
+ * Create a batch for up to maxrows records of a schema
+ * schema		Schema describing the records
+ * maxrows		Maximum number of records converted at a time
+ */
+CODEC_BATCH * CODEC_batch_new (SCHEMA * schema, unsigned int maxrows)
+{
+	CODEC_BATCH *b;
+	unsigned int x;
+
+__STACK(CODEC_batch_new)
+
+	b = (CODEC_BATCH *)xalloc(sizeof(CODEC_BATCH));
+	b->schema = schema;
+	b->maxrows = maxrows;
+	b->col = (CODEC_COLBUF *)xalloc(sizeof(CODEC_COLBUF) * (schema->ncols + 1));
+
+	for (x=0; x < schema->ncols; x++) {
+		b->col[x].off = (size_t *)xalloc(sizeof(size_t) * maxrows);
+		b->col[x].len = (int *)xalloc(sizeof(int) * maxrows);
+	}
+
+	__return b;
+
+} /* CODEC_batch_new */
+
+
+/*
+ * CODEC_batch_delete
+ * Delete a batch
+ * batch		Pointer to the batch
+ */
+void CODEC_batch_delete (CODEC_BATCH ** batch)
+{
+	CODEC_BATCH *b = *batch;
+	unsigned int x;
+
+__STACK(CODEC_batch_delete)
+
+	if (! b) {
+		__return;
+	}
+
+	for (x=0; x < b->schema->ncols; x++) {
+		xfree(b->col[x].data);
+		xfree(b->col[x].off);
+		xfree(b->col[x].len);
+	}
+
+	xfree(b->col);
+	xfree(b);
+
+	*batch = NULL;
+
+	__return;
+
+} /* CODEC_batch_delete */
+
+
+/*
+ * CODEC_batch_from_records
+ * Convert nrows contiguous records into COPY text values, one column
+ * at a time
+ * batch		Batch receiving values
+ * records		Records to convert
+ * nrows		Number of records (no more than maxrows)
+ *
+ * NOTE: blank fields are marked CODEC_DEFAULT: left out of the COPY, so
+ * they take the column default as they would in an INSERT; false if a
+ * column buffer could not grow (the batch can not be written)
+ */
+bool CODEC_batch_from_records (CODEC_BATCH * batch, char * records,
+	unsigned int nrows)
+{
+	SCHEMA *s = batch->schema;
+	unsigned int x;
+	bool ok = true;
+
+__STACK(CODEC_batch_from_records)
+
+	pgout(mDEBUG3, "batch < %u records", nrows);
+
+	if (nrows > batch->maxrows) {
+		pgout(0, "batch overflow (%u > %u)", nrows, batch->maxrows);
+		nrows = batch->maxrows;
+	}
+
+	batch->nrows = nrows;
+
+	for (x=0; ok == true && x < s->ncols; x++) {
+		CODEC_COLBUF *cb = &batch->col[x];
+		COLUMN *c = s->colv[x];
+
+		cb->size = 0;
+
+		// Phantom columns are not in the record (nor the COPY)
+		if (c->is_phantom) {
+			continue;
+		}
+
+		switch (c->datatype) {
+		case ISAM_TYPE_DECIMAL:
+			ok = batch_value(cb, c, records, s->reclen, nrows,
+				CODEC_decimal_from_record);
+			break;
+		case ISAM_TYPE_INTEGER:
+			ok = batch_value(cb, c, records, s->reclen, nrows,
+				CODEC_integer_from_record);
+			break;
+		case ISAM_TYPE_BOOLEAN:
+			ok = batch_value(cb, c, records, s->reclen, nrows,
+				CODEC_boolean_from_record);
+			break;
+		case ISAM_TYPE_BINARY:
+			ok = batch_binary(cb, c, records, s->reclen, nrows);
+			break;
+		default:
+			ok = batch_text(cb, c, records, s->reclen, nrows);
+		}
+	}
+
+	__return ok;
+
+} /* CODEC_batch_from_records */
+
+
+/*
+ * CODEC_batch_run
+ * Count the rows from first whose blank (CODEC_DEFAULT) columns are those
+ * of first: the rows one COPY can take
+ * batch		Converted batch
+ * first		First row
+ * omit			Receives, per column, whether first leaves it out (ncols)
+ */
+unsigned int CODEC_batch_run (CODEC_BATCH * batch, unsigned int first,
+	bool * omit)
+{
+	SCHEMA *s = batch->schema;
+	unsigned int row, x;
+
+__STACK(CODEC_batch_run)
+
+	for (x=0; x < s->ncols; x++) {
+		omit[x] = (s->colv[x]->is_phantom ||
+			batch->col[x].len[first] == CODEC_DEFAULT) ? true : false;
+	}
+
+	for (row = first + 1; row < batch->nrows; row++) {
+		for (x=0; x < s->ncols; x++) {
+			if (s->colv[x]->is_phantom) {
+				continue;
+			}
+			if (((batch->col[x].len[row] == CODEC_DEFAULT) ? true : false) != omit[x]) {
+				break;
+			}
+		}
+
+		if (x < s->ncols) {
+			break;
+		}
+	}
+
+	__return row - first;
+
+} /* CODEC_batch_run */
+
+
+/*
+ * CODEC_batch_to_copy
+ * Build the COPY ... FROM STDIN data for rows of a converted batch
+ * batch		Converted batch
+ * first		First row
+ * nrows		Number of rows (a run, see CODEC_batch_run)
+ * omit			Columns left out (see SCHEMA_create_copy)
+ * buf			Pointer receiving the (allocated) data
+ */
+size_t CODEC_batch_to_copy (CODEC_BATCH * batch, unsigned int first,
+	unsigned int nrows, bool * omit, char ** buf)
+{
+	SCHEMA *s = batch->schema;
+	size_t total = 0;
+	unsigned int row, x;
+	char *d;
+
+__STACK(CODEC_batch_to_copy)
+
+	// Size the buffer first: values + separators + newlines
+	for (x=0; x < s->ncols; x++) {
+		if (omit[x]) {
+			continue;
+		}
+		total += batch->col[x].size + (nrows * 3);
+	}
+
+	d = *buf = (char *)xalloc(total + nrows + 1);
+
+	for (row = first; row < first + nrows; row++) {
+		bool first_col = true;
+
+		for (x=0; x < s->ncols; x++) {
+			CODEC_COLBUF *cb = &batch->col[x];
+
+			if (omit[x]) {
+				continue;
+			}
+
+			if (! first_col) {
+				*d++ = '\t';
+			}
+			first_col = false;
+
+			if (cb->len[row] < 0) {
+				*d++ = '\\'; *d++ = 'N';
+			} else {
+				memcpy(d, &cb->data[cb->off[row]], cb->len[row]);
+				d += cb->len[row];
+			}
+		}
+
+		*d++ = '\n';
+	}
+
+	__return d - *buf;
+
+} /* CODEC_batch_to_copy */
+
+
+/*
+ * CODEC_batch_to_records
+ * Fill contiguous records from every row of a res, one column at a time
+ * cx			Context holding the field map
+ * res			Resource object containing values
+ * records		Records receiving values (res->tuples * reclen)
+ */
+void CODEC_batch_to_records (CONTEXT * cx, RES * res, char * records)
+{
+	SCHEMA *s = cx->schema;
+	PGresult *pgres = res->pgres;
+	bool bin = PQbinaryTuples(pgres) ? true : false;
+	unsigned int x;
+
+__STACK(CODEC_batch_to_records)
+
+	pgout(mDEBUG3, "batch > %d records", res->tuples);
+
+	// Fill the records with spaces
+	memset(records, 0x20, (size_t)res->tuples * s->reclen);
+
+	// Whole records from pgisam_record
+	if (CODEC_raw_to_records(res, records, s->reclen)) {
+		__return;
+	}
+
+	CODEC_map_res(cx, res);
+
+	for (x=0; x < s->ncols; x++) {
+		COLUMN *c = s->colv[x];
+		int field = cx->fieldv[x];
+		bool (*to_record) (char *, int, char *, unsigned int) = NULL;
+		bool ok = true;
+		int row;
+
+		// Skip "phantom" and unmatched columns
+		if (c->is_phantom || field < 0) {
+			continue;
+		}
+
+		switch (c->datatype) {
+		case ISAM_TYPE_DECIMAL:
+			to_record = bin ? CODEC_decimal_bin_to_record :
+				CODEC_decimal_to_record;
+			break;
+		case ISAM_TYPE_INTEGER:
+			to_record = bin ? CODEC_integer_bin_to_record :
+				CODEC_integer_to_record;
+			break;
+		case ISAM_TYPE_BINARY:
+			to_record = bin ? CODEC_binary_bin_to_record :
+				CODEC_binary_to_record;
+			break;
+		case ISAM_TYPE_BOOLEAN:
+			to_record = bin ? CODEC_boolean_bin_to_record :
+				CODEC_boolean_to_record;
+			break;
+		case ISAM_TYPE_CODE:
+		case ISAM_TYPE_CODEBLANK:
+			if (c->codelength) {
+				break;
+			}
+			// Fall through (no codelength is treated as CHAR)
+		default:
+			to_record = CODEC_char_to_record;
+		}
+
+		for (row=0; row < res->tuples; row++) {
+			char *rec = &records[(size_t)row * s->reclen + c->startpos];
+
+			if (to_record) {
+				ok &= to_record(PQgetvalue(pgres, row, field),
+					PQgetlength(pgres, row, field), rec, c->length);
+			} else {
+				ok &= CODEC_code_to_record(PQgetvalue(pgres, row, field),
+					PQgetlength(pgres, row, field), rec, c->length,
+					c->codelength);
+			}
+		}
+
+		if (! ok) {
+			pgout(0, "length mismatch in bridge schema column=[%s]",
+				c->name);
+		}
+	}
+
+	__return;
+
+} /* CODEC_batch_to_records */
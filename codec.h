@@ -0,0 +1,239 @@
+/*
+ * codec.h: record codecs between C-ISAM records and Postgres values
+ *
+ * Every column conversion is done by one of the CODEC_<type>_from_record
+ * or CODEC_<type>_to_record helpers below.  The interpreter in schema.c
+ * walks the COLUMN list and dispatches on datatype; codecs generated by
+ * defgen call the same helpers unrolled with constant offsets.
+ */
+
+#ifndef _CODEC_H
+#define _CODEC_H
+
+/*
+ * CODEC_FIELD
+ * Flat, constant description of a column in a generated codec
+ */
+typedef struct CODEC_FIELD_T {
+	char *name;				// Name of the field
+	unsigned int startpos;	// Starting offset
+	unsigned int length;	// Length
+	unsigned int codelength;// Significant bytes in code
+	unsigned int datatype;	// Data type (ISAM_TYPE_*)
+	bool is_phantom;		// Phantom columns are not in the record
+} CODEC_FIELD;
+
+/*
+ * CODEC
+ * A record codec compiled from a .def file by defgen
+ */
+typedef struct CODEC_T {
+	char *name;						// Schema name the codec was built from
+	unsigned long long fingerprint;	// SCHEMA_fingerprint of the .def
+	unsigned int reclen;			// Length of the C-ISAM record
+	unsigned int nfields;			// Number of entries in field
+	const CODEC_FIELD *field;		// Column layout (same order as SCHEMA colv)
+
+	// record > colv[]->value
+	void (*from_record) (COLUMN **colv, char *record);
+
+	// res row > record (fieldv maps column ordinal to res field number)
+	bool (*to_record) (PGresult *pgres, int row, const int *fieldv, char *record);
+} CODEC;
+
+/*
+ * CODEC_COLBUF
+ * Converted values of one column across a batch
+ */
+typedef struct CODEC_COLBUF_T {
+	char *data;				// Values, back to back (COPY text format)
+	size_t size;			// Bytes used in data
+	size_t alloc;			// Bytes allocated for data
+	size_t *off;			// Offset of each row's value in data
+	int *len;				// Length of each row's value (-1 = null, CODEC_DEFAULT)
+} CODEC_COLBUF;
+
+// Length of a blank value, left out so the column takes its default
+// (as SCHEMA_create_insert leaves it out)
+#define CODEC_DEFAULT -2
+
+/*
+ * CODEC_BATCH
+ * N records converted column by column
+ */
+typedef struct CODEC_BATCH_T {
+	SCHEMA *schema;			// Schema describing the records
+	unsigned int nrows;		// Rows currently in the batch
+	unsigned int maxrows;	// Rows allocated per column
+	CODEC_COLBUF *col;		// One per schema column (schema->colv order)
+} CODEC_BATCH;
+
+/*
+ * codec_registry
+ * NULL terminated list of generated codecs (codecs.c, written by defgen)
+ */
+extern const CODEC *codec_registry[];
+
+
+// Field returning whole records from the pgisam_record extension
+#define CODEC_RAW_FIELD "pgisam_record"
+
+
+// _____/ CODEC functions \__________
+/*
+ * CODEC_attach
+ * Attach the generated codec matching a schema's name and fingerprint
+ * schema		Schema to attach to
+ */
+void CODEC_attach (SCHEMA *schema);
+
+/*
+ * CODEC_map_res
+ * Map a context's schema columns to the fields of a res (cx->fieldv)
+ * Returns false if a record column is missing from the res
+ * cx			Context holding the field map
+ * res			Resource to map
+ */
+bool CODEC_map_res (CONTEXT *cx, RES *res);
+
+/*
+ * CODEC_raw_abi
+ * Native integer layout of raw records (see ext/pgisam_record.c)
+ * buf			Receives the abi (8 bytes)
+ */
+void CODEC_raw_abi (char *buf);
+
+/*
+ * CODEC_raw_to_records
+ * Copy the records of a res selected with pgisam_record (binary results)
+ * Returns false if the res has no CODEC_RAW_FIELD
+ * res			Resource object containing records
+ * records		Records receiving values (res->tuples * reclen)
+ * reclen		Record length
+ */
+bool CODEC_raw_to_records (RES *res, char *records, unsigned int reclen);
+
+/*
+ * CODEC_<type>_from_record
+ * Convert a record field into an (escaped) SQL value
+ * Returns an allocated value or NULL for blank fields
+ * field		Pointer to the field in the record
+ * length		Length of the field
+ * codelength	Significant bytes in code
+ */
+unsigned char * CODEC_char_from_record (char *field, unsigned int length);
+unsigned char * CODEC_decimal_from_record (char *field, unsigned int length);
+unsigned char * CODEC_integer_from_record (char *field, unsigned int length);
+unsigned char * CODEC_binary_from_record (char *field, unsigned int length);
+unsigned char * CODEC_boolean_from_record (char *field, unsigned int length);
+unsigned char * CODEC_code_from_record (char *field, unsigned int length,
+	unsigned int codelength);
+unsigned char * CODEC_codeblank_from_record (char *field, unsigned int length);
+
+/*
+ * CODEC_<type>_to_record
+ * Convert a Postgres text value into a record field
+ * Returns false on a length mismatch
+ * value		Text value (as returned by PQgetvalue)
+ * vallen		Length of value
+ * field		Pointer to the field in the record
+ * length		Length of the field
+ * codelength	Significant bytes in code
+ */
+bool CODEC_char_to_record (char *value, int vallen, char *field,
+	unsigned int length);
+bool CODEC_decimal_to_record (char *value, int vallen, char *field,
+	unsigned int length);
+bool CODEC_integer_to_record (char *value, int vallen, char *field,
+	unsigned int length);
+bool CODEC_binary_to_record (char *value, int vallen, char *field,
+	unsigned int length);
+bool CODEC_boolean_to_record (char *value, int vallen, char *field,
+	unsigned int length);
+bool CODEC_code_to_record (char *value, int vallen, char *field,
+	unsigned int length, unsigned int codelength);
+
+/*
+ * CODEC_<type>_bin_to_record
+ * Convert a Postgres binary value into a record field (CHAR and CODE
+ * values are the same in both formats)
+ * Returns false on a length mismatch
+ * value		Binary value (as returned by PQgetvalue)
+ * vallen		Length of value (0 is a null)
+ * field		Pointer to the field in the record
+ * length		Length of the field
+ */
+bool CODEC_decimal_bin_to_record (char *value, int vallen, char *field,
+	unsigned int length);
+bool CODEC_integer_bin_to_record (char *value, int vallen, char *field,
+	unsigned int length);
+bool CODEC_binary_bin_to_record (char *value, int vallen, char *field,
+	unsigned int length);
+bool CODEC_boolean_bin_to_record (char *value, int vallen, char *field,
+	unsigned int length);
+
+
+
+// _____/ CODEC_batch functions \__________
+/*
+ * CODEC_batch_new
+ * Create a batch for up to maxrows records of a schema
+ * schema		Schema describing the records
+ * maxrows		Maximum number of records converted at a time
+ */
+CODEC_BATCH * CODEC_batch_new (SCHEMA *schema, unsigned int maxrows);
+
+/*
+ * CODEC_batch_delete
+ * Delete a batch
+ * batch		Pointer to the batch
+ */
+void CODEC_batch_delete (CODEC_BATCH **batch);
+
+/*
+ * CODEC_batch_from_records
+ * Convert nrows contiguous records (reclen apart) into COPY text values,
+ * one column at a time
+ * Returns false if out of memory
+ * batch		Batch receiving values
+ * records		Records to convert
+ * nrows		Number of records (no more than maxrows)
+ */
+bool CODEC_batch_from_records (CODEC_BATCH *batch, char *records,
+	unsigned int nrows);
+
+/*
+ * CODEC_batch_run
+ * Count the rows from first whose blank (CODEC_DEFAULT) columns are those
+ * of first: the rows one COPY can take
+ * batch		Converted batch
+ * first		First row
+ * omit			Receives, per column, whether first leaves it out (ncols)
+ */
+unsigned int CODEC_batch_run (CODEC_BATCH *batch, unsigned int first,
+	bool *omit);
+
+/*
+ * CODEC_batch_to_copy
+ * Build the COPY ... FROM STDIN data for rows of a converted batch
+ * Returns the length of the data
+ * batch		Converted batch
+ * first		First row
+ * nrows		Number of rows (a run, see CODEC_batch_run)
+ * omit			Columns left out (see SCHEMA_create_copy)
+ * buf			Pointer receiving the (allocated) data
+ */
+size_t CODEC_batch_to_copy (CODEC_BATCH *batch, unsigned int first,
+	unsigned int nrows, bool *omit, char **buf);
+
+/*
+ * CODEC_batch_to_records
+ * Fill contiguous records (reclen apart) from every row of a res,
+ * one column at a time
+ * cx			Context holding the field map
+ * res			Resource object containing values
+ * records		Records receiving values (res->tuples * reclen)
+ */
+void CODEC_batch_to_records (CONTEXT *cx, RES *res, char *records);
+
+#endif // _CODEC_H
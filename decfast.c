@@ -0,0 +1,519 @@
+/*
+ * decfast.c: fast path arithmetic on C-ISAM packed decimals
+ *
+ * A packed decimal of up to 17 bytes holds at most 16 base 100 digits
+ * (10^32), which fits a 128 bit integer with room to align scales and
+ * multiply small values.  A FIXED is coef * 100^-scale; every kernel
+ * checks for 128 bit overflow and hands the operation to the decimal
+ * library when it happens.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <decimal.h>
+
+#include "sys.h"
+#include "decfast.h"
+
+#ifdef __SIZEOF_INT128__
+typedef __int128 int128;
+
+// Largest base 100 digit count loaded natively (DECSIZE)
+#define FAST_DIGITS		16
+
+#define INT128_MAX		((int128)(((unsigned __int128)1 << 127) - 1))
+
+typedef struct FIXED_T {
+	int128 coef;			// Signed coefficient
+	int scale;				// Base 100 digits after the point
+} FIXED;
+
+// Static function prototypes
+static int fixed_load (const unsigned char * p, int len, FIXED * f);
+static int fixed_store (FIXED * f, unsigned char * r, int rlen);
+static bool fixed_align (FIXED * a, FIXED * b);
+static bool fixed_scale100 (int128 * coef, int n);
+static bool fixed_addable (FIXED * a, FIXED * b);
+#endif // __SIZEOF_INT128__
+
+typedef enum DECOP { DecAdd, DecSub, DecMul, DecDiv } DECOP;
+
+static unsigned long fallbacks = 0L;
+
+// Static function prototypes
+static int slow_op (DECOP op, unsigned char * a, int alen, unsigned char * b,
+	int blen, unsigned char * r, int rlen);
+static bool is_null (const unsigned char * p, int len);
+
+
+// CODE STARTS HERE
+
+
+// _____/ 128 bit kernels \__________
+#ifdef __SIZEOF_INT128__
+/*
+ * fixed_load
+ * Load a packed decimal into a FIXED
+ * Returns 1, 0 for a null or -1 if it doesn't fit
+ */
+static int fixed_load (const unsigned char * p, int len, FIXED * f)
+{
+	int ndigits = len - 1, last = -1, exp, x;
+	bool neg;
+	int128 coef = 0;
+
+	if (is_null(p, len)) {
+		return 0;
+	}
+
+	if (ndigits < 1 || ndigits > FAST_DIGITS) {
+		return -1;
+	}
+
+	neg = (p[0] & 0x80) ? false : true;
+	exp = (neg ? (0x7F - p[0]) : (p[0] & 0x7F)) - 64;
+
+	for (x=0; x < ndigits; x++) {
+		if (p[x + 1] > 99) {
+			return -1;
+		}
+		if (p[x + 1]) {
+			last = x;
+		}
+	}
+
+	// Digits up to the last nonzero one (100's complement if negative)
+	for (x=0; x <= last; x++) {
+		int d = p[x + 1];
+
+		if (neg) {
+			d = (x == last) ? 100 - d : 99 - d;
+		}
+
+		coef = coef * 100 + d;
+	}
+
+	f->coef = neg ? -coef : coef;
+	f->scale = (last + 1) - exp;
+
+	// Whole numbers are held with scale 0
+	if (f->scale < 0) {
+		if (! fixed_scale100(&f->coef, -f->scale)) {
+			return -1;
+		}
+		f->scale = 0;
+	}
+
+	return 1;
+
+} /* fixed_load */
+
+
+/*
+ * fixed_store
+ * Store a FIXED as a packed decimal, rounding half up
+ */
+static int fixed_store (FIXED * f, unsigned char * r, int rlen)
+{
+	unsigned char digit[FAST_DIGITS * 2 + 2];
+	int128 q = (f->coef < 0) ? -f->coef : f->coef;
+	int n = 0, ndigits = rlen - 1, exp, x;
+
+	memset(r, 0, rlen);
+
+	if (ndigits < 1) {
+		return DECFAST_OVERFLOW;
+	}
+
+	if (! q) {
+		r[0] = 0x80;
+		return DECFAST_OK;
+	}
+
+	// Base 100 digits, least significant first
+	while (q) {
+		digit[n++] = (unsigned char)(q % 100);
+		q /= 100;
+	}
+
+	exp = n - f->scale;
+
+	// Round on the most significant digit that doesn't fit
+	if (n > ndigits) {
+		int drop = n - ndigits, carry = (digit[drop - 1] >= 50) ? 1 : 0;
+
+		for (x=0; x < ndigits; x++) {
+			digit[x] = digit[x + drop] + carry;
+			carry = (digit[x] == 100) ? 1 : 0;
+			digit[x] = carry ? 0 : digit[x];
+		}
+
+		n = ndigits;
+
+		if (carry) {
+			digit[n - 1] = 1;
+			exp++;
+		}
+	}
+
+	if (exp + 64 > 0x7F) {
+		return DECFAST_OVERFLOW;
+	}
+
+	if (exp + 64 < 0) {
+		r[0] = 0x80;
+		return DECFAST_UNDERFLOW;
+	}
+
+	// Most significant first
+	for (x=0; x < n; x++) {
+		r[x + 1] = digit[n - 1 - x];
+	}
+
+	if (f->coef < 0) {
+		int last = 0;
+
+		for (x=1; x <= n; x++) {
+			if (r[x]) {
+				last = x;
+			}
+		}
+
+		for (x=1; x <= last; x++) {
+			r[x] = (x == last) ? 100 - r[x] : 99 - r[x];
+		}
+
+		r[0] = (unsigned char)(0x7F - (exp + 64));
+	} else {
+		r[0] = (unsigned char)(0x80 | (exp + 64));
+	}
+
+	return DECFAST_OK;
+
+} /* fixed_store */
+
+
+/*
+ * fixed_scale100
+ * coef *= 100^n, false on overflow
+ */
+static bool fixed_scale100 (int128 * coef, int n)
+{
+	for (; n > 0; n--) {
+		if (*coef > INT128_MAX / 100 || *coef < -(INT128_MAX / 100)) {
+			return false;
+		}
+		*coef *= 100;
+	}
+
+	return true;
+
+} /* fixed_scale100 */
+
+
+/*
+ * fixed_align
+ * Bring a and b to the same scale, false on overflow
+ */
+static bool fixed_align (FIXED * a, FIXED * b)
+{
+	FIXED *lo = (a->scale < b->scale) ? a : b;
+	FIXED *hi = (lo == a) ? b : a;
+
+	if (! fixed_scale100(&lo->coef, hi->scale - lo->scale)) {
+		return false;
+	}
+
+	lo->scale = hi->scale;
+
+	return true;
+
+} /* fixed_align */
+
+
+/*
+ * fixed_addable
+ * Aligned a +/- b can't overflow
+ */
+static bool fixed_addable (FIXED * a, FIXED * b)
+{
+	int128 half = INT128_MAX / 2;
+
+	return (a->coef < half && a->coef > -half &&
+		b->coef < half && b->coef > -half) ? true : false;
+
+} /* fixed_addable */
+#endif // __SIZEOF_INT128__
+
+
+// _____/ decimal library \__________
+/*
+ * slow_op
+ * Run an operation through dec_t
+ */
+static int slow_op (DECOP op, unsigned char * a, int alen, unsigned char * b,
+	int blen, unsigned char * r, int rlen)
+{
+	dec_t da, db, dr;
+	int status;
+
+	__sync_fetch_and_add(&fallbacks, 1);
+
+	lddecimal(a, alen, &da);
+	lddecimal(b, blen, &db);
+
+	switch (op) {
+	case DecAdd:
+		status = decadd(&da, &db, &dr);
+		break;
+	case DecSub:
+		status = decsub(&da, &db, &dr);
+		break;
+	case DecMul:
+		status = decmul(&da, &db, &dr);
+		break;
+	default:
+		status = decdiv(&da, &db, &dr);
+	}
+
+	if (status) {
+		return status;
+	}
+
+	stdecimal(&dr, r, rlen);
+
+	return DECFAST_OK;
+
+} /* slow_op */
+
+
+/*
+ * is_null
+ */
+static bool is_null (const unsigned char * p, int len)
+{
+	int x;
+
+	for (x=0; x < len; x++) {
+		if (p[x]) {
+			return false;
+		}
+	}
+
+	return true;
+
+} /* is_null */
+
+
+// _____/ DECFAST functions \__________
+/*
+ * DECFAST_add
+ */
+int DECFAST_add (unsigned char * a, int alen, unsigned char * b, int blen,
+	unsigned char * r, int rlen)
+{
+#ifdef __SIZEOF_INT128__
+	FIXED fa, fb;
+	int la, lb;
+
+	la = fixed_load(a, alen, &fa);
+	lb = fixed_load(b, blen, &fb);
+
+	if ((! la) || (! lb)) {
+		memset(r, 0, rlen);
+		return DECFAST_OK;
+	}
+
+	if (la > 0 && lb > 0 && fixed_align(&fa, &fb) && fixed_addable(&fa, &fb)) {
+		fa.coef += fb.coef;
+		return fixed_store(&fa, r, rlen);
+	}
+#endif // __SIZEOF_INT128__
+
+	return slow_op(DecAdd, a, alen, b, blen, r, rlen);
+
+} /* DECFAST_add */
+
+
+/*
+ * DECFAST_sub
+ */
+int DECFAST_sub (unsigned char * a, int alen, unsigned char * b, int blen,
+	unsigned char * r, int rlen)
+{
+#ifdef __SIZEOF_INT128__
+	FIXED fa, fb;
+	int la, lb;
+
+	la = fixed_load(a, alen, &fa);
+	lb = fixed_load(b, blen, &fb);
+
+	if ((! la) || (! lb)) {
+		memset(r, 0, rlen);
+		return DECFAST_OK;
+	}
+
+	if (la > 0 && lb > 0 && fixed_align(&fa, &fb) && fixed_addable(&fa, &fb)) {
+		fa.coef -= fb.coef;
+		return fixed_store(&fa, r, rlen);
+	}
+#endif // __SIZEOF_INT128__
+
+	return slow_op(DecSub, a, alen, b, blen, r, rlen);
+
+} /* DECFAST_sub */
+
+
+/*
+ * DECFAST_mul
+ */
+int DECFAST_mul (unsigned char * a, int alen, unsigned char * b, int blen,
+	unsigned char * r, int rlen)
+{
+#ifdef __SIZEOF_INT128__
+	FIXED fa, fb;
+	int la, lb;
+
+	la = fixed_load(a, alen, &fa);
+	lb = fixed_load(b, blen, &fb);
+
+	if ((! la) || (! lb)) {
+		memset(r, 0, rlen);
+		return DECFAST_OK;
+	}
+
+	if (la > 0 && lb > 0) {
+		int128 ma = (fa.coef < 0) ? -fa.coef : fa.coef;
+		int128 mb = (fb.coef < 0) ? -fb.coef : fb.coef;
+
+		if ((! mb) || ma <= INT128_MAX / mb) {
+			fa.coef *= fb.coef;
+			fa.scale += fb.scale;
+			return fixed_store(&fa, r, rlen);
+		}
+	}
+#endif // __SIZEOF_INT128__
+
+	return slow_op(DecMul, a, alen, b, blen, r, rlen);
+
+} /* DECFAST_mul */
+
+
+/*
+ * DECFAST_div
+ */
+int DECFAST_div (unsigned char * a, int alen, unsigned char * b, int blen,
+	unsigned char * r, int rlen)
+{
+	if (is_null(a, alen) || is_null(b, blen)) {
+		memset(r, 0, rlen);
+		return DECFAST_OK;
+	}
+
+	return slow_op(DecDiv, a, alen, b, blen, r, rlen);
+
+} /* DECFAST_div */
+
+
+/*
+ * DECFAST_cmp
+ */
+int DECFAST_cmp (unsigned char * a, int alen, unsigned char * b, int blen)
+{
+	dec_t da, db;
+
+#ifdef __SIZEOF_INT128__
+	FIXED fa, fb;
+	int la, lb;
+
+	la = fixed_load(a, alen, &fa);
+	lb = fixed_load(b, blen, &fb);
+
+	if ((! la) || (! lb)) {
+		return DECFAST_UNKNOWN;
+	}
+
+	if (la > 0 && lb > 0 && fixed_align(&fa, &fb)) {
+		return (fa.coef < fb.coef) ? -1 : (fa.coef > fb.coef) ? 1 : 0;
+	}
+#endif // __SIZEOF_INT128__
+
+	__sync_fetch_and_add(&fallbacks, 1);
+
+	lddecimal(a, alen, &da);
+	lddecimal(b, blen, &db);
+
+	return deccmp(&da, &db);
+
+} /* DECFAST_cmp */
+
+
+/*
+ * DECFAST_cvlong
+ */
+int DECFAST_cvlong (long l, unsigned char * r, int rlen)
+{
+#ifdef __SIZEOF_INT128__
+	FIXED f;
+
+	f.coef = l;
+	f.scale = 0;
+
+	return fixed_store(&f, r, rlen);
+#else
+	dec_t dr;
+	int status;
+
+	__sync_fetch_and_add(&fallbacks, 1);
+
+	if ((status = deccvlong(l, &dr))) {
+		return status;
+	}
+
+	stdecimal(&dr, r, rlen);
+
+	return DECFAST_OK;
+#endif // __SIZEOF_INT128__
+
+} /* DECFAST_cvlong */
+
+
+/*
+ * DECFAST_tolong
+ *
+ * NOTE: only whole numbers in range are converted natively, so that
+ * truncation and range errors are the decimal library's
+ */
+int DECFAST_tolong (unsigned char * a, int alen, long * l)
+{
+	dec_t da;
+
+#ifdef __SIZEOF_INT128__
+	FIXED f;
+
+	if (fixed_load(a, alen, &f) > 0 && f.scale == 0 &&
+		f.coef <= (int128)0x7FFFFFFFL && f.coef >= -(int128)0x7FFFFFFFL) {
+		*l = (long)f.coef;
+		return DECFAST_OK;
+	}
+#endif // __SIZEOF_INT128__
+
+	__sync_fetch_and_add(&fallbacks, 1);
+
+	lddecimal(a, alen, &da);
+
+	return dectolong(&da, l);
+
+} /* DECFAST_tolong */
+
+
+/*
+ * DECFAST_fallbacks
+ */
+unsigned long DECFAST_fallbacks (void)
+{
+	return fallbacks;
+
+} /* DECFAST_fallbacks */
@@ -0,0 +1,68 @@
+/*
+ * decfast.h: fast path arithmetic on C-ISAM packed decimals
+ *
+ * Operands and results are packed decimals (stdecimal layout) as they sit
+ * in a record.  Values that fit a 128 bit scaled integer are added,
+ * subtracted, multiplied, compared and converted natively; anything else
+ * (or a compiler without 128 bit integers) falls back to the decimal
+ * library (lddecimal, dec<op>, stdecimal).
+ *
+ * NOTE: a null operand gives a null result (all zero bytes).
+ */
+
+#ifndef _DECFAST_H
+#define _DECFAST_H
+
+// Return codes (as the decimal library)
+#define DECFAST_OK			0
+#define DECFAST_OVERFLOW	(-1200)
+#define DECFAST_UNDERFLOW	(-1201)
+#define DECFAST_DIVZERO		(-1202)
+
+// DECFAST_cmp result when either operand is null
+#define DECFAST_UNKNOWN		(-2)
+
+/*
+ * DECFAST_add|sub|mul|div
+ * r = a <op> b, rounded half up to the length of r
+ * Returns DECFAST_OK or a decimal library error
+ * a, alen		First operand and its length
+ * b, blen		Second operand and its length
+ * r, rlen		Result and its length (may be a or b)
+ *
+ * NOTE: division always uses the decimal library
+ */
+int DECFAST_add (unsigned char *a, int alen, unsigned char *b, int blen,
+	unsigned char *r, int rlen);
+int DECFAST_sub (unsigned char *a, int alen, unsigned char *b, int blen,
+	unsigned char *r, int rlen);
+int DECFAST_mul (unsigned char *a, int alen, unsigned char *b, int blen,
+	unsigned char *r, int rlen);
+int DECFAST_div (unsigned char *a, int alen, unsigned char *b, int blen,
+	unsigned char *r, int rlen);
+
+/*
+ * DECFAST_cmp
+ * Compare a and b: -1, 0, 1 or DECFAST_UNKNOWN
+ */
+int DECFAST_cmp (unsigned char *a, int alen, unsigned char *b, int blen);
+
+/*
+ * DECFAST_cvlong
+ * Store a long as a packed decimal
+ */
+int DECFAST_cvlong (long l, unsigned char *r, int rlen);
+
+/*
+ * DECFAST_tolong
+ * Convert a packed decimal into a long (as dectolong)
+ */
+int DECFAST_tolong (unsigned char *a, int alen, long *l);
+
+/*
+ * DECFAST_fallbacks
+ * Number of operations handed to the decimal library so far
+ */
+unsigned long DECFAST_fallbacks (void);
+
+#endif // _DECFAST_H
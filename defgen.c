@@ -0,0 +1,333 @@
+/*
+ * defgen.c: compile bridge .def files into record codecs (codecs.c)
+ *
+ * Each schema is loaded with the same parser the bridge uses at runtime,
+ * then written out as a constant field table plus unrolled from/to record
+ * functions.  The schema fingerprint is stored with the codec; at runtime
+ * CODEC_attach only uses a codec whose fingerprint matches the loaded .def.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <libpq-fe.h>
+
+#include <isam.h>
+#include <decimal.h>
+
+#include "pgisam.h"
+#include "sys.h"
+#include "schema.h"
+#include "codec.h"
+#include "xstring.h"
+
+// Normally provided by pgbridge.o (not linked into defgen)
+pgisam_opt PGIsamOptions = PGIsamNormal;
+int iserrno = 0;
+char *envBRIDGE = NULL;
+
+// defgen is linked against codec.o, which needs a (empty) registry
+const CODEC *codec_registry[] = { NULL };
+
+static SCHEMA *hSchema = NULL;
+
+// Static function prototypes
+static void usage (void);
+static char * cname (char * name);
+static char * type_name (COLUMN * c, bool to_record);
+static void emit_header (FILE * out);
+static void emit_codec (FILE * out, SCHEMA * s);
+static void emit_registry (FILE * out);
+
+
+// CODE STARTS HERE
+
+
+char * get_EDATA (void)
+{
+	return getenv("EDATA");
+
+} /* get_EDATA */
+
+char * get_BRIDGE (void)
+{
+	return envBRIDGE;
+
+} /* get_BRIDGE */
+
+
+/* usage
+ */
+static void usage (void)
+{
+	fprintf(stderr, "\nPG-ISAM Codec generator: defgen [-b bridgedir] [-o outfile] def ...\n"
+		"  def       Schema name (bridgedir/<def>.def)\n"
+		"\n"
+		"  Options:\n"
+		"  -b        Bridge directory [DEFAULT=$BRIDGE]\n"
+		"  -o        Output file [DEFAULT=stdout]\n"
+		"  -?        Print this message\n"
+		);
+
+} /* usage */
+
+
+/* cname
+ * Make a C identifier from a schema name
+ */
+static char * cname (char * name)
+{
+	char *id = NULL;
+	char *p;
+
+	str_append(&id, "codec_%s", name);
+
+	for (p = id; *p; p++) {
+		if (! isalnum((unsigned char)*p)) {
+			*p = '_';
+		}
+	}
+
+	return id;
+
+} /* cname */
+
+
+/* type_name
+ * Helper suffix used for a column (mirrors COLUMN_from|to_record)
+ */
+static char * type_name (COLUMN * c, bool to_record)
+{
+	switch (c->datatype) {
+	case ISAM_TYPE_DECIMAL:
+		return "decimal";
+	case ISAM_TYPE_INTEGER:
+		return "integer";
+	case ISAM_TYPE_BINARY:
+		return "binary";
+	case ISAM_TYPE_BOOLEAN:
+		return "boolean";
+	case ISAM_TYPE_CODEBLANK:
+		if (to_record && c->codelength) {
+			return "code";
+		}
+		return to_record ? "char" : "codeblank";
+	case ISAM_TYPE_CODE:
+		return c->codelength ? "code" : "char";
+	}
+
+	return "char";
+
+} /* type_name */
+
+
+/* emit_header
+ */
+static void emit_header (FILE * out)
+{
+	fprintf(out,
+		"/*\n"
+		" * codecs.c: generated by defgen -- DO NOT EDIT\n"
+		" */\n"
+		"\n"
+		"#include <stdio.h>\n"
+		"#include <stdlib.h>\n"
+		"#include <libpq-fe.h>\n"
+		"\n"
+		"#include <isam.h>\n"
+		"\n"
+		"#include \"sys.h\"\n"
+		"#include \"schema.h\"\n"
+		"#include \"codec.h\"\n"
+		"\n"
+		);
+
+} /* emit_header */
+
+
+/* emit_codec
+ * Write the field table, from/to functions and CODEC for a schema
+ */
+static void emit_codec (FILE * out, SCHEMA * s)
+{
+	char *id = cname(s->name);
+	unsigned int x;
+
+	fprintf(out, "\n// _____/ %s (reclen=%u) \\__________\n", s->name, s->reclen);
+
+	// Field table
+	fprintf(out, "static const CODEC_FIELD %s_field[] = {\n", id);
+
+	for (x=0; x < s->ncols; x++) {
+		COLUMN *c = s->colv[x];
+
+		fprintf(out, "\t{ \"%s\", %u, %u, %u, 0x%x, %s },\n"
+			,c->name
+			,c->startpos
+			,c->length
+			,c->codelength
+			,c->datatype
+			,c->is_phantom ? "true" : "false"
+			);
+	}
+
+	fprintf(out, "};\n\n");
+
+	// record > colv[]->value
+	fprintf(out, "static void %s_from_record (COLUMN **colv, char *record)\n{\n", id);
+
+	for (x=0; x < s->ncols; x++) {
+		COLUMN *c = s->colv[x];
+		char *t = type_name(c, false);
+
+		if (c->is_phantom) {
+			continue;
+		}
+
+		if (! strcmp(t, "code")) {
+			fprintf(out, "\tcolv[%u]->value = CODEC_code_from_record(&record[%u], %u, %u);\n"
+				,x, c->startpos, c->length, c->codelength);
+		} else {
+			fprintf(out, "\tcolv[%u]->value = CODEC_%s_from_record(&record[%u], %u);\n"
+				,x, t, c->startpos, c->length);
+		}
+	}
+
+	fprintf(out, "}\n\n");
+
+	// res row > record
+	fprintf(out, "static bool %s_to_record (PGresult *pgres, int row, const int *fieldv,\n"
+		"\tchar *record)\n{\n", id);
+
+	for (x=0; x < s->ncols; x++) {
+		COLUMN *c = s->colv[x];
+		char *t = type_name(c, true);
+
+		if (c->is_phantom) {
+			continue;
+		}
+
+		fprintf(out, "\tif (! CODEC_%s_to_record(PQgetvalue(pgres, row, fieldv[%u]),\n"
+			"\t\tPQgetlength(pgres, row, fieldv[%u]), &record[%u], %u"
+			,t, x, x, c->startpos, c->length);
+
+		if (! strcmp(t, "code")) {
+			fprintf(out, ", %u", c->codelength);
+		}
+
+		fprintf(out, ")) return false;\n");
+	}
+
+	fprintf(out, "\treturn true;\n}\n\n");
+
+	// CODEC
+	fprintf(out, "static const CODEC %s = {\n"
+		"\t\"%s\", 0x%llxULL, %u, %u, %s_field,\n"
+		"\t%s_from_record, %s_to_record\n};\n"
+		,id
+		,s->name
+		,s->fingerprint
+		,s->reclen
+		,s->ncols
+		,id, id, id
+		);
+
+	str_free(&id);
+
+} /* emit_codec */
+
+
+/* emit_registry
+ */
+static void emit_registry (FILE * out)
+{
+	SCHEMA *s;
+
+	fprintf(out, "\n\nconst CODEC *codec_registry[] = {\n");
+
+	for (s = hSchema; s; s = s->next) {
+		char *id = cname(s->name);
+
+		fprintf(out, "\t&%s,\n", id);
+		str_free(&id);
+	}
+
+	fprintf(out, "\tNULL\n};\n");
+
+} /* emit_registry */
+
+
+int main (int argc, char ** argv)
+{
+	FILE *out = stdout;
+	char *outfile = NULL;
+	SCHEMA *s;
+	int c;
+	extern int optind;
+	extern char *optarg;
+
+	envBRIDGE = getenv("BRIDGE");
+
+	// Parse options on command line
+	while ((c = getopt(argc, argv, "b:o:?")) != -1) {
+		switch (c) {
+			case 'b':
+			envBRIDGE = optarg;
+			break;
+
+			case 'o':
+			outfile = optarg;
+			break;
+
+			case '?':
+			usage(); exit(EXIT_SUCCESS);
+
+			default:
+			usage(); exit(EXIT_FAILURE);
+		}
+	}
+
+	if (! envBRIDGE) {
+		fprintf(stderr, "defgen: no bridge directory (-b or $BRIDGE)\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Load each definition with the runtime parser
+	for (; optind < argc; optind++) {
+		char *name = str_dup(argv[optind]);
+
+		SCHEMA_push(&hSchema, name);
+
+		if (! hSchema->reclen) {
+			fprintf(stderr, "defgen: unable to load [%s/%s.def]\n",
+				envBRIDGE, name);
+			exit(EXIT_FAILURE);
+		}
+
+		str_free(&name);
+	}
+
+	if (outfile && (! (out = fopen(outfile, "w")))) {
+		fprintf(stderr, "defgen: unable to open [%s]\n", outfile);
+		exit(EXIT_FAILURE);
+	}
+
+	emit_header(out);
+
+	for (s = hSchema; s; s = s->next) {
+		emit_codec(out, s);
+	}
+
+	emit_registry(out);
+
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	SCHEMA_delete(&hSchema);
+
+	exit(EXIT_SUCCESS);
+
+} /* main */
@@ -0,0 +1,19 @@
+-- pgisam_record--1.0.sql
+-- C-ISAM fixed-width records for the pg2cisam bridge
+
+\echo Use "CREATE EXTENSION pgisam_record" to load this file. \quit
+
+CREATE FUNCTION pgisam_record_abi()
+RETURNS text
+AS 'MODULE_PATHNAME', 'pgisam_record_abi'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION pgisam_record(layout text, row record)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'pgisam_record'
+LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION pgisam_unrecord(layout text, rec bytea, template anyelement)
+RETURNS anyelement
+AS 'MODULE_PATHNAME', 'pgisam_unrecord'
+LANGUAGE C STABLE;
@@ -0,0 +1,553 @@
+/*
+ * pgisam_record.c: PostgreSQL extension converting table rows to and from
+ * fixed-width C-ISAM records on the server
+ *
+ * A layout describes the record ("rawrecord" schemas, see SCHEMA_raw_layout):
+ *   <abi>;<reclen>;<name>:<startpos>:<length>:<codelength>:<type>,...
+ *   abi		L<sizeof(long)><e|b> (native INTEGER fields)
+ *   type		c=CHAR d=DECIMAL k=CODE z=CODEBLANK b=BINARY i=INTEGER
+ *				l=BOOLEAN
+ *
+ * Field conversions follow the bridge's CODEC_<type>_from|to_record.
+ *
+ * Build: make -C ext (PGXS, against the server's pg_config)
+ */
+
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/typcache.h"
+
+// The bridge's packed decimal <> NUMERIC conversions
+#define PGISAM_EXTENSION
+#define __STACK(f)
+#define __return return
+#define xalloc(n) palloc0(n)
+#define xfree(p) pfree(p)
+#include "../numeric.c"
+
+PG_MODULE_MAGIC;
+
+#define MAXFIELDS 1024
+
+typedef struct FIELD_T {
+	char name[NAMEDATALEN];
+	int startpos;
+	int length;
+	int codelength;
+	char type;
+	int attno;				// Attribute in the row type (-1 = none)
+	Oid atttype;
+	FmgrInfo io;			// Output (pgisam_record) or input function
+	Oid ioparam;
+	int32 typmod;
+} FIELD;
+
+typedef struct LAYOUT_T {
+	char *text;				// Layout the cache was built from
+	Oid rowtype;			// Row type the attnos belong to
+	int reclen;
+	int nfields;
+	FIELD field[MAXFIELDS];
+} LAYOUT;
+
+PG_FUNCTION_INFO_V1(pgisam_record_abi);
+PG_FUNCTION_INFO_V1(pgisam_record);
+PG_FUNCTION_INFO_V1(pgisam_unrecord);
+
+// Static function prototypes
+static char * abi (void);
+static LAYOUT * layout_get (FunctionCallInfo fcinfo, text * layout,
+	TupleDesc td, Oid rowtype, bool output);
+static void field_to_record (FIELD * f, Datum value, char * rec);
+static bool field_from_record (FIELD * f, char * rec, Datum * value);
+static int field_fit (FIELD * f, int len, int room);
+static bool is_blank (const char * p, int len);
+static bool is_block_numeric (const char * p, int len);
+
+
+// CODE STARTS HERE
+
+
+/*
+ * abi
+ * Native integer layout of this server (must match the bridge's)
+ */
+static char * abi (void)
+{
+	static char buf[8];
+	long one = 1;
+
+	snprintf(buf, sizeof(buf), "L%d%c", (int)sizeof(long),
+		(*(char *)&one) ? 'e' : 'b');
+
+	return buf;
+
+} /* abi */
+
+
+/*
+ * field_fit
+ * Bytes of a value stored in a field of room bytes; a value that doesn't
+ * fit is truncated, and the server log says so
+ */
+static int field_fit (FIELD * f, int len, int room)
+{
+	if (len <= room) {
+		return len;
+	}
+
+	ereport(LOG,
+		(errmsg("pgisam_record: value of %s truncated from %d to %d bytes",
+			f->name, len, room)));
+
+	return room;
+
+} /* field_fit */
+
+
+/*
+ * is_blank | is_block_numeric
+ * As str_is_blank and str_is_block_numeric
+ */
+static bool is_blank (const char * p, int len)
+{
+	int x;
+
+	for (x=0; x < len; x++) {
+		if (p[x] != ' ') {
+			return false;
+		}
+	}
+
+	return true;
+
+} /* is_blank */
+
+
+static bool is_block_numeric (const char * p, int len)
+{
+	int x;
+
+	for (x=0; x < len; x++) {
+		if (p[x] == ' ' || p[x] == 0x00) continue;
+
+		if (! isdigit((unsigned char)p[x])) {
+			return false;
+		}
+	}
+
+	return true;
+
+} /* is_block_numeric */
+
+
+/*
+ * layout_get
+ * Parse a layout and resolve its fields against a row type; cached in
+ * fn_extra for the life of the statement
+ */
+static LAYOUT * layout_get (FunctionCallInfo fcinfo, text * layout,
+	TupleDesc td, Oid rowtype, bool output)
+{
+	LAYOUT *l = (LAYOUT *)fcinfo->flinfo->fn_extra;
+	char *str = text_to_cstring(layout);
+	char *p, *field, *save = NULL;
+	MemoryContext old;
+	int x;
+
+	if (l && l->rowtype == rowtype && (! strcmp(l->text, str))) {
+		pfree(str);
+		return l;
+	}
+
+	old = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+
+	if (! l) {
+		l = (LAYOUT *)palloc0(sizeof(LAYOUT));
+		fcinfo->flinfo->fn_extra = l;
+	} else {
+		pfree(l->text);
+		memset(l, 0, sizeof(LAYOUT));
+	}
+
+	l->text = pstrdup(str);
+	l->rowtype = rowtype;
+
+	// <abi>;<reclen>;<fields>
+	p = strtok_r(str, ";", &save);
+
+	if (! p || strcmp(p, abi())) {
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("pgisam_record: layout abi [%s] does not match server [%s]",
+				p ? p : "", abi())));
+	}
+
+	if (! (p = strtok_r(NULL, ";", &save)) || (l->reclen = atoi(p)) <= 0) {
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("pgisam_record: bad record length")));
+	}
+
+	p = strtok_r(NULL, ";", &save);
+
+	for (field = p ? strtok_r(p, ",", &save) : NULL; field;
+		field = strtok_r(NULL, ",", &save)) {
+		FIELD *f = &l->field[l->nfields];
+		char type;
+
+		if (l->nfields == MAXFIELDS ||
+			sscanf(field, "%63[^:]:%d:%d:%d:%c", f->name, &f->startpos,
+			&f->length, &f->codelength, &type) != 5 ||
+			f->startpos < 0 || f->length <= 0 ||
+			f->startpos + f->length > l->reclen) {
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("pgisam_record: bad field [%s]", field)));
+		}
+
+		// INTEGER fields are a native long whatever their length
+		if (type == 'i' && f->startpos + (int)sizeof(long) > l->reclen) {
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("pgisam_record: integer field [%s] past end of record",
+					f->name)));
+		}
+
+		f->type = type;
+		f->attno = -1;
+
+		for (x=0; x < td->natts; x++) {
+			Form_pg_attribute att = TupleDescAttr(td, x);
+
+			if ((! att->attisdropped) && (! strcmp(NameStr(att->attname), f->name))) {
+				bool varlena;
+
+				f->attno = x;
+				f->atttype = att->atttypid;
+				f->typmod = att->atttypmod;
+
+				if (output) {
+					Oid fn;
+
+					getTypeOutputInfo(f->atttype, &fn, &varlena);
+					fmgr_info_cxt(fn, &f->io, fcinfo->flinfo->fn_mcxt);
+				} else {
+					Oid fn;
+
+					getTypeInputInfo(f->atttype, &fn, &f->ioparam);
+					fmgr_info_cxt(fn, &f->io, fcinfo->flinfo->fn_mcxt);
+				}
+				break;
+			}
+		}
+
+		l->nfields++;
+	}
+
+	MemoryContextSwitchTo(old);
+	pfree(str);
+
+	return l;
+
+} /* layout_get */
+
+
+/*
+ * field_to_record
+ * Store a (non null) column value into its record field
+ */
+static void field_to_record (FIELD * f, Datum value, char * rec)
+{
+	char *field = &rec[f->startpos];
+	char *str;
+	int len;
+
+	// Types with a native form
+	switch (f->atttype) {
+	case BYTEAOID:
+		{
+			bytea *b = DatumGetByteaPP(value);
+
+			len = VARSIZE_ANY_EXHDR(b);
+			memcpy(field, VARDATA_ANY(b), field_fit(f, len, f->length));
+			return;
+		}
+	case BOOLOID:
+		field[0] = DatumGetBool(value) ? 'Y' : 'N';
+		return;
+	case INT2OID:
+	case INT4OID:
+	case INT8OID:
+		if (f->type == 'i') {
+			long number = (f->atttype == INT8OID) ? (long)DatumGetInt64(value) :
+				(f->atttype == INT4OID) ? (long)DatumGetInt32(value) :
+				(long)DatumGetInt16(value);
+
+			memcpy(field, &number, sizeof(long));
+			return;
+		}
+	}
+
+	str = OutputFunctionCall(&f->io, value);
+	len = strlen(str);
+
+	switch (f->type) {
+	case 'd':
+		{
+			unsigned char *numeric = palloc(NUMERIC_STRSZ(len));
+			int size = NUMERIC_from_str(str, len, numeric);
+
+			NUMERIC_to_packed(numeric, (size < 0) ? 0 : size,
+				(unsigned char *)field, f->length);
+			pfree(numeric);
+		}
+		break;
+	case 'i':
+		{
+			long number = atol(str);
+
+			memcpy(field, &number, sizeof(long));
+		}
+		break;
+	case 'l':
+		field[0] = (str[0] == 't') ? 'Y' : (str[0] == 'f') ? 'N' : ' ';
+		break;
+	case 'k':
+	case 'z':
+		if (f->codelength) {
+			int startpos = 0;
+
+			len = field_fit(f, len, f->codelength);
+
+			if (is_block_numeric(str, len)) {
+				startpos = f->length - f->codelength;
+			}
+
+			memcpy(&field[startpos], str, len);
+			break;
+		}
+		// Fall through (no codelength is treated as CHAR)
+	default:
+		memcpy(field, str, field_fit(f, len, f->length));
+	}
+
+	pfree(str);
+
+} /* field_to_record */
+
+
+/*
+ * field_from_record
+ * Column value of a record field; false for a null
+ */
+static bool field_from_record (FIELD * f, char * rec, Datum * value)
+{
+	char *field = &rec[f->startpos];
+	char *str;
+	int len;
+
+	if (is_blank(field, f->length)) {
+		// CODEBLANK keeps its spaces
+		if (f->type != 'z') {
+			return false;
+		}
+
+		str = palloc(f->length + 1);
+		memset(str, ' ', f->length);
+		str[f->length] = '\0';
+		*value = InputFunctionCall(&f->io, str, f->ioparam, f->typmod);
+		return true;
+	}
+
+	switch (f->type) {
+	case 'd':
+		{
+			unsigned char numeric[NUMERIC_PACKEDSZ(NUMERIC_MAXLEN)];
+
+			if (NUMERIC_from_packed((unsigned char *)field, f->length, numeric) < 0) {
+				return false;
+			}
+
+			str = palloc(NUMERIC_strlen(numeric) + 1);
+			NUMERIC_to_str(numeric, str);
+		}
+		break;
+	case 'i':
+		{
+			long number;
+
+			memcpy(&number, field, sizeof(long));
+			str = psprintf("%ld", number);
+		}
+		break;
+	case 'b':
+		if (f->atttype == BYTEAOID) {
+			bytea *b = (bytea *)palloc(VARHDRSZ + f->length);
+
+			SET_VARSIZE(b, VARHDRSZ + f->length);
+			memcpy(VARDATA(b), field, f->length);
+			*value = PointerGetDatum(b);
+			return true;
+		}
+		return false;
+	case 'l':
+		if (field[0] != 'Y' && field[0] != 'N') {
+			return false;
+		}
+		str = pstrdup((field[0] == 'Y') ? "true" : "false");
+		break;
+	case 'k':
+		if (f->codelength) {
+			int startpos = is_block_numeric(field, f->length) ?
+				f->length - f->codelength : 0;
+
+			str = pnstrdup(&field[startpos], f->codelength);
+			break;
+		}
+		// Fall through (no codelength is treated as CHAR)
+	default:
+		// Trailing spaces are trimmed
+		for (len = f->length; len > 0 && field[len - 1] == ' '; len--);
+		str = pnstrdup(field, len);
+	}
+
+	*value = InputFunctionCall(&f->io, str, f->ioparam, f->typmod);
+
+	return true;
+
+} /* field_from_record */
+
+
+/*
+ * pgisam_record_abi()
+ * Returns the native integer layout the server's records use
+ */
+Datum pgisam_record_abi (PG_FUNCTION_ARGS)
+{
+	PG_RETURN_TEXT_P(cstring_to_text(abi()));
+
+} /* pgisam_record_abi */
+
+
+/*
+ * pgisam_record(layout text, row record) RETURNS bytea
+ * A row as a C-ISAM record
+ */
+Datum pgisam_record (PG_FUNCTION_ARGS)
+{
+	HeapTupleHeader t = PG_GETARG_HEAPTUPLEHEADER(1);
+	Oid rowtype = HeapTupleHeaderGetTypeId(t);
+	TupleDesc td;
+	HeapTupleData tuple;
+	LAYOUT *l;
+	Datum *values;
+	bool *nulls;
+	bytea *out;
+	int x;
+
+	td = lookup_rowtype_tupdesc(rowtype, HeapTupleHeaderGetTypMod(t));
+	l = layout_get(fcinfo, PG_GETARG_TEXT_PP(0), td, rowtype, true);
+
+	tuple.t_len = HeapTupleHeaderGetDatumLength(t);
+	ItemPointerSetInvalid(&(tuple.t_self));
+	tuple.t_tableOid = InvalidOid;
+	tuple.t_data = t;
+
+	values = (Datum *)palloc(td->natts * sizeof(Datum));
+	nulls = (bool *)palloc(td->natts * sizeof(bool));
+	heap_deform_tuple(&tuple, td, values, nulls);
+
+	// A record starts as spaces
+	out = (bytea *)palloc(VARHDRSZ + l->reclen);
+	SET_VARSIZE(out, VARHDRSZ + l->reclen);
+	memset(VARDATA(out), ' ', l->reclen);
+
+	for (x=0; x < l->nfields; x++) {
+		FIELD *f = &l->field[x];
+
+		if (f->attno < 0) {
+			continue;
+		}
+
+		if (nulls[f->attno]) {
+			// Null decimals/integers are stored as the bridge does
+			if (f->type == 'd') {
+				memset(VARDATA(out) + f->startpos, 0, f->length);
+			} else
+			if (f->type == 'i') {
+				memset(VARDATA(out) + f->startpos, 0, sizeof(long));
+			}
+			continue;
+		}
+
+		field_to_record(f, values[f->attno], VARDATA(out));
+	}
+
+	ReleaseTupleDesc(td);
+
+	PG_RETURN_BYTEA_P(out);
+
+} /* pgisam_record */
+
+
+/*
+ * pgisam_unrecord(layout text, rec bytea, template anyelement)
+ *   RETURNS anyelement
+ * A C-ISAM record as a row of the template's type; columns not in the
+ * layout (oid, phantom) are null
+ */
+Datum pgisam_unrecord (PG_FUNCTION_ARGS)
+{
+	Oid rowtype = get_fn_expr_argtype(fcinfo->flinfo, 2);
+	bytea *rec;
+	TupleDesc td;
+	LAYOUT *l;
+	Datum *values;
+	bool *nulls;
+	HeapTuple tuple;
+	int x;
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+
+	if (! type_is_rowtype(rowtype)) {
+		ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+			errmsg("pgisam_unrecord: template must be a row type")));
+	}
+
+	rec = PG_GETARG_BYTEA_PP(1);
+
+	td = lookup_rowtype_tupdesc(rowtype, -1);
+	l = layout_get(fcinfo, PG_GETARG_TEXT_PP(0), td, rowtype, false);
+
+	if (VARSIZE_ANY_EXHDR(rec) != l->reclen) {
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("pgisam_unrecord: record length %d, expected %d",
+				(int)VARSIZE_ANY_EXHDR(rec), l->reclen)));
+	}
+
+	values = (Datum *)palloc0(td->natts * sizeof(Datum));
+	nulls = (bool *)palloc(td->natts * sizeof(bool));
+	memset(nulls, true, td->natts * sizeof(bool));
+
+	for (x=0; x < l->nfields; x++) {
+		FIELD *f = &l->field[x];
+
+		if (f->attno < 0) {
+			continue;
+		}
+
+		nulls[f->attno] = ! field_from_record(f, VARDATA_ANY(rec),
+			&values[f->attno]);
+	}
+
+	tuple = heap_form_tuple(td, values, nulls);
+	ReleaseTupleDesc(td);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+
+} /* pgisam_unrecord */
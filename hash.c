@@ -0,0 +1,174 @@
+/*
+ * hash.c: string keyed hash tables
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sys.h"
+#include "hash.h"
+
+// Static function prototypes
+static unsigned int hash_key (const char * key);
+static void hash_grow (HASH * hash);
+
+
+// CODE STARTS HERE
+
+
+// _____/ HASH functions \__________
+/*
+ * HASH_new
+ * Create a table sized for n keys
+ */
+HASH * HASH_new (unsigned int n)
+{
+	HASH *hash = xalloc(sizeof(HASH));
+
+__STACK(HASH_new)
+
+	// Keep the table at most half full
+	hash->size = 16;
+	while (hash->size < n * 2) {
+		hash->size <<= 1;
+	}
+
+	hash->key = xalloc(sizeof(char *) * hash->size);
+	hash->value = xalloc(sizeof(void *) * hash->size);
+
+	__return hash;
+
+} /* HASH_new */
+
+
+/*
+ * HASH_put
+ * Add a key; an existing key keeps its first value
+ * hash			Table
+ * key			Key (not copied)
+ * value		Value
+ */
+void HASH_put (HASH * hash, const char * key, void * value)
+{
+	unsigned int x;
+
+__STACK(HASH_put)
+
+	if ((hash->count + 1) * 2 > hash->size) {
+		hash_grow(hash);
+	}
+
+	for (x = hash_key(key) & (hash->size - 1); hash->key[x];
+		x = (x + 1) & (hash->size - 1)) {
+		if (! strcmp(hash->key[x], key)) {
+			__return;
+		}
+	}
+
+	hash->key[x] = key;
+	hash->value[x] = value;
+	hash->count++;
+
+	__return;
+
+} /* HASH_put */
+
+
+/*
+ * HASH_get
+ * Value of a key or NULL (hash may be NULL)
+ */
+void * HASH_get (HASH * hash, const char * key)
+{
+	unsigned int x;
+
+__STACK(HASH_get)
+
+	if (! hash) {
+		__return NULL;
+	}
+
+	for (x = hash_key(key) & (hash->size - 1); hash->key[x];
+		x = (x + 1) & (hash->size - 1)) {
+		if (! strcmp(hash->key[x], key)) {
+			__return hash->value[x];
+		}
+	}
+
+	__return NULL;
+
+} /* HASH_get */
+
+
+/*
+ * HASH_delete
+ * Delete a table (the keys and values are not freed)
+ */
+void HASH_delete (HASH ** hash)
+{
+__STACK(HASH_delete)
+
+	if (*hash) {
+		xfree((*hash)->key);
+		xfree((*hash)->value);
+		xfree(*hash);
+	}
+
+	*hash = NULL;
+
+	__return;
+
+} /* HASH_delete */
+
+
+// _____/ static functions \__________
+/*
+ * hash_key
+ * 32-bit FNV-1a of a key
+ */
+static unsigned int hash_key (const char * key)
+{
+	unsigned int h = 0x811c9dc5;
+
+__STACK(hash_key)
+
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 0x01000193;
+	}
+
+	__return h;
+
+} /* hash_key */
+
+
+/*
+ * hash_grow
+ * Double the slots of a table
+ */
+static void hash_grow (HASH * hash)
+{
+	const char **key = hash->key;
+	void **value = hash->value;
+	unsigned int size = hash->size, x;
+
+__STACK(hash_grow)
+
+	hash->size <<= 1;
+	hash->count = 0;
+	hash->key = xalloc(sizeof(char *) * hash->size);
+	hash->value = xalloc(sizeof(void *) * hash->size);
+
+	for (x=0; x < size; x++) {
+		if (key[x]) {
+			HASH_put(hash, key[x], value[x]);
+		}
+	}
+
+	xfree(key);
+	xfree(value);
+
+	__return;
+
+} /* hash_grow */
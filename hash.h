@@ -0,0 +1,49 @@
+/*
+ * hash.h: string keyed hash tables
+ *
+ * Open addressing, keys are not copied (they must live as long as the
+ * table, e.g. the name of the node stored as the value).
+ */
+
+#ifndef _HASH_H
+#define _HASH_H
+
+/*
+ * HASH
+ * Table of key/value pairs
+ */
+typedef struct HASH_T {
+	unsigned int size;		// Slots (a power of 2)
+	unsigned int count;		// Slots used
+	const char **key;
+	void **value;
+} HASH;
+
+/*
+ * HASH_new
+ * Create a table sized for n keys
+ */
+HASH * HASH_new (unsigned int n);
+
+/*
+ * HASH_put
+ * Add a key; an existing key keeps its first value
+ * hash			Table
+ * key			Key (not copied)
+ * value		Value
+ */
+void HASH_put (HASH * hash, const char * key, void * value);
+
+/*
+ * HASH_get
+ * Value of a key or NULL (hash may be NULL)
+ */
+void * HASH_get (HASH * hash, const char * key);
+
+/*
+ * HASH_delete
+ * Delete a table (the keys and values are not freed)
+ */
+void HASH_delete (HASH ** hash);
+
+#endif // _HASH_H
@@ -9,6 +9,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/time.h>
 
 #include <isam.h>
 #include <decimal.h>
@@ -21,6 +22,20 @@
 
 // Typedefs
 typedef enum bool { err = (-1), false = 0, true } bool;
+
+#ifdef TARGET_PGISAM
+#include <libpq-fe.h>
+#include "numeric.h"
+#include "decfast.h"
+#include "schema.h"
+#include "shard.h"
+#include "hash.h"
+
+#define NUMERIC_RANDOM 100000	// Randomized values tested by "numeric"
+#define BENCH_COUNT 1000000		// Default operations per bench-decimals test
+#define BENCH_OPERANDS 1024		// Generated operands per distribution
+#define SHARD_TEST 2			// Fake shards of the "shard" merge test
+#endif //TARGET_PGISAM
 typedef unsigned char byte;
 typedef unsigned short int word16;
 typedef unsigned int word32;
@@ -34,6 +49,13 @@ static unsigned long sum = 0L;
 static unsigned long sumlen = 0L;
 static unsigned long testnum = 0L;
 static bool VERBOSE = false;
+#ifdef TARGET_PGISAM
+static char *shard_rows[SHARD_TEST][4] = {	// Each fake shard's cursor rows
+	{ "1", "4", "9", NULL },
+	{ "2", "4", "10", NULL }
+};
+static int shard_pos[SHARD_TEST];			// Where each cursor is (see shard_row)
+#endif //TARGET_PGISAM
 
 // Static function prototypes
 static void cleanup (void);
@@ -45,6 +67,19 @@ static word16 checksum(byte *addr, word32 count);
 static void sumprintf (bool print, char *fmt, ...);
 static bool decimal_action (char *cmd, char *arg1, char *arg2);
 static bool sum_test_main (char *isamfilename);
+#ifdef TARGET_PGISAM
+static bool numeric_check (unsigned char *pack, int len, char *label);
+static bool numeric_test_main (char *filename);
+static double bench_now (void);
+static void bench_operands (int dist, int len, unsigned char *pack);
+static bool bench_decimals_main (unsigned long count);
+static bool shard_numcmp_check (char *a, char *b, int expect);
+static bool shard_range_check (char *bounds, int n, char *key, bool numeric,
+	int expect);
+static RES * shard_row (MERGE *merge, int shard, char *direction);
+static bool shard_merge_check (void);
+static bool shard_test_main (void);
+#endif //TARGET_PGISAM
 
 
 // CODE STARTS HERE
@@ -91,6 +126,9 @@ static void usage(void)
 	fprintf(stderr, "isamtest [-v?] operation [args...]\n"
 	    "  Operation                  Description\n"
 	    "  decimals <decimalfile>     Test decimals\n"
+	    "  numeric <decimalfile>      Round trip packed decimals through NUMERIC\n"
+	    "  bench-decimals [count]     Decimal ops/sec, library vs fast path\n"
+	    "  shard                      Shard key order, range routing and merge\n"
 	    "  sum <isamfile>             Read isam file by each index and sum the results\n"
 		"    -v                       Verbose\n"
 		"    -?                       Print this message\n"
@@ -420,6 +458,604 @@ retbad:
 } /* decimal_test_main */
 
 
+#ifdef TARGET_PGISAM
+/* numeric_check
+ * Round trip one packed decimal through NUMERIC (binary and text) and
+ * compare with the decimal library
+ */
+static bool numeric_check (unsigned char *pack, int len, char *label)
+{
+	unsigned char numeric[NUMERIC_STRSZ(MAXBUFSZ)], back[NUMERIC_MAXLEN];
+	char str[MAXBUFSZ], rbuf[64];
+	dec_t dec;
+	int size;
+	bool ok = true;
+
+	testnum++;
+
+	// packed > NUMERIC > packed
+	size = NUMERIC_from_packed(pack, len, numeric);
+	if (size < 0 || !NUMERIC_to_packed(numeric, size, back, len) ||
+		memcmp(pack, back, len)) {
+		sumprintf(true, "Test #%lu: %s: binary round trip failed\n",
+			testnum, label);
+		return false;
+	}
+
+	// NUMERIC text > library > packed
+	NUMERIC_to_str(numeric, str);
+	memset(back, 0, len);
+	deccvasc(str, strlen(str), &dec);
+	stdecimal(&dec, back, len);
+	if (memcmp(pack, back, len)) {
+		sumprintf(true, "Test #%lu: %s: [%s] differs from the library\n",
+			testnum, label, str);
+		ok = false;
+	}
+
+	// library text > NUMERIC > packed
+	memset(rbuf, 0, sizeof(rbuf));
+	lddecimal(pack, len, &dec);
+	dectoasc(&dec, rbuf, sizeof(rbuf) - 1, -1);
+	size = NUMERIC_from_str(rbuf, strlen(rbuf), numeric);
+	if (size < 0 || !NUMERIC_to_packed(numeric, size, back, len) ||
+		memcmp(pack, back, len)) {
+		sumprintf(true, "Test #%lu: %s: library text [%s] failed\n",
+			testnum, label, rbuf);
+		ok = false;
+	}
+
+	sumprintf(VERBOSE, "Test #%lu: %s: [%s] %s\n",
+		testnum, label, str, ok ? "ok" : "FAILED");
+
+	return ok;
+
+} /* numeric_check */
+
+
+/* numeric_test_main
+ * Every value in a decimal file, then randomized packed values
+ */
+static bool numeric_test_main (char *filename)
+{
+	FILE *fd;
+	char BUF[MAXBUFSZ];
+	unsigned char pack[NUMERIC_MAXLEN];
+	static int lengths[] = { 4, 8, 12, 0 };
+	unsigned long failed = 0L, x;
+	int l, y;
+
+	fd = fopen(filename, "r");
+	if (!fd) {
+		perror("fopen");
+		return false;
+	}
+
+	// Each argument, packed at several lengths ("quit" only ends the
+	// arithmetic tests)
+	while (fgets(BUF, MAXBUFSZ, fd) != (char *)NULL) {
+		char *arg;
+
+		if (BUF[0] == '\n' || BUF[0] == '#') continue;
+
+		strtok(BUF, " \r\n");
+		while ((arg = strtok(NULL, " \r\n")) != (char *)NULL) {
+			dec_t dec;
+
+			deccvasc(arg, strlen(arg), &dec);
+
+			for (l=0; lengths[l]; l++) {
+				memset(pack, 0, lengths[l]);
+				stdecimal(&dec, pack, lengths[l]);
+				failed += numeric_check(pack, lengths[l], arg) ? 0 : 1;
+			}
+		}
+	}
+
+	fclose(fd);
+
+	// Normalized random values: any sign, exponent and length
+	srand(1);
+
+	for (x=0; x < NUMERIC_RANDOM; x++) {
+		int len = 2 + rand() % (NUMERIC_MAXLEN - 1);
+		int exp = rand() % 128 - 64;
+		bool neg = rand() & 1;
+		int last = 0;
+
+		for (y=1; y < len; y++) {
+			pack[y] = rand() % 100;
+			if (pack[y]) last = y;
+		}
+
+		if (!pack[1]) {
+			pack[1] = 1 + rand() % 99;
+			last = (last > 1) ? last : 1;
+		}
+
+		if (neg) {
+			for (y=1; y <= last; y++) {
+				pack[y] = (y == last) ? 100 - pack[y] : 99 - pack[y];
+			}
+			pack[0] = 0x7F - (exp + 64);
+		} else {
+			pack[0] = 0x80 | (exp + 64);
+		}
+
+		failed += numeric_check(pack, len, "random") ? 0 : 1;
+	}
+
+	sumprintf(true, "numeric: %lu tests, %lu failed\n", testnum, failed);
+
+	return failed ? false : true;
+
+} /* numeric_test_main */
+
+
+/* bench_now
+ */
+static double bench_now (void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+
+} /* bench_now */
+
+
+/* bench_operands
+ * Fill BENCH_OPERANDS packed decimals of len bytes:
+ *   0 = money (+/-999999.99), 1 = rates (0.000001-0.999999),
+ *   2 = wide (30 significant digits)
+ */
+static void bench_operands (int dist, int len, unsigned char *pack)
+{
+	char BUF[64];
+	dec_t dec;
+	int x;
+
+	for (x=0; x < BENCH_OPERANDS; x++) {
+		switch (dist) {
+		case 0:
+			sprintf(BUF, "%s%d.%02d", (rand() & 1) ? "-" : "",
+				rand() % 1000000, rand() % 100);
+			break;
+		case 1:
+			sprintf(BUF, "0.%06d", 1 + rand() % 999999);
+			break;
+		default:
+			sprintf(BUF, "%s%09d%06d.%09d%06d", (rand() & 1) ? "-" : "",
+				1 + rand() % 999999999, rand() % 1000000,
+				rand() % 1000000000, rand() % 1000000);
+		}
+
+		deccvasc(BUF, strlen(BUF), &dec);
+		memset(&pack[x * len], 0, len);
+		stdecimal(&dec, &pack[x * len], len);
+	}
+
+} /* bench_operands */
+
+
+/* bench_decimals_main
+ * ops/sec of each operation on packed operands: lddecimal, dec<op>,
+ * stdecimal (the library) against DECFAST_<op>, with the results compared
+ */
+static bool bench_decimals_main (unsigned long count)
+{
+	static struct {
+		char *name;
+		int dista, lena;
+		int distb, lenb;
+		int rlen;
+	} bench[] = {
+		{ "money",       0, 8,  0, 8,  8 },
+		{ "money*rate",  0, 8,  1, 8,  8 },
+		{ "wide",        2, 17, 2, 17, 17 },
+		{ NULL }
+	};
+	static char *opname[] = { "add", "sub", "mul", "div", "cmp", "tolong",
+		"cvlong", NULL };
+	unsigned char *a, *b, r[32], rfast[32];
+	unsigned long failed = 0L;
+	int t, op;
+
+	a = malloc(BENCH_OPERANDS * 17);
+	b = malloc(BENCH_OPERANDS * 17);
+
+	srand(1);
+
+	sumprintf(true, "%-12s %-7s %14s %14s %8s %10s\n", "operands", "op",
+		"library/s", "decfast/s", "speedup", "fallbacks");
+
+	for (t=0; bench[t].name; t++) {
+		bench_operands(bench[t].dista, bench[t].lena, a);
+		bench_operands(bench[t].distb, bench[t].lenb, b);
+
+		for (op=0; opname[op]; op++) {
+			unsigned long fallbacks = DECFAST_fallbacks(), x, diffs = 0L;
+			double start, slow, fast;
+			long sink = 0L;
+
+			// Library
+			start = bench_now();
+			for (x=0; x < count; x++) {
+				unsigned char *pa = &a[(x % BENCH_OPERANDS) * bench[t].lena];
+				unsigned char *pb = &b[((x >> 3) % BENCH_OPERANDS) * bench[t].lenb];
+				dec_t da, db, dr;
+				long l = 0L;
+
+				if (op != 6) {
+					lddecimal(pa, bench[t].lena, &da);
+				}
+
+				switch (op) {
+				case 0:
+				case 1:
+				case 2:
+				case 3:
+					lddecimal(pb, bench[t].lenb, &db);
+					if (op == 0) decadd(&da, &db, &dr);
+					if (op == 1) decsub(&da, &db, &dr);
+					if (op == 2) decmul(&da, &db, &dr);
+					if (op == 3) decdiv(&da, &db, &dr);
+					stdecimal(&dr, r, bench[t].rlen);
+					break;
+				case 4:
+					lddecimal(pb, bench[t].lenb, &db);
+					sink += deccmp(&da, &db);
+					break;
+				case 5:
+					dectolong(&da, &l);
+					sink += l;
+					break;
+				default:
+					deccvlong((long)x, &dr);
+					stdecimal(&dr, r, bench[t].rlen);
+				}
+			}
+			slow = bench_now() - start;
+
+			// Fast path
+			start = bench_now();
+			for (x=0; x < count; x++) {
+				unsigned char *pa = &a[(x % BENCH_OPERANDS) * bench[t].lena];
+				unsigned char *pb = &b[((x >> 3) % BENCH_OPERANDS) * bench[t].lenb];
+				long l = 0L;
+
+				switch (op) {
+				case 0:
+					DECFAST_add(pa, bench[t].lena, pb, bench[t].lenb, rfast, bench[t].rlen);
+					break;
+				case 1:
+					DECFAST_sub(pa, bench[t].lena, pb, bench[t].lenb, rfast, bench[t].rlen);
+					break;
+				case 2:
+					DECFAST_mul(pa, bench[t].lena, pb, bench[t].lenb, rfast, bench[t].rlen);
+					break;
+				case 3:
+					DECFAST_div(pa, bench[t].lena, pb, bench[t].lenb, rfast, bench[t].rlen);
+					break;
+				case 4:
+					sink -= DECFAST_cmp(pa, bench[t].lena, pb, bench[t].lenb);
+					break;
+				case 5:
+					DECFAST_tolong(pa, bench[t].lena, &l);
+					sink -= l;
+					break;
+				default:
+					DECFAST_cvlong((long)x, rfast, bench[t].rlen);
+				}
+			}
+			fast = bench_now() - start;
+
+			// Same results?  (one pass over the operands)
+			for (x=0; x < BENCH_OPERANDS * 8 && op != 4 && op != 5; x++) {
+				unsigned char *pa = &a[(x % BENCH_OPERANDS) * bench[t].lena];
+				unsigned char *pb = &b[((x >> 3) % BENCH_OPERANDS) * bench[t].lenb];
+				dec_t da, db, dr;
+
+				lddecimal(pa, bench[t].lena, &da);
+				lddecimal(pb, bench[t].lenb, &db);
+				memset(r, 0, bench[t].rlen);
+
+				switch (op) {
+				case 0:
+					decadd(&da, &db, &dr);
+					DECFAST_add(pa, bench[t].lena, pb, bench[t].lenb, rfast, bench[t].rlen);
+					break;
+				case 1:
+					decsub(&da, &db, &dr);
+					DECFAST_sub(pa, bench[t].lena, pb, bench[t].lenb, rfast, bench[t].rlen);
+					break;
+				case 2:
+					decmul(&da, &db, &dr);
+					DECFAST_mul(pa, bench[t].lena, pb, bench[t].lenb, rfast, bench[t].rlen);
+					break;
+				case 3:
+					decdiv(&da, &db, &dr);
+					DECFAST_div(pa, bench[t].lena, pb, bench[t].lenb, rfast, bench[t].rlen);
+					break;
+				default:
+					deccvlong((long)x, &dr);
+					DECFAST_cvlong((long)x, rfast, bench[t].rlen);
+				}
+
+				stdecimal(&dr, r, bench[t].rlen);
+				diffs += memcmp(r, rfast, bench[t].rlen) ? 1 : 0;
+			}
+
+			// cmp and tolong give a sum over the same operands
+			if ((op == 4 || op == 5) && sink) {
+				diffs++;
+			}
+
+			sumprintf(true, "%-12s %-7s %14.0f %14.0f %7.2fx %10lu%s\n"
+				,bench[t].name
+				,opname[op]
+				,count / (slow > 0 ? slow : 1e-9)
+				,count / (fast > 0 ? fast : 1e-9)
+				,slow / (fast > 0 ? fast : 1e-9)
+				,DECFAST_fallbacks() - fallbacks
+				,diffs ? "  RESULTS DIFFER" : ""
+				);
+
+			failed += diffs ? 1 : 0;
+		}
+	}
+
+	free(a);
+	free(b);
+
+	return failed ? false : true;
+
+} /* bench_decimals_main */
+
+
+/* shard_numcmp_check
+ * Compare two numbers with SHARD_numcmp, both ways round
+ */
+static bool shard_numcmp_check (char *a, char *b, int expect)
+{
+	int ab, ba;
+
+	testnum++;
+
+	ab = SHARD_numcmp(a, strlen(a), b, strlen(b));
+	ba = SHARD_numcmp(b, strlen(b), a, strlen(a));
+
+	if (ab != expect || ba != -expect) {
+		sumprintf(true, "Test #%lu: numcmp [%s] [%s]: %d/%d, expected %d\n",
+			testnum, a, b, ab, ba, expect);
+		return false;
+	}
+
+	sumprintf(VERBOSE, "Test #%lu: numcmp [%s] [%s]: %d ok\n",
+		testnum, a, b, ab);
+
+	return true;
+
+} /* shard_numcmp_check */
+
+
+/* shard_range_check
+ * Route a key with SHARD_range; numeric keys are also passed as the
+ * value of a numeric key column
+ */
+static bool shard_range_check (char *bounds, int n, char *key, bool numeric,
+	int expect)
+{
+	int shard;
+
+	testnum++;
+
+	shard = SHARD_range(bounds, n, key, strlen(key), numeric ? key : NULL);
+
+	if (shard != expect) {
+		sumprintf(true, "Test #%lu: range:%s (%d shards) [%s]: shard %d, "
+			"expected %d\n", testnum, bounds, n, key, shard, expect);
+		return false;
+	}
+
+	sumprintf(VERBOSE, "Test #%lu: range:%s (%d shards) [%s]: shard %d ok\n",
+		testnum, bounds, n, key, shard);
+
+	return true;
+
+} /* shard_range_check */
+
+
+/* shard_row
+ * FETCH from a fake shard cursor (see MERGE); as on the server, a cursor
+ * stops one before the first row (-1) or one past the last
+ */
+static RES * shard_row (MERGE *merge, int shard, char *direction)
+{
+	PGresAttDesc attr;
+	RES *res;
+	int *pos = &shard_pos[shard], rows;
+
+	for (rows=0; shard_rows[shard][rows]; rows++);
+
+	if (!strcmp(direction, "FIRST")) {
+		*pos = 0;
+	} else
+	if (!strcmp(direction, "LAST")) {
+		*pos = rows - 1;
+	} else
+	if (!strcmp(direction, "NEXT")) {
+		*pos = (*pos < rows) ? *pos + 1 : rows;
+	} else
+	if (!strcmp(direction, "PRIOR")) {
+		*pos = (*pos >= 0) ? *pos - 1 : -1;
+	}
+
+	// "RELATIVE 0" (or walked off either end)
+	if (*pos < 0 || *pos >= rows) {
+		return (RES *)NULL;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.name = "id";
+	attr.typid = 1700;		// numeric
+	attr.typlen = -1;
+	attr.atttypmod = -1;
+
+	res = (RES *)calloc(1, sizeof(RES));
+	res->pgres = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+	PQsetResultAttrs(res->pgres, 1, &attr);
+	PQsetvalue(res->pgres, 0, 0, shard_rows[shard][*pos],
+		strlen(shard_rows[shard][*pos]));
+	res->tuples = 1;
+	res->nfields = 1;
+
+	return res;
+
+} /* shard_row */
+
+
+/* shard_merge_check
+ * Read the merged fake cursors in key order (numerically, then by shard),
+ * turning round between ISNEXT and ISPREV across shards
+ */
+static bool shard_merge_check (void)
+{
+	static char *merged[] = { "1/0", "2/1", "4/0", "4/1", "9/0", "10/1" };
+	static struct { int mode; int row; } step[] = {
+		{ ISFIRST, 0 }, { ISNEXT, 1 }, { ISNEXT, 2 }, { ISNEXT, 3 },
+		{ ISPREV, 2 }, { ISPREV, 1 }, { ISNEXT, 2 }, { ISNEXT, 3 },
+		{ ISNEXT, 4 }, { ISPREV, 3 }, { ISPREV, 2 }, { ISPREV, 1 },
+		{ ISLAST, 5 }, { ISPREV, 4 }, { ISPREV, 3 }, { ISNEXT, 4 },
+		{ ISCURR, 4 }, { ISNEXT, 5 }, { ISNEXT, -1 }, { -1, 0 }
+	};
+	SCHEMA schema;
+	INDEX index;
+	COLUMN column, icolumn;
+	MERGE *merge;
+	RES *res;
+	char got[32];
+	unsigned long failed = 0L;
+	int x;
+
+	memset(&schema, 0, sizeof(schema));
+	memset(&index, 0, sizeof(index));
+	memset(&column, 0, sizeof(column));
+
+	column.name = "id";
+	column.length = 8;
+	column.datatype = ISAM_TYPE_DECIMAL;
+	icolumn = column;
+
+	index.name = "shardtest_pkey";
+	index.is_unique = true;
+	index.num = 1;
+	index.column = &icolumn;
+
+	schema.name = "shardtest";
+	schema.column = &column;
+	schema.ncols = 1;
+	schema.index = &index;
+
+	merge = (MERGE *)calloc(1, sizeof(MERGE));
+	merge->n = SHARD_TEST;
+	merge->conn = (CONN **)calloc(SHARD_TEST, sizeof(CONN *));
+	merge->head = (RES **)calloc(SHARD_TEST, sizeof(RES *));
+	merge->last = -1;
+	merge->schema = &schema;
+	merge->index = &index;
+	merge->cursor_name = strdup("shardtest");
+	merge->row = shard_row;
+
+	for (x=0; step[x].mode >= 0; x++) {
+		testnum++;
+
+		res = MERGE_fetch(merge, step[x].mode);
+
+		if (res) {
+			sprintf(got, "%s/%d", PQgetvalue(res->pgres, 0, 0), merge->last);
+		} else {
+			strcpy(got, "none");
+		}
+		RES_delete(&res);
+
+		if (strcmp(got, (step[x].row < 0) ? "none" : merged[step[x].row])) {
+			sumprintf(true, "Test #%lu: merge step %d: [%s], expected [%s]\n",
+				testnum, x, got,
+				(step[x].row < 0) ? "none" : merged[step[x].row]);
+			failed++;
+			continue;
+		}
+
+		sumprintf(VERBOSE, "Test #%lu: merge step %d: [%s] ok\n",
+			testnum, x, got);
+	}
+
+	MERGE_delete(&merge, false);
+	HASH_delete(&schema.colhash);
+
+	return failed ? false : true;
+
+} /* shard_merge_check */
+
+
+/* shard_test_main
+ * SHARD_numcmp, range routing and the merged cursors of a sharded table
+ */
+static bool shard_test_main (void)
+{
+	unsigned long failed = 0L;
+
+	// Signs, leading and trailing zeros, -0
+	failed += shard_numcmp_check("1", "1", 0) ? 0 : 1;
+	failed += shard_numcmp_check("007", "7", 0) ? 0 : 1;
+	failed += shard_numcmp_check("7.50", "7.5", 0) ? 0 : 1;
+	failed += shard_numcmp_check("+3", "3", 0) ? 0 : 1;
+	failed += shard_numcmp_check("-0", "0", 0) ? 0 : 1;
+	failed += shard_numcmp_check("-0.00", "0.0", 0) ? 0 : 1;
+	failed += shard_numcmp_check("-0", "-1", 1) ? 0 : 1;
+	failed += shard_numcmp_check("-1", "1", -1) ? 0 : 1;
+	failed += shard_numcmp_check("-2", "-10", 1) ? 0 : 1;
+	failed += shard_numcmp_check("10", "9", 1) ? 0 : 1;
+	failed += shard_numcmp_check("0.5", "0.49", 1) ? 0 : 1;
+	failed += shard_numcmp_check("-0.5", "-0.49", -1) ? 0 : 1;
+	failed += shard_numcmp_check("000.100", ".1", 0) ? 0 : 1;
+	failed += shard_numcmp_check("123456789012345678901234567890",
+		"123456789012345678901234567891", -1) ? 0 : 1;
+
+	// Numeric keys: below, at and past the bounds
+	failed += shard_range_check("100,200,300", 4, "-5", true, 0) ? 0 : 1;
+	failed += shard_range_check("100,200,300", 4, "99.99", true, 0) ? 0 : 1;
+	failed += shard_range_check("100,200,300", 4, "100", true, 1) ? 0 : 1;
+	failed += shard_range_check("100,200,300", 4, "0100.00", true, 1) ? 0 : 1;
+	failed += shard_range_check("100,200,300", 4, "199.999", true, 1) ? 0 : 1;
+	failed += shard_range_check("100,200,300", 4, "300", true, 3) ? 0 : 1;
+	failed += shard_range_check("100,200,300", 4, "1000", true, 3) ? 0 : 1;
+	failed += shard_range_check("100,200,300", 3, "1000", true, 2) ? 0 : 1;
+	failed += shard_range_check("-10,0,10", 4, "-0", true, 2) ? 0 : 1;
+	failed += shard_range_check("-10,0,10", 4, "-10.5", true, 0) ? 0 : 1;
+
+	// Keys as they are in the record, compared bytewise
+	failed += shard_range_check("G,N", 3, "A   ", false, 0) ? 0 : 1;
+	failed += shard_range_check("G,N", 3, "F   ", false, 0) ? 0 : 1;
+	failed += shard_range_check("G,N", 3, "G   ", false, 1) ? 0 : 1;
+	failed += shard_range_check("G,N", 3, "GA  ", false, 1) ? 0 : 1;
+	failed += shard_range_check("G,N", 3, "N", false, 2) ? 0 : 1;
+	failed += shard_range_check("G,N", 3, "ZZZZ", false, 2) ? 0 : 1;
+	failed += shard_range_check("GG,N", 3, "G", false, 0) ? 0 : 1;
+
+	// Merged cursors, turning round across shards
+	failed += shard_merge_check() ? 0 : 1;
+
+	sumprintf(true, "shard: %lu tests, %lu failed\n", testnum, failed);
+
+	return failed ? false : true;
+
+} /* shard_test_main */
+#endif //TARGET_PGISAM
+
+
 /* sum_test_main
  */
 static bool sum_test_main (char *isamfilename)
@@ -568,6 +1204,30 @@ int main (int argc, char ** argv)
 		}
 		exstat = sum_test_main(argv[argc-1]);
 	} else
+#ifdef TARGET_PGISAM
+	if (!strcmp(operation, "numeric")) {
+		if (argc != optind+2) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		exstat = numeric_test_main(argv[argc-1]);
+	} else
+	if (!strcmp(operation, "bench-decimals")) {
+		if (argc > optind+2) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		exstat = bench_decimals_main((argc == optind+2) ?
+			strtoul(argv[argc-1], NULL, 10) : BENCH_COUNT);
+	} else
+	if (!strcmp(operation, "shard")) {
+		if (argc != optind+1) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		exstat = shard_test_main();
+	} else
+#endif //TARGET_PGISAM
 	{
 		usage();
 		exit(EXIT_FAILURE);
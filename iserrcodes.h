@@ -50,6 +50,11 @@ static struct iserrlist_t {
 	159, "invalid collation specifier",
 	171, "locking or NODESIZE change",
 	900, "no schema definition",
+	901, "operation timed out",
+	902, "no database connection",
+	903, "deferred write failed",
+	904, "grouped write failed",
+	905, "locked writes rolled back",
 	0, 0
 };
 
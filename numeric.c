@@ -0,0 +1,501 @@
+/*
+ * numeric.c: C-ISAM packed decimals <> PostgreSQL binary NUMERIC
+ *
+ * Conversions work digit by digit; neither side goes through dec_t or a
+ * decimal string.  A packed value is 0.d1 d2 ... dn * 100^exp, a NUMERIC
+ * is D0 D1 ... Dn with D0 weighted 10000^weight, so every base 100 digit
+ * is one half of a base 10000 digit.
+ *
+ * NOTE: also compiled into the server extension (ext/pgisam_record.c)
+ * with PGISAM_EXTENSION defined.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#ifndef PGISAM_EXTENSION
+#include "sys.h"
+#endif // PGISAM_EXTENSION
+#include "numeric.h"
+
+// Read/write the big endian 16 bit words of a NUMERIC
+#define GET16(p)		((unsigned int)(((p)[0] << 8) | (p)[1]))
+#define PUT16(p, v)		((p)[0] = (unsigned char)(((v) >> 8) & 0xFF), \
+						(p)[1] = (unsigned char)((v) & 0xFF))
+
+// Floor division/modulo for (possibly negative) digit weights
+#define FLOORDIV(a, b)	(((a) >= 0) ? (a) / (b) : -((-(a) + (b) - 1) / (b)))
+#define FLOORMOD(a, b)	((a) - FLOORDIV(a, b) * (b))
+
+static const int decpow[4] = { 1, 10, 100, 1000 };
+
+// Static function prototypes
+static int numeric_store (unsigned char * numeric, int ndigits, int weight,
+	unsigned int sign, int dscale, const int * digits);
+
+
+// CODE STARTS HERE
+
+
+/*
+ * numeric_store
+ * Write a NUMERIC, dropping leading and trailing zero digits
+ * Returns the size of the NUMERIC
+ */
+static int numeric_store (unsigned char * numeric, int ndigits, int weight,
+	unsigned int sign, int dscale, const int * digits)
+{
+	int first = 0, x;
+
+	while (first < ndigits && digits[first] == 0) {
+		first++;
+		weight--;
+	}
+
+	while (ndigits > first && digits[ndigits - 1] == 0) {
+		ndigits--;
+	}
+
+	ndigits -= first;
+
+	// Zero has no digits, weight or sign
+	if ((! ndigits) && sign != NUMERIC_NAN) {
+		weight = 0;
+		sign = NUMERIC_POS;
+	}
+
+	PUT16(&numeric[0], ndigits);
+	PUT16(&numeric[2], weight);
+	PUT16(&numeric[4], sign);
+	PUT16(&numeric[6], dscale);
+
+	for (x=0; x < ndigits; x++) {
+		PUT16(&numeric[NUMERIC_HDRSZ + x * 2], digits[first + x]);
+	}
+
+	return NUMERIC_HDRSZ + ndigits * 2;
+
+} /* numeric_store */
+
+
+/*
+ * NUMERIC_size
+ * Size in bytes of a binary NUMERIC
+ * numeric		Binary NUMERIC
+ */
+int NUMERIC_size (const unsigned char * numeric)
+{
+	return NUMERIC_HDRSZ + GET16(numeric) * 2;
+
+} /* NUMERIC_size */
+
+
+/*
+ * NUMERIC_from_packed
+ * Convert a packed decimal into a binary NUMERIC
+ * field		Packed decimal
+ * length		Length of the packed decimal
+ * numeric		Receives the NUMERIC (NUMERIC_PACKEDSZ(length) bytes)
+ */
+int NUMERIC_from_packed (const unsigned char * field, int length,
+	unsigned char * numeric)
+{
+	int digit[NUMERIC_MAXLEN];
+	int base[NUMERIC_MAXLEN / 2 + 2];
+	int exp, ndigits, last = -1, wtop, dscale = 0, x;
+	bool neg;
+
+__STACK(NUMERIC_from_packed)
+
+	if (length < 2 || length > NUMERIC_MAXLEN) {
+		__return -2;
+	}
+
+	// All zero bytes is a null
+	for (x=0; x < length && (! field[x]); x++);
+
+	if (x == length) {
+		__return -1;
+	}
+
+	neg = (field[0] & 0x80) ? false : true;
+	exp = (neg ? (0x7F - field[0]) : (field[0] & 0x7F)) - 64;
+	ndigits = length - 1;
+
+	for (x=0; x < ndigits; x++) {
+		digit[x] = field[x + 1];
+
+		if (digit[x] > 99) {
+			__return -2;
+		}
+
+		if (digit[x]) {
+			last = x;
+		}
+	}
+
+	// Undo the 100's complement of a negative value
+	if (neg) {
+		for (x=0; x <= last; x++) {
+			digit[x] = (x == last) ? 100 - digit[x] : 99 - digit[x];
+		}
+	}
+
+	memset(base, 0, sizeof(base));
+
+	// All digits zero (any sign/exponent) is a zero
+	if (last < 0) {
+		__return numeric_store(numeric, 0, 0, NUMERIC_POS, 0, base);
+	}
+
+	// digit[x] is weighted 100^(exp-1-x); 100^w is one half of 10000^(w/2)
+	wtop = FLOORDIV(exp - 1, 2);
+
+	for (x=0; x <= last; x++) {
+		int w = exp - 1 - x;
+
+		base[wtop - FLOORDIV(w, 2)] += (w & 1) ? digit[x] * 100 : digit[x];
+	}
+
+	// Display scale: decimal places down to the last nonzero digit
+	if (exp - 1 - last < 0) {
+		dscale = -2 * (exp - 1 - last) - ((digit[last] % 10) ? 0 : 1);
+	}
+
+	__return numeric_store(numeric, wtop - FLOORDIV(exp - 1 - last, 2) + 1,
+		wtop, neg ? NUMERIC_NEG : NUMERIC_POS, dscale, base);
+
+} /* NUMERIC_from_packed */
+
+
+/*
+ * NUMERIC_to_packed
+ * Convert a binary NUMERIC into a packed decimal
+ * numeric		Binary NUMERIC
+ * size			Size of the NUMERIC
+ * field		Receives the packed decimal
+ * length		Length of the packed decimal
+ *
+ * NOTE: zero is stored as a positive value (0x80) with zero digits
+ */
+bool NUMERIC_to_packed (const unsigned char * numeric, int size,
+	unsigned char * field, int length)
+{
+	int digit[NUMERIC_MAXLEN + 2];
+	int ndigits, weight, nbase, exp, n = 0, x;
+	unsigned int sign;
+
+__STACK(NUMERIC_to_packed)
+
+	if (length > NUMERIC_MAXLEN) {
+		__return false;
+	}
+
+	memset(field, 0, length);
+
+	if (size < NUMERIC_HDRSZ || GET16(&numeric[4]) == NUMERIC_NAN) {
+		__return true;
+	}
+
+	nbase = GET16(numeric);
+	weight = (short)GET16(&numeric[2]);
+	sign = GET16(&numeric[4]);
+	ndigits = length - 1;
+
+	if (size < NUMERIC_HDRSZ + nbase * 2 || ndigits < 1) {
+		__return false;
+	}
+
+	// Split base 10000 digits into base 100 digits (one extra for rounding)
+	exp = 2 * weight + 2;
+
+	for (x=0; x < nbase && n <= ndigits; x++) {
+		int d = GET16(&numeric[NUMERIC_HDRSZ + x * 2]);
+
+		if (n || d / 100) {
+			digit[n++] = d / 100;
+		} else {
+			exp--;
+		}
+
+		if (n <= ndigits && (n || d % 100)) {
+			digit[n++] = d % 100;
+		} else
+		if (! n) {
+			exp--;
+		}
+	}
+
+	if (! n) {
+		field[0] = 0x80;
+		__return true;
+	}
+
+	// Round half up on the first digit that doesn't fit
+	if (n > ndigits) {
+		bool carry = (digit[ndigits] >= 50) ? true : false;
+
+		n = ndigits;
+
+		for (x = n - 1; x >= 0 && carry; x--) {
+			if (++digit[x] < 100) {
+				carry = false;
+			} else {
+				digit[x] = 0;
+			}
+		}
+
+		// 99.99 > 100.00: one more base 100 digit
+		if (carry) {
+			digit[0] = 1;
+			exp++;
+		}
+	}
+
+	while (n < ndigits) {
+		digit[n++] = 0;
+	}
+
+	if (exp + 64 > 0x7F) {
+		__return false;
+	}
+
+	// Too small to represent: zero
+	if (exp + 64 < 0) {
+		field[0] = 0x80;
+		__return true;
+	}
+
+	if (sign == NUMERIC_NEG) {
+		int last = -1;
+
+		for (x=0; x < ndigits; x++) {
+			if (digit[x]) {
+				last = x;
+			}
+		}
+
+		for (x=0; x <= last; x++) {
+			digit[x] = (x == last) ? 100 - digit[x] : 99 - digit[x];
+		}
+
+		field[0] = (unsigned char)(0x7F - (exp + 64));
+	} else {
+		field[0] = (unsigned char)(0x80 | (exp + 64));
+	}
+
+	for (x=0; x < ndigits; x++) {
+		field[x + 1] = (unsigned char)digit[x];
+	}
+
+	__return true;
+
+} /* NUMERIC_to_packed */
+
+
+/*
+ * NUMERIC_from_str
+ * Parse a decimal string into a binary NUMERIC
+ * str			String ([+-]digits[.digits][e[+-]digits] or NaN)
+ * len			Length of str
+ * numeric		Receives the NUMERIC (NUMERIC_STRSZ(len) bytes)
+ */
+int NUMERIC_from_str (const char * str, int len, unsigned char * numeric)
+{
+	const char *p = str, *end = str + len;
+	int *base;
+	int nsig = 0, nint = 0, nfrac = 0, dexp = 0, dscale, wtop, nbase, size;
+	const char *sig = NULL;
+	bool neg = false, point = false, any = false;
+
+__STACK(NUMERIC_from_str)
+
+	while (p < end && isspace((unsigned char)*p)) p++;
+	while (end > p && (isspace((unsigned char)end[-1]) || (! end[-1]))) end--;
+
+	if (end - p == 3 && (! strncasecmp(p, "NaN", 3))) {
+		__return numeric_store(numeric, 0, 0, NUMERIC_NAN, 0, NULL);
+	}
+
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = (*p == '-') ? true : false;
+		p++;
+	}
+
+	// Significant digits start at the first nonzero digit
+	for (; p < end; p++) {
+		if (*p == '.' && (! point)) {
+			point = true;
+			continue;
+		}
+
+		if (! isdigit((unsigned char)*p)) {
+			break;
+		}
+
+		any = true;
+
+		if (point) {
+			nfrac++;
+		}
+
+		if (sig || *p != '0') {
+			if (! sig) {
+				sig = p;
+			}
+			nsig++;
+
+			if (! point) {
+				nint++;
+			}
+		}
+	}
+
+	if (! any) {
+		__return -1;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		int eneg = 0;
+
+		p++;
+
+		if (p < end && (*p == '-' || *p == '+')) {
+			eneg = (*p == '-');
+			p++;
+		}
+
+		if (p == end || (! isdigit((unsigned char)*p))) {
+			__return -1;
+		}
+
+		for (; p < end && isdigit((unsigned char)*p); p++) {
+			if (dexp < 10000) {
+				dexp = dexp * 10 + (*p - '0');
+			}
+		}
+
+		dexp = eneg ? -dexp : dexp;
+	}
+
+	if (p != end) {
+		__return -1;
+	}
+
+	dscale = nfrac - dexp;
+	dscale = (dscale < 0) ? 0 : (dscale > 0x3FFF) ? 0x3FFF : dscale;
+
+	if (! nsig) {
+		__return numeric_store(numeric, 0, 0, NUMERIC_POS, dscale, NULL);
+	}
+
+	// Value is 0.D1 D2 ... * 10^dpos (leading fractional zeros shift dpos)
+	{
+		int dpos = nint ? nint + dexp : dexp - (nfrac - nsig), k = 0;
+
+		wtop = FLOORDIV(dpos - 1, 4);
+		nbase = wtop - FLOORDIV(dpos - nsig, 4) + 1;
+		base = (int *)xalloc(sizeof(int) * nbase);
+
+		for (p = sig; k < nsig; p++) {
+			int w;
+
+			if (*p == '.') {
+				continue;
+			}
+
+			w = dpos - 1 - k++;
+
+			base[wtop - FLOORDIV(w, 4)] +=
+				(*p - '0') * decpow[FLOORMOD(w, 4)];
+		}
+	}
+
+	size = numeric_store(numeric, nbase, wtop,
+		neg ? NUMERIC_NEG : NUMERIC_POS, dscale, base);
+
+	xfree(base);
+
+	__return size;
+
+} /* NUMERIC_from_str */
+
+
+/*
+ * NUMERIC_strlen
+ * Upper bound of the length of NUMERIC_to_str's result
+ * numeric		Binary NUMERIC
+ */
+int NUMERIC_strlen (const unsigned char * numeric)
+{
+	int weight = (short)GET16(&numeric[2]);
+
+	if (GET16(&numeric[4]) == NUMERIC_NAN) {
+		return 3;
+	}
+
+	// sign + integer digits + point + decimals (written 4 at a time)
+	return 1 + ((weight < 0) ? 1 : (weight + 1) * 4) + 1 + GET16(&numeric[6]) + 3;
+
+} /* NUMERIC_strlen */
+
+
+/*
+ * NUMERIC_to_str
+ * Format a binary NUMERIC as a decimal string
+ * numeric		Binary NUMERIC
+ * buf			Receives the string (NUMERIC_strlen + 1 bytes)
+ */
+char * NUMERIC_to_str (const unsigned char * numeric, char * buf)
+{
+	int ndigits = GET16(numeric);
+	int weight = (short)GET16(&numeric[2]);
+	int dscale = GET16(&numeric[6]);
+	char *p = buf;
+	int d;
+
+__STACK(NUMERIC_to_str)
+
+	if (GET16(&numeric[4]) == NUMERIC_NAN) {
+		__return strcpy(buf, "NaN");
+	}
+
+	if (ndigits && GET16(&numeric[4]) == NUMERIC_NEG) {
+		*p++ = '-';
+	}
+
+	if (weight < 0 || (! ndigits)) {
+		*p++ = '0';
+	} else {
+		for (d=0; d <= weight; d++) {
+			int v = (d < ndigits) ? GET16(&numeric[NUMERIC_HDRSZ + d * 2]) : 0;
+
+			p += sprintf(p, d ? "%04d" : "%d", v);
+		}
+	}
+
+	if (dscale > 0) {
+		char *frac;
+
+		*p++ = '.';
+		frac = p;
+
+		// Base 10000 digits after the point, cut to dscale
+		for (d = weight + 1; p - frac < dscale; d++) {
+			int v = (ndigits && d >= 0 && d < ndigits) ?
+				GET16(&numeric[NUMERIC_HDRSZ + d * 2]) : 0;
+
+			p += sprintf(p, "%04d", v);
+		}
+
+		p = frac + dscale;
+	}
+
+	*p = '\0';
+
+	__return buf;
+
+} /* NUMERIC_to_str */
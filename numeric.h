@@ -0,0 +1,95 @@
+/*
+ * numeric.h: C-ISAM packed decimals <> PostgreSQL binary NUMERIC
+ *
+ * Packed decimal (stdecimal/lddecimal layout, DECLEN bytes):
+ *   byte 0		sign (0x80 = positive) | exponent (base 100, excess 64)
+ *   byte 1..n	base 100 digits, most significant first
+ *   Negative values complement byte 0 and take the 100's complement
+ *   of the digits; a null is all zero bytes.
+ *
+ * Binary NUMERIC (numeric_send/numeric_recv, network byte order):
+ *   int16 ndigits, int16 weight, uint16 sign, uint16 dscale,
+ *   int16 digits[ndigits] (base 10000, most significant first)
+ *
+ * NOTE: include sys.h (or define bool) first.
+ */
+
+#ifndef _NUMERIC_H
+#define _NUMERIC_H
+
+#define NUMERIC_POS		0x0000
+#define NUMERIC_NEG		0x4000
+#define NUMERIC_NAN		0xC000
+
+#define NUMERIC_HDRSZ	8
+
+// Longest packed decimal handled (bytes)
+#define NUMERIC_MAXLEN	32
+
+// Bytes needed for a NUMERIC converted from a packed field of len bytes
+#define NUMERIC_PACKEDSZ(len)	(NUMERIC_HDRSZ + 2 * ((len) / 2 + 2))
+
+// Bytes needed for a NUMERIC converted from a string of len chars
+#define NUMERIC_STRSZ(len)		(NUMERIC_HDRSZ + 2 * ((len) / 4 + 3))
+
+// Type oid of NUMERIC (for binary parameters)
+#define NUMERIC_OID		1700
+
+/*
+ * NUMERIC_size
+ * Size in bytes of a binary NUMERIC
+ * numeric		Binary NUMERIC
+ */
+int NUMERIC_size (const unsigned char *numeric);
+
+/*
+ * NUMERIC_from_packed
+ * Convert a packed decimal into a binary NUMERIC
+ * Returns the size of the NUMERIC, -1 for a null or -2 for bad digits
+ * field		Packed decimal
+ * length		Length of the packed decimal
+ * numeric		Receives the NUMERIC (NUMERIC_PACKEDSZ(length) bytes)
+ */
+int NUMERIC_from_packed (const unsigned char *field, int length,
+	unsigned char *numeric);
+
+/*
+ * NUMERIC_to_packed
+ * Convert a binary NUMERIC into a packed decimal, rounding half up to
+ * the digits available; a size of zero (or NaN) stores a null
+ * Returns false if the value is too large for the field
+ * numeric		Binary NUMERIC
+ * size			Size of the NUMERIC
+ * field		Receives the packed decimal
+ * length		Length of the packed decimal
+ */
+bool NUMERIC_to_packed (const unsigned char *numeric, int size,
+	unsigned char *field, int length);
+
+/*
+ * NUMERIC_from_str
+ * Parse a decimal string ([+-]digits[.digits] or NaN) into a binary NUMERIC
+ * Returns the size of the NUMERIC or -1 if str is not a number
+ * str			String
+ * len			Length of str
+ * numeric		Receives the NUMERIC (NUMERIC_STRSZ(len) bytes)
+ */
+int NUMERIC_from_str (const char *str, int len, unsigned char *numeric);
+
+/*
+ * NUMERIC_strlen
+ * Upper bound of the length of NUMERIC_to_str's result (w/out the null)
+ * numeric		Binary NUMERIC
+ */
+int NUMERIC_strlen (const unsigned char *numeric);
+
+/*
+ * NUMERIC_to_str
+ * Format a binary NUMERIC as a decimal string (like numeric_out)
+ * Returns buf
+ * numeric		Binary NUMERIC
+ * buf			Receives the string (NUMERIC_strlen + 1 bytes)
+ */
+char * NUMERIC_to_str (const unsigned char *numeric, char *buf);
+
+#endif // _NUMERIC_H
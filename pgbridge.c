@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include <libpq-fe.h>
 
@@ -14,10 +16,16 @@
 #include "sys.h"
 #include "pgbridge.h"
 #include "schema.h"
+#include "codec.h"
+#include "schimage.h"
+#include "session.h"
+#include "shard.h"
+#include "writebehind.h"
 #include "xstring.h"
 #include "pgres.h"
 
 #define MAXBUFSZ 1024
+#define PREFETCH_ROWS 64		// Rows read ahead by a sequential ISNEXT
 #define ISAM_TRUE 0
 #define ISAM_FALSE -1
 
@@ -27,25 +35,43 @@ pgisam_opt PGIsamOptions = PGIsamNormal;
 // For compatibility with C-ISAM or other bridge functionality
 bool suppress_error = false;
 bool initialized = false;
-extern char *last_sql;					// in pgres.c
-int iserrno = 0;
+extern __thread char *last_sql;			// in pgres.c
+int iserrno = 0;						// Also kept per session (get_iserrno)
 
-SCHEMA *hSchema = NULL;
-CONTEXT *hContext = NULL;
+SCHEMA *hSchema = NULL;					// Shared by all sessions
+static __thread SCHEMA *call_schema = NULL;	// Schema of the thread's current call
 char *envEDATA = NULL;
 char *envBRIDGE = NULL;
 
-// Static data
-
-/*
- */
-static CONN *conn_default = NULL;		// The conn resource used by reads
-
 
 // Static function prototypes
 static int ISERR (int errcode, bool logmsg);
+static CONTEXT *context_get (int isfd);
+static void call_deadline (SESSION * ss, CONTEXT * cx, SCHEMA * s);
 static char *build_select_stmt (INDEX * i, CONTEXT * cx, char * record, int mode);
 static char *get_mode (int mode);
+static int prefetch_read (CONTEXT * cx, char * record);
+static void prefetch_resync (CONTEXT * cx);
+static long count_records (CONTEXT * cx);
+static char *build_index_stmt (INDEX * i, SCHEMA * s, char * name, bool online);
+static INDEX *index_adopt (CONTEXT * cx, struct keydesc * key);
+static char *keyset_select_stmt (CONTEXT * cx, int mode, bool * prefetch);
+static void read_route (CONTEXT * cx);
+static int read_record (CONTEXT * cx, char * record, int mode);
+static int lock_read (CONTEXT * cx, char * record, int lock);
+static bool shard_route (CONTEXT * cx, char * record);
+static bool bulk_copy (CONTEXT * cx, CONN * conn, char * records, int nrec);
+static char *lookup_select_stmt (CONTEXT * cx, char * record, int mode, int * errcode);
+static int read_result (CONTEXT * cx, RES * res, char * record);
+static void async_receive (SESSION * ss, ASYNC * a);
+static int async_complete (SESSION * ss, ASYNC * a);
+static void async_forget (SESSION * ss, int isfd);
+static bool write_behind (CONTEXT * cx, char * record, char * sql);
+static bool wb_barrier (CONTEXT * cx);
+static RES *write_exec (CONTEXT * cx, char * sql, int * errcode);
+static RES *lock_write (SESSION * ss, CONN * conn, char * sql);
+static bool group_barrier (void);
+static void set_option (char *opt);
 
 
 // CODE STARTS HERE
@@ -77,6 +103,7 @@ __STACK(get_BRIDGE)
  */
 static int ISERR (int errcode, bool logmsg)
 {
+	SESSION *ss = SESSION_current(false);
 	int x = 0;
 	char *description = NULL;
 
@@ -84,6 +111,9 @@ __STACK(ISERR)
 	
 	if (errcode == 1 || errcode == 0) {
 		iserrno = errcode;
+		if (ss) {
+			ss->iserrno = iserrno;
+		}
 		__return errcode;
 	}
 	
@@ -104,6 +134,20 @@ __STACK(ISERR)
 		description = "Unknown";
 	}
 	
+	// The call failed because a statement was cancelled at its deadline
+	if (pg_timed_out() && errcode != 901) {
+		__return ISERR(901, logmsg);
+	}
+	
+	if (errcode == 901 && call_schema) {
+		__sync_fetch_and_add(&call_schema->timeouts, 1);
+		pgout(mDEBUG1, "schema=[%s] timed out", call_schema->name);
+	}
+	
+	if (ss) {
+		ss->iserrno = iserrno;
+	}
+	
 	if (logmsg) {
 		pgout(0, "%s", description);
 	} else {
@@ -115,15 +159,88 @@ __STACK(ISERR)
 } /* ISERR */
 
 
+/*
+ * context_get [X]
+ * Return the context of an isfd opened in the calling thread's session
+ * isfd		File descriptor
+ */
+static CONTEXT * context_get (int isfd)
+{
+	SESSION *ss = SESSION_current(false);
+	
+__STACK(context_get)
+	
+	CONTEXT *cx;
+	
+	// No session, nothing opened
+	if (! ss) {
+		call_deadline(NULL, NULL, NULL);
+		__return (CONTEXT *)NULL;
+	}
+	
+	cx = CONTEXT_get(&ss->context, isfd);
+	call_deadline(ss, cx, NULL);
+	
+	__return cx;
+	
+} /* context_get */
+
+
+/*
+ * call_deadline [X]
+ * Start the time budget of a call (see set_pgisam_timeout)
+ * ss		Calling session (NULL = none)
+ * cx		Context of the call (NULL = none)
+ * s		Schema of the call (NULL = cx's, if any)
+ *
+ * NOTE: the context's budget, else the session's, else the schema's
+ * timeout= directive; 0 there means not set, < 0 none at all
+ */
+static void call_deadline (SESSION * ss, CONTEXT * cx, SCHEMA * s)
+{
+	int ms = 0;
+	
+__STACK(call_deadline)
+	
+	if (! s && cx) {
+		s = cx->schema;
+	}
+	
+	if (cx && cx->timeout) {
+		ms = cx->timeout;
+	} else
+	if (ss && ss->timeout) {
+		ms = ss->timeout;
+	} else
+	if (s) {
+		ms = s->timeout;
+	}
+	
+	call_schema = s;
+	pg_deadline(ms);
+	
+	__return;
+	
+} /* call_deadline */
+
+
 /*
  * init_program [X]
  * Initialize a Postgres connection
+ *
+ * NOTE: loads the schemas shared by every session; call it once, before
+ * other threads use the bridge (they connect sessions of their own)
  */
 bool init_program (void)
 {
 	FILE *fd;
 	char *preload_def = NULL;
+	char *loaded_from = "image";
 	char BUF[MAXBUFSZ];
+	struct timeval start, connected, end;
+	SESSION *ss;
+	SCHEMA *s;
+	int nschemas = 0;
 	
 __STACK(init_program)
 	
@@ -146,45 +263,97 @@ __STACK(init_program)
 		__return false;
 	}	
 	envBRIDGE = getenv("BRIDGE");
+	
+	// Options of the environment (e.g. for a batch job), before connecting
+	if (getenv("PGISAM_OPTIONS")) {
+		pgout(mDEBUG1, "PGISAM_OPTIONS=[%s]", getenv("PGISAM_OPTIONS"));
+		set_pgisam_options(getenv("PGISAM_OPTIONS"));
+	}
+	
+	gettimeofday(&start, NULL);
 
-	// Open the default conn
+	// Open the calling thread's session; the connection is advanced
+	// between schemas as they load (the first statement waits for the rest)
 	pgout(mDEBUG3, "opening default PG conn");	
-	if ((conn_default = CONN_new ()) == (CONN *)NULL) {
-		pgout(0, "failed to create conn_default");
+	if (! (ss = SESSION_current(true))) {
+		pgout(0, "failed to create the default session");
 		__return false;
 	}
 	
+	pg_connect_poll(ss->conn);
+	
+	gettimeofday(&connected, NULL);
+	
 	str_append(&preload_def
 		,"%s/preload.def"
 		,get_BRIDGE()
 		);
 	
-	// Look for and process schemas in preload.def
-	pgout(mDEBUG3, "opening preload.def");
-	fd = fopen(preload_def, "r");
-	
-	if (! fd) {
-		pgout(mSYS, "fopen failed for [%s]", preload_def);
-		__return false;
-	}
-	
-	while (fgets(BUF, MAXBUFSZ, fd) != (char *)NULL) {
-		if (BUF[0] == '#' || BUF[0] == '\n'|| BUF[0] == '\r') continue;
+	// The compiled image of preload.def, when it is current
+	if (! SCHIMAGE_load(&hSchema, preload_def)) {
+		time_t parsed = time(NULL);
+		
+		loaded_from = "definitions";
+		
+		// Look for and process schemas in preload.def
+		pgout(mDEBUG3, "opening preload.def");
+		fd = fopen(preload_def, "r");
 		
-		if (BUF[strlen(BUF)-1] == '\n') {
-			BUF[strlen(BUF)-1] = '\0';
-			if (BUF[strlen(BUF)-1] == '\r') {
+		if (! fd) {
+			pgout(mSYS, "fopen failed for [%s]", preload_def);
+			str_free(&preload_def);
+			__return false;
+		}
+		
+		while (fgets(BUF, MAXBUFSZ, fd) != (char *)NULL) {
+			if (BUF[0] == '#' || BUF[0] == '\n'|| BUF[0] == '\r') continue;
+			
+			if (BUF[strlen(BUF)-1] == '\n') {
 				BUF[strlen(BUF)-1] = '\0';
+				if (BUF[strlen(BUF)-1] == '\r') {
+					BUF[strlen(BUF)-1] = '\0';
+				}
 			}
+			
+			pgout(mDEBUG2, "preloading %s definition", BUF);
+				
+			// Add the schema definition
+			SCHEMA_push(&hSchema, BUF);
+			
+			pg_connect_poll(ss->conn);
 		}
-		
-		pgout(mDEBUG2, "preloading %s definition", BUF);
 			
-		// Add the schema definition
-		SCHEMA_push(&hSchema, BUF);
-	}
+		fclose(fd);
 		
-	fclose(fd);
+		// Let the next process map it instead
+		SCHIMAGE_save(hSchema, preload_def, parsed);
+	}
+	
+	str_free(&preload_def);
+	
+	pg_connect_poll(ss->conn);
+	
+	// The image may have been saved without qualified names
+	if (PGIsamOptions & Stateless) {
+		SCHEMA_qualify(hSchema);
+	}
+	
+	for (s = hSchema; s; s = s->next) {
+		nschemas++;
+	}
+	
+	gettimeofday(&end, NULL);
+	
+	pgout(mDEBUG1, "startup: connect %s %.3f ms, "
+		"loaded %d schemas from %s in %.3f ms"
+		,(PGIsamOptions & LazyConnect) ? "(lazy)" : "started in"
+		,(connected.tv_sec - start.tv_sec) * 1000.0 +
+			(connected.tv_usec - start.tv_usec) / 1000.0
+		,nschemas
+		,loaded_from
+		,(end.tv_sec - connected.tv_sec) * 1000.0 +
+			(end.tv_usec - connected.tv_usec) / 1000.0
+		);
 	
 	__return initialized = true;
 	
@@ -196,23 +365,116 @@ __STACK(init_program)
  * 
  * Options (separate with comma):
  * printonly	Do not execute SQL; print to stdout
+ * lazyconnect	Connect on the first SQL statement, not in init_program
+ * exactcount	isindexinfo counts the records instead of estimating
+ * readers=N	Files opened ISINPUT share N connections of their own
+ *			(to the standbys in conn.def, if any; see README.md)
+ * standbylag=N	Read from the primary for N seconds after a write
+ *			(default 5)
+ * stateless	No session state on the server (see README.md; set before
+ *			init_program)
+ * writebehind=N	Files marked writebehind in their .def are written
+ *			outside transactions by N worker threads (see README.md)
+ * groupcommit=N	Writes outside transactions are committed N at a time
+ *			(a .def's groupcommit=N overrides it; see README.md)
+ * groupwait=N	A group of writes is committed after N ms at most
+ *			(default 1000; 0 = no limit)
+ * asynccommit	Commits don't wait for the server to flush them to disk
+ *			(a crash may lose the last moments' commits; see README.md)
+ * set:name=value	Server setting of every connection (e.g. set:work_mem=64MB)
+ *
+ * The PGISAM_OPTIONS environment variable holds more, applied by
+ * init_program (after those set by the program).  Server settings
+ * (asynccommit, set:) must be set before init_program.
  */
 void set_pgisam_options (char *optstr)
 {
-	if (!strcmp(optstr, "printonly")) {
-		PGIsamOptions = PGIsamOptions ^ PrintOnly;
+	char *opts = str_dup(optstr);
+	char *opt, *next;
+	
+	for (opt = opts; opt; opt = next) {
+		if ((next = strchr(opt, ',')) != (char *)NULL) {
+			*next++ = '\0';
+		}
+		
+		while (*opt == ' ') {
+			opt++;
+		}
+		
+		if (*opt) {
+			set_option(opt);
+		}
 	}
 	
+	str_free(&opts);
 	
 } /* set_pgisam_options */
 
 
+/*
+ * set_option
+ * Set one of the options of set_pgisam_options
+ * opt		Option
+ */
+static void set_option (char *opt)
+{
+	pgout(mDEBUG2, "option [%s]", opt);
+	
+	if (!strcmp(opt, "printonly")) {
+		PGIsamOptions = PGIsamOptions ^ PrintOnly;
+	}
+	
+	if (!strcmp(opt, "lazyconnect")) {
+		PGIsamOptions = PGIsamOptions | LazyConnect;
+	}
+	
+	if (!strcmp(opt, "exactcount")) {
+		PGIsamOptions = PGIsamOptions | ExactCount;
+	}
+	
+	if (!strcmp(opt, "stateless")) {
+		PGIsamOptions = PGIsamOptions | Stateless;
+	}
+	
+	if (!strncmp(opt, "readers=", 8)) {
+		SESSION_set_readers(atoi(&opt[8]));
+	}
+	
+	if (!strncmp(opt, "standbylag=", 11)) {
+		SESSION_set_standby_lag(atoi(&opt[11]));
+	}
+	
+	if (!strncmp(opt, "writebehind=", 12)) {
+		WB_set_workers(atoi(&opt[12]));
+	}
+	
+	if (!strncmp(opt, "groupcommit=", 12)) {
+		SESSION_set_group_size(atoi(&opt[12]));
+	}
+	
+	if (!strncmp(opt, "groupwait=", 10)) {
+		SESSION_set_group_wait(atoi(&opt[10]));
+	}
+	
+	if (!strcmp(opt, "asynccommit")) {
+		CONN_set_setting("synchronous_commit=off");
+	}
+	
+	if (!strncmp(opt, "set:", 4)) {
+		CONN_set_setting(&opt[4]);
+	}
+	
+} /* set_option */
+
+
 /*
  * shutdown_program [X]
  * Shutdown a Postgres connection
  */
 bool shutdown_program (void)
 {
+	SESSION *ss = SESSION_current(false);
+	
 __STACK(shutdown_program)
 
 	if (! initialized) {
@@ -222,14 +484,17 @@ __STACK(shutdown_program)
 	
 	pgout(mDTSTAMP|mDEBUG1, "shutting down");
 	
-	// Delete all open contexts	
-	CONTEXT_delete(&hContext);
+	log_pgisam_stats();
+	
+	// Delete the calling thread's session (its contexts and connection)
+	SESSION_delete(&ss);
 	
-	// Delete the connection object
-	CONN_delete(conn_default);
+	// Stop the write-behind workers once what is queued is made
+	WB_shutdown();
 	
-	// Delete the global schema
+	// Delete the global schema (and unmap the image it may point into)
 	SCHEMA_delete(&hSchema);
+	SCHIMAGE_unload();
 	
 	// Delete stack local to schema module
 	SCHEMA_shutdown();
@@ -255,19 +520,230 @@ __STACK(get_last_sql)
 } /* get_last_sql */
 
 
+/*
+ * get_iserrno
+ * Get the iserrno of the calling thread's last call
+ * (in pgbridge.c)
+ */
+int get_iserrno (void)
+{
+	SESSION *ss = SESSION_current(false);
+	
+__STACK(get_iserrno)
+
+	__return ss ? ss->iserrno : iserrno;
+	
+} /* get_iserrno */
+
+
+/*
+ * set_pgisam_timeout
+ * Set the time budget of the calls on a file, or of the calling session
+ * isfd		File descriptor (0 = every file of the session without one)
+ * ms		Milliseconds (0 = not set, the next level's; < 0 = none)
+ * (in pgbridge.c)
+ */
+int set_pgisam_timeout (int isfd, int ms)
+{
+	SESSION *ss = SESSION_current(isfd == 0);
+	CONTEXT *cx;
+	
+__STACK(set_pgisam_timeout)
+	
+	if (isfd == 0) {
+		if (! ss) {
+			__return ISERR(902, true); // 902 = no database connection
+		}
+		ss->timeout = ms;
+		__return ISAM_TRUE;
+	}
+	
+	if ((cx = context_get(isfd)) == (CONTEXT *)NULL) {
+		__return ISERR(101, true); // 101 = file not open
+	}
+	
+	cx->timeout = ms;
+	
+	__return ISAM_TRUE;
+	
+} /* set_pgisam_timeout */
+
+
+/*
+ * set_pgisam_write_callback
+ * Set the function told of a write behind that failed
+ * (in pgbridge.c)
+ */
+void set_pgisam_write_callback (pgWriteCallback callback)
+{
+__STACK(set_pgisam_write_callback)
+	
+	WB_set_callback(callback);
+	
+	__return;
+	
+} /* set_pgisam_write_callback */
+
+
+/*
+ * log_pgisam_stats
+ * Log the bridge's statistics (calls that timed out, by schema)
+ * (in pgbridge.c)
+ */
+void log_pgisam_stats (void)
+{
+	SCHEMA *s;
+	
+__STACK(log_pgisam_stats)
+	
+	for (s = hSchema; s; s = s->next) {
+		if (s->timeouts) {
+			pgout(0, "schema=[%s] timeouts=%lu", s->name, s->timeouts);
+		}
+	}
+	
+	__return;
+	
+} /* log_pgisam_stats */
+
+
+/*
+ * session_open
+ * Create a session (connected) for session_use
+ * (in pgbridge.c)
+ */
+pgisam_session * session_open (void)
+{
+__STACK(session_open)
+
+	__return SESSION_new();
+	
+} /* session_open */
+
+
+/*
+ * session_use
+ * Make a session the calling thread's session
+ * (in pgbridge.c)
+ */
+void session_use (pgisam_session * session)
+{
+__STACK(session_use)
+
+	SESSION_use(session);
+	
+	__return;
+	
+} /* session_use */
+
+
+/*
+ * session_close
+ * Close a session's files and connection
+ * (in pgbridge.c)
+ */
+void session_close (pgisam_session * session)
+{
+__STACK(session_close)
+
+	SESSION_delete(&session);
+	
+	__return;
+	
+} /* session_close */
+
+
 /*
  * x_isaddindex [X]
  * Add an index to a C-ISAM file
  * isfd		file desccriptor returned by isopen or isbuild
  * key		pointer to a key description struct
  * 
- * NOTE: indexes used to be added in isbuild
+ * NOTE: the index is built CONCURRENTLY (without blocking writers)
+ * unless a transaction is open, where that is not allowed; other
+ * processes find it by its name when they use the key (see index_adopt)
  */
 int x_isaddindex (int isfd, struct keydesc * key)
 {
+	SESSION *ss = SESSION_current(false);
+	CONTEXT *cx;
+	CONN *conn;
+	INDEX *i;
+	RES *res;
+	char *sql = NULL;
+	bool online;
+	int shard, nshards;
+	
 __STACK(x_isaddindex)
 
-	pgout(mDEBUG3, "x_isaddindex (does nothing)");
+	cx = context_get(isfd);
+	
+	if (! cx) {
+		__return ISERR(101, true); // 101 = file not open
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
+	
+	if (SCHEMA_index_keydesc(cx->schema, key) || index_adopt(cx, key)) {
+		__return ISERR(108, true); // 108 = key already exists
+	}
+	
+	if ((i = SCHEMA_index_add(cx->schema, key)) == (INDEX *)NULL) {
+		__return ISERR(103, true); // 103 = illegal key desc
+	}
+	
+	pgout(mDEBUG1, "adding index [%s] to [%s]", i->name, cx->schema->name);
+	
+	if (cx->schema->nocreate) {
+		__return ISAM_TRUE;
+	}
+	
+	online = cx->conn->in_transaction ? false : true;
+	sql = build_index_stmt(i, cx->schema, i->name, online);
+	
+	// Sharded: the index is built on every shard
+	nshards = SHARD_count(cx->schema) ? SHARD_count(cx->schema) : 1;
+	
+	for (shard=0; shard < nshards; shard++) {
+		conn = (nshards > 1) ? SESSION_shard_conn(ss, shard) : cx->conn;
+		
+		if ((res = conn ? pg_exec(conn, sql) : (RES *)NULL) == (RES *)NULL) {
+			break;
+		}
+		
+		RES_delete(&res);
+	}
+	
+	str_free(&sql);
+	
+	if (shard < nshards) {
+		char *table = strrchr(cx->schema->pgname, '.');
+		
+		// A failed concurrent build leaves an invalid index behind
+		// (and the shards before it a valid one)
+		str_append(&sql,
+			"DROP INDEX CONCURRENTLY IF EXISTS %.*s%s"
+			,table ? (int)(table - cx->schema->pgname) + 1 : 0
+			,cx->schema->pgname
+			,i->name
+			);
+		
+		for (; online && shard >= 0; shard--) {
+			conn = (nshards > 1) ? SESSION_shard_conn(ss, shard) : cx->conn;
+			
+			if (conn) {
+				res = pg_exec(conn, sql);
+				RES_delete(&res);
+			}
+		}
+		
+		str_free(&sql);
+		SCHEMA_index_remove(cx->schema, i);
+		__return ISERR(-1, false);
+	}
 	
 	__return ISAM_TRUE;
 	
@@ -280,15 +756,37 @@ __STACK(x_isaddindex)
  */
 int x_isbegin (void)
 {
+	SESSION *ss = SESSION_current(true);
 	int ret;
+	CONTEXT *cx;
 	
 __STACK(x_isbegin)
 	
+	call_deadline(ss, NULL, NULL);
+	
+	if (! ss) {
+		__return ISERR(902, true); // 902 = no database connection
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
+	
 	pgout(mDEBUG3, "transaction started");
 	
-	ret = CONN_begin(conn_default);
+	// Writes queued behind land before it (their errors wait for
+	// the next call on their file)
+	for (cx = ss->context; cx; cx = cx->next) {
+		WB_flush(cx->wb);
+	}
+	
+	// Row locks held already are the transaction's from now on
+	ret = (ss->locking && ss->conn->in_transaction) ? true : CONN_begin(ss->conn);
 	
-	conn_default->in_transaction = true;
+	ss->conn->in_transaction = true;
+	ss->locking = false;
+	ss->lock_wrote = false;
 	
 	if (ret < 0) {
 		__return ISERR(122, true); // 122 = no transaction
@@ -311,6 +809,8 @@ __STACK(x_isbegin)
  */
 int x_isbuild (char *filename, int reclen, struct keydesc *key, int mode)
 {
+	SESSION *ss = SESSION_current(true);
+	CONTEXT *cx;
 	char *sql = NULL;
 	char *basename;
 	SCHEMA *s;
@@ -319,11 +819,23 @@ int x_isbuild (char *filename, int reclen, struct keydesc *key, int mode)
 	INDEX *i;
 	RES *res = NULL;
 	char *rptmp = NULL;
+	int shard, nshards;
 	
 __STACK(x_isbuild)
 	
+	call_deadline(ss, NULL, NULL);
+	
 	pgout(mDEBUG3, "filename=[%s] reclen=[%d] mode=%d",
 		filename, reclen, mode);
+	
+	if (! ss) {
+		__return ISERR(902, true); // 902 = no database connection
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
 
 	basename = strrchr(filename, '/');
 	
@@ -332,17 +844,19 @@ __STACK(x_isbuild)
 	
 	// Get a new pointer in case it existed already
 	s = SCHEMA_get(hSchema, basename ? basename : filename);
+	call_deadline(ss, NULL, s);
 	
 	// Associate the context with a schema
-	// and push it on to the stack
-	CONTEXT_push(&hContext, s);
+	// and push it on to the session's stack
+	CONTEXT_push(&ss->context, s);
+	cx = ss->context;
 	
 	// Associate the context with a CONN
-	hContext->conn = conn_default;
+	cx->conn = ss->conn;
 	
 	// Don't actually build the table if "nocreate" is set in the schema
 	if (s->nocreate) {
-		__return hContext->isfd;
+		__return cx->isfd;
 	}
 	
 	if (! strcmp(s->name, "rptmp")) {
@@ -414,82 +928,68 @@ __STACK(x_isbuild)
 		") WITHOUT OIDS"
 		);
 	
-	res = pg_exec(hContext->conn, sql);
+	// Sharded: the table is built on every shard
+	nshards = SHARD_count(s) ? SHARD_count(s) : 1;
 	
-	str_free(&sql);
-	
-	if (! res) {
-		__return ISERR(101, true); // 101 = file not open
-	}
-
-	RES_delete(&res);
-	
-	// Iterate through and exec the table's modifiers
-	m = s->modify;
-	while (m) {
-
-		res = pg_exec(hContext->conn, m->definition);
+	for (shard=0; shard < nshards; shard++) {
+		CONN *conn = SESSION_shard_conn(ss, shard);
+		
+		res = conn ? pg_exec(conn, sql) : (RES *)NULL;
 		
 		if (! res) {
+			str_free(&sql);
+			str_free(&rptmp);
 			__return ISERR(101, true); // 101 = file not open
 		}
-		
+
 		RES_delete(&res);
 		
-		m = m->next;
-	}
-	
-	// Build the indexes
-	// Retrieve the index by keydesc (primary key)
-	i = s->index;
-	while (i) {
-		char *sql_index = NULL;
-		
-		str_append(&sql_index,
-			"CREATE %sINDEX %s ON %s ( "
-			,i->is_unique ? "UNIQUE " : ""
-			,rptmp ? rptmp : i->name
-			,s->pgname
-			);
+		// Iterate through and exec the table's modifiers
+		m = s->modify;
+		while (m) {
 
-		// Iterate through the column names in index
-		c = i->column;
-		while (c) {
-			str_append(&sql_index,
-				"%s,"
-				,c->name
-				);
-					
-			c = c->next;
-		}
-		
-		// Strip off trailing comma
-		if (sql_index[strlen(sql_index)-1] == ',') {
-			sql_index[strlen(sql_index)-1] = '\0';
+			res = pg_exec(conn, m->definition);
+			
+			if (! res) {
+				str_free(&sql);
+				str_free(&rptmp);
+				__return ISERR(101, true); // 101 = file not open
+			}
+			
+			RES_delete(&res);
+			
+			m = m->next;
 		}
 		
-		str_append(&sql_index, " )");
-		
-		res = NULL;
-		res = pg_exec(hContext->conn, sql_index);
-		
-		if (! res) {
+		// Build the indexes
+		// Retrieve the index by keydesc (primary key)
+		i = s->index;
+		while (i) {
+			char *sql_index = build_index_stmt(i, s, rptmp ? rptmp : i->name, false);
+			
+			res = NULL;
+			res = pg_exec(conn, sql_index);
+			
+			if (! res) {
+				str_free(&sql_index);
+				str_free(&sql);
+				str_free(&rptmp);
+				__return ISERR(101, true); // 101 = file not open
+			}
+			
+			RES_delete(&res);
+
 			str_free(&sql_index);
-			str_free(&rptmp);
-			__return ISERR(101, true); // 101 = file not open
+			
+			i = i->next;
 		}
-		
-		RES_delete(&res);
-
-		str_free(&sql_index);
-		
-		i = i->next;
 	}
 	
+	str_free(&sql);
 	str_free(&rptmp);
 	
 	// Return the context's file descriptor
-	__return hContext->isfd;
+	__return cx->isfd;
 	
 } /* x_isbuild */
 
@@ -500,12 +1000,27 @@ __STACK(x_isbuild)
  */
 int x_iscleanup (void)
 {
+	SESSION *ss = SESSION_current(false);
+	CONTEXT *cx;
+	
 __STACK(x_iscleanup)
+	
+	call_deadline(ss, NULL, NULL);
 
 	pgout(mDEBUG3, "deleting all contexts");
 	
-	// Close all contexts
-	CONTEXT_delete(&hContext);
+	// Close all contexts of the session (writes grouped are committed)
+	if (ss) {
+		SESSION_group_end(ss);
+		SESSION_lock_end(ss, true);
+		async_forget(ss, 0);
+		
+		for (cx = ss->context; cx; cx = cx->next) {
+			SESSION_context_end(cx, false);
+		}
+		
+		CONTEXT_delete(&ss->context);
+	}
 	
 	__return ISAM_TRUE;
 	
@@ -522,21 +1037,31 @@ __STACK(x_iscleanup)
 int x_isclose (int isfd)
 {
 	CONTEXT *cx;
+	int ret;
 
 __STACK(x_isclose)
 	
 	// Find the context
-	cx = CONTEXT_get(hContext, isfd);
+	cx = context_get(isfd);
 	
-	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
-
 	if (! cx) {
 		__return ISERR(101, true); // 101 = file not open
 	}
 	
-	CONTEXT_delete_node(&hContext, cx);
+	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	
+	// Closed all the same
+	ret = wb_barrier(cx) ? ISAM_TRUE : ISERR(903, true); // 903 = deferred write failed
 	
-	__return ISAM_TRUE;
+	if (! group_barrier()) {
+		ret = ISERR(904, true); // 904 = grouped write failed
+	}
+	
+	async_forget(SESSION_current(false), isfd);
+	SESSION_context_end(cx, true);
+	CONTEXT_delete_node(cx->list, cx);
+	
+	__return ret;
 	
 } /* x_isclose */
 
@@ -547,16 +1072,37 @@ __STACK(x_isclose)
  */
 int x_iscommit (void)
 {
+	SESSION *ss = SESSION_current(false);
 	int ret;
-	CONTEXT *cx = hContext;
+	CONTEXT *cx;
 
 __STACK(x_iscommit)
+	
+	call_deadline(ss, NULL, NULL);
 
 	pgout(mDEBUG3, "committing transaction");
+	
+	if (! ss) {
+		__return ISERR(122, true); // 122 = no transaction
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
 
-	ret = CONN_commit(conn_default);
+	ret = CONN_commit(ss->conn);
+	
+	ss->conn->in_transaction = false;
+	ss->locking = false;
+	ss->lock_wrote = false;
 	
-	conn_default->in_transaction = false;
+	// Shards the transaction wrote to (see SESSION_shard_conn)
+	if (! SESSION_shard_end(ss, ret >= 0)) {
+		ret = err;
+	}
+	
+	cx = ss->context;
 	
 	/*
 	 * Here we iterate through all of the contexts.
@@ -571,6 +1117,8 @@ __STACK(x_iscommit)
 		
 			// Indicates that the cursor is "closed"
 			str_free(&cx->cursor_name);
+			CONTEXT_prefetch_clear(cx);
+			MERGE_delete(&cx->merge, false);
 			cx->trans_cursor = false;
 		}
 	
@@ -580,6 +1128,7 @@ __STACK(x_iscommit)
 	if (ret < 0) {
 		__return ISERR(122, true); // 122 = no transaction
 	} else {
+		SESSION_wrote();
 		__return ISAM_TRUE;
 	}
 		
@@ -598,23 +1147,42 @@ int x_isdelcurr (int isfd)
 	char *sql = NULL;
 	char *oid = NULL;
 	bool ret = ISAM_TRUE;
+	int errcode;
 	
 __STACK(x_isdelcurr)
 		
 	// Obtain the context by file descriptor
-	cx = CONTEXT_get(hContext, isfd);
-	
-	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	cx = context_get(isfd);
 	
 	// Success?
 	if (! cx) {
 		__return ISERR(101, true); // 101 = file not open
 	}
 	
+	// Writes queued behind come first (see write_behind)
+	if (! wb_barrier(cx)) {
+		__return ISERR(903, true); // 903 = deferred write failed
+	}
+	
+	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	
+	// Positioned by key: the current record is the last one read
+	if (cx->keyset) {
+		if (! cx->in_read || ! cx->oid_last) {
+			__return ISERR(112, true); // 112 = no current record
+		}
+		
+		oid = str_dup(cx->oid_last);
+		goto delete;
+	}
+	
 	// Must be incursor
 	if (! cx->cursor_name) {
 		__return ISERR(112, true); // 112 = no current record
 	}
+	
+	// The cursor may be ahead of the current record
+	prefetch_resync(cx);
 
 	// Exec the SQL statement prepared by isstart
 	// Why? Because it will contain the current state of
@@ -640,20 +1208,26 @@ __STACK(x_isdelcurr)
 		__return ISERR(111, true); // 111 = no record found
 	}
 	
+delete:
 	// Create the delete statement	
 	str_append(&sql,
 		"DELETE FROM %s WHERE oid='%s'"
 		, cx->schema->pgname
 		, oid
 		);
+	str_free(&oid);
 
-	res = pg_exec(cx->conn, sql);
+	res = write_exec(cx, sql, &errcode);
 	str_free(&sql);
 		
+	if (! res && errcode) {
+		ret = ISERR(errcode, true);
+	} else
 	if (! res) {
 		ret = ISERR(111, false); // 111 = no record found
 	} else {
 		RES_delete(&res);
+		SESSION_wrote();
 	}
 	
 	__return ret;
@@ -675,22 +1249,33 @@ int x_isdelete (int isfd, char * record)
 	char *sql = NULL;
 	char *sql_where = NULL;
 	bool first_clause = true;
+	int errcode;
 	
 __STACK(x_isdelete)
 	
 	// Obtain the context by file descriptor
-	cx = CONTEXT_get(hContext, isfd);
-	
-	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	cx = context_get(isfd);
 	
 	// Success?
 	if (! cx) {
 		__return ISERR(101, true); // 101 = file not open
 	}
 	
-	COLUMN_from_record(cx->schema->column, record);
+	// Writes queued behind come first (see write_behind)
+	if (! wb_barrier(cx)) {
+		__return ISERR(903, true); // 903 = deferred write failed
+	}
+	
+	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	
+	// Sharded: the record's shard
+	if (! shard_route(cx, record)) {
+		__return ISERR(902, true); // 902 = no database connection
+	}
+	
+	SCHEMA_from_record(cx, record);
 	
-	c = cx->schema->column;
+	c = CONTEXT_columns(cx)->column;
 	
 	while (c) {
 			
@@ -720,17 +1305,21 @@ __STACK(x_isdelete)
 		, sql_where
 		);
 
-	res = pg_exec(cx->conn, sql);
+	res = write_exec(cx, sql, &errcode);
 	str_free(&sql);
 	str_free(&sql_where);
 	
 	// Clean the COLUMN
-	COLUMN_clean(cx->schema->column);
+	COLUMN_clean(CONTEXT_columns(cx)->column);
 			
+	if (! res && errcode) {
+		__return ISERR(errcode, true);
+	} else
 	if (! res) {
 		__return ISERR(111, false); // 111 = no record found
 	} else {
 		RES_delete(&res);
+		SESSION_wrote();
 	}
 	
 	__return ISAM_TRUE;
@@ -739,19 +1328,79 @@ __STACK(x_isdelete)
 
 
 /*
- * x_isdelindex
+ * x_isdelindex [X]
  * Removes an entire index
  * isfd		file descriptor
  * keydesc	ptr to a key description struct
  * 
- * NOTE: not required so it's ignored
+ * NOTE: dropped CONCURRENTLY unless a transaction is open (see x_isaddindex)
  */
 int x_isdelindex (int isfd, struct keydesc * keydesc)
 {
+	SESSION *ss = SESSION_current(false);
+	CONTEXT *cx;
+	INDEX *i;
+	RES *res;
+	char *sql = NULL;
+	int shard, nshards;
+	
 __STACK(x_isdelindex)
 
 	pgout(mDEBUG3, "isfd=%d", isfd);
-
+	
+	cx = context_get(isfd);
+	
+	if (! cx) {
+		__return ISERR(101, true); // 101 = file not open
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
+	
+	if ((i = SCHEMA_index_keydesc(cx->schema, keydesc)) == (INDEX *)NULL &&
+		(i = index_adopt(cx, keydesc)) == (INDEX *)NULL) {
+		__return ISERR(103, true); // 103 = illegal key desc
+	}
+	
+	if (i->num == 1) {
+		__return ISERR(109, true); // 109 = is primary key
+	}
+	
+	pgout(mDEBUG1, "removing index [%s] from [%s]", i->name, cx->schema->name);
+	
+	if (! cx->schema->nocreate) {
+		char *table = strrchr(cx->schema->pgname, '.');
+		
+		// The index is in the table's schema
+		str_append(&sql,
+			"DROP INDEX %sIF EXISTS %.*s%s"
+			,cx->conn->in_transaction ? "" : "CONCURRENTLY "
+			,table ? (int)(table - cx->schema->pgname) + 1 : 0
+			,cx->schema->pgname
+			,i->name
+			);
+		
+		// Sharded: from every shard
+		nshards = SHARD_count(cx->schema) ? SHARD_count(cx->schema) : 1;
+		
+		for (shard=0; shard < nshards; shard++) {
+			CONN *conn = (nshards > 1) ? SESSION_shard_conn(ss, shard) : cx->conn;
+			
+			if ((res = conn ? pg_exec(conn, sql) : (RES *)NULL) == (RES *)NULL) {
+				str_free(&sql);
+				__return ISERR(-1, false);
+			}
+			
+			RES_delete(&res);
+		}
+		
+		str_free(&sql);
+	}
+	
+	SCHEMA_index_remove(cx->schema, i);
+	
 	__return ISAM_TRUE;
 	
 } /* x_isdelindex */
@@ -781,20 +1430,34 @@ __STACK(x_isdelrec)
  */
 int x_iserase (char * filename)
 {
+	SESSION *ss = SESSION_current(true);
 	char *sql = NULL;
 	char *basename;
 	RES *res = NULL;
 	SCHEMA *s = NULL;
 	int ret;
+	int shard, nshards;
 	
 __STACK(x_iserase)
+	
+	call_deadline(ss, NULL, NULL);
 
 	pgout(mDEBUG3, "filename=[%s]", filename);
+	
+	if (! ss) {
+		__return ISERR(902, true); // 902 = no database connection
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
 
 	basename = strrchr(filename, '/');
 	
 	// Attempt to add the schema definition
 	s = SCHEMA_get(hSchema, basename ? (++basename) : filename);
+	call_deadline(ss, NULL, s);
 	
 	if (! s) {
 		__return ISERR(900, true); // 900 = no schema definition
@@ -817,34 +1480,99 @@ __STACK(x_iserase)
 		);
 	
 	// Since we are not associated w/a context here,
-	// act on the default conn
-	res = pg_exec(conn_default, sql);
-	str_free(&sql);
+	// act on the session's conn (and a sharded table's other shards)
+	nshards = SHARD_count(s) ? SHARD_count(s) : 1;
 	
-	if (! res) {
-		__return ISERR(-1, false);
-	} else {
-		RES_delete(&res);
+	for (shard=0; shard < nshards; shard++) {
+		CONN *conn = SESSION_shard_conn(ss, shard);
+		
+		res = conn ? pg_exec(conn, sql) : (RES *)NULL;
+		
+		if (! res) {
+			str_free(&sql);
+			__return ISERR(-1, false);
+		} else {
+			RES_delete(&res);
+		}
 	}
 	
+	str_free(&sql);
+	
 	__return ISAM_TRUE;
 	
 } /* x_iserase */
 
 
 /*
- * x_isindexinfo
+ * x_isindexinfo [X]
  * Determines information about the structure and indexes of a C-ISAM file
  * isfd		file descriptor
  * buffer	ptr to a struct (keydesc | dictinfo)
  * number	an index number or zero
+ *
+ * NOTE: the record count is the planner's estimate (pg_class.reltuples)
+ * unless the "exactcount" option is set or the table was never analyzed
  */
 int x_isindexinfo (int isfd, struct keydesc * buffer, int number)
 {
+	CONTEXT *cx;
+	INDEX *i;
+	struct dictinfo *di;
+	struct keydesc key;
+	long nrecords;
+	
 __STACK(x_isindexinfo)
 
-	pgout(mDEBUG3, "isfd=%d", isfd);
-
+	pgout(mDEBUG3, "isfd=%d, number=%d", isfd, number);
+	
+	cx = context_get(isfd);
+	
+	if (! cx) {
+		__return ISERR(101, true); // 101 = file not open
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
+	
+	if (number > 0) {
+		i = INDEX_get(cx->schema->index, number);
+		
+		if (! i) {
+			__return ISERR(102, true); // 102 = illegal argument
+		}
+		
+		if (! INDEX_keydesc(i, buffer)) {
+			__return ISERR(103, true); // 103 = illegal key desc
+		}
+		
+		__return ISAM_TRUE;
+	}
+	
+	if (number < 0) {
+		__return ISERR(102, true); // 102 = illegal argument
+	}
+	
+	if ((nrecords = count_records(cx)) < 0) {
+		__return ISERR(-1, false);
+	}
+	
+	di = (struct dictinfo *)buffer;
+	memset(di, 0, sizeof(struct dictinfo));
+	
+	di->di_recsize = cx->schema->reclen;
+	di->di_nrecords = nrecords;
+	
+	// No index nodes here: report the longest key instead
+	for (i = cx->schema->index; i; i = i->next) {
+		di->di_nkeys++;
+		
+		if (INDEX_keydesc(i, &key) && key.k_len > di->di_idxsize) {
+			di->di_idxsize = key.k_len;
+		}
+	}
+	
 	__return ISAM_TRUE;
 	
 } /* x_isindexinfo */
@@ -898,14 +1626,21 @@ __STACK(x_islogopen)
  */
 int x_isopen (char * filename, int mode)
 {
+	SESSION *ss = SESSION_current(true);
 	char *basename;
 	SCHEMA *s = NULL;
 	
 __STACK(x_isopen)
 	
+	call_deadline(ss, NULL, NULL);
+	
 	pgout(mDEBUG3, "filename=[%s] mode=[%d]",
 		filename, mode);
 	
+	if (! ss) {
+		__return ISERR(902, true); // 902 = no database connection
+	}
+	
 	basename = strrchr(filename, '/');
 	
 	// Find the schema matching filename
@@ -916,12 +1651,17 @@ __STACK(x_isopen)
 	}
 	
 	// Create a new context and associate it with the schema
-	CONTEXT_push(&hContext, s);
+	CONTEXT_push(&ss->context, s);
 	
 	// Associate the context with the appropriate connection
-	hContext->conn = conn_default;
+	// (sharded schemas are on the session's shard connections)
+	ss->context->conn = SHARD_count(s) ? ss->conn : SESSION_conn(ss, mode);
 	
-	__return hContext->isfd;
+	if (ss->context->conn != ss->conn) {
+		ss->context->reader = ss->context->conn;
+	}
+	
+	__return ss->context->isfd;
 	
 } /* x_isopen */
 
@@ -932,204 +1672,68 @@ __STACK(x_isopen)
  * isfd		file descriptor
  * record	pointer to string containing the search val, and receives the record
  * mode		mode
+ *
+ * NOTE: with ISLOCK, ISLCKW/ISWAIT or ISSKIPLOCK the record read is
+ * locked (see lock_read)
  */
 int x_isread (int isfd, char * record, int mode)
 {
 	CONTEXT *cx;
-	RES *res;
-	char *sql = NULL;
-	char *direction = NULL;
+	int lock, errcode, ret;
 	
 __STACK(x_isread)
 	
 	// Find the context
-	cx = CONTEXT_get(hContext, isfd);
+	cx = context_get(isfd);
 
-	pgout(mDEBUG3, "schema=[%s] mode=[%s]",
-		cx->schema->name, get_mode(mode));
-			
 	if (! cx) {
 		__return ISERR(101, true); // 101 = file not open
 	}
-
-	// If there is no cursor
-	if (! cx->cursor_name) {
-		
-		// Allow for an isread to occur on the default index, without an isstart
-		if (mode & ISEQUAL || mode & ISGTEQ) {
-			INDEX *i;
-
-			// Pivot to correct table if targeting isam file "tables"
-			if (cx->schema->is_pivotable) {
-				SCHEMA *s;
-				
-				s = SCHEMA_pivot(hSchema, record);
-				if (s) {
-					cx->schema = s;
-				}
-			}
-			
-			// Get the first index
-			i = INDEX_get(cx->schema->index, 1);
-			if (! i) {
-				__return ISERR(124, true); // 124 = no begin work yet
-			}
-			
-			// Build the select stmt... strip mode of other masks
-			sql = build_select_stmt(
-				i,
-				cx,
-				record,
-				(mode & ISEQUAL) ? ISEQUAL : ISGTEQ
-				);
-
-			// Only get one record
-			str_append(&sql, " LIMIT 1");
-			
-			goto execsql;
-
-		} else {
-			// In all other cases, a cursor is required
-			__return ISERR(124, true); // 124 = no begin work yet
-		}
+	
+	// Writes queued behind come first (see write_behind)
+	if (! wb_barrier(cx)) {
+		__return ISERR(903, true); // 903 = deferred write failed
 	}
-
-	// isread has "lock modes" that do not apply to pgisam
-	// Those are stripped here
-	mode = (mode & ISLOCK) ? (mode - ISLOCK) : mode;
-	mode = (mode & ISSKIPLOCK) ? (mode - ISSKIPLOCK) : mode;
-	mode = (mode & ISWAIT) ? (mode - ISWAIT) : mode;
-	mode = (mode & ISLCKW) ? (mode - ISLCKW) : mode;
 	
-	if (cx->reverse_direction) {
-		switch (mode) {
-			case ISPREV:
-			mode=ISNEXT;
-			break;
-			
-			case ISNEXT:
-			mode=ISPREV;
-			break;
-		}
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
 	}
 	
-	switch (mode) {
-		case ISFIRST:
-		direction = "FIRST";
-		break;
+	pgout(mDEBUG3, "schema=[%s] mode=[%s]",
+		cx->schema->name, get_mode(mode));
 	
-		case ISLAST:
-		direction = "LAST";
-		break;
-		
+	// The lock modes are taken off the read mode
+	lock = mode & (ISLOCK | ISSKIPLOCK | ISWAIT);
+	mode = mode & ~(ISLOCK | ISSKIPLOCK | ISWAIT);
+	
+	ret = read_record(cx, record, mode);
+	
+	// Lock the record read; ISSKIPLOCK reads on past those locked
+	while (ret == ISAM_TRUE && lock) {
+		errcode = lock_read(cx, record, lock);
 		
-		/* This appears to be where the problem is occurring.
-		 * Possibly reverse the direction of the cursor?
-		 */
+		if (errcode == 107 && (lock & ISSKIPLOCK) &&
+			(cx->cursor_name || cx->keyset) &&
+			mode != ISCURR && mode != ISEQUAL) {
+			mode = (mode == ISLAST || mode == ISPREV) ? ISPREV : ISNEXT;
+			ret = read_record(cx, record, mode);
+			continue;
+		}
 		
-		case ISPREV:
-		if ((! cx->in_read) && (cx->mode == ISLAST)) {
-			direction = "LAST";
-		} else {
-			direction = "BACKWARD 1";
+		if (errcode < 0) {
+			ret = pg_timed_out() ? ISERR(901, true) : ISERR(107, true); // 107 = record locked
+		} else
+		if (errcode) {
+			ret = ISERR(errcode, false);
 		}
-		break;
 		
-		case ISNEXT:
-		// Deals w/special-case behavior in C-ISAM
-		if ((cx->mode == ISGREAT) && (! cx->special_case)) {
-			char *sql_temp = NULL;
-			char *part1, *part2;
-			RES *tmpres;
-			
-			// First, close the current cursor
-			str_append(&sql_temp,
-				"CLOSE %s"
-				,cx->cursor_name);
+		break;
+	}
+	
+	__return ret;
 
-				
-			if ((tmpres = pg_exec(cx->conn, sql_temp)) == (RES *)NULL) {
-				pgout(0, "unable to close cursor [%s]",
-					cx->cursor_name);
-			}
-			
-			RES_delete(&tmpres);
-			str_free(&sql_temp);
-			
-			// Build the new cursor declaration from the previous
-			// in addition, add the additional WHERE clause
-			part1 = cx->sql_last;
-			
-			part2 = strstr(cx->sql_last, " ORDER BY ");
-			
-			*part2 = '\0'; *part2++;
-
-			str_append(&sql_temp, "%s%s %s", part1, cx->sql_temp, part2);
-			
-			// Re-open the cursor
-			if ((tmpres = pg_exec(cx->conn, sql_temp)) == (RES *)NULL) {
-				pgout(0, "unable to close cursor [%s]",
-					cx->cursor_name);
-			}
-			
-			RES_delete(&tmpres);
-			
-			cx->special_case = true;
-
-			str_free(&sql_temp);
-		}
-		
-		direction = "FORWARD 1";
-		break;
-		
-		default:
-		// ISCURR || ISGREAT || ISGTEQ || ISEQUAL
-		// fetch the current record
-		direction = "FORWARD 1";
-	}
-
-	str_append(&sql,
-		"FETCH %s FROM %s"
-		,direction
-		,cx->cursor_name
-		);
-
-execsql:
-	res = pg_exec(cx->conn, sql);
-	str_free(&sql);
-
-	if (! res) {
-		__return ISERR(111, false); // 111 = no record found
-	}
-		
-	if (res->tuples != 1) {
-		RES_delete(&res);
-		__return ISERR(111, false); // 111 = no record found
-	}
-	
-	// Obtain the OID of the current record
-	RES_get_oid(res, &cx->oid_last);
-
-	// Context has had a successful read
-	cx->in_read = true;
-
-	// Fill columns from resource
-	COLUMN_from_res(&cx->schema->column, res);
-	
-	// Fill the record with spaces (only on a successful read/fetch)
-	memset(record, 0x20, cx->schema->reclen);
-	
-	// Fill record from columns
-	COLUMN_to_record(cx->schema->column, &record);
-
-	// Clean it
-	COLUMN_clean(cx->schema->column);
-
-	RES_delete(&res);
-
-	__return ISAM_TRUE;
-
-} /* x_isread */
+} /* x_isread */
 
 
 /*
@@ -1137,13 +1741,24 @@ execsql:
  * Unlock records that are locked by calls to isread
  * isfd		file desccriptor returned by isopen or isbuild
  * 
- * NOTE: not meaningful in PG-ISAM
+ * NOTE: row locks are held by a transaction, so the locks of every file
+ * are released together: outside isbegin, by committing the transaction
+ * the first locking read started (and what was written since); in one,
+ * they are held until iscommit/isrollback
  */
 int x_isrelease (int isfd)
 {
+	SESSION *ss = SESSION_current(false);
+	
 __STACK(x_isrelease)
 
 	pgout(mDEBUG3, "isfd=%d", isfd);
+	
+	call_deadline(ss, NULL, NULL);
+	
+	if (! SESSION_lock_end(ss, true)) {
+		__return ISERR(905, true); // 905 = locked writes rolled back
+	}
 
 	__return ISAM_TRUE;
 	
@@ -1164,41 +1779,54 @@ int x_isrewcurr (int isfd, char * record)
 	RES *res;
 	char *sql = NULL;
 	bool ret = ISAM_TRUE;
+	int errcode;
 	
 __STACK(x_isrewcurr)
 	
 	// Obtain the context by file descriptor
-	cx = CONTEXT_get(hContext, isfd);
-	
-	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	cx = context_get(isfd);
 	
 	// Success?
 	if (! cx) {
 		__return ISERR(101, true); // 101 = file not open
 	}
 	
+	// Writes queued behind come first (see write_behind)
+	if (! wb_barrier(cx)) {
+		__return ISERR(903, true); // 903 = deferred write failed
+	}
+	
+	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	
 	// Check to make sure we were able to get the oid
 	if (! cx->oid_last) {
 		__return ISERR(111, true); // 111 = no record found
 	}
 	
-	// Fill column values from record
-	COLUMN_from_record(cx->schema->column, record);
-
 	// Create the update statement	
-	sql = SCHEMA_create_update(cx);
+	if (SCHEMA_use_raw(cx)) {
+		sql = SCHEMA_create_raw_update(cx, record);
+	} else {
+		// Fill column values from record
+		SCHEMA_from_record(cx, record);
+		sql = SCHEMA_create_update(cx);
+	}
 
-	res = pg_exec(cx->conn, sql);
+	res = write_exec(cx, sql, &errcode);
 	str_free(&sql);
 		
+	if (! res && errcode) {
+		ret = ISERR(errcode, true);
+	} else
 	if (! res) {
 		ret = ISERR(111, false); // 111 = no record found
 	} else {
 		RES_delete(&res);
+		SESSION_wrote();
 	}
 		
 	// Clean the COLUMN
-	COLUMN_clean(cx->schema->column);
+	COLUMN_clean(CONTEXT_columns(cx)->column);
 	
 	__return ret;
 	
@@ -1249,16 +1877,40 @@ __STACK(x_isrewrite)
  */
 int x_isrollback (void)
 {
+	SESSION *ss = SESSION_current(false);
 	int ret;
-	CONTEXT *cx = hContext;
+	CONTEXT *cx;
 
 __STACK(x_isrollback)
 	
+	call_deadline(ss, NULL, NULL);
+	
 	pgout(mDEBUG3, "rolling back transaction");
 	
-	ret = CONN_rollback(conn_default);
+	if (! ss) {
+		__return ISERR(122, true); // 122 = no transaction
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
+	
+	// Row locks taken outside a transaction are released, but what was
+	// written while they were held was not written in one: committed
+	if (! SESSION_lock_end(ss, true)) {
+		pgout(0, "writes made while row locks were held are rolled back");
+	}
+	
+	ret = CONN_rollback(ss->conn);
+	
+	ss->conn->in_transaction = false;
+	
+	if (! SESSION_shard_end(ss, false)) {
+		ret = err;
+	}
 	
-	conn_default->in_transaction = false;
+	cx = ss->context;
 	
 	/*
 	 * Here we iterate through all of the contexts.
@@ -1268,24 +1920,1159 @@ __STACK(x_isrollback)
 	 */
 	while (cx) {
 		
-		// First, is the context already in a cursor?
-		if (cx->cursor_name && cx->trans_cursor) {
-			
-			// Indicates that the cursor is "closed"
-			str_free(&cx->cursor_name);
-			cx->trans_cursor = false;
+		// First, is the context already in a cursor?
+		if (cx->cursor_name && cx->trans_cursor) {
+			
+			// Indicates that the cursor is "closed"
+			str_free(&cx->cursor_name);
+			CONTEXT_prefetch_clear(cx);
+			MERGE_delete(&cx->merge, false);
+			cx->trans_cursor = false;
+		}
+	
+		cx = cx->next;
+	}
+		
+	if (ret < 0) {
+		__return ISERR(122, true); // 122 = no transaction
+	} else {
+		__return ISAM_TRUE;
+	}
+		
+} /* x_isrollback */
+
+
+/*
+ * prefetch_read [X]
+ * Return the next row read ahead by x_isread
+ * cx		pointer to the current context
+ * record	receives the record
+ */
+static int prefetch_read (CONTEXT * cx, char * record)
+{
+	int row = cx->prefetch_next++;
+	
+__STACK(prefetch_read)
+	
+	memcpy(record, &cx->prefetch[(size_t)row * cx->schema->reclen],
+		cx->schema->reclen);
+	
+	// Obtain the OID of the current record
+	RES_get_oid_row(cx->prefetch_res, row, &cx->oid_last);
+	
+	// Context has had a successful read
+	cx->in_read = true;
+	
+	__return ISAM_TRUE;
+	
+} /* prefetch_read */
+
+
+/*
+ * prefetch_resync [X]
+ * Move the cursor back onto the last row returned and drop read ahead rows
+ * cx		pointer to the current context
+ */
+static void prefetch_resync (CONTEXT * cx)
+{
+	int count;
+	
+__STACK(prefetch_resync)
+	
+	if (! cx->prefetch_res) {
+		__return;
+	}
+	
+	// Rows not returned, plus the step past the end
+	count = cx->prefetch_res->tuples - cx->prefetch_next;
+	count += cx->prefetch_eof ? 1 : 0;
+	
+	if (count && cx->cursor_name) {
+		char *sql = NULL;
+		RES *res;
+		
+		str_append(&sql,
+			"MOVE BACKWARD %d FROM %s"
+			,count
+			,cx->cursor_name
+			);
+		
+		if ((res = pg_exec(cx->conn, sql)) == (RES *)NULL) {
+			pgout(0, "unable to move cursor [%s]", cx->cursor_name);
+		}
+		
+		RES_delete(&res);
+		str_free(&sql);
+	}
+	
+	CONTEXT_prefetch_clear(cx);
+	
+	__return;
+	
+} /* prefetch_resync */
+
+
+/*
+ * count_records [X]
+ * Number of records in a context's table (-1 on error)
+ * cx		pointer to the current context
+ */
+static long count_records (CONTEXT * cx)
+{
+	char *sql = NULL;
+	RES *res;
+	long count = -1;
+	
+__STACK(count_records)
+	
+	// Estimate first: reltuples is -1 (or 0 before 14) until analyzed
+	if (! (PGIsamOptions & ExactCount)) {
+		str_append(&sql,
+			"SELECT reltuples::bigint, relpages FROM pg_class "
+			"WHERE oid = to_regclass('%s')"
+			,cx->schema->pgname
+			);
+		
+		if ((res = pg_exec(cx->conn, sql)) != (RES *)NULL && res->tuples == 1) {
+			if (atol(PQgetvalue(res->pgres, 0, 1)) > 0) {
+				count = atol(PQgetvalue(res->pgres, 0, 0));
+			}
+		}
+		
+		RES_delete(&res);
+		str_free(&sql);
+		
+		if (count >= 0) {
+			__return count;
+		}
+	}
+	
+	str_append(&sql,
+		"SELECT count(*) FROM %s"
+		,cx->schema->pgname
+		);
+	
+	if ((res = pg_exec(cx->conn, sql)) != (RES *)NULL && res->tuples == 1) {
+		count = atol(PQgetvalue(res->pgres, 0, 0));
+	}
+	
+	RES_delete(&res);
+	str_free(&sql);
+	
+	__return count;
+	
+} /* count_records */
+
+
+/*
+ * build_index_stmt [X]
+ * Build the CREATE INDEX statement of an index
+ * i		pointer to the index
+ * s		pointer to the index's schema
+ * name		name to give the index
+ * online	build CONCURRENTLY (if it doesn't exist already)
+ */
+static char * build_index_stmt (INDEX * i, SCHEMA * s, char * name, bool online)
+{
+	char *sql = NULL;
+	COLUMN *c;
+	
+__STACK(build_index_stmt)
+	
+	str_append(&sql,
+		"CREATE %sINDEX %s%s ON %s ( "
+		,i->is_unique ? "UNIQUE " : ""
+		,online ? "CONCURRENTLY IF NOT EXISTS " : ""
+		,name
+		,s->pgname
+		);
+
+	// Iterate through the column names in index
+	for (c = i->column; c; c = c->next) {
+		str_append(&sql,
+			"%s,"
+			,c->name
+			);
+	}
+	
+	// Strip off trailing comma
+	if (sql[strlen(sql)-1] == ',') {
+		sql[strlen(sql)-1] = '\0';
+	}
+	
+	str_append(&sql, " )");
+	
+	__return sql;
+	
+} /* build_index_stmt */
+
+
+/*
+ * index_adopt
+ * Register the index of a keydesc that another process added with
+ * isaddindex (NULL if the table has no such valid index)
+ * cx		pointer to the current context
+ * key		pointer to a key description struct
+ *
+ * NOTE: added indexes live only in the schema of the process that added
+ * them; the others find them here when a keydesc doesn't resolve (their
+ * name comes from the keydesc, see SCHEMA_index_add)
+ */
+static INDEX * index_adopt (CONTEXT * cx, struct keydesc * key)
+{
+	INDEX *i = NULL;
+	RES *res;
+	char *sql = NULL, *name, *table;
+	bool found;
+	
+__STACK(index_adopt)
+	
+	if (cx->schema->nocreate || (! cx->conn)) {
+		__return (INDEX *)NULL;
+	}
+	
+	name = SCHEMA_index_name(cx->schema, key);
+	table = strrchr(cx->schema->pgname, '.');
+	
+	// A concurrent build still running (or failed) is not valid yet
+	str_append(&sql,
+		"SELECT EXISTS (SELECT 1 FROM pg_index"
+		" WHERE indexrelid = to_regclass('%.*s%s')"
+		" AND indrelid = to_regclass('%s') AND indisvalid)"
+		,table ? (int)(table - cx->schema->pgname) + 1 : 0
+		,cx->schema->pgname
+		,name
+		,cx->schema->pgname
+		);
+	
+	res = pg_exec(cx->conn, sql);
+	found = (res && res->tuples == 1 &&
+		(! strcmp(PQgetvalue(res->pgres, 0, 0), "t"))) ? true : false;
+	
+	RES_delete(&res);
+	str_free(&sql);
+	
+	if (found) {
+		SCHEMA_lock();
+		
+		// Another thread may have adopted it meanwhile
+		if ((i = SCHEMA_index_keydesc(cx->schema, key)) == (INDEX *)NULL) {
+			i = SCHEMA_index_add(cx->schema, key);
+		}
+		
+		SCHEMA_unlock();
+		
+		pgout(mDEBUG1, "adopting index [%s] of [%s]", name, cx->schema->name);
+	}
+	
+	str_free(&name);
+	
+	__return i;
+	
+} /* index_adopt */
+
+
+/*
+ * keyset_select_stmt [X]
+ * Build the select statement standing for an isread FETCH in stateless
+ * mode: the isstart statement, from the last record read on
+ * cx		pointer to the current context
+ * mode		read mode (already reversed for reverse_direction)
+ * prefetch	set when the rows are to be read ahead
+ *
+ * NOTE: rows are ordered by the index columns, then oid; NULL index
+ * values compare as unknown, so those rows are skipped (see README.md)
+ */
+static char * keyset_select_stmt (CONTEXT * cx, int mode, bool * prefetch)
+{
+	char *sql = NULL, *cols = NULL;
+	char *order = strstr(cx->sql_last, " ORDER BY ");
+	bool forward = true;
+	bool from_last = (cx->in_read && cx->oid_last) ? true : false;
+	int limit = 1;
+	COLUMN *c;
+	
+__STACK(keyset_select_stmt)
+	
+	switch (mode) {
+		case ISFIRST:
+		from_last = false;
+		break;
+		
+		case ISLAST:
+		forward = false;
+		from_last = false;
+		break;
+		
+		case ISPREV:
+		// Before the first row unless isstart was ISLAST
+		if (! from_last && cx->mode != ISLAST) {
+			__return (char *)NULL;
+		}
+		forward = false;
+		break;
+		
+		case ISNEXT:
+		// C-ISAM special case (see ISGREAT in x_isread)
+		if (cx->mode == ISGREAT) {
+			cx->special_case = true;
+		}
+		*prefetch = true;
+		limit = PREFETCH_ROWS;
+		break;
+		
+		case ISCURR:
+		if (from_last) {
+			str_append(&sql,
+				"%.*s AND oid='%s'"
+				,(int)(order - cx->sql_last)
+				,cx->sql_last
+				,cx->oid_last
+				);
+			__return sql;
+		}
+		break;
+		
+		default:
+		// ISGREAT || ISGTEQ || ISEQUAL: the next row, as FETCH FORWARD 1
+		break;
+	}
+	
+	// The isstart statement without its ORDER BY
+	str_append(&sql, "%.*s", (int)(order - cx->sql_last), cx->sql_last);
+	
+	if (cx->special_case && cx->sql_temp) {
+		str_append(&sql, "%s", cx->sql_temp);
+	}
+	
+	for (c = cx->index->column; c; c = c->next) {
+		str_append(&cols, "%s, ", c->name);
+	}
+	
+	str_append(&cols, "oid");
+	
+	// Descending when isstart reversed the collation
+	if (cx->reverse_direction) {
+		forward = ! forward;
+	}
+	
+	if (from_last) {
+		str_append(&sql,
+			" AND (%s) %s (SELECT %s FROM %s WHERE oid='%s')"
+			,cols
+			,forward ? ">" : "<"
+			,cols
+			,cx->schema->pgname
+			,cx->oid_last
+			);
+	}
+	
+	str_append(&sql, " ORDER BY");
+	
+	for (c = cx->index->column; c; c = c->next) {
+		str_append(&sql, " %s %s,", c->name, forward ? "ASC" : "DESC");
+	}
+	
+	str_append(&sql, " oid %s LIMIT %d", forward ? "ASC" : "DESC", limit);
+	
+	str_free(&cols);
+	
+	__return sql;
+	
+} /* keyset_select_stmt */
+
+
+/*
+ * read_record
+ * Read a record for x_isread
+ * cx		Context
+ * record	holds the key, and receives the record
+ * mode		mode (without lock modes)
+ */
+static int read_record (CONTEXT * cx, char * record, int mode)
+{
+	RES *res;
+	char *sql = NULL;
+	char *direction = NULL;
+	bool prefetch = false;
+	
+__STACK(read_record)
+	
+	// If there is no cursor (or isstart position)
+	if (! cx->cursor_name && ! cx->keyset) {
+		int errcode;
+		
+		if ((sql = lookup_select_stmt(cx, record, mode, &errcode)) == (char *)NULL) {
+			__return ISERR(errcode, true);
+		}
+		
+		goto execsql;
+	}
+
+	if (cx->reverse_direction) {
+		switch (mode) {
+			case ISPREV:
+			mode=ISNEXT;
+			break;
+			
+			case ISNEXT:
+			mode=ISPREV;
+			break;
+		}
+	}
+	
+	// Sharded: the next row of the shards' cursors, in key order
+	if (cx->merge) {
+		if ((! cx->in_read) && (cx->mode == ISLAST) && mode == ISPREV) {
+			mode = ISLAST;
+		}
+		
+		res = MERGE_fetch(cx->merge, mode);
+		
+		if (res) {
+			cx->conn = MERGE_conn(cx->merge);
+		}
+		
+		goto fetched;
+	}
+	
+	// Serve ISNEXT from rows read ahead; anything else must first
+	// put the cursor back on the last row returned
+	if (cx->prefetch_res) {
+		if (mode != ISNEXT) {
+			prefetch_resync(cx);
+		} else
+		if (cx->prefetch_next < cx->prefetch_res->tuples) {
+			__return prefetch_read(cx, record);
+		} else
+		if (cx->prefetch_eof) {
+			CONTEXT_prefetch_clear(cx);
+			__return ISERR(111, false); // 111 = no record found
+		} else {
+			CONTEXT_prefetch_clear(cx);
+		}
+	}
+	
+	// Stateless: a query from the last record read takes the FETCH's place
+	if (cx->keyset) {
+		if ((sql = keyset_select_stmt(cx, mode, &prefetch)) == (char *)NULL) {
+			__return ISERR(111, false); // 111 = no record found
+		}
+		
+		read_route(cx);
+		
+		goto execsql;
+	}
+	
+	switch (mode) {
+		case ISFIRST:
+		direction = "FIRST";
+		break;
+	
+		case ISLAST:
+		direction = "LAST";
+		break;
+		
+		
+		/* This appears to be where the problem is occurring.
+		 * Possibly reverse the direction of the cursor?
+		 */
+		
+		case ISPREV:
+		if ((! cx->in_read) && (cx->mode == ISLAST)) {
+			direction = "LAST";
+		} else {
+			direction = "BACKWARD 1";
+		}
+		break;
+		
+		case ISNEXT:
+		// Deals w/special-case behavior in C-ISAM
+		if ((cx->mode == ISGREAT) && (! cx->special_case)) {
+			char *sql_temp = NULL;
+			char *part1, *part2;
+			RES *tmpres;
+			
+			// First, close the current cursor
+			str_append(&sql_temp,
+				"CLOSE %s"
+				,cx->cursor_name);
+
+				
+			if ((tmpres = pg_exec(cx->conn, sql_temp)) == (RES *)NULL) {
+				pgout(0, "unable to close cursor [%s]",
+					cx->cursor_name);
+			}
+			
+			RES_delete(&tmpres);
+			str_free(&sql_temp);
+			
+			// Build the new cursor declaration from the previous
+			// in addition, add the additional WHERE clause
+			part1 = cx->sql_last;
+			
+			part2 = strstr(cx->sql_last, " ORDER BY ");
+			
+			*part2 = '\0'; *part2++;
+
+			str_append(&sql_temp, "%s%s %s", part1, cx->sql_temp, part2);
+			
+			// Re-open the cursor
+			if ((tmpres = pg_exec(cx->conn, sql_temp)) == (RES *)NULL) {
+				pgout(0, "unable to close cursor [%s]",
+					cx->cursor_name);
+			}
+			
+			RES_delete(&tmpres);
+			
+			cx->special_case = true;
+
+			str_free(&sql_temp);
+		}
+		
+		// Read ahead; the rows are converted as a batch
+		prefetch = true;
+		direction = "FORWARD";
+		break;
+		
+		default:
+		// ISCURR || ISGREAT || ISGTEQ || ISEQUAL
+		// fetch the current record
+		direction = "FORWARD 1";
+	}
+
+	if (prefetch) {
+		str_append(&sql,
+			"FETCH %s %d FROM %s"
+			,direction
+			,PREFETCH_ROWS
+			,cx->cursor_name
+			);
+	} else {
+		str_append(&sql,
+			"FETCH %s FROM %s"
+			,direction
+			,cx->cursor_name
+			);
+	}
+
+execsql:
+	// Read ahead rows come back binary once the table's types are known,
+	// raw records always (the bytea is copied as is)
+	if ((prefetch && cx->schema->binary_res) || SCHEMA_use_raw(cx)) {
+		res = pg_exec_binary(cx->conn, sql);
+	} else {
+		res = pg_exec(cx->conn, sql);
+	}
+	str_free(&sql);
+
+fetched:
+	if (! res) {
+		__return ISERR(111, false); // 111 = no record found
+	}
+	
+	if (prefetch && res->tuples > 0) {
+		cx->prefetch_res = res;
+		cx->prefetch = (char *)xalloc((size_t)res->tuples * cx->schema->reclen);
+		cx->prefetch_next = 0;
+		cx->prefetch_eof = (res->tuples < PREFETCH_ROWS) ? true : false;
+		
+		CODEC_batch_to_records(cx, res, cx->prefetch);
+		
+		__return prefetch_read(cx, record);
+	}
+	
+	__return read_result(cx, res, record);
+
+} /* read_record */
+
+
+/*
+ * lock_read
+ * Lock the record an isread read and read it again, as it is now (the
+ * read may have been from a cursor's snapshot, or a reader)
+ * cx		Context (its current record)
+ * record	receives the record
+ * lock		lock modes of the isread: ISLOCK, ISWAIT (ISLCKW), ISSKIPLOCK
+ *
+ * NOTE: 0 when locked, else 107 (locked by another), 111 (since deleted)
+ * or -1 (failed, e.g. waiting: the transaction holding the locks is
+ * rolled back if isbegin did not start it).  Outside a transaction, one
+ * is started to hold the lock until isrelease (see SESSION_lock_begin).
+ */
+static int lock_read (CONTEXT * cx, char * record, int lock)
+{
+	SESSION *ss = SESSION_current(false);
+	CONN *conn;
+	RES *res;
+	char *sql = NULL;
+	
+__STACK(lock_read)
+	
+	if (! ss || ! cx->oid_last) {
+		__return -1;
+	}
+	
+	// Locks are taken where writes are made, not on a reader
+	conn = cx->reader ? ss->conn : cx->conn;
+	
+	if (! SESSION_lock_begin(ss, conn)) {
+		__return -1;
+	}
+	
+	if (SCHEMA_use_raw(cx)) {
+		str_append(&sql,
+			"SELECT oid, pgisam_record('%s', pgisam_t) AS " CODEC_RAW_FIELD
+			" FROM %s pgisam_t"
+			,SCHEMA_raw_layout(cx->schema)
+			,cx->schema->pgname
+			);
+	} else {
+		str_append(&sql,
+			"SELECT * FROM %s"
+			,cx->schema->pgname
+			);
+	}
+	
+	// Not NOWAIT: its error would abort the transaction holding the
+	// other locks; a row skipped is either locked or gone
+	str_append(&sql,
+		" WHERE oid='%s' FOR UPDATE%s"
+		,cx->oid_last
+		,(lock & ISWAIT) ? "" : " SKIP LOCKED"
+		);
+	
+	res = SCHEMA_use_raw(cx) ? pg_exec_binary(conn, sql) : pg_exec(conn, sql);
+	str_free(&sql);
+	
+	if (! res) {
+		SESSION_lock_end(ss, false);
+		__return -1;
+	}
+	
+	if (res->tuples == 1) {
+		read_result(cx, res, record);
+		__return 0;
+	}
+	
+	RES_delete(&res);
+	
+	// Skipped: is it still there?
+	str_append(&sql,
+		"SELECT 1 FROM %s WHERE oid='%s'"
+		,cx->schema->pgname
+		,cx->oid_last
+		);
+	
+	res = pg_exec(conn, sql);
+	str_free(&sql);
+	
+	if (! res) {
+		SESSION_lock_end(ss, false);
+		__return -1;
+	}
+	
+	if (res->tuples == 1) {
+		RES_delete(&res);
+		__return 107; // 107 = record locked
+	}
+	
+	RES_delete(&res);
+	
+	__return 111; // 111 = no record found
+	
+} /* lock_read */
+
+
+/*
+ * read_route [X]
+ * Point a read-only context at the connection its next query should
+ * use (see SESSION_read_conn); call only where no cursor is open
+ * cx		pointer to the current context
+ */
+static void read_route (CONTEXT * cx)
+{
+	SESSION *ss = SESSION_current(false);
+	
+__STACK(read_route)
+	
+	if (cx->reader && ss) {
+		cx->conn = SESSION_read_conn(ss, cx);
+	}
+	
+	__return;
+	
+} /* read_route */
+
+
+/*
+ * shard_route [X]
+ * Point a context of a sharded schema at the shard of a record
+ * cx		pointer to the current context
+ * record	record (its primary key picks the shard)
+ *
+ * NOTE: false if the shard could not be connected
+ */
+static bool shard_route (CONTEXT * cx, char * record)
+{
+	SESSION *ss = SESSION_current(false);
+	CONN *conn;
+	
+__STACK(shard_route)
+	
+	if (! ss || ! SHARD_count(cx->schema)) {
+		__return true;
+	}
+	
+	if ((conn = SESSION_shard_conn(ss, SHARD_of(cx->schema, record))) == (CONN *)NULL) {
+		__return false;
+	}
+	
+	cx->conn = conn;
+	
+	__return true;
+	
+} /* shard_route */
+
+/*
+ * bulk_copy [X]
+ * Write records to a connection with COPY: one for each run of records
+ * leaving the same blank fields to their column defaults (see
+ * CODEC_batch_run), in a transaction of their own if there are several
+ * cx		pointer to the current context
+ * conn		connection (NULL = none; fails)
+ * records	records to write
+ * nrec		number of records
+ */
+static bool bulk_copy (CONTEXT * cx, CONN * conn, char * records, int nrec)
+{
+	CODEC_BATCH *batch;
+	char *sql = NULL;
+	char *data = NULL;
+	bool *omit;
+	size_t len;
+	unsigned int row, n;
+	bool own = false;
+	bool ret = true;
+	
+__STACK(bulk_copy)
+	
+	if (! conn) {
+		__return false;
+	}
+	
+	batch = CODEC_batch_new(cx->schema, nrec);
+	omit = (bool *)xalloc(sizeof(bool) * (cx->schema->ncols + 1));
+	
+	// Convert column by column, then stream the rows
+	if (! CODEC_batch_from_records(batch, records, nrec)) {
+		ret = false;
+	}
+	
+	for (row=0; ret == true && row < (unsigned int)nrec; row += n) {
+		n = CODEC_batch_run(batch, row, omit);
+		
+		// Several COPYs are one write, as a single COPY would be
+		if (! row && n < (unsigned int)nrec && ! conn->in_transaction) {
+			if (CONN_begin(conn) != true) {
+				ret = false;
+				break;
+			}
+			own = true;
+		}
+		
+		len = CODEC_batch_to_copy(batch, row, n, omit, &data);
+		sql = SCHEMA_create_copy(cx, omit);
+		
+		if (! pg_copy(conn, sql, data, len)) {
+			ret = false;
+		}
+		
+		str_free(&sql);
+		xfree(data);
+	}
+	
+	if (own) {
+		if (ret == true) {
+			ret = (CONN_commit(conn) == true) ? true : false;
+		} else {
+			CONN_rollback(conn);
+		}
+	}
+	
+	if (ret == true) {
+		SESSION_wrote();
+	}
+	
+	xfree(omit);
+	CODEC_batch_delete(&batch);
+	
+	__return ret;
+	
+} /* bulk_copy */
+
+
+/*
+ * lookup_select_stmt
+ * SELECT of an isread by key without an isstart (NULL = not possible)
+ * cx		Context (pivoted to the record's schema, routed to its server)
+ * record	Record holding the key
+ * mode		isread mode
+ * errcode	Receives the error when NULL
+ */
+static char * lookup_select_stmt (CONTEXT * cx, char * record, int mode,
+	int * errcode)
+{
+	INDEX *i;
+	char *sql;
+	
+__STACK(lookup_select_stmt)
+	
+	// In all other cases, a cursor is required
+	if (! (mode & ISEQUAL || mode & ISGTEQ)) {
+		*errcode = 124; // 124 = no begin work yet
+		__return (char *)NULL;
+	}
+	
+	// Pivot to the schema of the record's type
+	if (cx->schema->is_pivotable) {
+		SCHEMA *s;
+		
+		s = SCHEMA_pivot(hSchema, cx->schema, record);
+		if (s) {
+			cx->schema = s;
+		}
+	}
+	
+	// Get the first index
+	i = INDEX_get(cx->schema->index, 1);
+	if (! i) {
+		*errcode = 124; // 124 = no begin work yet
+		__return (char *)NULL;
+	}
+	
+	// Build the select stmt... strip mode of other masks
+	sql = build_select_stmt(
+		i,
+		cx,
+		record,
+		(mode & ISEQUAL) ? ISEQUAL : ISGTEQ
+		);
+
+	// Only get one record
+	str_append(&sql, " LIMIT 1");
+	
+	read_route(cx);
+	
+	if (! shard_route(cx, record)) {
+		str_free(&sql);
+		*errcode = 902; // 902 = no database connection
+		__return (char *)NULL;
+	}
+	
+	__return sql;
+	
+} /* lookup_select_stmt */
+
+
+/*
+ * read_result
+ * Make the row of an isread the context's current record
+ * cx		Context
+ * res		Result (deleted)
+ * record	Receives the record
+ */
+static int read_result (CONTEXT * cx, RES * res, char * record)
+{
+__STACK(read_result)
+	
+	if (res->tuples != 1) {
+		RES_delete(&res);
+		__return ISERR(111, false); // 111 = no record found
+	}
+	
+	// Obtain the OID of the current record
+	RES_get_oid(res, &cx->oid_last);
+
+	// Context has had a successful read
+	cx->in_read = true;
+
+	// Fill the record with spaces (only on a successful read/fetch)
+	memset(record, 0x20, cx->schema->reclen);
+	
+	// Fill record from resource
+	SCHEMA_to_record(cx, res, record);
+
+	RES_delete(&res);
+
+	__return ISAM_TRUE;
+	
+} /* read_result */
+
+
+/*
+ * async_receive
+ * Read the result of a lookup, and of those sent before it on its
+ * connection (results come back in the order sent)
+ * ss		Session
+ * a		Lookup
+ */
+static void async_receive (SESSION * ss, ASYNC * a)
+{
+	CONN *conn = a->conn;
+	ASYNC *p;
+	
+__STACK(async_receive)
+	
+	for (p = ss->async; conn && p; p = p->next) {
+		if (p->conn != conn) {
+			continue;
+		}
+		
+		p->res = pg_receive(conn);
+		p->conn = NULL;
+		
+		if (p == a) {
+			break;
+		}
+	}
+	
+	__return;
+	
+} /* async_receive */
+
+
+/*
+ * async_complete
+ * Complete a lookup into the caller's buffer, as its x_isread would
+ * ss		Session
+ * a		Lookup (deleted)
+ *
+ * NOTE: the result is waited for within the deadline of the x_iswait
+ * (or x_iswaitany) call
+ */
+static int async_complete (SESSION * ss, ASYNC * a)
+{
+	ASYNC **p;
+	CONTEXT *cx;
+	int ret;
+	
+__STACK(async_complete)
+	
+	if (a->conn) {
+		async_receive(ss, a);
+	}
+	
+	for (p = &ss->async; *p != a; p = &(*p)->next);
+	*p = a->next;
+	
+	// Read synchronously: its outcome as it was
+	if (! a->schema) {
+		iserrno = ss->iserrno = a->iserrno;
+		ret = a->ret;
+	} else
+	if ((cx = CONTEXT_get(&ss->context, a->isfd)) == (CONTEXT *)NULL) {
+		ret = ISERR(101, true); // 101 = file not open
+	} else
+	if (! a->res) {
+		// Failed (or cancelled at the deadline: 901), as read_record
+		ret = ISERR(111, false); // 111 = no record found
+	} else {
+		cx->schema = a->schema;
+		ret = read_result(cx, a->res, a->record);
+		a->res = NULL;
+	}
+	
+	RES_delete(&a->res);
+	xfree(a);
+	
+	__return ret;
+	
+} /* async_complete */
+
+
+/*
+ * async_forget
+ * Detach the lookups of a file that is closed (x_iswait: 101)
+ * ss		Session
+ * isfd		File descriptor (0 = every file)
+ */
+static void async_forget (SESSION * ss, int isfd)
+{
+	ASYNC *a;
+	
+__STACK(async_forget)
+	
+	for (a = ss ? ss->async : NULL; a; a = a->next) {
+		if (a->schema && (! isfd || a->isfd == isfd)) {
+			a->isfd = -1;
+		}
+	}
+	
+	__return;
+	
+} /* async_forget */
+
+
+/*
+ * write_behind
+ * Queue a write to the write-behind workers, if it is one for them:
+ * the file's .def says writebehind, the writebehind=N option is set and
+ * the session is not in a transaction (sharded files are written by
+ * their shard's connection)
+ * cx		Context
+ * record	Record written
+ * sql		Its INSERT (taken if queued)
+ */
+static bool write_behind (CONTEXT * cx, char * record, char * sql)
+{
+	SESSION *ss = SESSION_current(false);
+	
+__STACK(write_behind)
+	
+	if (! cx->schema->writebehind || ! WB_workers() ||
+		ss->conn->in_transaction || cx->schema->shard ||
+		(PGIsamOptions & PrintOnly)) {
+		__return false;
+	}
+	
+	if (! cx->wb) {
+		cx->wb = WB_open(cx->isfd);
+	}
+	
+	__return WB_write(cx->wb, cx->schema, record, sql);
+	
+} /* write_behind */
+
+
+/*
+ * wb_barrier
+ * Wait for the writes queued behind on a file (false = one failed)
+ * cx		Context
+ */
+static bool wb_barrier (CONTEXT * cx)
+{
+__STACK(wb_barrier)
+	
+	if (! cx->wb) {
+		__return true;
+	}
+	
+	WB_flush(cx->wb);
+	
+	__return WB_error(cx->wb) ? false : true;
+	
+} /* wb_barrier */
+
+
+/*
+ * write_exec
+ * Execute a write (INSERT, UPDATE or DELETE): outside a transaction, in
+ * the session's group if the file's writes are grouped (see
+ * SESSION_group_exec); otherwise on its own, after the group is committed
+ * cx		Context
+ * sql		Statement
+ * errcode	receives the error code when the group before it failed (0 = none)
+ */
+static RES * write_exec (CONTEXT * cx, char * sql, int * errcode)
+{
+	SESSION *ss = SESSION_current(false);
+	
+__STACK(write_exec)
+	
+	*errcode = 0;
+	
+	if (! ss || cx->conn != ss->conn || ss->conn->in_transaction ||
+		SESSION_group_size(cx->schema->groupcommit) <= 1 ||
+		(PGIsamOptions & PrintOnly)) {
+		
+		if (! group_barrier()) {
+			*errcode = 904; // 904 = grouped write failed
+			__return (RES *)NULL;
+		}
+		
+		// In the transaction holding row locks, a write that fails is
+		// undone alone (the locks, and what was written, are kept)
+		if (ss && ss->locking && cx->conn->in_transaction) {
+			__return lock_write(ss, cx->conn, sql);
+		}
+		
+		__return pg_exec(cx->conn, sql);
+	}
+	
+	// Full, or open long enough: committed before this one joins
+	if (SESSION_group_due(ss, cx->schema->groupcommit) &&
+		! SESSION_group_end(ss)) {
+		*errcode = 904; // 904 = grouped write failed
+		__return (RES *)NULL;
+	}
+	
+	__return SESSION_group_exec(ss, sql);
+	
+} /* write_exec */
+
+
+/*
+ * lock_write
+ * Make a write in the transaction holding row locks under a savepoint
+ * (in the same round trip), rolling back to it if the write fails
+ * ss		Session
+ * conn		Connection (in the transaction)
+ * sql		Statement
+ *
+ * NOTE: the transaction is only rolled back, and isrelease fails (905),
+ * if the savepoint can't be rolled back to
+ */
+static RES * lock_write (SESSION * ss, CONN * conn, char * sql)
+{
+	RES *res;
+	char *stmt = NULL;
+	
+__STACK(lock_write)
+	
+	str_append(&stmt,
+		"SAVEPOINT pgisam_write; %s; RELEASE SAVEPOINT pgisam_write"
+		,sql
+		);
+	
+	res = pg_exec(conn, stmt);
+	str_free(&stmt);
+	
+	if (res) {
+		ss->lock_wrote = true;
+	} else {
+		RES *undo;
+		
+		// Not cut short if the write ran out of time
+		pg_deadline_end();
+		
+		undo = pg_exec(conn,
+			"ROLLBACK TO SAVEPOINT pgisam_write; RELEASE SAVEPOINT pgisam_write");
+		
+		if (! undo) {
+			SESSION_lock_end(ss, false);
 		}
-	
-		cx = cx->next;
-	}
 		
-	if (ret < 0) {
-		__return ISERR(122, true); // 122 = no transaction
-	} else {
-		__return ISAM_TRUE;
+		RES_delete(&undo);
 	}
-		
-} /* x_isrollback */
+	
+	__return res;
+	
+} /* lock_write */
+
+
+/*
+ * group_barrier
+ * Commit the writes the session grouped (false = one failed; see
+ * SESSION_group_end)
+ */
+static bool group_barrier (void)
+{
+__STACK(group_barrier)
+	
+	__return SESSION_group_end(SESSION_current(false));
+	
+} /* group_barrier */
 
 
 /*
@@ -1312,10 +3099,20 @@ __STACK(build_select_stmt)
 	 * SQL statement
 	 * -------------------------------------
 	 */
-	str_append(&sql,
-		"SELECT * FROM %s"
-		,cx->schema->pgname
-		);
+	if (SCHEMA_use_raw(cx)) {
+		// Whole records built by the server (see ext/)
+		str_append(&sql,
+			"SELECT oid, pgisam_record('%s', pgisam_t) AS " CODEC_RAW_FIELD
+			" FROM %s pgisam_t"
+			,SCHEMA_raw_layout(cx->schema)
+			,cx->schema->pgname
+			);
+	} else {
+		str_append(&sql,
+			"SELECT * FROM %s"
+			,cx->schema->pgname
+			);
+	}
 
 
 	/* -------------------------------------
@@ -1333,13 +3130,15 @@ __STACK(build_select_stmt)
 		 * get column from the index selected above.
 		 */		
 		COLUMN *valc;
+		COLSET *cs;
 		bool first_clause = true;
 		char *sql_op;
 		STMT *st = NULL, *stmt = NULL;
 
 		valc = i->column;
 
-		COLUMN_from_record(cx->schema->column, record);
+		SCHEMA_from_record(cx, record);
+		cs = CONTEXT_columns(cx);
 		
 		switch (mode) {
 			case ISGREAT:
@@ -1358,15 +3157,19 @@ __STACK(build_select_stmt)
 			COLUMN *c_comp = NULL;
 
 			// Index columns are just names, so get the real column
-			c_comp = COLUMN_get(cx->schema->column, valc->name);
+			c_comp = SCHEMA_column(cx->schema, valc->name);
 		
 			// Make sure there was a match
 			if (! c_comp) {
 				pgout(0, "could not retrieve column matching index %s",
 					i->name);
+				COLUMN_clean(cs->column);
 				str_free(&sql);
 				__return (char *)NULL;
 			}
+			
+			// The value is in the context's copy
+			c_comp = cs->colv[c_comp->ordinal];
 
 			if (str_is_filled((char *)c_comp->value, 'z')) {
 				z_values = true;
@@ -1429,7 +3232,7 @@ __STACK(build_select_stmt)
 		}
 			
 		// Clean the COLUMN
-		COLUMN_clean(cx->schema->column);
+		COLUMN_clean(cs->column);
 	}
 
 
@@ -1457,9 +3260,12 @@ __STACK(build_select_stmt)
 	c = i->column;
 	
 	while (c) {
+		// Sharded: text is merged bytewise (see MERGE_compare)
 		str_append(&sql,
-			" %s%s,"
+			" %s%s%s,"
 			, c->name
+			, (SHARD_count(cx->schema) && (c->datatype & (ISAM_TYPE_CHAR |
+				ISAM_TYPE_CODE | ISAM_TYPE_CODEBLANK))) ? " COLLATE \"C\"" : ""
 			, collation
 			);
 				
@@ -1572,30 +3378,43 @@ int x_isstart (int isfd, struct keydesc * key, int length, char * record, int mo
 	char *sql_full = NULL;
 	char *sql_select = NULL;
 	bool WITH_HOLD = false;
+	SESSION *ss = NULL;
 	
 __STACK(x_isstart)
 	
 	// Find the context
-	cx = CONTEXT_get(hContext, isfd);
+	cx = context_get(isfd);
 
-	pgout(mDEBUG3, "schema=[%s] mode=[%s]", cx->schema->name, get_mode(mode));
-	
 	if (! cx) {
 		__return ISERR(101, true); // 101 = file not open
 	}
 	
-	// Pivot to correct table if targeting isam file "tables"
+	// Writes queued behind come first (see write_behind)
+	if (! wb_barrier(cx)) {
+		__return ISERR(903, true); // 903 = deferred write failed
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
+	
+	pgout(mDEBUG3, "schema=[%s] mode=[%s]", cx->schema->name, get_mode(mode));
+	
+	// Pivot to the schema of the record's type
 	if (cx->schema->is_pivotable) {
 		SCHEMA *s;
 			
-		s = SCHEMA_pivot(hSchema, record);
+		s = SCHEMA_pivot(hSchema, cx->schema, record);
 		if (s) {
 			cx->schema = s;
 		}
 	}
 	
-	// Retreive the index matching keydesc
-	i = INDEX_get_keydesc(cx->schema->index, key);
+	// Retreive the index matching keydesc (or added by another process)
+	if ((i = SCHEMA_index_keydesc(cx->schema, key)) == (INDEX *)NULL) {
+		i = index_adopt(cx, key);
+	}
 	
 	if (! i) {
 		__return ISERR(103, true); // 103 = illegal key desc
@@ -1613,6 +3432,9 @@ __STACK(x_isstart)
 	 * -------------------------------------
 	 */
 	// First, is the context already in a cursor?
+	if (cx->merge) {
+		MERGE_delete(&cx->merge, true);
+	} else
 	if (cx->cursor_name) {
 		RES *tmpres;
 		char *tmpsql = NULL;
@@ -1636,9 +3458,36 @@ __STACK(x_isstart)
 	 * Data cleaning
 	 * -------------------------------------
 	 */	
+	CONTEXT_prefetch_clear(cx);
 	str_free(&cx->sql_last);
 	str_free(&cx->sql_temp);
 	str_free(&cx->cursor_name);	
+	cx->keyset = false;
+	
+	// The old cursor is closed; the new one may be declared elsewhere
+	read_route(cx);
+
+
+	/* -------------------------------------
+	 * Stateless: no cursor, isread selects from
+	 * the last record read (keyset_select_stmt)
+	 * -------------------------------------
+	 */
+	if ((PGIsamOptions & Stateless) && ! SHARD_count(cx->schema)) {
+		cx->reverse_direction = false;
+		cx->sql_last = build_select_stmt(i, cx, record, mode);
+		
+		if (! cx->sql_last) {
+			__return ISERR(111, true); // 111 = no matching record
+		}
+		
+		cx->keyset = true;
+		cx->special_case = false;
+		cx->in_read = false;
+		cx->mode = mode;
+		
+		__return ISERR(ISAM_TRUE, false);
+	}
 
 
 	/* -------------------------------------
@@ -1657,7 +3506,15 @@ __STACK(x_isstart)
 	
 	// The connection we're pointed to in this context
 	// determines whether a hold is placed on this cursor
-	WITH_HOLD = (cx->conn->in_transaction) ? false : true;
+	// (a sharded context's follows the session's, see SESSION_shard_conn)
+	ss = SESSION_current(false);
+	
+	if (SHARD_count(cx->schema) && ss) {
+		cx->conn = ss->conn;
+	}
+	
+	// (not by one holding row locks until isrelease: see SESSION_lock_begin)
+	WITH_HOLD = (cx->conn->in_transaction && ! (ss && ss->locking)) ? false : true;
 
 	// Build the cursor declaration/select statment
 	str_append(&sql_full,
@@ -1679,6 +3536,48 @@ __STACK(x_isstart)
 		__return ISERR(111, true); // 111 = no matching record
 	}
 	
+	
+	/* -------------------------------------
+	 * Sharded: the same cursor on every shard
+	 * (ISGREAT's exclusion is applied up front)
+	 * -------------------------------------
+	 */
+	if (ss && SHARD_count(cx->schema)) {
+		str_append(&sql_full, "%s", sql_select);
+		str_free(&sql_select);
+		
+		if (cx->sql_temp) {
+			char *order = strstr(sql_full, " ORDER BY ");
+			char *sql_merge = NULL;
+			
+			str_append(&sql_merge, "%.*s%s%s"
+				,(int)(order - sql_full)
+				,sql_full
+				,cx->sql_temp
+				,order
+				);
+			str_free(&sql_full);
+			sql_full = sql_merge;
+		}
+		
+		cx->merge = MERGE_new(ss, cx->schema, i, cx->reverse_direction,
+			cx->cursor_name, sql_full, WITH_HOLD);
+		
+		if (! cx->merge) {
+			str_free(&sql_full);
+			str_free(&cx->cursor_name);
+			__return ISERR(111, false); // 111 = no matching record
+		}
+		
+		cx->trans_cursor = WITH_HOLD ? false : true;
+		cx->sql_last = sql_full;
+		cx->special_case = true;
+		cx->in_read = false;
+		cx->mode = mode;
+		
+		__return ISERR(ISAM_TRUE, false);
+	}
+	
 	if (WITH_HOLD) {
 		CONN_begin(cx->conn);
 		cx->trans_cursor = false;		// Remove the transactionable flag
@@ -1745,19 +3644,25 @@ int x_isfinish (int isfd)
 __STACK(x_isfinish)
 	
 	// Find the context
-	cx = CONTEXT_get(hContext, isfd);
-	
-	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	cx = context_get(isfd);
 	
 	if (! cx) {
 		__return ISERR(101, true); // 101 = file not open
 	}
 	
+	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	
 	// If we're not in a cursor, we don't need to do anything
 	if (! cx->cursor_name) {
 		__return false;
 	}
 	
+	if (cx->merge) {
+		MERGE_delete(&cx->merge, true);
+		str_free(&cx->cursor_name);
+		__return ISAM_TRUE;
+	}
+	
 	str_append(&sql,
 		"CLOSE %s"
 		, cx->cursor_name);
@@ -1772,6 +3677,7 @@ __STACK(x_isfinish)
 		
 	// Not in cursor anymore
 	str_free(&cx->cursor_name);
+	CONTEXT_prefetch_clear(cx);
 	
 	str_free(&sql);
 	
@@ -1792,31 +3698,56 @@ int x_iswrcurr (int isfd, char * record)
 	RES *res;
 	char *sql = NULL;
 	bool ret = ISAM_TRUE;
+	int errcode;
 	
 __STACK(x_iswrcurr)
 	
-	cx = CONTEXT_get(hContext, isfd);
-	
-	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	cx = context_get(isfd);
 	
 	if (! cx) {
 		__return ISERR(101, true); // 101 = file not open
 	}
 	
-	// Fill column values from record
-	COLUMN_from_record(cx->schema->column, record);
+	// A write queued behind failed since the last call
+	if (WB_error(cx->wb)) {
+		__return ISERR(903, true); // 903 = deferred write failed
+	}
+	
+	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	
+	// Sharded: the record's shard
+	if (! shard_route(cx, record)) {
+		__return ISERR(902, true); // 902 = no database connection
+	}
 	
-	sql = SCHEMA_create_insert(cx);
+	if (SCHEMA_use_raw(cx)) {
+		sql = SCHEMA_create_raw_insert(cx, record);
+	} else {
+		// Fill column values from record
+		SCHEMA_from_record(cx, record);
+		sql = SCHEMA_create_insert(cx);
+	}
 
-	res = pg_exec(cx->conn, sql);
+	// Outside a transaction, a worker may make it (see write_behind)
+	if (write_behind(cx, record, sql)) {
+		COLUMN_clean(CONTEXT_columns(cx)->column);
+		SESSION_wrote();
+		__return ISAM_TRUE;
+	}
+
+	res = write_exec(cx, sql, &errcode);
+	if (! res && errcode) {
+		ret = ISERR(errcode, true);
+	} else
 	if (! res) {
-		ret = err;
+		ret = pg_timed_out() ? ISERR(901, true) : err;
 	} else {
 		RES_delete(&res);
+		SESSION_wrote();
 	}
 		
 	// Clean the COLUMN
-	COLUMN_clean(cx->schema->column);
+	COLUMN_clean(CONTEXT_columns(cx)->column);
 	
 	str_free(&sql);
 	
@@ -1837,34 +3768,353 @@ int x_iswrite (int isfd, char * record)
 	RES *res;
 	char *sql = NULL;
 	bool ret = ISAM_TRUE;
+	int errcode;
 	
 __STACK(x_iswrite)
 
-	cx = CONTEXT_get(hContext, isfd);
-	
-	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	cx = context_get(isfd);
 	
 	if (! cx) {
 		__return ISERR(101, true); // 101 = file not open
 	}
-
-	// Fill column values from record
-	COLUMN_from_record(cx->schema->column, record);
 	
-	sql = SCHEMA_create_insert(cx);
-	res = pg_exec(cx->conn, sql);
+	// A write queued behind failed since the last call
+	if (WB_error(cx->wb)) {
+		__return ISERR(903, true); // 903 = deferred write failed
+	}
+	
+	pgout(mDEBUG3, "schema=[%s]", cx->schema->name);
+	
+	// Sharded: the record's shard
+	if (! shard_route(cx, record)) {
+		__return ISERR(902, true); // 902 = no database connection
+	}
 
+	if (SCHEMA_use_raw(cx)) {
+		sql = SCHEMA_create_raw_insert(cx, record);
+	} else {
+		// Fill column values from record
+		SCHEMA_from_record(cx, record);
+		sql = SCHEMA_create_insert(cx);
+	}
+
+	// Outside a transaction, a worker may make it (see write_behind)
+	if (write_behind(cx, record, sql)) {
+		COLUMN_clean(CONTEXT_columns(cx)->column);
+		SESSION_wrote();
+		__return ISAM_TRUE;
+	}
+
+	res = write_exec(cx, sql, &errcode);
+
+	if (! res && errcode) {
+		ret = ISERR(errcode, true);
+	} else
 	if (! res) {
-		ret = err;
+		ret = pg_timed_out() ? ISERR(901, true) : err;
 	} else {
 		RES_delete(&res);
+		SESSION_wrote();
 	}
 
 	// Clean the COLUMN
-	COLUMN_clean(cx->schema->column);
+	COLUMN_clean(CONTEXT_columns(cx)->column);
 
 	str_free(&sql);
 	
 	__return ret;
 	
 } /* x_iswrite */
+
+
+/*
+ * x_isbulkwrite [X]
+ * Writes nrec contiguous records (reclen apart) with COPY
+ * isfd		file descriptor
+ * records	records to write
+ * nrec		number of records
+ *
+ * NOTE: as with x_iswrite, blank fields are left to the column default
+ * (see bulk_copy); the records are written all or none (per shard)
+ */
+int x_isbulkwrite (int isfd, char * records, int nrec)
+{
+	CONTEXT *cx = NULL;
+	int ret = ISAM_TRUE;
+	int x, n;
+	
+__STACK(x_isbulkwrite)
+
+	cx = context_get(isfd);
+	
+	if (! cx) {
+		__return ISERR(101, true); // 101 = file not open
+	}
+	
+	// Writes queued behind come first (see write_behind)
+	if (! wb_barrier(cx)) {
+		__return ISERR(903, true); // 903 = deferred write failed
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
+	
+	pgout(mDEBUG3, "schema=[%s] nrec=[%d]", cx->schema->name, nrec);
+	
+	if (nrec <= 0) {
+		__return ISAM_TRUE;
+	}
+	
+	// "tables" records may each pivot to another schema
+	if (cx->schema->is_pivotable) {
+		for (x=0; x < nrec; x++) {
+			if (x_iswrite(isfd, &records[(size_t)x * cx->schema->reclen]) < 0) {
+				ret = err;
+			}
+		}
+		__return ret;
+	}
+	
+	// Sharded: each shard's records with a COPY of their own
+	if ((n = SHARD_count(cx->schema)) > 1) {
+		size_t reclen = cx->schema->reclen;
+		char *group = (char *)xalloc((size_t)nrec * reclen);
+		int *shard = (int *)xalloc(sizeof(int) * nrec);
+		int s, ngroup;
+		
+		for (x=0; x < nrec; x++) {
+			shard[x] = SHARD_of(cx->schema, &records[(size_t)x * reclen]);
+		}
+		
+		for (s=0; s < n; s++) {
+			for (ngroup=0, x=0; x < nrec; x++) {
+				if (shard[x] == s) {
+					memcpy(&group[(size_t)ngroup++ * reclen],
+						&records[(size_t)x * reclen], reclen);
+				}
+			}
+			
+			if (ngroup && ! bulk_copy(cx,
+				SESSION_shard_conn(SESSION_current(false), s), group, ngroup)) {
+				ret = err;
+			}
+		}
+		
+		xfree(shard);
+		xfree(group);
+		__return ret;
+	}
+	
+	if (! bulk_copy(cx, cx->conn, records, nrec)) {
+		ret = err;
+	}
+	
+	__return ret;
+	
+} /* x_isbulkwrite */
+
+
+/*
+ * x_isflush [X]
+ * Wait until the writes queued behind on a file are made, and commit
+ * the writes the session grouped (see write_exec)
+ * isfd		file descriptor (0 = every file of the session)
+ *
+ * NOTE: fails (903) if one of them failed since the last call on the
+ * file, (904) if a grouped write failed
+ */
+int x_isflush (int isfd)
+{
+	SESSION *ss = SESSION_current(false);
+	CONTEXT *cx;
+	int ret = ISAM_TRUE;
+	
+__STACK(x_isflush)
+
+	if (isfd == 0) {
+		call_deadline(ss, NULL, NULL);
+		
+		if (! group_barrier()) {
+			ret = ISERR(904, true); // 904 = grouped write failed
+		}
+		
+		for (cx = ss ? ss->context : NULL; cx; cx = cx->next) {
+			if (! wb_barrier(cx)) {
+				ret = ISERR(903, true); // 903 = deferred write failed
+			}
+		}
+		
+		__return ret;
+	}
+	
+	cx = context_get(isfd);
+	
+	if (! cx) {
+		__return ISERR(101, true); // 101 = file not open
+	}
+	
+	if (! wb_barrier(cx)) {
+		__return ISERR(903, true); // 903 = deferred write failed
+	}
+	
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
+	
+	__return ISAM_TRUE;
+	
+} /* x_isflush */
+
+
+/*
+ * x_isread_async [X]
+ * Start an isread and return at once; x_iswait (or x_iswaitany) completes
+ * it into record, as x_isread would have
+ * isfd		file descriptor
+ * record	holds the key, and receives the record (must stay valid until then)
+ * mode		mode
+ * ticket	receives the ticket to wait for
+ *
+ * NOTE: reads by key without an isstart are pipelined on the file's
+ * connection, so lookups in several files cost about one round trip;
+ * other reads are made at once (their outcome is kept for x_iswait)
+ */
+int x_isread_async (int isfd, char * record, int mode, int * ticket)
+{
+	SESSION *ss = SESSION_current(false);
+	CONTEXT *cx;
+	ASYNC *a, **tail;
+	char *sql = NULL;
+	int errcode;
+	
+__STACK(x_isread_async)
+
+	cx = context_get(isfd);
+	
+	if (! cx) {
+		__return ISERR(101, true); // 101 = file not open
+	}
+	
+	// Writes queued behind come first (see write_behind)
+	if (! wb_barrier(cx)) {
+		__return ISERR(903, true); // 903 = deferred write failed
+	}
+	
+	// Writes grouped since the last call are committed first (see write_exec)
+	if (! group_barrier()) {
+		__return ISERR(904, true); // 904 = grouped write failed
+	}
+	
+	pgout(mDEBUG3, "schema=[%s] mode=[%s]",
+		cx->schema->name, get_mode(mode));
+	
+	a = (ASYNC *)xalloc(sizeof(ASYNC));
+	a->ticket = ++ss->next_ticket;
+	a->isfd = isfd;
+	a->record = record;
+	
+	// Locking reads are made at once (see lock_read)
+	if (! cx->cursor_name && ! cx->keyset &&
+		! (mode & (ISLOCK | ISSKIPLOCK | ISWAIT)) &&
+		(sql = lookup_select_stmt(cx, record, mode, &errcode)) != (char *)NULL &&
+		pg_send(cx->conn, sql, SCHEMA_use_raw(cx) ? 1 : 0)) {
+		a->conn = cx->conn;
+		a->schema = cx->schema;
+	}
+	
+	str_free(&sql);
+	
+	if (! a->conn) {
+		a->ret = x_isread(isfd, record, mode);
+		a->iserrno = get_iserrno();
+	}
+	
+	for (tail = &ss->async; *tail; tail = &(*tail)->next);
+	*tail = a;
+	
+	*ticket = a->ticket;
+	
+	__return ISAM_TRUE;
+	
+} /* x_isread_async */
+
+
+/*
+ * x_iswait [X]
+ * Wait for a read started by x_isread_async
+ * ticket	its ticket
+ *
+ * Returns what its x_isread would have (iserrno likewise)
+ */
+int x_iswait (int ticket)
+{
+	SESSION *ss = SESSION_current(false);
+	ASYNC *a;
+	
+__STACK(x_iswait)
+
+	for (a = ss ? ss->async : NULL; a && a->ticket != ticket; a = a->next);
+	
+	if (! a) {
+		__return ISERR(102, true); // 102 = illegal argument
+	}
+	
+	// The time budget of the lookup's file
+	call_deadline(ss, CONTEXT_get(&ss->context, a->isfd), a->schema);
+	
+	__return async_complete(ss, a);
+	
+} /* x_iswait */
+
+
+/*
+ * x_iswaitany [X]
+ * Wait for whichever read started by x_isread_async completes first
+ * ticket	receives its ticket
+ *
+ * Returns what its x_isread would have (iserrno likewise)
+ */
+int x_iswaitany (int * ticket)
+{
+	SESSION *ss = SESSION_current(false);
+	ASYNC *a, *p;
+	CONN **conn;
+	int n = 0, x;
+	
+__STACK(x_iswaitany)
+
+	if (! ss || ! ss->async) {
+		__return ISERR(102, true); // 102 = illegal argument
+	}
+	
+	// Not on one file: the session's time budget
+	call_deadline(ss, NULL, NULL);
+	
+	// One already in (read synchronously, or off the wire)
+	for (a = ss->async; a && a->conn; a = a->next);
+	
+	// Else the first to come back of the oldest on each connection
+	if (! a) {
+		for (p = ss->async; p; p = p->next, n++);
+		conn = (CONN **)xalloc(sizeof(CONN *) * n);
+		
+		for (n = 0, p = ss->async; p; p = p->next) {
+			for (x=0; x < n && conn[x] != p->conn; x++);
+			if (x == n) {
+				conn[n++] = p->conn;
+			}
+		}
+		
+		x = pg_wait_any(conn, n);
+		
+		for (a = ss->async; a->conn != conn[x]; a = a->next);
+		xfree(conn);
+	}
+	
+	*ticket = a->ticket;
+	
+	__return async_complete(ss, a);
+	
+} /* x_iswaitany */
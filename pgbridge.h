@@ -179,6 +179,13 @@ int x_isstart (int isfd, struct keydesc *key, int length, char *record, int mode
  */
 int x_isfinish (int isfd);
 
+/*
+ * x_isrelease:
+ * Unlocks the records locked by isread (those of every file, see pgbridge.c)
+ * isfd		file descriptor
+ */
+int x_isrelease (int isfd);
+
 /*
  * x_iswrcurr:
  * Writes a record and makes it the current record
@@ -195,4 +202,45 @@ int x_iswrcurr (int isfd, char *record);
  */
 int x_iswrite (int isfd, char *record);
 
+/*
+ * x_isbulkwrite:
+ * Writes nrec contiguous records (reclen apart) with COPY, all or none
+ * isfd		file descriptor
+ * records	records to write
+ * nrec		number of records
+ */
+int x_isbulkwrite (int isfd, char *records, int nrec);
+
+/*
+ * x_isflush:
+ * Waits until the writes queued behind on a file are made, and commits
+ * the writes grouped outside transactions
+ * isfd		file descriptor (0 = every file of the session)
+ */
+int x_isflush (int isfd);
+
+/*
+ * x_isread_async:
+ * Starts an isread and returns at once (see x_iswait)
+ * isfd		file descriptor
+ * record	holds the key, and receives the record (keep it until the wait)
+ * mode		mode
+ * ticket	receives the ticket to wait for
+ */
+int x_isread_async (int isfd, char *record, int mode, int *ticket);
+
+/*
+ * x_iswait:
+ * Waits for a read started by x_isread_async; returns as x_isread
+ * ticket	its ticket
+ */
+int x_iswait (int ticket);
+
+/*
+ * x_iswaitany:
+ * Waits for the first read started by x_isread_async to complete
+ * ticket	receives its ticket
+ */
+int x_iswaitany (int *ticket);
+
 #endif // _PGBRIDGE_H
@@ -6,6 +6,7 @@
 #define _PGISAM_H
 
 #include <decimal.h>
+#include <decfast.h>
 #include <bridge.h>
 
 #define pgout(a, b, ...) pgout_t(a, "%s|%s|%d|" b, __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__)
@@ -34,6 +35,9 @@
 typedef enum pgisam_opt {
 	 PGIsamNormal = 0
 	,PrintOnly = 1
+	,LazyConnect = 2
+	,ExactCount = 4
+	,Stateless = 8
 } pgisam_opt;
 
 extern pgisam_opt PGIsamOptions;
@@ -41,6 +45,12 @@ extern pgisam_opt PGIsamOptions;
 // pgout typedef
 typedef void (*pgCallback)(int mode, char *message);
 
+// Failed write behind (see set_pgisam_write_callback)
+typedef void (*pgWriteCallback)(int isfd, char *record, int iserrno);
+
+// Bridge session (see session_open)
+typedef struct SESSION_T pgisam_session;
+
 /* dec_to_str
  * Convert a decimal type to a string
  */
@@ -62,9 +72,26 @@ int init_program (void);
  * 
  * Options (separate with comma):
  * printonly	Do not execute SQL; print to stdout
+ * lazyconnect	Connect on the first SQL statement, not in init_program
+ * writebehind=N	Files marked writebehind in their .def are written
+ *			outside transactions by N worker threads (see README.md)
+ * groupcommit=N	Writes outside transactions are committed N at a time
+ * groupwait=N	A group of writes is committed after N ms at most
+ * asynccommit	Commits don't wait for the server to flush them to disk
+ * set:name=value	Server setting of every connection (e.g. set:work_mem=64MB)
+ *
+ * PGISAM_OPTIONS in the environment holds more (applied by init_program)
  */
 void set_pgisam_options (char *optstr);
 
+/* set_pgisam_write_callback:
+ * Set the function told of a write behind that failed: the file, the
+ * record and the error (903, deferred write failed).  It is called in a
+ * worker thread.
+ * (in pgbridge.c)
+ */
+void set_pgisam_write_callback (pgWriteCallback callback);
+
 /* shutdown_program:
  * Initialize a Postgres connection
  * (in pgbridge.c)
@@ -77,6 +104,40 @@ int shutdown_program (void);
  */
 char * get_last_sql (void);
 
+/* get_iserrno:
+ * Get the iserrno of the calling thread's last call
+ * (iserrno itself is shared by all threads)
+ * (in pgbridge.c)
+ */
+int get_iserrno (void);
+
+/* set_pgisam_timeout:
+ * Give each call on a file (isfd), or on every file of the calling
+ * thread's session (isfd 0), a time budget in ms: a statement still
+ * running at its end is cancelled on the server and the call fails
+ * with iserrno 901 (operation timed out).  0 = not set (the session's,
+ * then the .def's timeout=), < 0 = none.
+ * (in pgbridge.c)
+ */
+int set_pgisam_timeout (int isfd, int ms);
+
+/* log_pgisam_stats:
+ * Log the bridge's statistics (done by shutdown_program)
+ * (in pgbridge.c)
+ */
+void log_pgisam_stats (void);
+
+/* session_open|use|close
+ * Sessions for multi-threaded programs: each thread works in its own
+ * session (connection, open files, iserrno), created on its first call.
+ * A session opened here can be handed between threads with session_use,
+ * one thread at a time; files opened in a session are only valid in it.
+ * (in pgbridge.c)
+ */
+pgisam_session * session_open (void);
+void session_use (pgisam_session * session);
+void session_close (pgisam_session * session);
+
 /* get_EDATA|BRIDGE
  * "Get" methods for retreiving the
  * EDATA and BRIDGE environment variables.
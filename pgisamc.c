@@ -0,0 +1,724 @@
+/*
+ * pgisamc.c: bridge routines forwarded to pgisamd
+ *
+ * Link with libpgisamc instead of libpgisam to have the x_is* calls made
+ * by the local daemon (see pgisamd.c), which keeps the schemas loaded and
+ * the database connections open between program runs.  Each thread talks
+ * to the daemon over a socket of its own and so gets its own session.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pgisam.h"
+#include "sys.h"
+#include "pgbridge.h"
+#include "proto.h"
+#include "xstring.h"
+
+#define ENOBRIDGE 802		// No daemon (reported as 902 like the bridge)
+#define RECLEN_SLOT_MASK 0xffff	// Slot of an isfd (generation << 16 | slot + 1)
+
+/*
+ * RECLEN
+ * Record length of the file open in an isfd slot
+ */
+typedef struct RECLEN_T {
+	int isfd;				// File (0 = none; stale isfds of the slot don't match)
+	int len;
+} RECLEN;
+
+pgisam_opt PGIsamOptions = PGIsamNormal;
+
+// External data
+// For compatibility with C-ISAM or other bridge functionality
+bool initialized = false;
+int iserrno = 0;
+
+// Static data
+static char *socket_path = NULL;
+static __thread int sock = -1;			// Connection to the daemon
+static __thread int thread_iserrno = 0;
+static __thread RECLEN *reclen = NULL;	// Record length by isfd slot
+static __thread int reclen_size = 0;
+static __thread char *last_sql = NULL;
+static __thread int *done = NULL;		// x_isread_async: ticket, ret, iserrno
+static __thread int ndone = 0;
+static __thread int next_ticket = 0;
+
+// Static function prototypes
+static bool bridge_connect (void);
+static int call (PROTO_REQUEST * rq, const void * p1, unsigned int l1,
+	const void * p2, unsigned int l2, void * reply, unsigned int replylen);
+static int record_len (int isfd);
+static void record_len_set (int isfd, int len);
+static int done_take (int x);
+
+
+// CODE STARTS HERE
+/*
+ * get_EDATA|BRIDGE
+ * "Get" methods for retreiving the
+ * EDATA and BRIDGE environment variables.
+ */
+char * get_EDATA(void)
+{
+__STACK(get_EDATA);
+
+	__return getenv("EDATA");
+
+} /* get_EDATA */
+
+char * get_BRIDGE(void)
+{
+__STACK(get_BRIDGE)
+
+	__return getenv("BRIDGE");
+
+} /* get_BRIDGE */
+
+
+/*
+ * init_program [X]
+ * Connect the calling thread to the daemon
+ */
+bool init_program (void)
+{
+__STACK(init_program)
+
+	if (initialized) {
+		__return false;
+	}
+
+	socket_path = PROTO_socket_path();
+
+	if (! bridge_connect()) {
+		pgout(mDISPLAY, "cannot reach pgisamd on [%s]", socket_path);
+		__return false;
+	}
+
+	initialized = true;
+
+	__return true;
+
+} /* init_program */
+
+
+/*
+ * shutdown_program [X]
+ * Disconnect the calling thread (the daemon closes its files)
+ */
+bool shutdown_program (void)
+{
+__STACK(shutdown_program)
+
+	if (sock >= 0) {
+		close(sock);
+		sock = -1;
+	}
+
+	free(reclen);
+	reclen = NULL;
+	reclen_size = 0;
+
+	initialized = false;
+
+	__return true;
+
+} /* shutdown_program */
+
+
+/*
+ * set_pgisam_options
+ * Options are the daemon's (set them on pgisamd)
+ */
+void set_pgisam_options (char *optstr)
+{
+__STACK(set_pgisam_options)
+
+	pgout(0, "options [%s] ignored, they are set on pgisamd", optstr);
+
+	__return;
+
+} /* set_pgisam_options */
+
+
+/*
+ * get_last_sql
+ * Last statement the daemon ran for the calling thread
+ */
+char * get_last_sql (void)
+{
+	PROTO_REQUEST rq = { PROTO_LASTSQL };
+	char buf[8192];
+
+__STACK(get_last_sql)
+
+	*buf = '\0';
+
+	if (call(&rq, NULL, 0, NULL, 0, buf, sizeof(buf)) < 0) {
+		__return NULL;
+	}
+
+	buf[sizeof(buf) - 1] = '\0';
+	str_free(&last_sql);
+	last_sql = str_dup(buf);
+
+	__return last_sql;
+
+} /* get_last_sql */
+
+
+/*
+ * get_iserrno
+ * Get the iserrno of the calling thread's last call
+ */
+int get_iserrno (void)
+{
+__STACK(get_iserrno)
+
+	__return thread_iserrno;
+
+} /* get_iserrno */
+
+
+/*
+ * set_pgisam_timeout
+ * Set the time budget of the calls on a file, or of the thread's session
+ */
+int set_pgisam_timeout (int isfd, int ms)
+{
+	PROTO_REQUEST rq = { PROTO_TIMEOUT, isfd, 0, 0, ms };
+
+__STACK(set_pgisam_timeout)
+
+	__return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* set_pgisam_timeout */
+
+
+/*
+ * set_pgisam_write_callback
+ * Writes behind are the daemon's: their failures are logged there and
+ * reported by the next call on the file
+ */
+void set_pgisam_write_callback (pgWriteCallback callback)
+{
+__STACK(set_pgisam_write_callback)
+
+	pgout(0, "set_pgisam_write_callback: not available through pgisamd");
+
+	__return;
+
+} /* set_pgisam_write_callback */
+
+
+/*
+ * log_pgisam_stats
+ * Statistics are the daemon's (logged when it shuts down)
+ */
+void log_pgisam_stats (void)
+{
+__STACK(log_pgisam_stats)
+
+	__return;
+
+} /* log_pgisam_stats */
+
+
+/*
+ * session_open|use|close
+ * Sessions are the daemon's: each thread already has its own
+ */
+pgisam_session * session_open (void)
+{
+__STACK(session_open)
+
+	pgout(0, "session_open: not available through pgisamd");
+
+	__return NULL;
+
+} /* session_open */
+
+void session_use (pgisam_session * session)
+{
+__STACK(session_use)
+
+	__return;
+
+} /* session_use */
+
+void session_close (pgisam_session * session)
+{
+__STACK(session_close)
+
+	__return;
+
+} /* session_close */
+
+
+// _____/ x_is functions \__________
+int x_isaddindex (int isfd, struct keydesc *key)
+{
+	PROTO_REQUEST rq = { PROTO_ADDINDEX, isfd };
+
+	return call(&rq, key, sizeof(*key), NULL, 0, NULL, 0);
+
+} /* x_isaddindex */
+
+int x_isbegin (void)
+{
+	PROTO_REQUEST rq = { PROTO_BEGIN };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_isbegin */
+
+int x_isbuild (char * filename, int len, struct keydesc *key, int mode)
+{
+	PROTO_REQUEST rq = { PROTO_BUILD, 0, mode, 0, len };
+	int rlen = 0, ret;
+
+	ret = call(&rq, key, sizeof(*key), filename, strlen(filename),
+		&rlen, sizeof(rlen));
+	record_len_set(ret, rlen);
+
+	return ret;
+
+} /* x_isbuild */
+
+int x_iscleanup (void)
+{
+	PROTO_REQUEST rq = { PROTO_CLEANUP };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_iscleanup */
+
+int x_isclose (int isfd)
+{
+	PROTO_REQUEST rq = { PROTO_CLOSE, isfd };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_isclose */
+
+int x_iscommit (void)
+{
+	PROTO_REQUEST rq = { PROTO_COMMIT };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_iscommit */
+
+int x_isdelcurr (int isfd)
+{
+	PROTO_REQUEST rq = { PROTO_DELCURR, isfd };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_isdelcurr */
+
+int x_isdelete (int isfd, char *record)
+{
+	PROTO_REQUEST rq = { PROTO_DELETE, isfd };
+
+	return call(&rq, record, record_len(isfd), NULL, 0, NULL, 0);
+
+} /* x_isdelete */
+
+int x_isdelindex (int isfd, struct keydesc *key)
+{
+	PROTO_REQUEST rq = { PROTO_DELINDEX, isfd };
+
+	return call(&rq, key, sizeof(*key), NULL, 0, NULL, 0);
+
+} /* x_isdelindex */
+
+int x_isdelrec (int isfd, long recnum)
+{
+	PROTO_REQUEST rq = { PROTO_DELREC, isfd, 0, 0, recnum };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_isdelrec */
+
+int x_iserase (char *filename)
+{
+	PROTO_REQUEST rq = { PROTO_ERASE };
+
+	return call(&rq, filename, strlen(filename), NULL, 0, NULL, 0);
+
+} /* x_iserase */
+
+int x_isindexinfo (int isfd, struct keydesc *buffer, int number)
+{
+	PROTO_REQUEST rq = { PROTO_INDEXINFO, isfd, 0, 0, number };
+
+	// Index 0 fills a (smaller) struct dictinfo
+	return call(&rq, NULL, 0, NULL, 0, buffer,
+		number ? sizeof(struct keydesc) : sizeof(struct dictinfo));
+
+} /* x_isindexinfo */
+
+int x_islogclose (void)
+{
+	PROTO_REQUEST rq = { PROTO_LOGCLOSE };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_islogclose */
+
+int x_islogopen (char *logname)
+{
+	PROTO_REQUEST rq = { PROTO_LOGOPEN };
+
+	return call(&rq, logname, strlen(logname), NULL, 0, NULL, 0);
+
+} /* x_islogopen */
+
+int x_isopen (char *filename, int mode)
+{
+	PROTO_REQUEST rq = { PROTO_OPEN, 0, mode };
+	int rlen = 0, ret;
+
+	ret = call(&rq, filename, strlen(filename), NULL, 0, &rlen, sizeof(rlen));
+	record_len_set(ret, rlen);
+
+	return ret;
+
+} /* x_isopen */
+
+int x_isread (int isfd, char *record, int mode)
+{
+	PROTO_REQUEST rq = { PROTO_READ, isfd, mode };
+	int len = record_len(isfd);
+
+	return call(&rq, record, len, NULL, 0, record, len);
+
+} /* x_isread */
+
+int x_isrelease (int isfd)
+{
+	PROTO_REQUEST rq = { PROTO_RELEASE, isfd };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_isrelease */
+
+int x_isrewcurr (int isfd, char *record)
+{
+	PROTO_REQUEST rq = { PROTO_REWCURR, isfd };
+
+	return call(&rq, record, record_len(isfd), NULL, 0, NULL, 0);
+
+} /* x_isrewcurr */
+
+int x_isrewrec (int isfd, long recnum, char *record)
+{
+	PROTO_REQUEST rq = { PROTO_REWREC, isfd, 0, 0, recnum };
+
+	return call(&rq, record, record_len(isfd), NULL, 0, NULL, 0);
+
+} /* x_isrewrec */
+
+int x_isrewrite (int isfd, char *record)
+{
+	PROTO_REQUEST rq = { PROTO_REWRITE, isfd };
+
+	return call(&rq, record, record_len(isfd), NULL, 0, NULL, 0);
+
+} /* x_isrewrite */
+
+int x_isrollback (void)
+{
+	PROTO_REQUEST rq = { PROTO_ROLLBACK };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_isrollback */
+
+int x_isstart (int isfd, struct keydesc *key, int length, char *record, int mode)
+{
+	PROTO_REQUEST rq = { PROTO_START, isfd, mode, length };
+
+	return call(&rq, key, sizeof(*key), record, record_len(isfd), NULL, 0);
+
+} /* x_isstart */
+
+int x_isfinish (int isfd)
+{
+	PROTO_REQUEST rq = { PROTO_FINISH, isfd };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_isfinish */
+
+int x_iswrcurr (int isfd, char *record)
+{
+	PROTO_REQUEST rq = { PROTO_WRCURR, isfd };
+
+	return call(&rq, record, record_len(isfd), NULL, 0, NULL, 0);
+
+} /* x_iswrcurr */
+
+int x_iswrite (int isfd, char *record)
+{
+	PROTO_REQUEST rq = { PROTO_WRITE, isfd };
+
+	return call(&rq, record, record_len(isfd), NULL, 0, NULL, 0);
+
+} /* x_iswrite */
+
+int x_isbulkwrite (int isfd, char *records, int nrec)
+{
+	PROTO_REQUEST rq = { PROTO_BULKWRITE, isfd, 0, 0, nrec };
+
+	return call(&rq, records, record_len(isfd) * nrec, NULL, 0, NULL, 0);
+
+} /* x_isbulkwrite */
+
+/*
+ * x_isread_async|wait|waitany
+ * Reads are made by the daemon one at a time: x_isread_async reads at
+ * once and the wait returns its outcome
+ */
+int x_isread_async (int isfd, char *record, int mode, int *ticket)
+{
+	int *grown, ret;
+
+	// Room for its outcome first: nothing is read without it
+	if (! (grown = (int *)xrealloc(done, sizeof(int) * 3 * (ndone + 1)))) {
+		iserrno = thread_iserrno = ENOMEM;
+		return -1;
+	}
+
+	done = grown;
+	ret = x_isread(isfd, record, mode);
+
+	done[ndone * 3] = *ticket = ++next_ticket;
+	done[ndone * 3 + 1] = ret;
+	done[ndone * 3 + 2] = thread_iserrno;
+	ndone++;
+
+	return 0;
+
+} /* x_isread_async */
+
+int x_isflush (int isfd)
+{
+	PROTO_REQUEST rq = { PROTO_FLUSH, isfd };
+
+	return call(&rq, NULL, 0, NULL, 0, NULL, 0);
+
+} /* x_isflush */
+
+int x_iswait (int ticket)
+{
+	int x;
+
+	for (x=0; x < ndone && done[x * 3] != ticket; x++);
+
+	return done_take(x);
+
+} /* x_iswait */
+
+int x_iswaitany (int *ticket)
+{
+	if (ndone) {
+		*ticket = done[0];
+	}
+
+	return done_take(0);
+
+} /* x_iswaitany */
+
+
+// _____/ static functions \__________
+/*
+ * done_take
+ * Return (and forget) the outcome of the x_isread_async in slot x
+ */
+static int done_take (int x)
+{
+	int ret;
+
+__STACK(done_take)
+
+	// No such ticket: 102 = illegal argument
+	if (x >= ndone) {
+		iserrno = thread_iserrno = 2;
+		__return -1;
+	}
+
+	ret = done[x * 3 + 1];
+	iserrno = thread_iserrno = done[x * 3 + 2];
+
+	memmove(&done[x * 3], &done[(x + 1) * 3], sizeof(int) * 3 * (ndone - x - 1));
+	ndone--;
+
+	__return ret;
+
+} /* done_take */
+
+/*
+ * bridge_connect
+ * Connect the calling thread to the daemon (once)
+ */
+static bool bridge_connect (void)
+{
+	struct sockaddr_un addr;
+
+__STACK(bridge_connect)
+
+	if (sock >= 0) {
+		__return true;
+	}
+
+	if (! socket_path) {
+		socket_path = PROTO_socket_path();
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		pgout(mSYS, "bridge_connect: socket failed");
+		__return false;
+	}
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		pgout(mSYS, "bridge_connect: cannot connect to [%s]", socket_path);
+		close(sock);
+		sock = -1;
+		__return false;
+	}
+
+	__return true;
+
+} /* bridge_connect */
+
+
+/*
+ * call
+ * Send a request (payload in two parts) and wait for its reply
+ * rq			Request (len is set here)
+ * p1, l1		First part of the payload
+ * p2, l2		Second part of the payload
+ * reply		Receives the reply payload (at most replylen bytes)
+ */
+static int call (PROTO_REQUEST * rq, const void * p1, unsigned int l1,
+	const void * p2, unsigned int l2, void * reply, unsigned int replylen)
+{
+	PROTO_REPLY rp;
+	char skip[256];
+	unsigned int n;
+
+__STACK(call)
+
+	if (! bridge_connect()) {
+		iserrno = thread_iserrno = ENOBRIDGE;
+		__return -1;
+	}
+
+	rq->len = l1 + l2;
+
+	if (! PROTO_write(sock, rq, sizeof(*rq)) ||
+		(l1 && ! PROTO_write(sock, p1, l1)) ||
+		(l2 && ! PROTO_write(sock, p2, l2)) ||
+		! PROTO_read(sock, &rp, sizeof(rp))) {
+		goto lost;
+	}
+
+	// Take what fits, drop the rest
+	n = rp.len < replylen ? rp.len : replylen;
+
+	if (n && ! PROTO_read(sock, reply, n)) {
+		goto lost;
+	}
+
+	for (rp.len -= n; rp.len; rp.len -= n) {
+		n = rp.len < sizeof(skip) ? rp.len : sizeof(skip);
+		if (! PROTO_read(sock, skip, n)) {
+			goto lost;
+		}
+	}
+
+	iserrno = thread_iserrno = rp.iserrno;
+
+	__return rp.ret;
+
+lost:
+	// The daemon's session (files, transaction) is gone with the socket
+	pgout(mSYS, "lost the connection to pgisamd (request %d)", rq->op);
+	close(sock);
+	sock = -1;
+	iserrno = thread_iserrno = ENOBRIDGE;
+
+	__return -1;
+
+} /* call */
+
+
+/*
+ * record_len
+ * Record length of an open file (0 if unknown)
+ */
+static int record_len (int isfd)
+{
+	int slot = isfd & RECLEN_SLOT_MASK;
+
+__STACK(record_len)
+
+	if (isfd <= 0 || slot >= reclen_size || reclen[slot].isfd != isfd) {
+		__return 0;
+	}
+
+	__return reclen[slot].len;
+
+} /* record_len */
+
+
+/*
+ * record_len_set
+ * Keep the record length of a file just opened
+ */
+static void record_len_set (int isfd, int len)
+{
+	int slot = isfd & RECLEN_SLOT_MASK;
+	int size;
+	RECLEN *grown;
+
+__STACK(record_len_set)
+
+	if (isfd <= 0) {
+		__return;
+	}
+
+	if (slot >= reclen_size) {
+		size = reclen_size ? reclen_size : 16;
+		while (size <= slot) {
+			size <<= 1;
+		}
+
+		if (! (grown = (RECLEN *)xrealloc(reclen, sizeof(RECLEN) * size))) {
+			__return;
+		}
+
+		reclen = grown;
+		memset(reclen + reclen_size, 0, sizeof(RECLEN) * (size - reclen_size));
+		reclen_size = size;
+	}
+
+	reclen[slot].isfd = isfd;
+	reclen[slot].len = len;
+
+	__return;
+
+} /* record_len_set */
@@ -0,0 +1,610 @@
+/*
+ * pgisamd.c: per-host bridge daemon
+ *
+ * Loads the schemas once and keeps a pool of connected sessions.  Each
+ * client of libpgisamc (see pgisamc.c) is served by a thread working in
+ * a session of its own, taken from the pool when the client connects and
+ * returned (files closed, open transaction rolled back) when it leaves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <libpq-fe.h>
+
+#include <isam.h>
+#include <decimal.h>
+
+#include "sys.h"
+#include "pgbridge.h"
+#include "schema.h"
+#include "session.h"
+#include "proto.h"
+#include "xstring.h"
+
+#define WARM_SESSIONS 4			// Sessions connected at startup
+#define MAX_SESSIONS 64			// Sessions (connections) at most
+
+// Externs
+extern bool initialized;
+
+// Static data
+static char *socket_path = NULL;
+static int listen_fd = -1;
+static volatile sig_atomic_t running = true;
+
+// Session pool
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wait = PTHREAD_COND_INITIALIZER;
+static SESSION **pool = NULL;			// Idle sessions
+static int pool_idle = 0;
+static int pool_busy = 0;
+static int pool_max = MAX_SESSIONS;
+
+// Static function prototypes
+static void signal_handler (int signo);
+static void usage (void);
+static SESSION * pool_get (void);
+static void pool_put (SESSION * session);
+static void * client_main (void * data);
+static void serve (int fd);
+static int dispatch (PROTO_REQUEST * rq, char * buf, char ** reply,
+	unsigned int * replylen);
+static bool request_fits (PROTO_REQUEST * rq);
+static int bad_request (PROTO_REQUEST * rq);
+
+
+// CODE STARTS HERE
+
+
+/* signal_handler
+ */
+static void signal_handler (int signo)
+{
+	running = false;
+
+} /* signal_handler */
+
+
+/* usage
+ */
+static void usage (void)
+{
+	fprintf(stderr,
+		"usage: pgisamd [-v] [-n warm] [-m max] [-s socket]\n"
+		"  -n  sessions connected at startup [%d]\n"
+		"  -m  sessions (database connections) at most [%d]\n"
+		"  -s  socket path [$PGISAMD_SOCKET or $BRIDGE/%s]\n"
+		"  -v  verbose\n"
+		,WARM_SESSIONS
+		,MAX_SESSIONS
+		,PROTO_SOCKET
+		);
+
+} /* usage */
+
+
+int main (int argc, char ** argv)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	int c, warm = WARM_SESSIONS;
+	bool verbose = false;
+	extern int optind;
+	extern char *optarg;
+
+	// Parse options on command line
+	while ((c = getopt(argc, argv, "n:m:s:v?")) != -1) {
+		switch (c) {
+			case 'n':
+			warm = atoi(optarg);
+			break;
+
+			case 'm':
+			pool_max = atoi(optarg);
+			break;
+
+			case 's':
+			socket_path = str_dup(optarg);
+			break;
+
+			case 'v':
+			verbose = true;
+			break;
+
+			case '?':
+			usage(); exit(EXIT_SUCCESS);
+
+			default:
+			usage(); exit(EXIT_FAILURE);
+		}
+	}
+
+	if (pool_max < 1 || warm < 0 || warm > pool_max) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	pgout_set("logs/pgisamd.log");
+
+	if (verbose) {
+		pgout_set_display();
+	}
+
+	pgout(mDTSTAMP, "pgisamd: started");
+
+	// Stop accepting on TERM/INT (accept is interrupted, not restarted)
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signal_handler;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// Load the schemas (shared by every session)
+	if (! init_program()) {
+		pgout(mDISPLAY, "pgisamd: could not initialize the program");
+		exit(EXIT_FAILURE);
+	}
+
+	// Connect the warm sessions
+	pool = (SESSION **)xalloc(sizeof(SESSION *) * pool_max);
+
+	while (pool_idle < warm) {
+		SESSION *session = SESSION_new();
+
+		if (! session) {
+			pgout(0, "pgisamd: could only connect %d sessions", pool_idle);
+			break;
+		}
+
+		pool[pool_idle++] = session;
+	}
+
+	if (! socket_path) {
+		socket_path = PROTO_socket_path();
+	}
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		pgout(mDISPLAY, "pgisamd: socket path too long [%s]", socket_path);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	unlink(socket_path);
+
+	if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+		bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(listen_fd, SOMAXCONN) < 0) {
+		pgout(mSYS|mDISPLAY, "pgisamd: cannot listen on [%s]", socket_path);
+		exit(EXIT_FAILURE);
+	}
+
+	pgout(mDEBUG1, "listening on [%s], %d of %d sessions connected",
+		socket_path, pool_idle, pool_max);
+
+	while (running) {
+		pthread_t thread;
+		int fd = accept(listen_fd, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno != EINTR) {
+				pgout(mSYS, "accept failed");
+			}
+			continue;
+		}
+
+		if (pthread_create(&thread, NULL, client_main, (void *)(long)fd)) {
+			pgout(mSYS, "cannot start a client thread");
+			close(fd);
+			continue;
+		}
+
+		pthread_detach(thread);
+	}
+
+	pgout(mDTSTAMP, "pgisamd: stopping");
+
+	close(listen_fd);
+	unlink(socket_path);
+
+	// Clients still connected keep their sessions until the process ends
+	pthread_mutex_lock(&pool_lock);
+	while (pool_idle) {
+		SESSION_delete(&pool[--pool_idle]);
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if (initialized) {
+		shutdown_program();
+	}
+
+	exit(EXIT_SUCCESS);
+
+} /* main */
+
+
+// _____/ pool functions \__________
+/*
+ * pool_get
+ * Take an idle session (or connect one), waiting while max are in use
+ */
+static SESSION * pool_get (void)
+{
+	SESSION *session = NULL;
+
+__STACK(pool_get)
+
+	pthread_mutex_lock(&pool_lock);
+
+	while (! pool_idle && pool_busy >= pool_max) {
+		pthread_cond_wait(&pool_wait, &pool_lock);
+	}
+
+	pool_busy++;
+
+	if (pool_idle) {
+		session = pool[--pool_idle];
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+
+	// Connect outside the lock
+	if (! session && ! (session = SESSION_new())) {
+		pthread_mutex_lock(&pool_lock);
+		pool_busy--;
+		pthread_cond_signal(&pool_wait);
+		pthread_mutex_unlock(&pool_lock);
+	}
+
+	__return session;
+
+} /* pool_get */
+
+
+/*
+ * pool_put
+ * Return a session to the pool (a broken one is dropped)
+ * session		Session, already cleaned up for the next client
+ */
+static void pool_put (SESSION * session)
+{
+__STACK(pool_put)
+
+	if (session->conn->is_connected &&
+		PQstatus(session->conn->pgconn) == CONNECTION_BAD) {
+		pgout(0, "dropping a session with a broken connection");
+		SESSION_delete(&session);
+	}
+
+	pthread_mutex_lock(&pool_lock);
+
+	pool_busy--;
+
+	if (session) {
+		pool[pool_idle++] = session;
+	}
+
+	pthread_cond_signal(&pool_wait);
+	pthread_mutex_unlock(&pool_lock);
+
+	__return;
+
+} /* pool_put */
+
+
+// _____/ client functions \__________
+/*
+ * client_main
+ * Serve one client connection in a session from the pool
+ * data			Client socket
+ */
+static void * client_main (void * data)
+{
+	int fd = (int)(long)data;
+	SESSION *session;
+
+__STACK(client_main)
+
+	if (! (session = pool_get())) {
+		pgout(0, "no session for a client");
+		close(fd);
+		__return NULL;
+	}
+
+	SESSION_use(session);
+
+	pgout(mDEBUG2, "client connected (fd %d)", fd);
+
+	serve(fd);
+
+	pgout(mDEBUG2, "client disconnected (fd %d)", fd);
+
+	// Leave nothing behind for the next client
+	x_iscleanup();
+
+	if (session->conn->in_transaction) {
+		x_isrollback();
+	}
+
+	// set_pgisam_timeout(0, ms) was the client's
+	session->timeout = 0;
+
+	SESSION_use(NULL);
+	pool_put(session);
+
+	close(fd);
+
+	__return NULL;
+
+} /* client_main */
+
+
+/*
+ * serve
+ * Answer a client's requests until it disconnects
+ * fd			Client socket
+ */
+static void serve (int fd)
+{
+	PROTO_REQUEST rq;
+	PROTO_REPLY rp;
+	char *buf = NULL;
+	unsigned int bufsz = 0;
+
+__STACK(serve)
+
+	while (PROTO_read(fd, &rq, sizeof(rq))) {
+		char *reply = NULL;
+		unsigned int replylen = 0;
+
+		if (rq.len > PROTO_MAXLEN) {
+			pgout(0, "request too large (%u bytes)", rq.len);
+			break;
+		}
+
+		// Room for the payload, NUL terminated for names
+		if (rq.len + 1 > bufsz) {
+			char *grown = (char *)xrealloc(buf, rq.len + 1);
+		
+			if (! grown) {
+				break;
+			}
+			buf = grown;
+			bufsz = rq.len + 1;
+		}
+
+		if (! PROTO_read(fd, buf, rq.len)) {
+			break;
+		}
+
+		buf[rq.len] = '\0';
+
+		rp.ret = dispatch(&rq, buf, &reply, &replylen);
+		rp.iserrno = get_iserrno();
+		rp.len = replylen;
+
+		if (! PROTO_write(fd, &rp, sizeof(rp)) ||
+			(replylen && ! PROTO_write(fd, reply, replylen))) {
+			break;
+		}
+	}
+
+	xfree(buf);
+
+	__return;
+
+} /* serve */
+
+
+/*
+ * dispatch
+ * Make the call a request stands for
+ * rq			Request
+ * buf			Its payload (records are updated in place)
+ * reply		Receives the reply payload (may point into buf)
+ * replylen		Receives the reply payload length
+ */
+static int dispatch (PROTO_REQUEST * rq, char * buf, char ** reply,
+	unsigned int * replylen)
+{
+	static __thread int reclen;		// Reply to OPEN/BUILD
+	static __thread struct keydesc info;
+	struct keydesc key;
+	CONTEXT *cx;
+	int ret;
+
+__STACK(dispatch)
+
+	// Requests carrying a keydesc start with it
+	memset(&key, 0, sizeof(key));
+
+	switch (rq->op) {
+	case PROTO_BUILD:
+	case PROTO_START:
+	case PROTO_ADDINDEX:
+	case PROTO_DELINDEX:
+		if (rq->len < sizeof(key)) {
+			__return bad_request(rq);
+		}
+		memcpy(&key, buf, sizeof(key));
+		break;
+	}
+	
+	// The bridge reads and writes whole records of the file
+	if (! request_fits(rq)) {
+		__return bad_request(rq);
+	}
+
+	switch (rq->op) {
+	case PROTO_OPEN:
+		ret = x_isopen(buf, rq->mode);
+		break;
+	case PROTO_BUILD:
+		ret = x_isbuild(buf + sizeof(key), (int)rq->arg, &key, rq->mode);
+		break;
+	case PROTO_ERASE:
+		__return x_iserase(buf);
+	case PROTO_CLOSE:
+		__return x_isclose(rq->isfd);
+	case PROTO_CLEANUP:
+		__return x_iscleanup();
+	case PROTO_BEGIN:
+		__return x_isbegin();
+	case PROTO_COMMIT:
+		__return x_iscommit();
+	case PROTO_ROLLBACK:
+		__return x_isrollback();
+	case PROTO_READ:
+		*reply = buf;
+		*replylen = rq->len;
+		__return x_isread(rq->isfd, buf, rq->mode);
+	case PROTO_START:
+		__return x_isstart(rq->isfd, &key, rq->length, buf + sizeof(key),
+			rq->mode);
+	case PROTO_WRITE:
+		__return x_iswrite(rq->isfd, buf);
+	case PROTO_WRCURR:
+		__return x_iswrcurr(rq->isfd, buf);
+	case PROTO_REWRITE:
+		__return x_isrewrite(rq->isfd, buf);
+	case PROTO_REWCURR:
+		__return x_isrewcurr(rq->isfd, buf);
+	case PROTO_REWREC:
+		__return x_isrewrec(rq->isfd, (long)rq->arg, buf);
+	case PROTO_DELETE:
+		__return x_isdelete(rq->isfd, buf);
+	case PROTO_DELCURR:
+		__return x_isdelcurr(rq->isfd);
+	case PROTO_DELREC:
+		__return x_isdelrec(rq->isfd, (long)rq->arg);
+	case PROTO_BULKWRITE:
+		__return x_isbulkwrite(rq->isfd, buf, (int)rq->arg);
+	case PROTO_ADDINDEX:
+		__return x_isaddindex(rq->isfd, &key);
+	case PROTO_DELINDEX:
+		__return x_isdelindex(rq->isfd, &key);
+	case PROTO_INDEXINFO:
+		memset(&info, 0, sizeof(info));
+		*reply = (char *)&info;
+		*replylen = sizeof(info);
+		__return x_isindexinfo(rq->isfd, &info, (int)rq->arg);
+	case PROTO_RELEASE:
+		__return x_isrelease(rq->isfd);
+	case PROTO_FINISH:
+		__return x_isfinish(rq->isfd);
+	case PROTO_LOGOPEN:
+		__return x_islogopen(buf);
+	case PROTO_LOGCLOSE:
+		__return x_islogclose();
+	case PROTO_FLUSH:
+		__return x_isflush(rq->isfd);
+	case PROTO_TIMEOUT:
+		__return set_pgisam_timeout(rq->isfd, (int)rq->arg);
+	case PROTO_LASTSQL:
+		if ((*reply = get_last_sql()) != (char *)NULL) {
+			*replylen = strlen(*reply) + 1;
+		}
+		__return 0;
+	default:
+		pgout(0, "unknown request %d", rq->op);
+		__return -1;
+	}
+
+	// OPEN and BUILD tell the client the record length of the file
+	reclen = 0;
+
+	if (ret >= 0 && (cx = CONTEXT_get(&SESSION_current(false)->context, ret))) {
+		reclen = cx->schema->reclen;
+	}
+
+	*reply = (char *)&reclen;
+	*replylen = sizeof(reclen);
+
+	__return ret;
+
+} /* dispatch */
+
+
+/*
+ * request_fits
+ * Does the payload hold the records (and keydesc) the call works on?
+ * rq			Request
+ *
+ * NOTE: a file that isn't open passes; its call fails (101) without
+ * touching the payload
+ */
+static bool request_fits (PROTO_REQUEST * rq)
+{
+	SESSION *ss = SESSION_current(false);
+	CONTEXT *cx;
+	unsigned long long need;
+
+__STACK(request_fits)
+
+	switch (rq->op) {
+	case PROTO_READ:
+	case PROTO_START:
+	case PROTO_WRITE:
+	case PROTO_WRCURR:
+	case PROTO_REWRITE:
+	case PROTO_REWCURR:
+	case PROTO_REWREC:
+	case PROTO_DELETE:
+	case PROTO_BULKWRITE:
+		break;
+	default:
+		__return true;
+	}
+
+	if (! ss || ! (cx = CONTEXT_get(&ss->context, rq->isfd))) {
+		__return true;
+	}
+
+	need = cx->schema->reclen;
+
+	if (rq->op == PROTO_START) {
+		need += sizeof(struct keydesc);
+	}
+
+	// Exactly nrec records
+	if (rq->op == PROTO_BULKWRITE) {
+		__return (rq->arg >= 0 &&
+			(unsigned long long)rq->arg * need == rq->len) ? true : false;
+	}
+
+	__return (rq->len >= need) ? true : false;
+
+} /* request_fits */
+
+
+/*
+ * bad_request
+ * Fail a malformed request with iserrno 2 (102, illegal argument)
+ * rq			Request
+ */
+static int bad_request (PROTO_REQUEST * rq)
+{
+	SESSION *ss = SESSION_current(false);
+
+__STACK(bad_request)
+
+	pgout(0, "malformed request %d on isfd %d (%u bytes)",
+		rq->op, rq->isfd, rq->len);
+
+	iserrno = 2;
+	if (ss) {
+		ss->iserrno = iserrno;
+	}
+
+	__return -1;
+
+} /* bad_request */
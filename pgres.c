@@ -8,12 +8,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <time.h>
 
 // For keydesc in schema.h
 #include <isam.h>
 
 #include <libpq-fe.h>
 
+// pg_send/pg_receive pipeline lookups (x_isread_async)
+#ifndef LIBPQ_HAS_PIPELINING
+#error "libpq 14 or later is required (pipeline mode)"
+#endif
+
 #include "sys.h"
 #include "schema.h"
 #include "pgres.h"
@@ -22,9 +31,13 @@
 
 // Static data
 
-// Shared data
-char * last_sql = NULL;
-int last_sql_count = 0;
+// Shared data (per thread, as sessions are)
+__thread char * last_sql = NULL;
+__thread int last_sql_count = 0;
+
+// Deadline of the thread's current call (see pg_deadline)
+static __thread double deadline = 0.0;	// ms since the epoch (0 = none)
+static __thread bool timed_out = false;	// A statement was cancelled at it
 
 static char color_red[] = {	0x1b, '[', '3', '1', 'm', 0 };
 static char color_magenta[] = { 0x1b, '[', '3', '5', 'm', 0 };
@@ -33,6 +46,12 @@ static char color_normal[] = { 0x1b, '[', '3', '7', 'm', 0 };
 
 // Static function prototypes
 static void pg_print_tuples(FILE *fd, RES *res);
+static RES * pg_exec_format (CONN * conn, char * sql, int format);
+static PGresult * pg_exec_deadline (CONN * conn, char * sql, int format);
+static bool pg_await (CONN * conn, bool * cancelled);
+static double pg_clock (void);
+static RES * pg_pipe_result (CONN * conn);
+static void pg_drain (CONN * conn);
 
 
 // CODE STARTS HERE
@@ -50,7 +69,7 @@ __STACK(pg_msg)
 	
 	va_start(ap, fmt);
 	
-	vsprintf(buf, fmt, ap);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
 	
 	pgout_t(0, "SQL %s [%s]", PQerrorMessage (conn->pgconn), buf);
 	
@@ -81,40 +100,155 @@ __STACK(pg_free)
 
 /*
  * pg_startup
- * Startup a connection to a Postgres database
+ * Startup a connection to a Postgres database (waits for it)
  */
-CONN * pg_startup (CONN * conn, char * connstr, char * set_schema)
+CONN * pg_startup (CONN * conn)
 {
-	PGconn * pgconn = NULL;
-	PGresult * res = NULL;
-	char *sql = NULL;
-	
 __STACK(pg_startup)
 	
-	pgout(mDEBUG3, "pg_startup: connecting [%s]", connstr);
+	if (! pg_connect_start(conn) || ! pg_ready(conn)) {
+		__return (CONN *)NULL;
+	}
 	
-	conn->pgconn = PQconnectdb(connstr);
+	__return conn;
 	
-	if (PQstatus(conn->pgconn) != CONNECTION_OK) {
-		pg_msg(conn, 0, "pg_startup");
-		pgout(mDEBUG, "connstr=[%s]", connstr);
-		__return (CONN *)NULL;
+} /* pg_startup */
+
+
+/*
+ * pg_connect_start
+ * Start connecting to conn->connstr without waiting (see pg_ready)
+ */
+bool pg_connect_start (CONN * conn)
+{
+	struct timeval now;
+	
+__STACK(pg_connect_start)
+	
+	pgout(mDEBUG3, "pg_connect_start: connecting [%s]", conn->connstr);
+	
+	gettimeofday(&now, NULL);
+	conn->started = now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+	
+	conn->pgconn = PQconnectStart(conn->connstr);
+	conn->is_pending = true;
+	
+	// As if PQconnectStart had returned PGRES_POLLING_WRITING
+	conn->polling = PGRES_POLLING_WRITING;
+	
+	if (! conn->pgconn || PQstatus(conn->pgconn) == CONNECTION_BAD) {
+		pg_msg(conn, 0, "pg_connect_start");
+		pgout(mDEBUG, "connstr=[%s]", conn->connstr);
+		PQfinish(conn->pgconn);
+		conn->pgconn = NULL;
+		conn->is_pending = false;
+		__return false;
 	}
 	
-	asprintf(&sql, "SET search_path TO %s", set_schema);
-	res = PQexec(conn->pgconn, sql);
-	xfree(sql);
+	__return true;
 	
-    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-		pg_msg(conn, 0, "%s failed", sql);
-        PQclear(res);
-        PQfinish(conn->pgconn);
-        __return (CONN *)NULL;
-    }
+} /* pg_connect_start */
+
+
+/*
+ * pg_connect_poll
+ * Advance a started connection as far as it can go without waiting, so
+ * the startup and authentication exchange runs while the caller works
+ * (e.g. init_program between schemas); true once it is connected
+ */
+bool pg_connect_poll (CONN * conn)
+{
+	struct pollfd pfd;
 	
-	__return conn;
+__STACK(pg_connect_poll)
 	
-} /* pg_startup */
+	if (! conn || conn->is_connected || ! conn->is_pending) {
+		__return (conn && conn->is_connected) ? true : false;
+	}
+	
+	while (conn->polling != PGRES_POLLING_OK &&
+		conn->polling != PGRES_POLLING_FAILED) {
+		pfd.fd = PQsocket(conn->pgconn);
+		pfd.events = (conn->polling == PGRES_POLLING_READING) ? POLLIN : POLLOUT;
+		pfd.revents = 0;
+		
+		// Not ready: pg_ready (or the next poll) carries on
+		if (poll(&pfd, 1, 0) <= 0) {
+			break;
+		}
+		
+		conn->polling = PQconnectPoll(conn->pgconn);
+	}
+	
+	__return (conn->polling == PGRES_POLLING_OK) ? true : false;
+	
+} /* pg_connect_poll */
+
+
+/*
+ * pg_ready
+ * Finish connecting (starting first if that was put off); every
+ * statement goes through here, so a connection is only waited for (or
+ * made at all) when it is first used
+ */
+bool pg_ready (CONN * conn)
+{
+	PostgresPollingStatusType status;
+	struct timeval start, end;
+	
+__STACK(pg_ready)
+	
+	if (conn->is_connected) {
+		__return true;
+	}
+	
+	gettimeofday(&start, NULL);
+	
+	if (! conn->is_pending && ! pg_connect_start(conn)) {
+		__return false;
+	}
+	
+	// Carry on from where pg_connect_poll left it
+	status = conn->polling;
+	
+	while (status != PGRES_POLLING_OK && status != PGRES_POLLING_FAILED) {
+		struct pollfd pfd;
+		
+		pfd.fd = PQsocket(conn->pgconn);
+		pfd.events = (status == PGRES_POLLING_READING) ? POLLIN : POLLOUT;
+		pfd.revents = 0;
+		
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			pgout(mSYS, "poll failed");
+			status = PGRES_POLLING_FAILED;
+			break;
+		}
+		
+		status = PQconnectPoll(conn->pgconn);
+	}
+	
+	conn->polling = status;
+	conn->is_pending = false;
+	
+	if (status == PGRES_POLLING_FAILED) {
+		pg_msg(conn, 0, "pg_ready");
+		pgout(mDEBUG, "connstr=[%s]", conn->connstr);
+		PQfinish(conn->pgconn);
+		conn->pgconn = NULL;
+		__return false;
+	}
+	
+	gettimeofday(&end, NULL);
+	
+	pgout(mDEBUG1, "connected in %.3f ms (%.3f ms waiting)"
+		,end.tv_sec * 1000.0 + end.tv_usec / 1000.0 - conn->started
+		,(end.tv_sec - start.tv_sec) * 1000.0 +
+			(end.tv_usec - start.tv_usec) / 1000.0
+		);
+	
+	__return conn->is_connected = true;
+	
+} /* pg_ready */
 
 
 /*
@@ -128,6 +262,14 @@ __STACK(pg_shutdown)
 	pgout(mDEBUG3, "disconnecting");
     PQfinish(conn->pgconn);
     
+	// Results nobody came for
+	while (conn->received) {
+		RES *res = conn->received;
+		
+		conn->received = res->next;
+		RES_delete(&res);
+	}
+    
 	__return true;
 	
 } /* pg_shutdown */
@@ -147,7 +289,8 @@ static void pg_print_tuples(FILE *fd, RES *res)
 	
 __STACK(pg_print_tuples)
 	
-	if (! rows) {
+	// Binary results aren't printable
+	if (! rows || PQbinaryTuples(res->pgres)) {
 		__return;
 	}
 	
@@ -220,24 +363,68 @@ __STACK(pg_print_tuples)
  * Execute a query on a postgres database
  */
 RES * pg_exec (CONN * conn, char * sql)
+{
+__STACK(pg_exec)
+
+	__return pg_exec_format(conn, sql, 0);
+
+} /* pg_exec */
+
+
+/*
+ * pg_exec_binary
+ * Execute a query on a postgres database, returning binary results
+ * (see CODEC_<type>_bin_to_record)
+ */
+RES * pg_exec_binary (CONN * conn, char * sql)
+{
+__STACK(pg_exec_binary)
+
+	__return pg_exec_format(conn, sql, 1);
+
+} /* pg_exec_binary */
+
+
+/*
+ * pg_exec_format
+ * Execute a query with text (0) or binary (1) results
+ */
+static RES * pg_exec_format (CONN * conn, char * sql, int format)
 {
 	RES *res = NULL;
 	ExecStatusType pgstatus;
 
-__STACK(pg_exec)
+__STACK(pg_exec_format)
 
 	if (PGIsamOptions & PrintOnly) {
 		fprintf(stdout, "%s\n", sql);
 		__return (RES *)NULL;		
 	}
 	
+	if (! pg_ready(conn)) {
+		__return (RES *)NULL;
+	}
+	
+	// Read what pg_send left on the wire first
+	if (conn->pipelined) {
+		pg_drain(conn);
+	}
+	
 	res = (RES *)xalloc(sizeof(RES));
 	
 	// Store the last_sql global
 	str_free(&last_sql);	
 	str_append(&last_sql, "%s;", sql);
 	
-	res->pgres = PQexec(conn->pgconn, sql);
+	if (deadline) {
+		res->pgres = pg_exec_deadline(conn, sql, format);
+	} else
+	if (format) {
+		res->pgres = PQexecParams(conn->pgconn, sql, 0, NULL, NULL, NULL,
+			NULL, format);
+	} else {
+		res->pgres = PQexec(conn->pgconn, sql);
+	}
 	
 	pgstatus = PQresultStatus(res->pgres);
 
@@ -264,4 +451,491 @@ __STACK(pg_exec)
 	
 	__return res;
 	
-} /* pg_exec */
+} /* pg_exec_format */
+
+
+/*
+ * pg_exec_deadline
+ * Execute a query, cancelling it on the server if it runs past the
+ * thread's deadline (PQexec's result: the last, NULL = none)
+ */
+static PGresult * pg_exec_deadline (CONN * conn, char * sql, int format)
+{
+	PGresult *pgres, *last = NULL;
+	bool cancelled = false;
+	char *state;
+	int sent;
+
+__STACK(pg_exec_deadline)
+
+	if (format) {
+		sent = PQsendQueryParams(conn->pgconn, sql, 0, NULL, NULL, NULL,
+			NULL, format);
+	} else {
+		sent = PQsendQuery(conn->pgconn, sql);
+	}
+	
+	if (! sent) {
+		__return (PGresult *)NULL;
+	}
+	
+	// Collect what arrives until the NULL after the last result
+	while (pg_await(conn, &cancelled)) {
+		if ((pgres = PQgetResult(conn->pgconn)) == (PGresult *)NULL) {
+			goto done;
+		}
+		PQclear(last);
+		last = pgres;
+	}
+	
+	// Broken off: read the rest, or the connection would refuse the next
+	// query (once it is lost, PQgetResult answers at once)
+	while ((pgres = PQgetResult(conn->pgconn)) != (PGresult *)NULL) {
+		PQclear(last);
+		last = pgres;
+	}
+	
+done:
+	// Finished as it was cancelled: not a timeout
+	state = last ? PQresultErrorField(last, PG_DIAG_SQLSTATE) : NULL;
+	
+	if (cancelled && state && ! strcmp(state, "57014")) {
+		pgout(0, "cancelled at the deadline: %s", sql);
+		timed_out = true;
+	}
+	
+	__return last;
+
+} /* pg_exec_deadline */
+
+
+/*
+ * pg_await
+ * Wait until PQgetResult would not block, cancelling the statement on
+ * the server if the thread's deadline passes (false = connection failed)
+ * conn			Connection
+ * cancelled	Set once the cancel is sent (the server answers with an error)
+ */
+static bool pg_await (CONN * conn, bool * cancelled)
+{
+	struct pollfd pfd;
+	int wait;
+
+__STACK(pg_await)
+
+	pfd.fd = PQsocket(conn->pgconn);
+	pfd.events = POLLIN;
+	
+	while (PQisBusy(conn->pgconn)) {
+		wait = (*cancelled || ! deadline) ? -1 : (int)(deadline - pg_clock());
+		
+		// Out of time: the server stops the statement and answers
+		// with an error (the transaction, if any, is aborted)
+		if (! *cancelled && deadline && wait <= 0) {
+			PGcancel *cancel = PQgetCancel(conn->pgconn);
+			char errbuf[256];
+			
+			if (! cancel || ! PQcancel(cancel, errbuf, sizeof(errbuf))) {
+				pgout(0, "unable to cancel: %s", cancel ? errbuf : "no cancel");
+			}
+			
+			PQfreeCancel(cancel);
+			*cancelled = true;
+			continue;
+		}
+		
+		pfd.revents = 0;
+		
+		if (poll(&pfd, 1, wait) < 0 && errno != EINTR) {
+			pgout(mSYS, "poll failed");
+			__return false;
+		}
+		
+		if (! PQconsumeInput(conn->pgconn)) {
+			__return false;
+		}
+	}
+	
+	__return true;
+
+} /* pg_await */
+
+
+/*
+ * pg_deadline
+ * Give the statements of the thread's current call a time budget
+ * ms			Milliseconds from now (0 or less = none)
+ */
+void pg_deadline (int ms)
+{
+__STACK(pg_deadline)
+
+	deadline = (ms > 0) ? pg_clock() + ms : 0.0;
+	timed_out = false;
+	
+	__return;
+
+} /* pg_deadline */
+
+
+/*
+ * pg_deadline_end
+ * Lift the deadline of the thread's current call, for statements that
+ * undo what it failed to do (pg_timed_out still says if it was cancelled)
+ */
+void pg_deadline_end (void)
+{
+__STACK(pg_deadline_end)
+
+	deadline = 0.0;
+	
+	__return;
+
+} /* pg_deadline_end */
+
+
+/*
+ * pg_timed_out
+ * Was a statement of the thread's current call cancelled at its deadline?
+ */
+bool pg_timed_out (void)
+{
+__STACK(pg_timed_out)
+
+	__return timed_out;
+
+} /* pg_timed_out */
+
+
+/*
+ * pg_clock
+ * Milliseconds on the monotonic clock (deadlines are not moved by changes
+ * to the wall clock)
+ */
+static double pg_clock (void)
+{
+	struct timespec now;
+
+__STACK(pg_clock)
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	__return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+
+} /* pg_clock */
+
+
+/*
+ * pg_copy
+ * Stream COPY ... FROM STDIN data to a postgres database
+ * conn			Connection object
+ * sql			The COPY statement
+ * data			COPY text format rows
+ * len			Length of data
+ */
+bool pg_copy (CONN * conn, char * sql, char * data, size_t len)
+{
+	PGresult *pgres;
+	bool ret = true;
+
+__STACK(pg_copy)
+
+	if (PGIsamOptions & PrintOnly) {
+		fprintf(stdout, "%s;\n%.*s\\.\n", sql, (int)len, data);
+		__return true;
+	}
+	
+	if (! pg_ready(conn)) {
+		__return false;
+	}
+	
+	if (conn->pipelined) {
+		pg_drain(conn);
+	}
+	
+	// Store the last_sql global
+	str_free(&last_sql);	
+	str_append(&last_sql, "%s;", sql);
+	
+	pgres = PQexec(conn->pgconn, sql);
+	
+	if (PQresultStatus(pgres) != PGRES_COPY_IN) {
+		pg_msg(conn, 0, "%s", sql);
+		PQclear(pgres);
+		__return false;
+	}
+	
+	PQclear(pgres);
+	
+	if (PQputCopyData(conn->pgconn, data, len) != 1) {
+		pg_msg(conn, 0, "%s (data)", sql);
+		ret = false;
+	}
+	
+	if (PQputCopyEnd(conn->pgconn, ret ? NULL : "pg_copy failed") != 1) {
+		pg_msg(conn, 0, "%s (end)", sql);
+		ret = false;
+	}
+	
+	// Collect the COPY status
+	while ((pgres = PQgetResult(conn->pgconn)) != (PGresult *)NULL) {
+		if (PQresultStatus(pgres) != PGRES_COMMAND_OK) {
+			pg_msg(conn, 0, "%s", sql);
+			ret = false;
+		}
+		PQclear(pgres);
+	}
+	
+	pgout(mDEBUG2, "sql=[%s] bytes=[%ld]", sql, (long)len);
+	
+	__return ret;
+
+} /* pg_copy */
+
+
+/*
+ * pg_send
+ * Send a query without waiting for its result (see pg_receive)
+ * conn			Connection (queries sent on it are pipelined)
+ * sql			Query
+ * format		Text (0) or binary (1) results
+ *
+ * NOTE: each query is synced on its own, so one failing doesn't abort
+ * those sent after it; a statement run with pg_exec first reads every
+ * result still on the wire
+ */
+bool pg_send (CONN * conn, char * sql, int format)
+{
+__STACK(pg_send)
+
+	if (PGIsamOptions & PrintOnly) {
+		fprintf(stdout, "%s\n", sql);
+		__return false;
+	}
+	
+	if (! pg_ready(conn)) {
+		__return false;
+	}
+	
+	if (PQpipelineStatus(conn->pgconn) == PQ_PIPELINE_OFF &&
+		! PQenterPipelineMode(conn->pgconn)) {
+		pg_msg(conn, 0, "%s (pipeline)", sql);
+		__return false;
+	}
+	
+	// Store the last_sql global
+	str_free(&last_sql);	
+	str_append(&last_sql, "%s;", sql);
+	
+	if (! PQsendQueryParams(conn->pgconn, sql, 0, NULL, NULL, NULL, NULL,
+		format) || ! PQpipelineSync(conn->pgconn)) {
+		pg_msg(conn, 0, "%s", sql);
+		if (! conn->pipelined) {
+			PQexitPipelineMode(conn->pgconn);
+		}
+		__return false;
+	}
+	
+	conn->pipelined++;
+	
+	pgout(mDEBUG2, "sql=[%s] pipelined=[%d]", sql, conn->pipelined);
+	
+	__return true;
+
+} /* pg_send */
+
+
+/*
+ * pg_receive
+ * Result of the oldest query sent by pg_send (NULL = it failed)
+ * conn			Connection it was sent on
+ */
+RES * pg_receive (CONN * conn)
+{
+	RES *res;
+
+__STACK(pg_receive)
+
+	if ((res = conn->received) != (RES *)NULL) {
+		conn->received = res->next;
+		res->next = NULL;
+	} else
+	if (conn->pipelined) {
+		res = pg_pipe_result(conn);
+	}
+	
+	if (res && ! res->pgres) {
+		RES_delete(&res);
+	}
+	
+	__return res;
+
+} /* pg_receive */
+
+
+/*
+ * pg_receive_ready
+ * Would pg_receive return without waiting for the server?
+ * conn			Connection
+ */
+bool pg_receive_ready (CONN * conn)
+{
+__STACK(pg_receive_ready)
+
+	if (conn->received || ! conn->pipelined) {
+		__return true;
+	}
+	
+	// A broken connection is ready: pg_receive reports it
+	if (! PQconsumeInput(conn->pgconn)) {
+		__return true;
+	}
+	
+	__return PQisBusy(conn->pgconn) ? false : true;
+
+} /* pg_receive_ready */
+
+
+/*
+ * pg_wait_any
+ * Wait until pg_receive is ready on one of several connections
+ * conn			Connections
+ * n			Number of connections
+ *
+ * Returns the index of the connection
+ */
+int pg_wait_any (CONN ** conn, int n)
+{
+	struct pollfd *pfd = xalloc(sizeof(struct pollfd) * n);
+	int x, wait;
+
+__STACK(pg_wait_any)
+
+	for (;;) {
+		for (x=0; x < n; x++) {
+			if (pg_receive_ready(conn[x])) {
+				xfree(pfd);
+				__return x;
+			}
+			pfd[x].fd = PQsocket(conn[x]->pgconn);
+			pfd[x].events = POLLIN;
+			pfd[x].revents = 0;
+		}
+		
+		// Out of time: pg_receive cancels the first
+		wait = deadline ? (int)(deadline - pg_clock()) : -1;
+		
+		if (deadline && wait <= 0) {
+			break;
+		}
+		
+		if (poll(pfd, n, wait) < 0 && errno != EINTR) {
+			pgout(mSYS, "poll failed");
+			break;
+		}
+	}
+	
+	xfree(pfd);
+	
+	// pg_receive waits on the first
+	__return 0;
+
+} /* pg_wait_any */
+
+
+/*
+ * pg_pipe_result
+ * Read the result of the oldest pipelined query off the wire
+ * conn			Connection
+ *
+ * NOTE: res->pgres is NULL if the query failed
+ */
+static RES * pg_pipe_result (CONN * conn)
+{
+	RES *res = (RES *)xalloc(sizeof(RES));
+	PGresult *pgres;
+	ExecStatusType pgstatus;
+	bool cancelled = false;
+	char *state;
+
+__STACK(pg_pipe_result)
+
+	// The query's result, the NULL ending it, then its sync
+	// (within the deadline of the call that reads it)
+	for (;;) {
+		pg_await(conn, &cancelled);
+		
+		if ((pgres = PQgetResult(conn->pgconn)) == (PGresult *)NULL) {
+			if (PQstatus(conn->pgconn) != CONNECTION_OK) {
+				break;
+			}
+			continue;
+		}
+		
+		if (PQresultStatus(pgres) == PGRES_PIPELINE_SYNC) {
+			PQclear(pgres);
+			break;
+		}
+		
+		if (! res->pgres) {
+			res->pgres = pgres;
+		} else {
+			PQclear(pgres);
+		}
+	}
+	
+	if (--conn->pipelined == 0) {
+		PQexitPipelineMode(conn->pgconn);
+	}
+	
+	pgstatus = PQresultStatus(res->pgres);
+	
+	// Finished as it was cancelled: not a timeout
+	state = res->pgres ? PQresultErrorField(res->pgres, PG_DIAG_SQLSTATE) : NULL;
+	
+	if (cancelled && state && ! strcmp(state, "57014")) {
+		pgout(0, "cancelled at the deadline [pipelined]");
+		timed_out = true;
+	}
+	
+	if (pgstatus != PGRES_COMMAND_OK && pgstatus != PGRES_TUPLES_OK) {
+		pgout_t(0, "SQL %s [pipelined]", res->pgres ?
+			PQresultErrorMessage(res->pgres) : PQerrorMessage(conn->pgconn));
+		PQclear(res->pgres);
+		res->pgres = NULL;
+		__return res;
+	}
+	
+	res->tuples = PQntuples(res->pgres);
+	res->nfields = PQnfields(res->pgres);
+	
+	pgout(mDEBUG2, "pipelined tuples=[%d]", res->tuples);
+	
+	__return res;
+
+} /* pg_pipe_result */
+
+
+/*
+ * pg_drain
+ * Read every pipelined result off the wire, for pg_receive to return
+ * conn			Connection
+ */
+static void pg_drain (CONN * conn)
+{
+	RES **tail = &conn->received;
+
+__STACK(pg_drain)
+
+	while (*tail) {
+		tail = &(*tail)->next;
+	}
+	
+	while (conn->pipelined) {
+		*tail = pg_pipe_result(conn);
+		tail = &(*tail)->next;
+	}
+	
+	__return;
+
+} /* pg_drain */
@@ -2,8 +2,20 @@
  * pgres.h: Postgres routines
  */
 
-CONN * pg_startup(CONN * conn, char * connstr, char * set_schema);
+CONN * pg_startup(CONN * conn);
+bool pg_connect_start(CONN * conn);
+bool pg_connect_poll(CONN * conn);
+bool pg_ready(CONN * conn);
 bool pg_shutdown(CONN * conn);
 void pg_msg(CONN * conn, int mode, char *fmt, ...);
 RES * pg_exec(CONN * conn, char * sql);
+RES * pg_exec_binary(CONN * conn, char * sql);
+bool pg_copy(CONN * conn, char * sql, char * data, size_t len);
+bool pg_send(CONN * conn, char * sql, int format);
+RES * pg_receive(CONN * conn);
+bool pg_receive_ready(CONN * conn);
+int pg_wait_any(CONN ** conn, int n);
+void pg_deadline(int ms);
+void pg_deadline_end(void);
+bool pg_timed_out(void);
 void pg_free (void *data);
@@ -19,6 +19,7 @@
 #define CLONELISTFILE "clonelist.def"
 #define MAXBUFSZ 1024
 #define SZ_TABLEREC 257
+#define TRANBLOCK 1000
 
 // Externs
 extern char *ffilename;
@@ -26,7 +27,6 @@ extern int DEBUG_LEVEL;
 extern bool append_convert;
 
 extern SCHEMA *hSchema;
-extern CONTEXT *hContext;
 
 static int printrec = 0;
 static int lastlen = 0;
@@ -42,6 +42,7 @@ static void usage (void);
 static bool clone_main (char * singlefile);
 static bool schema_main (void);
 static bool process_schema (char * schemaname);
+static void write_block (int pgfd, char * block, int nrec, size_t reclen);
 static bool process_tables (void);
 static bool process_single_table (char *table_type);
 void print_recnum (long recnum);
@@ -136,6 +137,41 @@ void print_recnum(long recnum)
 } /* print_recnum */
 
 
+/* write_block
+ * Write a block of records to a pgisam table in one transaction; if it
+ * fails, write them one at a time so only the bad records are lost
+ */
+static void write_block (int pgfd, char * block, int nrec, size_t reclen)
+{
+	int x, failed = 0;
+	
+	x_isbegin();
+	
+	if (x_isbulkwrite(pgfd, block, nrec) >= 0) {
+		x_iscommit();
+		return;
+	}
+	
+	x_isrollback();
+	
+	pgout(0, "x_isbulkwrite failed: writing the block's %d records one at a time",
+		nrec);
+	
+	for (x=0; x < nrec; x++) {
+		if (x_iswrite(pgfd, &block[(size_t)x * reclen]) < 0) {
+			pgout(0, "unable to write record %d of the block (iserrno=%d)",
+				x + 1, iserrno);
+			failed++;
+		}
+	}
+	
+	if (failed) {
+		pgout(0, "%d of %d records not written to pgisam table", failed, nrec);
+	}
+
+} /* write_block */
+
+
 /* process_schema
  * Process an individual schema (in clonelist.txt)
  * schemaname		Name of the schema
@@ -146,6 +182,7 @@ static bool process_schema (char * schemaname)
 	char *record = NULL;
 	SCHEMA *s = NULL;
 	int io, isfd, pgfd;
+	char *block = NULL;
 	int trancount = 0;
 	struct keydesc key;
 	long recnum = 0;
@@ -188,6 +225,9 @@ static bool process_schema (char * schemaname)
 	record = (char *)xalloc(s->reclen);
 	memset(record, 0x20, s->reclen);		
 	
+	// Records are written a transaction block at a time
+	block = (char *)xalloc((size_t)s->reclen * TRANBLOCK);
+	
 	io = isstart(isfd, &key, 1, record, ISFIRST);
 	if (io < 0) {
 		pgout(0, "isstart failed to position record pointer");
@@ -199,26 +239,19 @@ static bool process_schema (char * schemaname)
 	
 	while ((io = isread(isfd, record, ISNEXT)) >= 0) {
 		
-		if (trancount++ == 0) {
-			x_isbegin();
-		}
-			
 		print_recnum(recnum++);
 		
-		io = x_iswrite(pgfd, record);
-		if (io < 0) {
-			pgout(0, "x_iswrite failed: unable to write record to pgisam table");
-		}
+		memcpy(&block[(size_t)trancount * s->reclen], record, s->reclen);
 		
-		if (trancount == 1000) {
+		if (++trancount == TRANBLOCK) {
+			write_block(pgfd, block, trancount, s->reclen);
 			trancount = 0;
-			x_iscommit();
 		}
 	}
 	
-	// Commit the last block
+	// Write the last block
 	if (trancount)
-		x_iscommit();
+		write_block(pgfd, block, trancount, s->reclen);
 	
 	// Always print the last record #
 	printrec = 10;
@@ -230,6 +263,7 @@ static bool process_schema (char * schemaname)
 	x_isclose(pgfd);
 	isclose(isfd);
 	
+	xfree(block);
 	str_free(&record);
 	str_free(&isampath);
 	
@@ -0,0 +1,106 @@
+/*
+ * proto.c: pgisamd wire protocol
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "sys.h"
+#include "proto.h"
+#include "xstring.h"
+
+
+// CODE STARTS HERE
+
+
+// _____/ PROTO functions \__________
+/*
+ * PROTO_read
+ * Read exactly len bytes (false = error or end of file)
+ * fd			Socket
+ * buf			Receives the data
+ * len			Length
+ */
+bool PROTO_read (int fd, void * buf, size_t len)
+{
+	char *p = buf;
+	
+__STACK(PROTO_read)
+	
+	while (len) {
+		ssize_t n = read(fd, p, len);
+		
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		
+		if (n <= 0) {
+			__return false;
+		}
+		
+		p += n;
+		len -= n;
+	}
+	
+	__return true;
+	
+} /* PROTO_read */
+
+
+/*
+ * PROTO_write
+ * Write exactly len bytes (false = error)
+ * fd			Socket
+ * buf			Data
+ * len			Length
+ */
+bool PROTO_write (int fd, const void * buf, size_t len)
+{
+	const char *p = buf;
+	
+__STACK(PROTO_write)
+	
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		
+		if (n <= 0) {
+			__return false;
+		}
+		
+		p += n;
+		len -= n;
+	}
+	
+	__return true;
+	
+} /* PROTO_write */
+
+
+/*
+ * PROTO_socket_path
+ * Path of the daemon's socket (allocated)
+ */
+char * PROTO_socket_path (void)
+{
+	char *path = NULL;
+	
+__STACK(PROTO_socket_path)
+	
+	if (getenv("PGISAMD_SOCKET")) {
+		__return str_dup(getenv("PGISAMD_SOCKET"));
+	}
+	
+	str_append(&path, "%s/%s"
+		,getenv("BRIDGE") ? getenv("BRIDGE") : "."
+		,PROTO_SOCKET
+		);
+	
+	__return path;
+	
+} /* PROTO_socket_path */
@@ -0,0 +1,92 @@
+/*
+ * proto.h: pgisamd wire protocol
+ *
+ * Clients (libpgisamc) send one request per x_is* call over a Unix domain
+ * socket and wait for its reply.  Both ends run on the same host, so
+ * integers and struct keydesc travel in native layout.  Each client
+ * connection is served by its own bridge session in the daemon: open
+ * files, cursors and transactions belong to that client alone.
+ */
+
+#ifndef _PROTO_H
+#define _PROTO_H
+
+#define PROTO_SOCKET "pgisamd.sock"	// In $BRIDGE unless PGISAMD_SOCKET is set
+#define PROTO_MAXLEN (64 * 1024 * 1024)	// Largest payload accepted
+
+/*
+ * PROTO_OP
+ * Requests (payload / reply payload in the comments)
+ */
+typedef enum PROTO_OP_T {
+	 PROTO_OPEN = 1		// filename / int reclen
+	,PROTO_BUILD		// keydesc, filename / int reclen
+	,PROTO_ERASE		// filename
+	,PROTO_CLOSE
+	,PROTO_CLEANUP
+	,PROTO_BEGIN
+	,PROTO_COMMIT
+	,PROTO_ROLLBACK
+	,PROTO_READ			// record / record
+	,PROTO_START		// keydesc, record
+	,PROTO_WRITE		// record
+	,PROTO_WRCURR		// record
+	,PROTO_REWRITE		// record
+	,PROTO_REWCURR		// record
+	,PROTO_REWREC		// record
+	,PROTO_DELETE		// record
+	,PROTO_DELCURR
+	,PROTO_DELREC
+	,PROTO_BULKWRITE	// records
+	,PROTO_ADDINDEX		// keydesc
+	,PROTO_DELINDEX		// keydesc
+	,PROTO_INDEXINFO	// / keydesc (or dictinfo)
+	,PROTO_RELEASE
+	,PROTO_FINISH
+	,PROTO_LOGOPEN		// logname
+	,PROTO_LOGCLOSE
+	,PROTO_LASTSQL		// / last statement
+	,PROTO_TIMEOUT		// (arg = ms)
+	,PROTO_FLUSH
+} PROTO_OP;
+
+/*
+ * PROTO_REQUEST
+ * Request header (len bytes of payload follow)
+ */
+typedef struct PROTO_REQUEST_T {
+	int op;					// PROTO_OP
+	int isfd;				// File descriptor (when the call takes one)
+	int mode;				// Mode (isopen, isread, isstart...)
+	int length;				// isstart key length
+	long long arg;			// reclen, recnum, nrec or index number
+	unsigned int len;		// Payload length
+} PROTO_REQUEST;
+
+/*
+ * PROTO_REPLY
+ * Reply header (len bytes of payload follow)
+ */
+typedef struct PROTO_REPLY_T {
+	int ret;				// Return value of the call
+	int iserrno;			// iserrno after the call
+	unsigned int len;		// Payload length
+} PROTO_REPLY;
+
+/*
+ * PROTO_read | write
+ * Read or write exactly len bytes (false = error or end of file)
+ * fd			Socket
+ * buf			Data
+ * len			Length
+ */
+bool PROTO_read (int fd, void * buf, size_t len);
+bool PROTO_write (int fd, const void * buf, size_t len);
+
+/*
+ * PROTO_socket_path
+ * Path of the daemon's socket (allocated)
+ */
+char * PROTO_socket_path (void);
+
+#endif // _PROTO_H
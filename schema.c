@@ -9,6 +9,7 @@
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <pthread.h>
 
 // For keydesc
 #include <isam.h>
@@ -18,11 +19,29 @@
 
 #include "sys.h"
 #include "schema.h"
+#include "codec.h"
 #include "pgres.h"
+#include "hash.h"
 #include "xstring.h"
 
 #define MAXBUFSZ 1024
-#define MAXFDS 512
+#define HANDLE_SLOT_BITS 16		// isfd = generation << HANDLE_SLOT_BITS | (slot + 1)
+#define HANDLE_SLOT_MASK ((1 << HANDLE_SLOT_BITS) - 1)
+#define HANDLE_GEN_MASK 0x7fff	// Keeps isfd positive
+#define KEYCACHE_SLOTS 8		// Keydescs remembered per schema (power of 2)
+
+/*
+ * KEYCACHE
+ * A keydesc resolved by INDEX_get_keydesc (only the fields it reads)
+ */
+typedef struct KEYCACHE_T {
+	bool used;
+	unsigned int hash;
+	short flags;
+	short nparts;
+	struct keypart part[NPARTS];
+	INDEX *index;			// Matching index (NULL = none)
+} KEYCACHE;
 
 // External data
 extern bool PRINT_DEBUG;
@@ -32,21 +51,77 @@ bool append_convert = false;
 
 // Static data types
 static const char * conn_def_file = "conn.def";
-static int fdpool[MAXFDS];
-static bool is_fdpool_initialized = false;
+static struct HANDLE_T *handles = NULL;	// isfd slots (see CONTEXT_handle_get)
+static int handles_alloc = 0;			// Slots allocated
+static int handles_used = 0;			// Slots ever issued
+static int handles_free = -1;			// First free slot (-1 = none)
+static pthread_mutex_t handle_lock = PTHREAD_MUTEX_INITIALIZER;
 static unsigned long context_id = 1L;
 
 // Connection string
 static char *connstr = NULL;
-static CONN *CURRENT_conn = NULL;
+static pthread_mutex_t connstr_lock = PTHREAD_MUTEX_INITIALIZER;
+static char **standby = NULL;			// Connection strings of the standbys
+static int nstandby = 0;
+static unsigned int next_standby = 0;
+static char **shard = NULL;				// Connection strings of shards 1..nshard
+static int nshard = 0;
+static char *settings = NULL;			// Server settings of every connection (" -c name=value" ...)
+static __thread CONN *CURRENT_conn = NULL;	// Per thread (see CONN_use)
 
 // Schema
 static char *set_schema = NULL;
 
+// Schemas by name (for the list headed by schema_hash_head)
+static HASH *schema_hash = NULL;
+static SCHEMA *schema_hash_head = NULL;
+
+// Guards the schema list and what is built on it on demand
+static pthread_mutex_t schema_lock;
+static pthread_once_t schema_lock_once = PTHREAD_ONCE_INIT;
+
+/*
+ * HANDLE
+ * A slot of the isfd table; free slots are chained through next_free
+ */
+typedef struct HANDLE_T {
+	CONTEXT *context;		// Open context (NULL = free)
+	unsigned int generation;// Bumped on every release (stale isfd check)
+	int next_free;			// Next free slot (-1 = end)
+} HANDLE;
+
+/*
+ * PIVOTTAB
+ * Pivot targets by discriminator: page[first byte][second byte], or
+ * page[0][byte] for a one byte discriminator
+ */
+typedef struct PIVOTTAB_T {
+	SCHEMA **page[256];
+} PIVOTTAB;
+
 // Static function prototypes
 static char * CONN_build_string (void);
-static int CONTEXT_fdpool_get (void);
-static void CONTEXT_fdpool_delete (int fd);
+static CONN * CONN_connect (const char * _connstr);
+static char ** CONN_endpoints (char ** hosts, int nhosts, char * tail,
+	char * options);
+static void SCHEMA_build_colv (SCHEMA * schema);
+static unsigned long long SCHEMA_fingerprint (SCHEMA * schema);
+static char * SCHEMA_raw_unrecord (SCHEMA * s, char * record, char ** sql_col);
+static bool SCHEMA_raw_blank (COLUMN * c, char * record);
+static void SCHEMA_free_image (SCHEMA * schema);
+static void SCHEMA_free_added (INDEX ** index);
+static void SCHEMA_qualify_name (SCHEMA * schema);
+static void SCHEMA_hash (SCHEMA * schema);
+static unsigned int SCHEMA_keydesc_hash (struct keydesc * key);
+static void SCHEMA_pivot_build (SCHEMA * schema, SCHEMA * root);
+static void SCHEMA_pivot_fill (SCHEMA * schema, SCHEMA * root, bool report);
+static void SCHEMA_pivot_set (SCHEMA * root, int b0, int b1, SCHEMA * target);
+static void SCHEMA_pivot_delete (SCHEMA * schema);
+static void SCHEMA_lock_init (void);
+static int CONTEXT_handle_get (CONTEXT * context);
+static void CONTEXT_handle_delete (int isfd);
+static COLSET * CONTEXT_colset_new (SCHEMA * schema);
+static void CONTEXT_colset_delete (COLSET ** colset);
 
 
 // CODE STARTS HERE
@@ -68,6 +143,11 @@ static char * CONN_build_string (void)
 	char *EDATA_DEF, *hostname, *port, *database, *username, *password;
 	char *_connstr = NULL;
 	char *conn_def_path = NULL;
+	char *tail = NULL;
+	char **hosts[2] = {NULL, NULL};			// Standbys, shards
+	int nhosts[2] = {0, 0};
+	int kind;
+	size_t elen = strlen(get_EDATA());
 	
 __STACK(CONN_build_string)
 	
@@ -108,7 +188,29 @@ __STACK(CONN_build_string)
 			goto retbad;
 		}
 	
-		if ( ! strcmp(EDATA_DEF, get_EDATA())) {
+		// EDATA:standby=hostname, port (a read-only server streaming
+		// from the primary) and EDATA:shard=hostname, port (the next
+		// shard of sharded tables); the rest is taken from the EDATA line
+		kind = strncmp(EDATA_DEF, get_EDATA(), elen) ? -1 :
+			! strcmp(&EDATA_DEF[elen], ":standby") ? 0 :
+			! strcmp(&EDATA_DEF[elen], ":shard") ? 1 : -1;
+		
+		if (kind >= 0) {
+			char ***h = &hosts[kind];
+			
+			hostname = start = str_part(&end, ',');
+			port = start = str_part(&end, ',');
+			if (! hostname || ! port) {
+				goto malformed;
+			}
+			*h = (char **)realloc(*h, (nhosts[kind] + 1) * sizeof(char *));
+			(*h)[nhosts[kind]] = NULL;
+			str_append(&(*h)[nhosts[kind]++], "host=%s port=%s ",
+				hostname, port);
+			continue;
+		}
+	
+		if (! VALID_CONN && ! strcmp(EDATA_DEF, get_EDATA())) {
 			hostname = start = str_part(&end, ',');
 			if (! hostname) {
 				goto malformed;			
@@ -143,7 +245,25 @@ __STACK(CONN_build_string)
 			
 			VALID_CONN = true;
 
-			break;			
+			// Build the connection string now (BUF is reused by the
+			// standby lines); search_path is set by the server at
+			// startup, saving a round trip; poolers don't pass it on,
+			// so stateless mode qualifies the table names instead
+			asprintf(&_connstr,
+				"host=%s "
+				"port=%s ",
+				hostname,
+				port
+				);
+			
+			asprintf(&tail,
+				"dbname=%s "
+				"user=%s "
+				"password=%s ",
+				database,
+				username,
+				password
+				);
 		}		
 	}
 	
@@ -153,26 +273,33 @@ __STACK(CONN_build_string)
 		goto retbad;
 	}
 	
-	// Build the connection string
-	asprintf(&_connstr,
-		"host=%s "
-		"port=%s "
-		"dbname=%s "
-		"user=%s "
-		"password=%s",
-		hostname,
-		port,
-		database,
-		username,
-		password
+	str_append(&_connstr, "%s%s%s%s%s",
+		tail,
+		(PGIsamOptions & Stateless) ? "" : "options='-c search_path=",
+		(PGIsamOptions & Stateless) ? "" : set_schema,
+		(PGIsamOptions & Stateless || ! settings) ? "" : settings,
+		(PGIsamOptions & Stateless) ? "" : "'"
 		);
 	
-	if (! hostname) {
-		pgout(0, "no schema matching [%s] in [%s]",
-			get_EDATA(), conn_def_file);
-		goto retbad;
+	// Poolers don't pass options on either
+	if (settings && (PGIsamOptions & Stateless)) {
+		pgout(0, "server settings not applied in stateless mode"
+			" (set them on the role):%s", settings);
+	} else
+	if (settings) {
+		pgout(0, "server settings:%s", settings);
 	}
 	
+	// Standbys refuse writes anyway; saying so up front keeps an
+	// accidental write from waiting on a lock it can never get
+	standby = CONN_endpoints(hosts[0], nhosts[0], tail,
+		" -c default_transaction_read_only=on");
+	nstandby = nhosts[0];
+	
+	shard = CONN_endpoints(hosts[1], nhosts[1], tail, "");
+	nshard = nhosts[1];
+	
+	str_free(&tail);
 	fclose(fd);
 	
 	pgout(mDEBUG2, "connstr=[%s]", _connstr);
@@ -181,17 +308,69 @@ __STACK(CONN_build_string)
 	
 malformed:
 	pgout(0, "%s is malformed"
-		" (Usage: EDATA=hostname, port, database, schema, username, password)",
+		" (Usage: EDATA=hostname, port, database, schema, username, password"
+		" | EDATA:standby|shard=hostname, port)",
 		conn_def_file);
 
 retbad:
 	if (fd) fclose(fd);
 	
+	for (kind = 0; kind < 2; kind++) {
+		while (nhosts[kind]) {
+			str_free(&hosts[kind][--nhosts[kind]]);
+		}
+		free(hosts[kind]);
+	}
+	
+	str_free(&_connstr);
+	str_free(&tail);
+	
 	__return (char *)NULL;
 	
 } /* CONN_build_string */
 
 
+/*
+ * CONN_endpoints
+ * Connection strings of the extra endpoints of conn.def (frees hosts)
+ * hosts		"host=... port=... " of each endpoint
+ * nhosts		Number of hosts
+ * tail			dbname, user and password of the EDATA entry
+ * options		Server options added to search_path (and settings)
+ */
+static char ** CONN_endpoints (char ** hosts, int nhosts, char * tail,
+	char * options)
+{
+	char **list = NULL;
+	int i;
+	
+__STACK(CONN_endpoints)
+	
+	if (nhosts) {
+		list = (char **)xalloc(nhosts * sizeof(char *));
+	}
+	
+	for (i = 0; i < nhosts; i++) {
+		str_append(&list[i], "%s%s%s%s%s%s%s",
+			hosts[i],
+			tail,
+			(PGIsamOptions & Stateless) ? "" : "options='-c search_path=",
+			(PGIsamOptions & Stateless) ? "" : set_schema,
+			(PGIsamOptions & Stateless) ? "" : options,
+			(PGIsamOptions & Stateless || ! settings) ? "" : settings,
+			(PGIsamOptions & Stateless) ? "" : "'"
+			);
+		str_free(&hosts[i]);
+		pgout(mDEBUG2, "endpoint connstr=[%s]", list[i]);
+	}
+	
+	free(hosts);
+	
+	__return list;
+	
+} /* CONN_endpoints */
+
+
 /*
  * CONN_new [X]
  * Create a new connection to a Postgres database
@@ -205,31 +384,196 @@ __STACK(CONN_new)
 	pgout(mDEBUG3, "connecting");
 
 	// If we haven't built a connection string yet,
-	// do that here.
+	// do that here (once, whichever thread gets here first)
+	pthread_mutex_lock(&connstr_lock);
+	
 	if (! connstr) {
 		connstr = CONN_build_string();
-		
-		if (! connstr) {
-			pgout(0, "unable to retreive connection string");
-			__return (CONN *)NULL;
-		}
 	}
 	
-	conn = (CONN *)xalloc(sizeof(CONN));
-	
-	// Establish the connection
-	CURRENT_conn = conn = pg_startup(conn, connstr, set_schema);
+	pthread_mutex_unlock(&connstr_lock);
 	
-	// Set the bool flag
-	if (conn) {
-		conn->is_connected = true;
+	if (! connstr) {
+		pgout(0, "unable to retreive connection string");
+		__return (CONN *)NULL;
 	}
 	
+	conn = CONN_connect(connstr);
+	
 	__return conn;
 	
 } /* CONN_new */
 
 
+/*
+ * CONN_new_standby [X]
+ * Create a new connection to one of the standbys in conn.def (in turn)
+ * Returns NULL if there are none (see CONN_has_standby)
+ */
+CONN * CONN_new_standby (void)
+{
+	CONN *conn;
+	unsigned int x;
+	
+__STACK(CONN_new_standby)
+	
+	if (! CONN_has_standby()) {
+		__return (CONN *)NULL;
+	}
+	
+	x = __sync_fetch_and_add(&next_standby, 1) % nstandby;
+	
+	pgout(mDEBUG3, "connecting to standby %u", x);
+	
+	if ((conn = CONN_connect(standby[x])) != (CONN *)NULL) {
+		conn->is_standby = true;
+	}
+	
+	__return conn;
+	
+} /* CONN_new_standby */
+
+
+/*
+ * CONN_has_standby [X]
+ * Are any standbys listed in conn.def?
+ */
+bool CONN_has_standby (void)
+{
+	bool ret;
+	
+__STACK(CONN_has_standby)
+	
+	// The standbys are read with the connection string
+	pthread_mutex_lock(&connstr_lock);
+	
+	if (! connstr) {
+		connstr = CONN_build_string();
+	}
+	
+	ret = nstandby ? true : false;
+	
+	pthread_mutex_unlock(&connstr_lock);
+	
+	__return ret;
+	
+} /* CONN_has_standby */
+
+
+/*
+ * CONN_new_shard [X]
+ * Create a new connection to a shard of the sharded tables
+ * n			Shard (0 = the EDATA entry itself, see CONN_shards)
+ */
+CONN * CONN_new_shard (int n)
+{
+	CONN *conn;
+	
+__STACK(CONN_new_shard)
+	
+	if (n <= 0 || n >= CONN_shards()) {
+		__return n ? (CONN *)NULL : CONN_new();
+	}
+	
+	pgout(mDEBUG3, "connecting to shard %d", n);
+	
+	conn = CONN_connect(shard[n - 1]);
+	
+	__return conn;
+	
+} /* CONN_new_shard */
+
+
+/*
+ * CONN_shards [X]
+ * Number of shards in conn.def: the EDATA entry and its shard lines
+ */
+int CONN_shards (void)
+{
+	int ret;
+	
+__STACK(CONN_shards)
+	
+	pthread_mutex_lock(&connstr_lock);
+	
+	if (! connstr) {
+		connstr = CONN_build_string();
+	}
+	
+	ret = nshard + 1;
+	
+	pthread_mutex_unlock(&connstr_lock);
+	
+	__return ret;
+	
+} /* CONN_shards */
+
+
+/*
+ * CONN_connect
+ * Start a connection with a connection string and make it current
+ * _connstr		Connection string (kept, not copied)
+ */
+static CONN * CONN_connect (const char * _connstr)
+{
+	CONN *conn;
+	
+__STACK(CONN_connect)
+	
+	conn = (CONN *)xalloc(sizeof(CONN));
+	conn->connstr = _connstr;
+	
+	// Start connecting; the first statement waits for it (pg_ready)
+	if (! (PGIsamOptions & LazyConnect) && ! pg_connect_start(conn)) {
+		xfree(conn);
+		__return (CONN *)NULL;
+	}
+	
+	CURRENT_conn = conn;
+	
+	__return conn;
+	
+} /* CONN_connect */
+
+
+/*
+ * CONN_set_setting [X]
+ * Add a server setting to the connections made from now on
+ * setting		"name=value" (e.g. "synchronous_commit=off")
+ *
+ * NOTE: sent with the connection request (no round trip); settings made
+ * after the first connection (init_program) are ignored
+ */
+bool CONN_set_setting (char * setting)
+{
+	bool ret = true;
+	
+__STACK(CONN_set_setting)
+	
+	// Passed inside options='...': no quoting or escaping
+	if (! strchr(setting, '=') || *setting == '=' ||
+		strpbrk(setting, " \t'\\")) {
+		pgout(0, "server setting [%s] ignored (usage: name=value)", setting);
+		__return false;
+	}
+	
+	pthread_mutex_lock(&connstr_lock);
+	
+	if (connstr) {
+		pgout(0, "server setting [%s] ignored: set it before init_program",
+			setting);
+		ret = false;
+	} else {
+		str_append(&settings, " -c %s", setting);
+	}
+	
+	pthread_mutex_unlock(&connstr_lock);
+	
+	__return ret;
+	
+} /* CONN_set_setting */
+
+
 /*
  * CONN_delete [X]
  * Delete a connection (NOTE: since CONN is reusable, certain members stay intact)
@@ -249,6 +593,10 @@ __STACK(CONN_delete)
 	
 	conn->is_connected = ret = pg_shutdown(conn);
 	
+	if (CURRENT_conn == conn) {
+		CURRENT_conn = NULL;
+	}
+	
 	xfree(conn);
 	conn = NULL;
 	
@@ -320,6 +668,107 @@ __STACK(CONN_rollback)
 } /* CONN_rollback */
 
 
+/*
+ * CONN_current [X]
+ * Return the calling thread's connection (the last created by CONN_new
+ * or passed to CONN_use)
+ */
+CONN * CONN_current (void)
+{
+__STACK(CONN_current)
+
+	__return CURRENT_conn;
+
+} /* CONN_current */
+
+
+/*
+ * CONN_use [X]
+ * Make a connection the calling thread's current connection
+ * conn			Connection object
+ */
+void CONN_use (CONN * conn)
+{
+__STACK(CONN_use)
+
+	CURRENT_conn = conn;
+	
+	__return;
+
+} /* CONN_use */
+
+
+/*
+ * CONN_has_rawrecord [X]
+ * Is the pgisam_record extension installed (checked once per connection)?
+ * conn			Connection object
+ *
+ * NOTE: its functions are looked up by signature first (to_regprocedure
+ * can't fail), and the abi is read under a savepoint in a transaction,
+ * so that neither aborts an open transaction
+ */
+bool CONN_has_rawrecord (CONN * conn)
+{
+	RES *res;
+	char abi[8];
+	bool savepoint;
+	
+__STACK(CONN_has_rawrecord)
+	
+	if (conn->rawrecord_checked) {
+		__return conn->has_rawrecord;
+	}
+	
+	conn->rawrecord_checked = true;
+	conn->has_rawrecord = false;
+	
+	res = pg_exec(conn,
+		"SELECT to_regprocedure('pgisam_record_abi()') IS NOT NULL"
+		" AND to_regprocedure('pgisam_record(text,record)') IS NOT NULL"
+		" AND to_regprocedure('pgisam_unrecord(text,bytea,anyelement)') IS NOT NULL");
+	
+	if (! res || res->tuples != 1 || strcmp(PQgetvalue(res->pgres, 0, 0), "t")) {
+		RES_delete(&res);
+		pgout(mDEBUG1, "pgisam_record is not installed");
+		__return false;
+	}
+	
+	RES_delete(&res);
+	
+	savepoint = (PQtransactionStatus(conn->pgconn) == PQTRANS_INTRANS) ? true : false;
+	
+	if (savepoint && (res = pg_exec(conn, "SAVEPOINT pgisam_abi")) == (RES *)NULL) {
+		__return false;
+	}
+	RES_delete(&res);
+	
+	if ((res = pg_exec(conn, "SELECT pgisam_record_abi()")) != (RES *)NULL) {
+		CODEC_raw_abi(abi);
+		
+		if (res->tuples == 1 && (! strcmp(PQgetvalue(res->pgres, 0, 0), abi))) {
+			conn->has_rawrecord = true;
+		} else {
+			pgout(0, "pgisam_record abi [%s] does not match [%s]",
+				res->tuples ? PQgetvalue(res->pgres, 0, 0) : "", abi);
+		}
+		
+		RES_delete(&res);
+	} else
+	if (savepoint) {
+		res = pg_exec(conn, "ROLLBACK TO SAVEPOINT pgisam_abi");
+		RES_delete(&res);
+	}
+	
+	if (savepoint) {
+		res = pg_exec(conn, "RELEASE SAVEPOINT pgisam_abi");
+		RES_delete(&res);
+	}
+	
+	__return conn->has_rawrecord;
+	
+} /* CONN_has_rawrecord */
+
+
 // _____/ RES functions \__________
 /*
  * RES_delete [X]
@@ -388,12 +837,30 @@ __STACK(RES_print)
  * oidstr		Pointer to the oid
  */
 void RES_get_oid (RES * res, char ** oidstr)
+{
+__STACK(RES_get_oid)
+	
+	RES_get_oid_row(res, 0, oidstr);
+	
+	__return;
+	
+} /* RES_get_oid */
+
+
+/*
+ * RES_get_oid_row
+ * Obtain the oid of a row from a RES
+ * res			Pointer to the resource
+ * row			Row number
+ * oidstr		Pointer to the oid
+ */
+void RES_get_oid_row (RES * res, int row, char ** oidstr)
 {
 	char *colname, *oid = *oidstr;
 	PGresult *pgres = res->pgres;
 	int colidx = 0;
 	
-__STACK(RES_get_oid)
+__STACK(RES_get_oid_row)
 	
 	pgout(mDEBUG3, "obtaining oid");
 
@@ -405,7 +872,19 @@ __STACK(RES_get_oid)
 		
 		// Found a match?  Save it...
 		if (! strcmp(colname, "oid")) {
-				oid = str_dup(PQgetvalue(pgres, 0, colidx));
+				if (PQfformat(pgres, colidx)) {
+					unsigned char *p = (unsigned char *)PQgetvalue(pgres, row, colidx);
+					long long number = 0;
+					int x;
+					
+					// Binary int4/int8/oid: big endian
+					for (x=0; x < PQgetlength(pgres, row, colidx); x++) {
+						number = (number << 8) | p[x];
+					}
+					
+					str_append(&oid, "%lld", number);
+				} else
+					oid = str_dup(PQgetvalue(pgres, row, colidx));
 				pgout(mDEBUG3, "found oid=[%s]", oid);
 				break;	
 		}
@@ -420,7 +899,7 @@ __STACK(RES_get_oid)
 	
 	__return;
 	
-} /* RES_get_oid */
+} /* RES_get_oid_row */
 
 
 // _____/ COLUMN functions \__________
@@ -662,8 +1141,7 @@ __STACK(COLUMN_from_record)
 	pgout(mDEBUG3, "column < record");
 	
 	while (c) {
-		size_t padlength;
-		char *unescaped;
+		char *field = &record[c->startpos];
 		
 		// Skip "phantom" columns
 		if (c->is_phantom) {
@@ -671,97 +1149,31 @@ __STACK(COLUMN_from_record)
 			continue;
 		}
 		
-		if (! str_is_blank(&record[c->startpos], c->length)) {
-			
-			// --- DECIMAL
-			if (c->datatype == ISAM_TYPE_DECIMAL) {
-				unsigned char *dec_str = NULL;
-				
-				dec_str = malloc(33);
-				memset(dec_str, 0, 33);
-
-				dectostr(&dec_str, &record[c->startpos], c->length);
-
-				// A blank field is NULL
-				if (! str_is_blank(dec_str, c->length)) {
-					c->value = (unsigned char *)str_dup(dec_str);
-				}
-				
-				free(dec_str);
-			}
-			else
-			// --- INTEGER
-			if (c->datatype == ISAM_TYPE_INTEGER) {
-				long l_number;
-				
-				memcpy(&l_number, &record[c->startpos], sizeof(long));
-
-				asprintf((void *)&c->value, "%d", l_number);
-			}
-			else
-			// --- BINARY
-			if (c->datatype == ISAM_TYPE_BINARY) {
-				size_t vallen = 0;
-				c->value = (unsigned char *)PQescapeByteaConn(CURRENT_conn->pgconn, (const unsigned char *)&record[c->startpos],
-					c->length, &vallen);
-			}
-			else
-			// --- BOOLEAN
-			if (c->datatype == ISAM_TYPE_BOOLEAN) {
-				if (record[c->startpos] == 'Y')
-					c->value = str_dup("true");
-				else
-				if (record[c->startpos] == 'N')
-					c->value = str_dup("false");
-			} else
-			// --- CODE
-			if ((c->datatype == ISAM_TYPE_CODE) && c->codelength) {
-				int startpos = c->startpos;
-
-				// If numeric, start at the end of code minus the actual length
-				if (str_is_block_numeric(&record[c->startpos], c->length))
-					startpos += (c->length - c->codelength);
-				
-				// Allocate enough memory to hold the value + the null terminator
-				unescaped = (char *)xalloc((c->codelength) + 1);
-				c->value = (unsigned char *)xalloc((c->codelength * 2) + 1);
-
-				memcpy(unescaped, &record[startpos], c->codelength);
-			
-				PQescapeString((char *)c->value, (const char *)unescaped,
-					strlen(unescaped));
-			
-				str_free(&unescaped);
-			}
-			// --- CHAR/VARCHAR
-			else {
-				padlength = str_padlength(&record[c->startpos], c->length);
-				
-				// Allocate enough memory to hold the value + the null terminator
-				unescaped = (char *)xalloc((c->length - padlength) + 1);
-				c->value = (unsigned char *)xalloc(((c->length - padlength) * 2) + 1);
-
-				memcpy(unescaped, &record[c->startpos], c->length - padlength);
-			
-				PQescapeString((char *)c->value, (const char *)unescaped,
-					strlen(unescaped));
-			
-				str_free(&unescaped);
+		switch (c->datatype) {
+		case ISAM_TYPE_DECIMAL:
+			c->value = CODEC_decimal_from_record(field, c->length);
+			break;
+		case ISAM_TYPE_INTEGER:
+			c->value = CODEC_integer_from_record(field, c->length);
+			break;
+		case ISAM_TYPE_BINARY:
+			c->value = CODEC_binary_from_record(field, c->length);
+			break;
+		case ISAM_TYPE_BOOLEAN:
+			c->value = CODEC_boolean_from_record(field, c->length);
+			break;
+		case ISAM_TYPE_CODEBLANK:
+			c->value = CODEC_codeblank_from_record(field, c->length);
+			break;
+		case ISAM_TYPE_CODE:
+			if (c->codelength) {
+				c->value = CODEC_code_from_record(field, c->length,
+					c->codelength);
+				break;
 			}
-		}
-		// Blank values
-		else {
-			// Blank booleans are treated differently
-			if (c->datatype == ISAM_TYPE_BOOLEAN)
-				c->value = str_dup("null");
-				
-			// Blank "CODEBLANK" values
-			if (c->datatype == ISAM_TYPE_CODEBLANK) {
-				// Allocate enough memory to hold the spaces plus one
-				c->value = (char *)xalloc(c->length + 1);
-				// Set spaces into the code length value
-				memset(c->value, 0x20, c->length);
-			}				
+			// Fall through (no codelength is treated as CHAR)
+		default:
+			c->value = CODEC_char_from_record(field, c->length);
 		}
 		
 		c = c->next;
@@ -788,7 +1200,10 @@ __STACK(COLUMN_to_record)
 	pgout(mDEBUG3, "column > record");
 	
 	while (c) {
+		char *value = (char *)c->value;
+		char *field = &rec[c->startpos];
 		unsigned int vallen;
+		bool ok;
 		
 		// Skip "phantom" columns
 		if (c->is_phantom) {
@@ -797,98 +1212,42 @@ __STACK(COLUMN_to_record)
 		}		
 
 		// Only fill char arrays if value has a size
-		if (! c->value) {
+		if (! value) {
 			c = c->next;
 			continue;
 		}
 
-		vallen = strlen((char *)c->value);
+		vallen = strlen(value);
 		
-		// --- DECIMAL
-		if (c->datatype == ISAM_TYPE_DECIMAL) {
-			dec_t number;
-			
-			deccvasc((char *)c->value, vallen, &number);
-			
-			stdecimal(&number, &rec[c->startpos], c->length);
+		switch (c->datatype) {
+		case ISAM_TYPE_DECIMAL:
+			ok = CODEC_decimal_to_record(value, vallen, field, c->length);
+			break;
+		case ISAM_TYPE_INTEGER:
+			ok = CODEC_integer_to_record(value, vallen, field, c->length);
+			break;
+		case ISAM_TYPE_BINARY:
+			ok = CODEC_binary_to_record(value, vallen, field, c->length);
+			break;
+		case ISAM_TYPE_BOOLEAN:
+			ok = CODEC_boolean_to_record(value, vallen, field, c->length);
+			break;
+		case ISAM_TYPE_CODE:
+		case ISAM_TYPE_CODEBLANK:
+			if (c->codelength) {
+				ok = CODEC_code_to_record(value, vallen, field, c->length,
+					c->codelength);
+				break;
+			}
+			// Fall through (no codelength is treated as CHAR)
+		default:
+			ok = CODEC_char_to_record(value, vallen, field, c->length);
 		}
-		else
-		// --- INTEGER
-		if (c->datatype == ISAM_TYPE_INTEGER) {
-			long number;
-
-			number = atol((char *)c->value);
-				
-			memcpy(&rec[c->startpos], &number, sizeof(long));
-		}
-		else
-		// --- BINARY
-		if (c->datatype == ISAM_TYPE_BINARY) {
-			unsigned char *bytea_lit = NULL;
-			size_t lit_size = 0;
-			
-			// A new string is allocated which contains the actual binary data
-			bytea_lit = PQunescapeBytea(c->value, &lit_size);
-			
-			if (! bytea_lit) {
-				// Get the other columns
-				continue;
-			}
-			
-			// The size of the byte array cannot be greater than the field size
-			if (lit_size > vallen) {
-				pgout(0, "bytea mismatch in bridge schema column=[%s]",
-					c->name);
-				
-				// Don't use str_free... binary data could include a NULL
-				pg_free(bytea_lit);
-				__return;
-			}
-			
-			// Copy the bytea literal to the record
-			memcpy(&rec[c->startpos], bytea_lit, lit_size);
-			
-			// Free the bytea literal
-			pg_free(bytea_lit);
-
-		} else
-		// --- BOOLEAN
-		if (c->datatype == ISAM_TYPE_BOOLEAN) {
-			if (c->value[0] == 't')
-				rec[c->startpos] = 'Y';
-			else
-			if (c->value[0] == 'f')
-				rec[c->startpos] = 'N';
-			else
-				rec[c->startpos] = ' ';
-		} else
-		// --- CODE
-		if ((c->datatype == ISAM_TYPE_CODE || c->datatype == ISAM_TYPE_CODEBLANK)
-			&& c->codelength) {
-			int startpos = c->startpos;
-
-			if (vallen > c->codelength) {
-				pgout(0, "length mismatch in bridge schema column=[%s]",
-					c->name);
-				__return;
-			}
-			
-			// If numeric, start at the end of code minus the actual length
-			if (str_is_block_numeric(c->value, strlen(c->value))) {
-				startpos += (c->length - c->codelength);
-			}
-			
-			memcpy(&rec[startpos], c->value, vallen);
-		}
-		// --- CHAR/VARCHAR
-		else {
-			if (vallen > c->length) {
-				pgout(0, "length mismatch in bridge schema column=[%s]",
-					c->name);
-				__return;
-			}
-			
-			memcpy(&rec[c->startpos], c->value, vallen);
+		
+		if (! ok) {
+			pgout(0, "length mismatch in bridge schema column=[%s]",
+				c->name);
+			__return;
 		}
 
 		c = c->next;
@@ -1110,6 +1469,64 @@ __STACK(SCHEMA_assign_def)
 			continue;
 		}
 		
+		if (! strncmp(BUF, "shard=", 6)) {
+			if (strcmp(&BUF[6], "hash") && strncmp(&BUF[6], "range:", 6)) {
+				goto malformed;
+			}
+			s->shard = str_dup(&BUF[6]);
+			xfree(cpBUF);
+			continue;
+		}
+		
+		if (! strncmp(BUF, "timeout=", 8)) {
+			s->timeout = atoi(&BUF[8]);
+			xfree(cpBUF);
+			continue;
+		}
+		
+		if (! strncmp(BUF, "groupcommit=", 12)) {
+			s->groupcommit = atoi(&BUF[12]);
+			xfree(cpBUF);
+			continue;
+		}
+		
+		if (! strcmp(BUF, "writebehind")) {
+			s->writebehind = true;
+			xfree(cpBUF);
+			continue;
+		}
+		
+		if (! strcmp(BUF, "rawrecord")) {
+			s->rawrecord = true;
+			xfree(cpBUF);
+			continue;
+		}
+		
+		if (! strncmp(BUF, "discriminator=", 14)) {
+			unsigned int length;
+			
+			idx = (char *)index(&BUF[14], ':');
+			length = idx ? atoi(idx + 1) : 0;
+			
+			if (length < 1 || length > 2) {
+				goto malformed;
+			}
+			
+			s->disc_start = atoi(&BUF[14]);
+			s->disc_length = length;
+			s->is_pivotable = true;
+			xfree(cpBUF);
+			continue;
+		}
+		
+		if (! strncmp(BUF, "pivot=", 6)) {
+			if (! PIVOT_push(&s->pivot, &BUF[6])) {
+				goto malformed;
+			}
+			xfree(cpBUF);
+			continue;
+		}
+		
 		if (! strncmp(BUF, "index ", 6)) {
 			INDEX_append_node(&s->index, s->column, &BUF[6]);
 			if (! s->index) {
@@ -1262,12 +1679,28 @@ malformed:
 	if (s->is_convertable && append_convert) {
 		str_append(&s->pgname, "_conv");
 	}
+	
+	// No search_path in stateless mode (see CONN_build_string)
+	if (PGIsamOptions & Stateless) {
+		SCHEMA_qualify_name(s);
+	}
 		
 	str_free(&rptmp);
 	
-	// Is the schema pivotable?
-	if (! strncmp(s->name, "tables", 6)) {
+	// Is the schema pivotable?  "tables*" route on their first two bytes
+	// to "tables_<xx>" unless they say otherwise
+	if (! strncmp(s->name, "tables", 6) && ! s->disc_length) {
 		s->is_pivotable = true;
+		s->disc_start = 0;
+		s->disc_length = 2;
+		s->pivot_byname = ! s->pivot;
+	}
+	
+	// The discriminator must lie within the record (see SCHEMA_pivot)
+	if (s->is_pivotable && s->disc_start + s->disc_length > s->reclen) {
+		pgout(0, "%s: discriminator %u:%u is beyond reclen %u; not pivoting",
+			filepath, s->disc_start, s->disc_length, s->reclen);
+		s->is_pivotable = false;
 	}
 	
 	// Reverse the COLUMN list so we can iterate it in order
@@ -1276,6 +1709,11 @@ malformed:
 	// Do the same with the index
 	INDEX_reverse(&s->index);
 	
+	// Flatten the columns and look for a generated codec
+	SCHEMA_build_colv(s);
+	s->fingerprint = SCHEMA_fingerprint(s);
+	CODEC_attach(s);
+	
 	*schema = s;
 	
 	xfree(filepath);
@@ -1301,10 +1739,16 @@ void SCHEMA_push (SCHEMA ** schema, char * definition)
 	
 __STACK(SCHEMA_push)
 	
+	SCHEMA_lock();
+	
+	// Another thread may have pushed since the caller read the head
+	s = *schema;
+	
 	// Check to see if the definition matches an
 	// existing schema (SCHEMAs must be unique)
 	if (SCHEMA_get(s, definition) != (SCHEMA *)NULL) {
 		pgout(mDEBUG3, "schema %s exists", s->name);
+		SCHEMA_unlock();
 		__return;
 	}
 	
@@ -1319,6 +1763,21 @@ __STACK(SCHEMA_push)
 
 	*schema = new_element;
 	
+	// Keep the name hash in step with the list
+	if (schema_hash_head == s && schema_hash && new_element->name) {
+		HASH_put(schema_hash, new_element->name, new_element);
+		schema_hash_head = new_element;
+	}
+	
+	// Pivot tables built already take in the new schema as a target
+	for (s = new_element->next; s; s = s->next) {
+		if (s->pivottab) {
+			SCHEMA_pivot_fill(new_element, s, false);
+		}
+	}
+	
+	SCHEMA_unlock();
+	
 	__return;
 	
 } /* SCHEMA_push */
@@ -1375,28 +1834,28 @@ __STACK(SCHEMA_print)
  */
 SCHEMA * SCHEMA_get (SCHEMA * schema, char * definition)
 {
-	SCHEMA *s = schema;
-	char *real_def = NULL;
+	char *name = definition;
+	SCHEMA *s;
 	
 __STACK(SCHEMA_get)
 	
+	// rptmp* files all use rptmp.def
 	if (! strncmp(definition, "rptmp", 5)) {
-		real_def = str_dup("rptmp");
-	} else {
-		real_def = str_dup(definition);
+		name = "rptmp";
 	}
 	
-	while (s) {
-		if (! strcmp(s->name, real_def)) {
-			str_free(&real_def);
-			__return s;
-		}	
-		s = s->next;
+	SCHEMA_lock();
+	
+	// The list was built (or replaced) without SCHEMA_push
+	if (schema != schema_hash_head) {
+		SCHEMA_hash(schema);
 	}
 	
-	str_free(&real_def);
+	s = (SCHEMA *)HASH_get(schema_hash, name);
 	
-	__return (SCHEMA *)NULL;
+	SCHEMA_unlock();
+	
+	__return s;
 		
 } /* SCHEMA_get */
 
@@ -1404,7 +1863,7 @@ __STACK(SCHEMA_get)
 /*
  * SCHEMA_create_insert [X]
  * Create an INSERT sql statement from SCHEMA
- * schema		Pointer to object containing values
+ * context		Pointer to the current context (holding the values)
  */
 char * SCHEMA_create_insert (CONTEXT * context)
 {
@@ -1416,7 +1875,7 @@ char * SCHEMA_create_insert (CONTEXT * context)
 	
 __STACK(SCHEMA_create_insert)
 	
-	c = s->column;
+	c = CONTEXT_columns(context)->column;
 	
 	while (c) {
 		if (c->value) {
@@ -1435,170 +1894,1261 @@ __STACK(SCHEMA_create_insert)
 		c = c->next;
 	}
 	
-	str_trim_char(&sql_col, ',');
-	str_trim_char(&sql_val, ',');
+	str_trim_char(&sql_col, ',');
+	str_trim_char(&sql_val, ',');
+	
+	str_append(&sql,
+		"INSERT INTO %s ( %s ) VALUES ( %s )"
+		,s->pgname
+		,sql_col
+		,sql_val
+		);
+	
+	str_free(&sql_col);
+	str_free(&sql_val);
+		
+	__return sql;
+	
+} /* SCHEMA_create_insert */
+
+
+/*
+ * SCHEMA_create_update [X]
+ * Create an UPDATE sql statement from SCHEMA
+ * context		Pointer to the current context
+ */
+char * SCHEMA_create_update (CONTEXT * context)
+{
+	SCHEMA *s = context->schema;
+	COLUMN *c;
+	char *sql = NULL;
+	char *sql_set = NULL;
+	
+__STACK(SCHEMA_create_update)
+	
+	c = CONTEXT_columns(context)->column;
+	
+	// Iterate through each COLUMN in the SCHEMA
+	while (c) {
+		// If it has a value, update it		
+		if (c->value) {
+			if (c->datatype == ISAM_TYPE_BOOLEAN && (! strcmp(c->value, "null"))) {
+				str_append(&sql_set, " %s=null,", c->name);
+			} else
+			if (c->datatype == ISAM_TYPE_DECIMAL) {
+				str_append(&sql_set, "%s=%s,", c->name, c->value);
+			} else
+				str_append(&sql_set, " %s='%s',", c->name, c->value);
+		}
+		
+		c = c->next;
+	}
+	
+	str_trim_char(&sql_set, ',');
+	
+	// Always update the table by its primal key
+	str_append(&sql,
+		"UPDATE %s SET%s WHERE oid='%s'"
+		,s->pgname
+		,sql_set
+		,context->oid_last
+		);
+		
+	str_free(&sql_set);
+	
+	pgout(mDEBUG3, "sql=[%s]", sql);
+	
+	__return sql;
+	
+} /* SCHEMA_create_update */
+
+
+/*
+ * SCHEMA_create_copy [X]
+ * Create a COPY ... FROM STDIN sql statement from SCHEMA
+ * context		Pointer to the current context
+ * omit			Columns left out, by ordinal (see CODEC_batch_run)
+ *
+ * NOTE: column order matches CODEC_batch_to_copy
+ */
+char * SCHEMA_create_copy (CONTEXT * context, bool * omit)
+{
+	SCHEMA *s = context->schema;
+	COLUMN *c;
+	char *sql = NULL;
+	char *sql_col = NULL;
+	
+__STACK(SCHEMA_create_copy)
+	
+	for (c = s->column; c; c = c->next) {
+		if (! c->is_phantom && ! omit[c->ordinal]) {
+			str_append(&sql_col, "%s,", c->name);
+		}
+	}
+	
+	str_trim_char(&sql_col, ',');
+	
+	str_append(&sql,
+		"COPY %s ( %s ) FROM STDIN"
+		,s->pgname
+		,sql_col
+		);
+	
+	str_free(&sql_col);
+	
+	__return sql;
+	
+} /* SCHEMA_create_copy */
+
+
+/*
+ * SCHEMA_use_raw [X]
+ * Does a context move whole records through pgisam_record?
+ * context		Pointer to the current context
+ */
+bool SCHEMA_use_raw (CONTEXT * context)
+{
+	SCHEMA *s = context->schema;
+	
+__STACK(SCHEMA_use_raw)
+	
+	// "tables" records pivot to other schemas; shards are merged
+	// by their key columns (see MERGE_fetch)
+	if (! s->rawrecord || s->is_pivotable || s->shard) {
+		__return false;
+	}
+	
+	__return CONN_has_rawrecord(context->conn);
+	
+} /* SCHEMA_use_raw */
+
+
+/*
+ * SCHEMA_raw_layout [X]
+ * Record layout of a schema for pgisam_record:
+ *   <abi>;<reclen>;<name>:<startpos>:<length>:<codelength>:<type>,...
+ * schema		Schema
+ */
+char * SCHEMA_raw_layout (SCHEMA * schema)
+{
+	COLUMN *c;
+	char abi[8];
+	
+__STACK(SCHEMA_raw_layout)
+	
+	SCHEMA_lock();
+	
+	if (schema->rawlayout) {
+		SCHEMA_unlock();
+		__return schema->rawlayout;
+	}
+	
+	CODEC_raw_abi(abi);
+	
+	str_append(&schema->rawlayout, "%s;%u;", abi, schema->reclen);
+	
+	for (c = schema->column; c; c = c->next) {
+		char type;
+		
+		if (c->is_phantom) {
+			continue;
+		}
+		
+		switch (c->datatype) {
+		case ISAM_TYPE_DECIMAL:		type = 'd'; break;
+		case ISAM_TYPE_CODE:		type = 'k'; break;
+		case ISAM_TYPE_CODEBLANK:	type = 'z'; break;
+		case ISAM_TYPE_BINARY:		type = 'b'; break;
+		case ISAM_TYPE_INTEGER:		type = 'i'; break;
+		case ISAM_TYPE_BOOLEAN:		type = 'l'; break;
+		default:					type = 'c';
+		}
+		
+		str_append(&schema->rawlayout, "%s:%u:%u:%u:%c,"
+			,c->name
+			,c->startpos
+			,c->length
+			,c->codelength
+			,type
+			);
+	}
+	
+	str_trim_char(&schema->rawlayout, ',');
+	
+	SCHEMA_unlock();
+	
+	__return schema->rawlayout;
+	
+} /* SCHEMA_raw_layout */
+
+
+/*
+ * SCHEMA_raw_blank
+ * Is a field one SCHEMA_create_insert|update leave out (blank, so the
+ * column keeps its default or value)?  Blank BOOLEANs are written as
+ * null and CODEBLANKs as spaces, as there.
+ * c			Column
+ * record		Record
+ */
+static bool SCHEMA_raw_blank (COLUMN * c, char * record)
+{
+	char *field = &record[c->startpos];
+	unsigned int x;
+	
+	if (c->datatype == ISAM_TYPE_CODEBLANK) {
+		return false;
+	}
+	
+	// Neither Y, N nor blank is left out too
+	if (c->datatype == ISAM_TYPE_BOOLEAN) {
+		return (str_is_blank(field, c->length) ||
+			field[0] == 'Y' || field[0] == 'N') ? false : true;
+	}
+	
+	if (str_is_blank(field, c->length)) {
+		return true;
+	}
+	
+	// All zero bytes is a null decimal
+	if (c->datatype == ISAM_TYPE_DECIMAL) {
+		for (x=0; x < c->length && (! field[x]); x++);
+		return (x == c->length) ? true : false;
+	}
+	
+	return false;
+	
+} /* SCHEMA_raw_blank */
+
+
+/*
+ * SCHEMA_raw_unrecord
+ * Create "SELECT <cols> FROM pgisam_unrecord(...)" for a record
+ * s			Schema of the record
+ * record		Record to write
+ * sql_col		Receives the column list (blank fields left out, see
+ * 				SCHEMA_raw_blank)
+ */
+static char * SCHEMA_raw_unrecord (SCHEMA * s, char * record, char ** sql_col)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *sql = NULL;
+	char *data;
+	COLUMN *c;
+	unsigned int x;
+	
+	for (c = s->column; c; c = c->next) {
+		if (! c->is_phantom && ! SCHEMA_raw_blank(c, record)) {
+			str_append(sql_col, "%s,", c->name);
+		}
+	}
+	
+	str_trim_char(sql_col, ',');
+	
+	data = (char *)xalloc(s->reclen * 2 + 1);
+	
+	for (x=0; x < s->reclen; x++) {
+		data[x * 2] = hex[(unsigned char)record[x] >> 4];
+		data[x * 2 + 1] = hex[(unsigned char)record[x] & 0x0F];
+	}
+	
+	str_append(&sql,
+		"SELECT %s FROM pgisam_unrecord('%s', decode('%s', 'hex'), NULL::%s)"
+		,*sql_col
+		,SCHEMA_raw_layout(s)
+		,data
+		,s->pgname
+		);
+	
+	xfree(data);
+	
+	return sql;
+	
+} /* SCHEMA_raw_unrecord */
+
+
+/*
+ * SCHEMA_create_raw_insert [X]
+ * Create an INSERT sql statement from a whole record
+ * context		Pointer to the current context
+ * record		Record to write
+ *
+ * NOTE: blank fields are left to the column default (as
+ * SCHEMA_create_insert)
+ */
+char * SCHEMA_create_raw_insert (CONTEXT * context, char * record)
+{
+	SCHEMA *s = context->schema;
+	char *sql = NULL;
+	char *sql_col = NULL;
+	char *sql_sel;
+	
+__STACK(SCHEMA_create_raw_insert)
+	
+	sql_sel = SCHEMA_raw_unrecord(s, record, &sql_col);
+	
+	str_append(&sql,
+		"INSERT INTO %s ( %s ) %s"
+		,s->pgname
+		,sql_col
+		,sql_sel
+		);
+	
+	str_free(&sql_col);
+	str_free(&sql_sel);
+	
+	__return sql;
+	
+} /* SCHEMA_create_raw_insert */
+
+
+/*
+ * SCHEMA_create_raw_update [X]
+ * Create an UPDATE sql statement from a whole record
+ * context		Pointer to the current context
+ * record		Record to write
+ *
+ * NOTE: columns of blank fields keep their value (as SCHEMA_create_update)
+ */
+char * SCHEMA_create_raw_update (CONTEXT * context, char * record)
+{
+	SCHEMA *s = context->schema;
+	char *sql = NULL;
+	char *sql_col = NULL;
+	char *sql_sel;
+	
+__STACK(SCHEMA_create_raw_update)
+	
+	sql_sel = SCHEMA_raw_unrecord(s, record, &sql_col);
+	
+	// Always update the table by its primal key
+	str_append(&sql,
+		"UPDATE %s SET ( %s ) = ( %s ) WHERE oid='%s'"
+		,s->pgname
+		,sql_col
+		,sql_sel
+		,context->oid_last
+		);
+	
+	str_free(&sql_col);
+	str_free(&sql_sel);
+	
+	pgout(mDEBUG3, "sql=[%s]", sql);
+	
+	__return sql;
+	
+} /* SCHEMA_create_raw_update */
+
+
+/*
+ * SCHEMA_delete [X]
+ * Delete a SCHEMA object
+ * schema		Pointer to the list to print
+ */
+void SCHEMA_delete (SCHEMA ** schema)
+{
+	SCHEMA *s = *schema;
+	
+__STACK(SCHEMA_delete)
+	
+	if (s && s == schema_hash_head) {
+		HASH_delete(&schema_hash);
+		schema_hash_head = NULL;
+	}
+	
+	while (s) {
+		SCHEMA *next = s->next;
+		
+		// Strings are in the mapped image, the nodes share s's allocation
+		if (s->in_image) {
+			SCHEMA_free_image(s);
+			s = next;
+			continue;
+		}
+		
+		str_free(&s->name);
+		str_free(&s->pgname);
+		str_free(&s->prefix);
+		str_free(&s->shard);
+		str_free(&s->rawlayout);
+		HASH_delete(&s->colhash);
+		xfree(s->keycache);
+		SCHEMA_pivot_delete(s);
+		PIVOT_delete(&s->pivot);
+		
+		INDEX_delete(&s->index);
+		INDEX_delete(&s->dropped);
+		COLUMN_delete(&s->column);
+		MODIFY_delete(&s->modify);
+		
+		xfree(s->colv);
+				
+		xfree(s);
+	
+		s = next;	
+	}
+	
+	*schema = NULL;
+	
+	__return;
+	
+} /* SCHEMA_delete */
+
+
+/*
+ * SCHEMA_free_image
+ * Delete a schema built from the schema image
+ * schema		Schema (in_image)
+ */
+static void SCHEMA_free_image (SCHEMA * schema)
+{
+	INDEX *i;
+	COLUMN *c;
+	
+__STACK(SCHEMA_free_image)
+	
+	// Indexes added at runtime are not part of the allocation
+	SCHEMA_free_added(&schema->index);
+	SCHEMA_free_added(&schema->dropped);
+	
+	for (c = schema->column; c; c = c->next) {
+		if (c->datatype == ISAM_TYPE_BINARY) {
+			pg_free(c->value);
+		} else {
+			str_free((char **)&c->value);
+		}
+	}
+	
+	for (i = schema->index; i; i = i->next) {
+		for (c = i->column; c; c = c->next) {
+			if (c->datatype == ISAM_TYPE_BINARY) {
+				pg_free(c->value);
+			} else {
+				str_free((char **)&c->value);
+			}
+		}
+	}
+	
+	if (schema->pgname_alloc) {
+		str_free(&schema->pgname);
+	}
+	
+	str_free(&schema->rawlayout);
+	HASH_delete(&schema->colhash);
+	xfree(schema->keycache);
+	SCHEMA_pivot_delete(schema);
+	
+	xfree(schema);
+	
+	__return;
+	
+} /* SCHEMA_free_image */
+
+
+/*
+ * SCHEMA_free_added
+ * Delete the indexes of a list added by SCHEMA_index_add
+ * index		Pointer to the list head
+ */
+static void SCHEMA_free_added (INDEX ** index)
+{
+	INDEX **link = index;
+	
+__STACK(SCHEMA_free_added)
+	
+	while (*link) {
+		INDEX *i = *link;
+		
+		if (i->is_added) {
+			*link = i->next;
+			i->next = NULL;
+			INDEX_delete(&i);
+		} else {
+			link = &i->next;
+		}
+	}
+	
+	__return;
+	
+} /* SCHEMA_free_added */
+
+
+/*
+ * SCHEMA_qualify [X]
+ * Prefix the table names of a schema list with the database schema
+ * schema		Pointer to the list
+ *
+ * NOTE: needs the connection string built (CONN_new), which reads the
+ * database schema from conn.def
+ */
+void SCHEMA_qualify (SCHEMA * schema)
+{
+	SCHEMA *s;
+	
+__STACK(SCHEMA_qualify)
+	
+	for (s = schema; s; s = s->next) {
+		SCHEMA_qualify_name(s);
+	}
+	
+	__return;
+	
+} /* SCHEMA_qualify */
+
+
+/*
+ * SCHEMA_qualify_name
+ * Prefix the table name of one schema with the database schema
+ * schema		Schema
+ */
+static void SCHEMA_qualify_name (SCHEMA * schema)
+{
+	char *pgname = NULL;
+	
+__STACK(SCHEMA_qualify_name)
+	
+	if (strchr(schema->pgname, '.')) {
+		__return;
+	}
+	
+	if (! set_schema) {
+		pgout(0, "no database schema to qualify [%s] with", schema->pgname);
+		__return;
+	}
+	
+	str_append(&pgname, "%s.%s", set_schema, schema->pgname);
+	
+	// Image strings are not freed (see SCHEMA_free_image)
+	if (schema->in_image) {
+		schema->pgname_alloc = true;
+	} else {
+		str_free(&schema->pgname);
+	}
+	
+	schema->pgname = pgname;
+	
+	__return;
+	
+} /* SCHEMA_qualify_name */
+
+
+/*
+ * SCHEMA_shutdown [X]
+ * Delete resources associated with the schema module
+ */
+void SCHEMA_shutdown (void)
+{
+__STACK(SCHEMA_shutdown)
+
+	pgout(mDEBUG3, "shutting down schema");
+	
+	str_free(&connstr);
+	connstr = NULL;
+	
+	str_free(&settings);
+	settings = NULL;
+	
+	str_free(&set_schema);
+	set_schema = NULL;
+	
+	__return;
+	
+} /* SCHEMA_shutdown */
+
+
+/*
+ * SCHEMA_pivot [x]
+ * Select the schema a record of a pivotable schema belongs to, from
+ * the discriminator bytes of the record (NULL = no match)
+ * schema		Pointer to the list head
+ * current		Pivotable schema (or a schema it pivoted to)
+ * record		Record
+ */
+SCHEMA * SCHEMA_pivot (SCHEMA * schema, SCHEMA * current, char * record)
+{
+	SCHEMA *root, *s;
+	unsigned char *disc;
+	SCHEMA **page;
+	
+__STACK(SCHEMA_pivot)
+	
+	// Slots of the pivot table are only set (see SCHEMA_pivot_fill)
+	SCHEMA_lock();
+	
+	if (! (root = current->pivot_root)) {
+		// "tables_<xx>" route through "tables" when it is loaded
+		if (! current->pivot_byname || ! (root = SCHEMA_get(schema, "tables"))) {
+			root = current;
+		}
+		
+		if (! root->pivottab) {
+			SCHEMA_pivot_build(schema, root);
+		}
+		
+		current->pivot_root = root;
+	}
+	
+	SCHEMA_unlock();
+	
+	disc = (unsigned char *)&record[root->disc_start];
+	
+	if (root->disc_length == 2) {
+		page = root->pivottab->page[disc[0]];
+		s = page ? page[disc[1]] : NULL;
+	} else {
+		s = root->pivottab->page[0][disc[0]];
+	}
+	
+	// Records without a target of their own stay with the root
+	if (! s && ! (root->pivot_byname && strcmp(root->name, "tables"))) {
+		s = root;
+	}
+	
+	if (s) {
+		pgout(mDEBUG2, "pivoting %s schema to [%s]", root->name, s->name);
+	}
+		
+	__return s;
+	
+} /* SCHEMA_pivot */
+
+
+/*
+ * SCHEMA_hash
+ * Index a schema list by name for SCHEMA_get
+ * schema		Head of the list
+ */
+static void SCHEMA_hash (SCHEMA * schema)
+{
+	SCHEMA *s;
+	unsigned int n = 0;
+	
+__STACK(SCHEMA_hash)
+	
+	HASH_delete(&schema_hash);
+	
+	for (s = schema; s; s = s->next) {
+		n++;
+	}
+	
+	schema_hash = HASH_new(n);
+	schema_hash_head = schema;
+	
+	// The first of duplicate names wins, as with a list walk
+	for (s = schema; s; s = s->next) {
+		if (s->name) {
+			HASH_put(schema_hash, s->name, s);
+		}
+	}
+	
+	__return;
+	
+} /* SCHEMA_hash */
+
+
+/*
+ * SCHEMA_column [X]
+ * Return the column of a schema matching name
+ * schema		Schema
+ * name			Column name
+ */
+COLUMN * SCHEMA_column (SCHEMA * schema, char * name)
+{
+	COLUMN *c;
+	
+__STACK(SCHEMA_column)
+	
+	SCHEMA_lock();
+	
+	// Built on first use; columns don't change after load
+	if (! schema->colhash) {
+		schema->colhash = HASH_new(schema->ncols);
+		
+		for (c = schema->column; c; c = c->next) {
+			HASH_put(schema->colhash, c->name, c);
+		}
+	}
+	
+	c = (COLUMN *)HASH_get(schema->colhash, name);
+	
+	SCHEMA_unlock();
+	
+	__return c;
+	
+} /* SCHEMA_column */
+
+
+/*
+ * SCHEMA_index_keydesc [X]
+ * INDEX_get_keydesc of a schema's indexes, memoized per keydesc
+ * schema		Schema
+ * key			Keydesc to match
+ */
+INDEX * SCHEMA_index_keydesc (SCHEMA * schema, struct keydesc * key)
+{
+	KEYCACHE *k;
+	INDEX *i;
+	unsigned int hash;
+	
+__STACK(SCHEMA_index_keydesc)
+	
+	if (! key || key->k_nparts < 0 || key->k_nparts > NPARTS) {
+		__return INDEX_get_keydesc(schema->index, key);
+	}
+	
+	SCHEMA_lock();
+	
+	if (! schema->keycache) {
+		schema->keycache = xalloc(sizeof(KEYCACHE) * KEYCACHE_SLOTS);
+	}
+	
+	hash = SCHEMA_keydesc_hash(key);
+	k = &schema->keycache[hash & (KEYCACHE_SLOTS - 1)];
+	
+	if (k->used &&
+		k->hash == hash &&
+		k->flags == key->k_flags &&
+		k->nparts == key->k_nparts &&
+		(! memcmp(k->part, key->k_part, sizeof(struct keypart) * k->nparts))) {
+		i = k->index;
+		SCHEMA_unlock();
+		__return i;
+	}
+	
+	// Resolve and remember it (replacing whatever shared the slot)
+	k->used = true;
+	k->hash = hash;
+	k->flags = key->k_flags;
+	k->nparts = key->k_nparts;
+	memcpy(k->part, key->k_part, sizeof(struct keypart) * k->nparts);
+	i = k->index = INDEX_get_keydesc(schema->index, key);
+	
+	SCHEMA_unlock();
+	
+	__return i;
+	
+} /* SCHEMA_index_keydesc */
+
+
+/*
+ * SCHEMA_index_changed [X]
+ * Forget resolved keydescs (must be called when schema->index changes)
+ * schema		Schema
+ */
+void SCHEMA_index_changed (SCHEMA * schema)
+{
+__STACK(SCHEMA_index_changed)
+	
+	SCHEMA_lock();
+	
+	xfree(schema->keycache);
+	schema->keycache = NULL;
+	
+	SCHEMA_unlock();
+	
+	__return;
+	
+} /* SCHEMA_index_changed */
+
+
+/*
+ * SCHEMA_index_add [X]
+ * Add an index described by a keydesc (NULL if the key matches no columns)
+ * schema		Schema
+ * key			Key description
+ *
+ * NOTE: every key part must cover at least one column; the index takes
+ * the next number and its name comes from the table and the keydesc, so
+ * that every program adding the same key names the same index
+ */
+INDEX * SCHEMA_index_add (SCHEMA * schema, struct keydesc * key)
+{
+	INDEX *index, **tail;
+	COLUMN *c;
+	int x;
+	
+__STACK(SCHEMA_index_add)
+	
+	if (key->k_nparts < 1 || key->k_nparts > NPARTS) {
+		__return (INDEX *)NULL;
+	}
+	
+	index = xalloc(sizeof(INDEX));
+	index->is_unique = (key->k_flags & ISDUPS) ? false : true;
+	index->is_added = true;
+	
+	for (x=0; x < key->k_nparts; x++) {
+		unsigned int keystart = key->k_part[x].kp_start;
+		unsigned int keyend = keystart + key->k_part[x].kp_leng;
+		bool covered = false;
+		
+		for (c = schema->column; c; c = c->next) {
+			int typelength = (c->datatype == ISAM_TYPE_INTEGER) ? 2 : c->length;
+			
+			if ((! c->is_phantom) && c->startpos >= keystart &&
+				c->startpos + typelength <= keyend) {
+				COLUMN_push_copy(&index->column, c);
+				covered = true;
+			}
+		}
+		
+		if (! covered) {
+			pgout(0, "%s: key part %d (%d,%d) covers no column", schema->name,
+				x, key->k_part[x].kp_start, key->k_part[x].kp_leng);
+			INDEX_delete(&index);
+			__return (INDEX *)NULL;
+		}
+	}
+	
+	COLUMN_reverse(&index->column);
+	
+	SCHEMA_lock();
+	
+	// Lists are not kept in index number order
+	index->num = 1;
+	for (tail = &schema->index; *tail; tail = &(*tail)->next) {
+		if ((*tail)->num >= index->num) {
+			index->num = (*tail)->num + 1;
+		}
+	}
+	
+	index->name = SCHEMA_index_name(schema, key);
+	*tail = index;
+	
+	SCHEMA_index_changed(schema);
+	SCHEMA_unlock();
+	
+	__return index;
+	
+} /* SCHEMA_index_add */
+
+
+/*
+ * SCHEMA_index_name [X]
+ * Name of the index SCHEMA_index_add makes for a keydesc
+ * schema		Schema
+ * key			Key description
+ *
+ * NOTE: index names take the table's schema (they cannot be qualified)
+ */
+char * SCHEMA_index_name (SCHEMA * schema, struct keydesc * key)
+{
+	char *name = NULL;
+	
+__STACK(SCHEMA_index_name)
+	
+	str_append(&name, "%s_k%08x"
+		,strrchr(schema->pgname, '.') ? strrchr(schema->pgname, '.') + 1 :
+			schema->pgname
+		,SCHEMA_keydesc_hash(key)
+		);
+	
+	__return name;
+	
+} /* SCHEMA_index_name */
+
+
+/*
+ * SCHEMA_index_remove [X]
+ * Remove an index from a schema (its node stays valid until SCHEMA_delete)
+ * schema		Schema
+ * index		Index to remove
+ *
+ * NOTE: contexts may still point to the index of their last isstart;
+ * the indexes after it are renumbered, as C-ISAM does
+ */
+void SCHEMA_index_remove (SCHEMA * schema, INDEX * index)
+{
+	INDEX **link, *i;
+	
+__STACK(SCHEMA_index_remove)
+	
+	SCHEMA_lock();
+	
+	for (link = &schema->index; *link; link = &(*link)->next) {
+		if (*link == index) {
+			*link = index->next;
+			index->next = schema->dropped;
+			schema->dropped = index;
+			break;
+		}
+	}
+	
+	for (i = schema->index; i; i = i->next) {
+		if (i->num > index->num) {
+			i->num--;
+		}
+	}
+	
+	SCHEMA_index_changed(schema);
+	SCHEMA_unlock();
+	
+	__return;
+	
+} /* SCHEMA_index_remove */
+
+
+/*
+ * SCHEMA_lock | unlock [X]
+ * Serialize changes to the shared schemas: the list itself and the
+ * lookups built on demand (name hashes, keydesc memo, pivot table...)
+ *
+ * NOTE: the lock is recursive
+ */
+void SCHEMA_lock (void)
+{
+__STACK(SCHEMA_lock)
+	
+	pthread_once(&schema_lock_once, SCHEMA_lock_init);
+	pthread_mutex_lock(&schema_lock);
+	
+	__return;
+	
+} /* SCHEMA_lock */
+
+void SCHEMA_unlock (void)
+{
+__STACK(SCHEMA_unlock)
+	
+	pthread_mutex_unlock(&schema_lock);
+	
+	__return;
+	
+} /* SCHEMA_unlock */
+
+
+/*
+ * SCHEMA_lock_init
+ * Create the (recursive) schema lock
+ */
+static void SCHEMA_lock_init (void)
+{
+	pthread_mutexattr_t attr;
+	
+__STACK(SCHEMA_lock_init)
+	
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&schema_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	
+	__return;
+	
+} /* SCHEMA_lock_init */
+
+
+/*
+ * SCHEMA_keydesc_hash
+ * 32-bit FNV-1a of the keydesc fields INDEX_get_keydesc depends on
+ * key			Keydesc (k_nparts already checked)
+ */
+static unsigned int SCHEMA_keydesc_hash (struct keydesc * key)
+{
+	unsigned int h = 0x811c9dc5;
+	int x;
+	
+__STACK(SCHEMA_keydesc_hash)
+	
+#define FNV_SHORT(v) { unsigned short _v = (v); \
+	h ^= (_v & 0xff); h *= 0x01000193; h ^= (_v >> 8); h *= 0x01000193; }
+	
+	FNV_SHORT(key->k_flags);
+	FNV_SHORT(key->k_nparts);
+	
+	for (x=0; x < key->k_nparts; x++) {
+		FNV_SHORT(key->k_part[x].kp_start);
+		FNV_SHORT(key->k_part[x].kp_leng);
+		FNV_SHORT(key->k_part[x].kp_type);
+	}
+	
+#undef FNV_SHORT
+	
+	__return h;
+	
+} /* SCHEMA_keydesc_hash */
+
+
+/*
+ * SCHEMA_pivot_build
+ * Build the direct lookup table of a pivotable schema
+ * schema		Pointer to the list head
+ * root			Pivotable schema
+ */
+static void SCHEMA_pivot_build (SCHEMA * schema, SCHEMA * root)
+{
+__STACK(SCHEMA_pivot_build)
+	
+	root->pivottab = xalloc(sizeof(PIVOTTAB));
+	
+	if (root->disc_length == 1) {
+		root->pivottab->page[0] = xalloc(sizeof(SCHEMA *) * 256);
+	}
+	
+	SCHEMA_pivot_fill(schema, root, true);
+	
+	__return;
+	
+} /* SCHEMA_pivot_build */
+
+
+/*
+ * SCHEMA_pivot_fill
+ * Route the discriminator values of root to the targets loaded; filled
+ * again as schemas are loaded (see SCHEMA_push), so slots are only ever
+ * set, never freed, and SCHEMA_pivot reads them without the lock
+ * schema		Pointer to the list head
+ * root			Pivotable schema (with its pivottab)
+ * report		Log pivot= lines not (yet) routed
+ */
+static void SCHEMA_pivot_fill (SCHEMA * schema, SCHEMA * root, bool report)
+{
+	PIVOT *p;
+	SCHEMA *t;
+	int b0, b1;
+	
+__STACK(SCHEMA_pivot_fill)
+	
+	// "tables_<xx>": the discriminator matches xx ignoring case
+	if (root->pivot_byname) {
+		for (t = schema; t; t = t->next) {
+			if (! t->name || strlen(t->name) != 9 ||
+				strncmp(t->name, "tables_", 7)) {
+				continue;
+			}
+			
+			for (b0=0; b0 < 256; b0++) {
+				if (tolower(b0) != t->name[7]) continue;
+				
+				for (b1=0; b1 < 256; b1++) {
+					if (tolower(b1) == t->name[8]) {
+						SCHEMA_pivot_set(root, b0, b1, t);
+					}
+				}
+			}
+		}
+	}
+	
+	// The list is in reverse; the first pivot= line for a value wins
+	for (p = root->pivot; p; p = p->next) {
+		unsigned char *v = (unsigned char *)p->value;
+		
+		if (strlen(p->value) != root->disc_length) {
+			if (report) {
+				pgout(0, "%s: pivot value [%s] is not %u bytes long",
+					root->name, p->value, root->disc_length);
+			}
+			continue;
+		}
+		
+		// Routed when it is loaded
+		if (! (t = SCHEMA_get(schema, p->target))) {
+			if (report) {
+				pgout(mDEBUG1, "%s: pivot target [%s] is not loaded yet",
+					root->name, p->target);
+			}
+			continue;
+		}
+		
+		if (root->disc_length == 2) {
+			SCHEMA_pivot_set(root, v[0], v[1], t);
+		} else {
+			SCHEMA_pivot_set(root, 0, v[0], t);
+		}
+	}
+	
+	__return;
+	
+} /* SCHEMA_pivot_fill */
+
+
+/*
+ * SCHEMA_pivot_set
+ * Route a discriminator value of root to target
+ */
+static void SCHEMA_pivot_set (SCHEMA * root, int b0, int b1, SCHEMA * target)
+{
+	SCHEMA ***page = &root->pivottab->page[b0];
+	
+__STACK(SCHEMA_pivot_set)
+	
+	if (! *page) {
+		*page = xalloc(sizeof(SCHEMA *) * 256);
+	}
+	
+	(*page)[b1] = target;
+	
+	// Records read through the target pivot the same way
+	if (target != root) {
+		target->is_pivotable = true;
+		target->pivot_root = root;
+	}
+	
+	__return;
+	
+} /* SCHEMA_pivot_set */
+
+
+/*
+ * SCHEMA_pivot_delete
+ * Delete the direct lookup table of a pivotable schema
+ */
+static void SCHEMA_pivot_delete (SCHEMA * schema)
+{
+	int x;
+	
+__STACK(SCHEMA_pivot_delete)
 	
-	str_append(&sql,
-		"INSERT INTO %s ( %s ) VALUES ( %s )"
-		,s->pgname
-		,sql_col
-		,sql_val
-		);
+	if (schema->pivottab) {
+		for (x=0; x < 256; x++) {
+			xfree(schema->pivottab->page[x]);
+		}
+		xfree(schema->pivottab);
+		schema->pivottab = NULL;
+	}
 	
-	str_free(&sql_col);
-	str_free(&sql_val);
-		
-	__return sql;
+	__return;
 	
-} /* SCHEMA_create_insert */
+} /* SCHEMA_pivot_delete */
 
 
 /*
- * SCHEMA_create_update [X]
- * Create an UPDATE sql statement from SCHEMA
- * context		Pointer to the current context
+ * SCHEMA_build_colv [X]
+ * Index a schema's columns by ordinal
+ * schema		Schema to index
  */
-char * SCHEMA_create_update (CONTEXT * context)
+static void SCHEMA_build_colv (SCHEMA * schema)
 {
-	SCHEMA *s = context->schema;
 	COLUMN *c;
-	char *sql = NULL;
-	char *sql_set = NULL;
+	unsigned int x = 0;
 	
-__STACK(SCHEMA_create_update)
+__STACK(SCHEMA_build_colv)
 	
-	c = s->column;
+	schema->ncols = 0;
 	
-	// Iterate through each COLUMN in the SCHEMA
-	while (c) {
-		// If it has a value, update it		
-		if (c->value) {
-			if (c->datatype == ISAM_TYPE_BOOLEAN && (! strcmp(c->value, "null"))) {
-				str_append(&sql_set, " %s=null,", c->name);
-			} else
-			if (c->datatype == ISAM_TYPE_DECIMAL) {
-				str_append(&sql_set, "%s=%s,", c->name, c->value);
-			} else
-				str_append(&sql_set, " %s='%s',", c->name, c->value);
-		}
-		
-		c = c->next;
+	for (c = schema->column; c; c = c->next) {
+		schema->ncols++;
 	}
 	
-	str_trim_char(&sql_set, ',');
-	
-	// Always update the table by its primal key
-	str_append(&sql,
-		"UPDATE %s SET%s WHERE oid='%s'"
-		,s->pgname
-		,sql_set
-		,context->oid_last
-		);
-		
-	str_free(&sql_set);
+	schema->colv = (COLUMN **)xalloc(sizeof(COLUMN *) * (schema->ncols + 1));
 	
-	pgout(mDEBUG3, "sql=[%s]", sql);
+	for (c = schema->column; c; c = c->next) {
+		c->ordinal = x;
+		schema->colv[x++] = c;
+	}
 	
-	__return sql;
+	__return;
 	
-} /* SCHEMA_create_update */
+} /* SCHEMA_build_colv */
 
 
 /*
- * SCHEMA_delete [X]
- * Delete a SCHEMA object
- * schema		Pointer to the list to print
+ * SCHEMA_fingerprint [X]
+ * 64-bit FNV-1a hash of a schema's record layout
+ * schema		Schema to hash
+ *
+ * NOTE: only what affects record conversion is hashed (names, offsets,
+ * lengths, types); indexes, params and modifiers are not.
  */
-void SCHEMA_delete (SCHEMA ** schema)
+static unsigned long long SCHEMA_fingerprint (SCHEMA * schema)
 {
-	SCHEMA *s = *schema;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	unsigned int x;
 	
-__STACK(SCHEMA_delete)
+__STACK(SCHEMA_fingerprint)
 	
-	while (s) {
-		SCHEMA *next = s->next;
+#define FNV_BYTE(b) { h ^= (unsigned char)(b); h *= 0x100000001b3ULL; }
+#define FNV_UINT(u) { unsigned int _u = (u); int _i; \
+	for (_i=0; _i < 4; _i++) { FNV_BYTE(_u & 0xff); _u >>= 8; } }
+	
+	FNV_UINT(schema->reclen);
+	
+	for (x=0; x < schema->ncols; x++) {
+		COLUMN *c = schema->colv[x];
+		char *p;
 		
-		str_free(&s->name);
-		str_free(&s->pgname);
-		str_free(&s->prefix);
+		for (p = c->name; *p; p++) {
+			FNV_BYTE(*p);
+		}
+		FNV_BYTE(0);
 		
-		INDEX_delete(&s->index);
-		COLUMN_delete(&s->column);
-		MODIFY_delete(&s->modify);
-				
-		xfree(s);
-	
-		s = next;	
+		FNV_UINT(c->startpos);
+		FNV_UINT(c->length);
+		FNV_UINT(c->codelength);
+		FNV_UINT(c->datatype);
+		FNV_UINT(c->is_phantom);
 	}
 	
-	*schema = NULL;
+#undef FNV_UINT
+#undef FNV_BYTE
 	
-	__return;
+	__return h;
 	
-} /* SCHEMA_delete */
+} /* SCHEMA_fingerprint */
 
 
 /*
- * SCHEMA_shutdown [X]
- * Delete resources associated with the schema module
+ * SCHEMA_from_record [X]
+ * Fills a context's column values from record
+ * context		Context receiving values (in its COLSET)
+ * record		Generic record pointer containing values
  */
-void SCHEMA_shutdown (void)
+void SCHEMA_from_record (CONTEXT * context, char * record)
 {
-__STACK(SCHEMA_shutdown)
-
-	pgout(mDEBUG3, "shutting down schema");
+	COLSET *cs = CONTEXT_columns(context);
 	
-	str_free(&connstr);
-	connstr = NULL;
+__STACK(SCHEMA_from_record)
 	
-	str_free(&set_schema);
-	set_schema = NULL;
+	if (context->schema->codec) {
+		context->schema->codec->from_record(cs->colv, record);
+		__return;
+	}
+	
+	COLUMN_from_record(cs->column, record);
 	
 	__return;
 	
-} /* SCHEMA_shutdown */
+} /* SCHEMA_from_record */
 
 
 /*
- * SCHEMA_pivot [x]
- * Pivoting a schema is unique to c-isam file "tables",
- * Where a schema must be adapted based on the "tables type".
+ * SCHEMA_to_record [X]
+ * Fills a record from the first row of a res
+ * context		Context owning the schema and field map
+ * res			Resource object containing values
+ * record		Generic record pointer receiving values
  */
-SCHEMA * SCHEMA_pivot (SCHEMA * schema, char * record)
+void SCHEMA_to_record (CONTEXT * context, RES * res, char * record)
 {
-	char str_comp[10];
-	SCHEMA *s = schema;
-	SCHEMA *tables_default = NULL;
+	SCHEMA *s = context->schema;
+	COLSET *cs;
 	
-__STACK(SCHEMA_pivot)
+__STACK(SCHEMA_to_record)
 	
-	sprintf(str_comp, "tables_%c%c", tolower(record[0]), tolower(record[1]));
+	// Whole records from pgisam_record
+	if (CODEC_raw_to_records(res, record, s->reclen)) {
+		__return;
+	}
 	
-	while (s) {
-
-		if (! strcmp(s->name, str_comp)) {
-
-			pgout(mDEBUG2, "pivoting tables schema to [%s]",
-				str_comp);
-				
-			__return s;	
-		}
-				
-		if (! strcmp(s->name, "tables")) {
-			// Save it for later
-			tables_default = s;
+	if (s->codec && CODEC_map_res(context, res)) {
+		if (! s->codec->to_record(res->pgres, 0, context->fieldv, record)) {
+			pgout(0, "length mismatch in bridge schema [%s]", s->name);
 		}
-		
-		s = s->next;
+		__return;
 	}
+	
+	cs = CONTEXT_columns(context);
+	
+	// Fill columns from resource
+	COLUMN_from_res(&cs->column, res);
+	
+	// Fill record from columns
+	COLUMN_to_record(cs->column, &record);
 
-	if (tables_default) {	
-		pgout(mDEBUG2, "pivoting tables schema to [tables]");
-	}
-		
-	__return tables_default;
+	// Clean it
+	COLUMN_clean(cs->column);
 	
-} /* SCHEMA_pivot */
+	__return;
+	
+} /* SCHEMA_to_record */
 
 
 // _____/ STMT functions \__________
@@ -1781,6 +3331,67 @@ __STACK(MODIFY_delete)
 } /* MODIFY_delete */
 
 
+// _____/ PIVOT functions \__________
+/*
+ * PIVOT_push [X]
+ * Add a "<value>:<schema>" pivot definition to top of list
+ * pivot		Pointer to the list head
+ * definition	Definition
+ */
+bool PIVOT_push (PIVOT ** pivot, char * definition)
+{
+	PIVOT *new_element;
+	char *colon = strrchr(definition, ':');
+	
+__STACK(PIVOT_push)
+	
+	if (! colon || colon == definition || ! colon[1]) {
+		__return false;
+	}
+	
+	new_element = xalloc(sizeof(PIVOT));
+	
+	asprintf(&new_element->value, "%.*s", (int)(colon - definition),
+		definition);
+	new_element->target = str_dup(colon + 1);
+	
+	new_element->next = *pivot;
+	*pivot = new_element;
+	
+	__return true;
+	
+} /* PIVOT_push */
+
+
+/*
+ * PIVOT_delete [X]
+ * Delete a PIVOT list
+ * pivot		Pointer to the list head
+ */
+void PIVOT_delete (PIVOT ** pivot)
+{
+	PIVOT *p = *pivot;
+	
+__STACK(PIVOT_delete)
+	
+	while (p) {
+		PIVOT *next = p->next;
+		
+		str_free(&p->value);
+		str_free(&p->target);
+		
+		xfree(p);
+		
+		p = next;
+	}
+	
+	*pivot = NULL;
+	
+	__return;
+	
+} /* PIVOT_delete */
+
+
 // _____/ INDEX functions \__________
 
 /*
@@ -2095,6 +3706,54 @@ __STACK(INDEX_get_keydesc)
 } /* INDEX_get_keydesc */
 
 
+/*
+ * INDEX_keydesc [X]
+ * Describe an INDEX as a C-ISAM keydesc (the inverse of INDEX_get_keydesc)
+ * index		Index
+ * key			Receives the key description
+ *
+ * NOTE: adjacent character columns share a key part, as they would in
+ * the C-ISAM file the schema describes
+ */
+bool INDEX_keydesc (INDEX * index, struct keydesc * key)
+{
+	COLUMN *c;
+	struct keypart *kp = NULL;
+	
+__STACK(INDEX_keydesc)
+	
+	memset(key, 0, sizeof(struct keydesc));
+	
+	key->k_flags = index->is_unique ? ISNODUPS : ISDUPS;
+	
+	for (c = index->column; c; c = c->next) {
+		bool integer = (c->datatype == ISAM_TYPE_INTEGER);
+		int length = integer ? INTSIZE : c->length;
+		
+		if (kp && kp->kp_type == CHARTYPE && (! integer) &&
+			kp->kp_start + kp->kp_leng == (int)c->startpos) {
+			kp->kp_leng += length;
+		} else {
+			if (key->k_nparts == NPARTS) {
+				pgout(0, "index [%s] has more than %d key parts",
+					index->name, NPARTS);
+				__return false;
+			}
+			
+			kp = &key->k_part[key->k_nparts++];
+			kp->kp_start = c->startpos;
+			kp->kp_leng = length;
+			kp->kp_type = integer ? INTTYPE : CHARTYPE;
+		}
+		
+		key->k_len += length;
+	}
+	
+	__return true;
+	
+} /* INDEX_keydesc */
+
+
 /*
  * INDEX_delete [X]
  * Delete an INDEX object
@@ -2158,47 +3817,97 @@ __STACK(INDEX_reverse)
 
 // _____/ CONTEXT functions \__________
 
-static int CONTEXT_fdpool_get (void)
+/*
+ * CONTEXT_handle_get
+ * Issue an isfd for a context (0 = table full)
+ * context		Context the isfd will find
+ *
+ * NOTE: a slot's first isfd is slot + 1, as C-ISAM numbers files;
+ * isfds of reused slots carry the generation, so a closed isfd never
+ * finds the context that took its slot.  The table is shared by all
+ * sessions, so isfds are unique within the process.
+ */
+static int CONTEXT_handle_get (CONTEXT * context)
 {
-	int x;
+	HANDLE *h;
+	int slot, isfd;
 	
-__STACK(CONTEXT_fdpool_get)
+__STACK(CONTEXT_handle_get)
 	
-	if (! is_fdpool_initialized) {
-		for (x=1; x < MAXFDS; x++) {
-			fdpool[x] = 0;
-		}
-
-		is_fdpool_initialized = true;	
-		__return fdpool[0] = 1;
-	}
+	pthread_mutex_lock(&handle_lock);
 	
-	for (x=0; x < MAXFDS; x++) {
-		if (! fdpool[x]) {
-			pgout(mDEBUG3, "issuing fd #%d", x+1);
-			__return fdpool[x] = x+1;
+	if (handles_free >= 0) {
+		slot = handles_free;
+		handles_free = handles[slot].next_free;
+	} else {
+		if (handles_used == HANDLE_SLOT_MASK) {
+			pthread_mutex_unlock(&handle_lock);
+			pgout(0, "all %d file descriptors are in use", HANDLE_SLOT_MASK);
+			__return 0; // All out of fd's... bad
+		}
+		
+		if (handles_used == handles_alloc) {
+			int grow = handles_alloc ? handles_alloc * 2 : 64;
+			HANDLE *grown = (HANDLE *)xrealloc(handles, sizeof(HANDLE) * grow);
+			
+			if (! grown) {
+				pthread_mutex_unlock(&handle_lock);
+				__return 0;
+			}
+			
+			handles = grown;
+			handles_alloc = grow;
+			memset(&handles[handles_used], 0,
+				sizeof(HANDLE) * (handles_alloc - handles_used));
 		}
+		
+		slot = handles_used++;
 	}
 	
-	__return 0; // All out of fd's... bad
+	h = &handles[slot];
+	h->context = context;
+	h->next_free = -1;
+	
+	isfd = (int)(h->generation << HANDLE_SLOT_BITS) | (slot + 1);
+	
+	pthread_mutex_unlock(&handle_lock);
+	
+	pgout(mDEBUG3, "issuing fd #%d", isfd);
 	
-} /* CONTEXT_fdpool_get */
+	__return isfd;
+	
+} /* CONTEXT_handle_get */
 
 
-static void CONTEXT_fdpool_delete (int fd)
+/*
+ * CONTEXT_handle_delete
+ * Release the slot of an isfd
+ */
+static void CONTEXT_handle_delete (int isfd)
 {
-__STACK(CONTEXT_fdpool_delete)
+	int slot = (isfd & HANDLE_SLOT_MASK) - 1;
+	
+__STACK(CONTEXT_handle_delete)
 
-	if (fd <= 0) {
+	pthread_mutex_lock(&handle_lock);
+	
+	if (isfd <= 0 || slot >= handles_used || ! handles[slot].context) {
+		pthread_mutex_unlock(&handle_lock);
 		__return;
 	}
 	
-	pgout(mDEBUG3, "deleting fd #%d", fd);
-	fdpool[fd - 1] = 0;
+	handles[slot].context = NULL;
+	handles[slot].generation = (handles[slot].generation + 1) & HANDLE_GEN_MASK;
+	handles[slot].next_free = handles_free;
+	handles_free = slot;
+	
+	pthread_mutex_unlock(&handle_lock);
+	
+	pgout(mDEBUG3, "deleting fd #%d", isfd);
 	
 	__return;
 
-} /* CONTEXT_fdpool_delete */
+} /* CONTEXT_handle_delete */
 
 
 /*
@@ -2213,9 +3922,10 @@ void CONTEXT_push (CONTEXT ** current, SCHEMA * schema)
 	
 __STACK(CONTEXT_push)
 		
-	new_element->id = context_id++;		// Increment the context id
-	new_element->isfd = CONTEXT_fdpool_get();
+	new_element->id = __sync_fetch_and_add(&context_id, 1);	// Increment the context id
+	new_element->isfd = CONTEXT_handle_get(new_element);
 	new_element->schema = schema;		// Point to the right schema
+	new_element->list = current;		// Only found through this list
 	
 	new_element->next = *current;
 	*current = new_element;
@@ -2228,27 +3938,50 @@ __STACK(CONTEXT_push)
 /*
  * CONTEXT_get [X]
  * Return a context matching C-ISAM bridge file descriptor
- * current		Pointer to the current list
+ * list			Pointer to the list the context must be on
  * isfd			C-ISAM bridge file descriptor
+ *
+ * NOTE: isfds of other lists (other sessions) are not found
  */
-CONTEXT * CONTEXT_get (CONTEXT * current, int isfd)
+CONTEXT * CONTEXT_get (CONTEXT ** list, int isfd)
 {
-	CONTEXT *cx = current;
+	int slot = (isfd & HANDLE_SLOT_MASK) - 1;
+	CONTEXT *cx = NULL;
+	bool other = false;
+	HANDLE *h;
 	
 __STACK(CONTEXT_get)
 	
-	if (! cx) {
+	pthread_mutex_lock(&handle_lock);
+	
+	if (isfd > 0 && slot >= 0 && slot < handles_used) {
+		h = &handles[slot];
+		
+		// Closed, or closed and the slot reused since
+		if (h->context &&
+			(unsigned int)(isfd >> HANDLE_SLOT_BITS) == h->generation) {
+			cx = h->context;
+		}
+	}
+	
+	// Read while the slot can't be released and its context freed
+	if (cx && cx->list != list) {
+		other = true;
+		cx = NULL;
+	}
+	
+	pthread_mutex_unlock(&handle_lock);
+	
+	if (other) {
+		pgout(mDEBUG2, "fd #%d belongs to another session", isfd);
 		__return (CONTEXT *)NULL;
 	}
 	
-	while (cx) {
-		if (cx->isfd == isfd) {
-			__return cx;
-		}	
-		cx = cx->next;
+	if (! cx) {
+		pgout(mDEBUG2, "stale fd #%d", isfd);
 	}
 	
-	__return (CONTEXT *)NULL;
+	__return cx;
 	
 } /* CONTEXT_get */
 
@@ -2288,6 +4021,7 @@ __STACK(CONTEXT_delete_node)
 			prev->next = c->next;	// Unlink the node
 			
 			// If context is in a cursor, close the cursor
+			// (a sharded one's are closed by SESSION_context_end)
 			if (c->cursor_name) {
 				RES *tmpres;
 				char *tmpsql = NULL;
@@ -2307,14 +4041,17 @@ __STACK(CONTEXT_delete_node)
 				str_free(&c->cursor_name);
 			}
 			
-			// Let fd go back into the pool
-			CONTEXT_fdpool_delete(c->isfd);
+			// Let fd go back into the table
+			CONTEXT_handle_delete(c->isfd);
 			
 			// Free node resources
 			str_free(&c->oid_last);
 			str_free(&c->sql_last);
 			str_free(&c->sql_temp);
 			str_free(&c->cursor_name);
+			xfree(c->fieldv);
+			CONTEXT_prefetch_clear(c);
+			CONTEXT_colset_delete(&c->colset);
 			
 			xfree(c);				// Free it
 			break;					// That's all, take a break
@@ -2347,13 +4084,16 @@ __STACK(CONTEXT_delete)
 	while (c) {
 		CONTEXT *next = c->next;	// Save a copy of the next ptr
 		
-		// Let fd go back into the pool
-		CONTEXT_fdpool_delete(c->isfd);
+		// Let fd go back into the table
+		CONTEXT_handle_delete(c->isfd);
 		
 		str_free(&c->oid_last);
 		str_free(&c->sql_last);
 		str_free(&c->sql_temp);
 		str_free(&c->cursor_name);
+		xfree(c->fieldv);
+		CONTEXT_prefetch_clear(c);
+		CONTEXT_colset_delete(&c->colset);
 		
 		xfree(c);
 		
@@ -2367,6 +4107,124 @@ __STACK(CONTEXT_delete)
 } /* CONTEXT_delete */
 
 
+/*
+ * CONTEXT_columns [X]
+ * Return the context's COLSET for its current schema (built once)
+ * context		Context
+ *
+ * NOTE: a pivoting context keeps a COLSET for each schema it visits
+ */
+COLSET * CONTEXT_columns (CONTEXT * context)
+{
+	COLSET *cs;
+	
+__STACK(CONTEXT_columns)
+	
+	for (cs = context->colset; cs; cs = cs->next) {
+		if (cs->schema == context->schema) {
+			__return cs;
+		}
+	}
+	
+	cs = CONTEXT_colset_new(context->schema);
+	cs->next = context->colset;
+	context->colset = cs;
+	
+	__return cs;
+	
+} /* CONTEXT_columns */
+
+
+/*
+ * CONTEXT_colset_new
+ * Copy a schema's columns (without values); the copies and colv are
+ * a single allocation and share the schema's names and params
+ * schema		Schema to copy
+ */
+static COLSET * CONTEXT_colset_new (SCHEMA * schema)
+{
+	COLSET *cs;
+	COLUMN *column;
+	unsigned int x;
+	
+__STACK(CONTEXT_colset_new)
+	
+	cs = xalloc(sizeof(COLSET) +
+		sizeof(COLUMN *) * (schema->ncols + 1) +
+		sizeof(COLUMN) * schema->ncols);
+	
+	cs->schema = schema;
+	cs->colv = (COLUMN **)&cs[1];
+	column = (COLUMN *)&cs->colv[schema->ncols + 1];
+	
+	for (x=0; x < schema->ncols; x++) {
+		column[x] = *schema->colv[x];
+		column[x].value = NULL;
+		column[x].sz_value = 0;
+		column[x].prev = x ? &column[x - 1] : NULL;
+		column[x].next = (x + 1 < schema->ncols) ? &column[x + 1] : NULL;
+		cs->colv[x] = &column[x];
+	}
+	
+	cs->column = schema->ncols ? column : NULL;
+	
+	__return cs;
+	
+} /* CONTEXT_colset_new */
+
+
+/*
+ * CONTEXT_colset_delete
+ * Delete a context's COLSET list (and any values left in it)
+ * colset		Pointer to the list
+ */
+static void CONTEXT_colset_delete (COLSET ** colset)
+{
+	COLSET *cs = *colset;
+	
+__STACK(CONTEXT_colset_delete)
+	
+	while (cs) {
+		COLSET *next = cs->next;
+		unsigned int x;
+		
+		for (x=0; x < cs->schema->ncols; x++) {
+			str_free((char **)&cs->colv[x]->value);
+		}
+		
+		xfree(cs);
+		
+		cs = next;
+	}
+	
+	*colset = NULL;
+	
+	__return;
+	
+} /* CONTEXT_colset_delete */
+
+
+/*
+ * CONTEXT_prefetch_clear [X]
+ * Discard the rows read ahead by a context
+ * context		Context owning the rows
+ */
+void CONTEXT_prefetch_clear (CONTEXT * context)
+{
+__STACK(CONTEXT_prefetch_clear)
+	
+	RES_delete(&context->prefetch_res);
+	xfree(context->prefetch);
+	
+	context->prefetch = NULL;
+	context->prefetch_next = 0;
+	context->prefetch_eof = false;
+	
+	__return;
+	
+} /* CONTEXT_prefetch_clear */
+
+
 /*
  * CONTEXT_print [X]
  * Print a CONTEXT type to stdout
@@ -26,8 +26,17 @@ typedef struct STMT_T {
  */
 typedef struct CONN_T {
 	PGconn *pgconn;			// Postgres data connection
+	const char *connstr;	// Connection string (shared)
+	double started;			// When connecting started (ms, for the startup log)
 	bool in_transaction;	// Is the connection in a transaction state?
+	bool is_standby;		// Connected to a read-only standby
+	bool is_pending;		// Started but not yet usable (see pg_ready)
+	PostgresPollingStatusType polling;	// Where connecting is (see pg_connect_poll)
 	bool is_connected;		// Flag indicating connection state
+	bool rawrecord_checked;	// Has the pgisam_record extension been looked for?
+	bool has_rawrecord;		// pgisam_record is installed (and the abi matches)
+	int pipelined;			// Statements sent by pg_send whose results are unread
+	struct RES_T *received;	// Their results, read off to run a statement
 } CONN;
 
 /*
@@ -38,6 +47,7 @@ typedef struct RES_T {
 	int tuples;				// Tuples returned by query
 	int nfields;			// Number of fields
 	PGresult *pgres;
+	struct RES_T *next;		// Next result read ahead of its caller (see pg_receive)
 } RES;
 
 /*
@@ -49,6 +59,16 @@ typedef struct MODIFY_T {
 	struct MODIFY_T *next;
 } MODIFY;
 
+/*
+ * PIVOT
+ * Routes records of a pivotable schema with a discriminator value
+ */
+typedef struct PIVOT_T {
+	char *value;			// Discriminator value
+	char *target;			// Name of the schema the records belong to
+	struct PIVOT_T *next;
+} PIVOT;
+
 /*
  * COLUMN
  * Holds column definitions
@@ -63,6 +83,7 @@ typedef struct COLUMN_T {
 	unsigned int codelength;// Significant bytes in code 
 	unsigned int datatype;	// Data type (ISAM_TYPE_CHAR|DECIMAL|CODE)
 	size_t sz_value;		// Size of value storage (used for bytea conversions)
+	unsigned int ordinal;	// Position in the schema's colv
 	struct COLUMN_T *prev;
 	struct COLUMN_T *next;
 } COLUMN;
@@ -76,6 +97,7 @@ typedef struct INDEX_T {
 	bool is_unique;			// Is the index unique?
 	int num;				// The index #
 	COLUMN *column;			// Columns making up the index (col must exist)
+	bool is_added;			// Added by isaddindex (allocated on its own)
 	struct INDEX_T *next;
 } INDEX;
 
@@ -88,15 +110,51 @@ typedef struct SCHEMA_T {
 	char *pgname;			// Postgres table name (normally ecn_*)
 	char *prefix;			// Table prefix
 	bool is_convertable;	// Will have the word CONVERT appended
-	bool is_pivotable;		// Is the schema pivotable (i.e. "tables*")?
+	bool is_pivotable;		// Is the schema pivotable (discriminator= or "tables*")?
+	unsigned int disc_start;	// Discriminator of pivotable records
+	unsigned int disc_length;	// (1 or 2 bytes)
+	bool pivot_byname;		// Targets are "tables_<xx>" (no pivot= list)
+	PIVOT *pivot;			// Discriminator values > target schemas
+	struct PIVOTTAB_T *pivottab;	// Direct lookup, built on first pivot
+	struct SCHEMA_T *pivot_root;	// Schema whose pivottab routes this one
 	bool nocreate;			// Do we skip "CREATE TABLE" on isbuild [DEFAULT=no]?
+	char *shard;			// shard=hash|range:<bound>,... (see shard.c; NULL = none)
+	int timeout;			// Time budget of a call, ms (timeout=; 0 = none)
+	bool writebehind;		// Autocommit writes are queued to workers (see writebehind.c)
+	int groupcommit;		// Autocommit writes per group transaction (groupcommit=; 0 = the option's)
+	unsigned long timeouts;	// Calls that ran out of it (see log_pgisam_stats)
 	unsigned int reclen;	// Length of the C-ISAM record
 	INDEX *index;			// Index definition list
+	INDEX *dropped;			// Removed by isdelindex (freed with the schema)
 	COLUMN *column;			// Column definition list
 	MODIFY *modify;			// SQL modifiers
+	unsigned int ncols;		// Number of columns in colv
+	COLUMN **colv;			// Column definitions by ordinal (codec order)
+	unsigned long long fingerprint;	// Hash of the record layout
+	const struct CODEC_T *codec;	// Generated codec (NULL = interpreter)
+	bool binary_checked;	// Table column types have been checked
+	bool binary_res;		// Fetches may return binary results
+	bool rawrecord;			// Use pgisam_record when installed [DEFAULT=no]?
+	char *rawlayout;		// Record layout passed to pgisam_record
+	bool in_image;			// Built from the schema image (see schimage.c)
+	bool pgname_alloc;		// pgname replaced by SCHEMA_qualify (in_image)
+	struct HASH_T *colhash;	// Columns by name (see SCHEMA_column)
+	struct KEYCACHE_T *keycache;	// Resolved keydescs (see SCHEMA_index_keydesc)
 	struct SCHEMA_T *next;
 } SCHEMA;
 
+/*
+ * COLSET
+ * A context's copy of a schema's columns; schemas are shared between
+ * sessions, so values only ever live in a COLSET
+ */
+typedef struct COLSET_T {
+	SCHEMA *schema;			// Schema the columns were copied from
+	COLUMN *column;			// Copies of schema->column (same order)
+	COLUMN **colv;			// Copies by ordinal
+	struct COLSET_T *next;
+} COLSET;
+
 /*
  * CONTEXT
  * Holds context information based on C-ISAM file descriptors
@@ -107,15 +165,30 @@ typedef struct CONTEXT_T {
 	bool special_case;		// Flag for special case scenarios
 	bool reverse_direction;	// Should the cursor read in reverse direction?
 	CONN *conn;				// Pointer to the current connection the context is using
+	CONN *reader;			// Reader connection of a read-only context (NULL = none)
+	struct MERGE_T *merge;	// Cursors of a sharded schema (see shard.c)
 	char *cursor_name;		// Name of the current cursor associated w/the context
 	char *sql_last;			// Stores the sql stmt associated with the cursor declaration
 	char *oid_last;			// Holds the last OID obtained by isread
 	char *sql_temp;			// Stores extended sql clauses for temporary use later
 	int isfd;				// C-ISAM bridge file descriptor
 	int mode;				// isstart mode associated with the cursor
+	int timeout;			// Time budget of a call, ms (0 = the session's; <0 = none)
+	struct WBFILE_T *wb;	// Writes queued behind (NULL = none yet)
 	INDEX *index;			// Pointer to the index used by the last isstart
+	bool keyset;			// Positioned by isstart without a cursor (stateless)
 	SCHEMA *schema;			// Pointer to the schema
 	unsigned long id;		// Cursor ID
+	int *fieldv;			// Codec column ordinal > res field number
+	int fieldv_nfields;		// Number of res fields fieldv was mapped from
+	bool fieldv_complete;	// Does the res hold every record column?
+	struct SCHEMA_T *fieldv_schema;	// Schema fieldv was mapped for
+	RES *prefetch_res;		// Rows read ahead by a multi-row FETCH
+	char *prefetch;			// prefetch_res converted to records
+	int prefetch_next;		// Next row of prefetch to return
+	bool prefetch_eof;		// Did the FETCH run past the end of the cursor?
+	COLSET *colset;			// Column values by schema (see CONTEXT_columns)
+	struct CONTEXT_T **list;	// List the context was pushed on (see CONTEXT_get)
 	struct CONTEXT_T *next;	
 } CONTEXT;
 
@@ -126,10 +199,43 @@ typedef struct CONTEXT_T {
 // _____/ CONN functions \__________
 /*
  * CONN_new
- * Create a new connection to a Postgres database
+ * Create a new connection to a Postgres database; connecting is started
+ * (or, with the lazyconnect option, put off) and finished on first use
  */
 CONN * CONN_new (void);
 
+/*
+ * CONN_new_standby
+ * Create a new connection to one of the standbys in conn.def (in turn)
+ */
+CONN * CONN_new_standby (void);
+
+/*
+ * CONN_has_standby
+ * Are any standbys listed in conn.def?
+ */
+bool CONN_has_standby (void);
+
+/*
+ * CONN_new_shard
+ * Create a new connection to a shard of the sharded tables
+ * n			Shard (0 = the EDATA entry itself, see CONN_shards)
+ */
+CONN * CONN_new_shard (int n);
+
+/*
+ * CONN_shards
+ * Number of shards in conn.def: the EDATA entry and its shard lines
+ */
+int CONN_shards (void);
+
+/*
+ * CONN_set_setting
+ * Add a server setting to the connections made from now on
+ * setting		"name=value" (e.g. "synchronous_commit=off")
+ */
+bool CONN_set_setting (char * setting);
+
 /*
  * CONN_delete
  * Delete a connection (NOTE: since CONN is reusable, certain members stay intact)
@@ -147,6 +253,27 @@ bool CONN_begin (CONN * conn);
 bool CONN_commit (CONN * conn);
 bool CONN_rollback (CONN * conn);
 
+/*
+ * CONN_current
+ * Return the calling thread's connection (the last created by CONN_new
+ * or passed to CONN_use)
+ */
+CONN * CONN_current (void);
+
+/*
+ * CONN_use
+ * Make a connection the calling thread's current connection
+ * conn			Connection object
+ */
+void CONN_use (CONN * conn);
+
+/*
+ * CONN_has_rawrecord
+ * Is the pgisam_record extension installed (checked once per connection)?
+ * conn			Connection object
+ */
+bool CONN_has_rawrecord (CONN * conn);
+
 
 // _____/ RES functions \__________
 /*
@@ -171,6 +298,15 @@ void RES_print (RES * res);
  */
 void RES_get_oid (RES * res, char ** oidstr);
 
+/*
+ * RES_get_oid_row
+ * Obtain the oid of a row from a RES
+ * res			Pointer to the resource
+ * row			Row number
+ * oidstr		Pointer to the oid
+ */
+void RES_get_oid_row (RES * res, int row, char ** oidstr);
+
 
 // _____/ COLUMN functions \__________
 /*
@@ -274,6 +410,53 @@ void SCHEMA_push (SCHEMA **schema, char *definition);
  */
 SCHEMA * SCHEMA_get (SCHEMA *current, char *definition);
 
+/*
+ * SCHEMA_column
+ * Return the column of a schema matching name
+ * schema		Schema
+ * name			Column name
+ */
+COLUMN * SCHEMA_column (SCHEMA *schema, char *name);
+
+/*
+ * SCHEMA_index_keydesc
+ * INDEX_get_keydesc of a schema's indexes, memoized per keydesc
+ * schema		Schema
+ * key			Keydesc to match
+ */
+INDEX * SCHEMA_index_keydesc (SCHEMA *schema, struct keydesc *key);
+
+/*
+ * SCHEMA_index_changed
+ * Forget resolved keydescs (must be called when schema->index changes)
+ * schema		Schema
+ */
+void SCHEMA_index_changed (SCHEMA *schema);
+
+/*
+ * SCHEMA_index_add
+ * Add an index described by a keydesc (NULL if the key matches no columns)
+ * schema		Schema
+ * key			Key description
+ */
+INDEX * SCHEMA_index_add (SCHEMA *schema, struct keydesc *key);
+
+/*
+ * SCHEMA_index_name
+ * Name of the index SCHEMA_index_add makes for a keydesc (str_free it)
+ * schema		Schema
+ * key			Key description
+ */
+char * SCHEMA_index_name (SCHEMA *schema, struct keydesc *key);
+
+/*
+ * SCHEMA_index_remove
+ * Remove an index from a schema (its node stays valid until SCHEMA_delete)
+ * schema		Schema
+ * index		Index to remove
+ */
+void SCHEMA_index_remove (SCHEMA *schema, INDEX *index);
+
 /*
  * SCHEMA_print
  * Print a SCHEMA type to stdout
@@ -296,6 +479,38 @@ char * SCHEMA_create_insert (CONTEXT *context);
  */
 char * SCHEMA_create_update (CONTEXT *context);
 
+/*
+ * SCHEMA_create_copy
+ * Create a COPY ... FROM STDIN sql statement from context's schema
+ * context		Pointer to the current context
+ * omit			Columns left out, by ordinal (see CODEC_batch_run)
+ */
+char * SCHEMA_create_copy (CONTEXT *context, bool *omit);
+
+/*
+ * SCHEMA_use_raw
+ * Does a context move whole records through pgisam_record?
+ * context		Pointer to the current context
+ */
+bool SCHEMA_use_raw (CONTEXT *context);
+
+/*
+ * SCHEMA_raw_layout
+ * Record layout of a schema for pgisam_record (cached in the schema)
+ * schema		Schema
+ */
+char * SCHEMA_raw_layout (SCHEMA *schema);
+
+/*
+ * SCHEMA_create_raw_insert | SCHEMA_create_raw_update
+ * Create an INSERT/UPDATE sql statement passing the whole record to
+ * pgisam_unrecord
+ * context		Pointer to the current context
+ * record		Record to write
+ */
+char * SCHEMA_create_raw_insert (CONTEXT *context, char *record);
+char * SCHEMA_create_raw_update (CONTEXT *context, char *record);
+
 /*
  * SCHEMA_delete
  * Delete a SCHEMA object
@@ -303,12 +518,49 @@ char * SCHEMA_create_update (CONTEXT *context);
  */
 void SCHEMA_delete (SCHEMA **schema);
 
+/*
+ * SCHEMA_qualify
+ * Prefix the table names of a schema list with the database schema
+ * schema		Pointer to the list
+ */
+void SCHEMA_qualify (SCHEMA *schema);
+
 /*
  * SCHEMA_pivot [x]
- * Pivoting a schema is unique to c-isam file "tables",
- * Where a schema must be adapted based on the "tables type".
+ * Select the schema a record of a pivotable schema belongs to, from
+ * the discriminator bytes of the record (NULL = no match)
+ * schema		Pointer to the list head
+ * current		Pivotable schema (or a schema it pivoted to)
+ * record		Record
  */
-SCHEMA * SCHEMA_pivot (SCHEMA *schema, char *record);
+SCHEMA * SCHEMA_pivot (SCHEMA *schema, SCHEMA *current, char *record);
+
+/*
+ * SCHEMA_lock | unlock
+ * Serialize changes to the shared schemas: the list itself and the
+ * lookups built on demand (name hashes, keydesc memo, pivot table...)
+ *
+ * NOTE: the lock is recursive
+ */
+void SCHEMA_lock (void);
+void SCHEMA_unlock (void);
+
+/*
+ * SCHEMA_from_record
+ * Fills a context's column values from record (codec or interpreter)
+ * context		Context receiving values (in its COLSET)
+ * record		Generic record pointer containing values
+ */
+void SCHEMA_from_record (CONTEXT *context, char *record);
+
+/*
+ * SCHEMA_to_record
+ * Fills a record from the first row of a res (codec or interpreter)
+ * context		Context owning the schema and field map
+ * res			Resource object containing values
+ * record		Generic record pointer receiving values
+ */
+void SCHEMA_to_record (CONTEXT *context, RES *res, char *record);
 
 
 // _____/ STMT functions \___________
@@ -355,6 +607,23 @@ char * MODIFY_print (MODIFY *modify, char *label);
 void MODIFY_delete (MODIFY **modify);
 
 
+// _____/ PIVOT functions \___________
+/*
+ * PIVOT_push
+ * Add a "<value>:<schema>" pivot definition to top of list
+ * pivot		Pointer to the list head
+ * definition	Definition
+ */
+bool PIVOT_push (PIVOT **pivot, char *definition);
+
+/*
+ * PIVOT_delete
+ * Delete a PIVOT list
+ * pivot		Pointer to the list head
+ */
+void PIVOT_delete (PIVOT **pivot);
+
+
 // _____/ INDEX functions \___________
 /*
  * INDEX_push
@@ -398,6 +667,14 @@ char * INDEX_print (INDEX *index, char *label);
  */
 INDEX * INDEX_get_keydesc (INDEX *index, struct keydesc *keydesc);
 
+/*
+ * INDEX_keydesc
+ * Describe an INDEX as a C-ISAM keydesc
+ * index		Index
+ * key			Receives the key description
+ */
+bool INDEX_keydesc (INDEX *index, struct keydesc *key);
+
 /*
  * INDEX_delete
  * Delete an INDEX object
@@ -441,10 +718,24 @@ void CONTEXT_delete (CONTEXT **context);
 /*
  * CONTEXT_get
  * Return a context matching C-ISAM bridge file descriptor
- * current		Pointer to the current list
+ * list			Pointer to the list the context must be on
  * isfd			C-ISAM bridge file descriptor
  */
-CONTEXT * CONTEXT_get (CONTEXT *current, int isfd);
+CONTEXT * CONTEXT_get (CONTEXT **list, int isfd);
+
+/*
+ * CONTEXT_columns
+ * Return the context's COLSET for its current schema (built once)
+ * context		Context
+ */
+COLSET * CONTEXT_columns (CONTEXT *context);
+
+/*
+ * CONTEXT_prefetch_clear
+ * Discard the rows read ahead by a context
+ * context		Context owning the rows
+ */
+void CONTEXT_prefetch_clear (CONTEXT *context);
 
 /*
  * CONTEXT_print
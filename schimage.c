@@ -0,0 +1,872 @@
+/*
+ * schimage.c: compiled schema image
+ *
+ * Layout (native byte order, every offset from the start of the image):
+ *   IMG_HEADER
+ *   IMG_DEF[ndefs]			definition files and their mtime/size
+ *   IMG_SCHEMA[nschemas]	in hSchema order
+ *   IMG_COLUMN[ncolumns]	schema columns, in list order
+ *   IMG_INDEX[nindexes]
+ *   IMG_COLUMN[nicolumns]	index columns, in list order
+ *   IMG_MODIFY[nmodifies]
+ *   IMG_PIVOT[npivots]
+ *   strings				NUL terminated; a string reference is an
+ *							offset into this section, 0 = NULL
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// For keydesc
+#include <isam.h>
+
+#include <libpq-fe.h>
+
+#include "sys.h"
+#include "schema.h"
+#include "codec.h"
+#include "schimage.h"
+#include "xstring.h"
+
+#define IMG_MAGIC		"PGISIMG"
+#define IMG_VERSION		5
+#define IMG_BYTEORDER	0x01020304
+#define IMG_ALIGN(n)	(((n) + 7) & ~7)
+
+// IMG_SCHEMA flags
+#define IMG_CONVERTABLE	0x01
+#define IMG_PIVOTABLE	0x02
+#define IMG_NOCREATE	0x04
+#define IMG_RAWRECORD	0x08
+#define IMG_PIVOTBYNAME	0x10
+#define IMG_WRITEBEHIND	0x20
+
+typedef struct IMG_HEADER_T {
+	char magic[8];
+	unsigned int version;
+	unsigned int byteorder;		// IMG_BYTEORDER as written
+	unsigned int size;			// Bytes in the image
+	unsigned int ndefs;
+	unsigned int nschemas;
+	unsigned int ncolumns;
+	unsigned int nindexes;
+	unsigned int nicolumns;
+	unsigned int nmodifies;
+	unsigned int npivots;
+	unsigned int nstrings;		// Bytes in the string section
+	unsigned int defs;			// Section offsets
+	unsigned int schemas;
+	unsigned int columns;
+	unsigned int indexes;
+	unsigned int icolumns;
+	unsigned int modifies;
+	unsigned int pivots;
+	unsigned int strings;
+} IMG_HEADER;
+
+typedef struct IMG_DEF_T {
+	unsigned int file;			// File name in $BRIDGE
+	unsigned int pad;
+	long long mtime;
+	long long size;
+} IMG_DEF;
+
+typedef struct IMG_SCHEMA_T {
+	unsigned int name;
+	unsigned int pgname;
+	unsigned int prefix;
+	unsigned int flags;
+	unsigned int reclen;
+	unsigned int ncols;			// Columns, from IMG_COLUMN column
+	unsigned int column;
+	unsigned int nindexes;		// Indexes, from IMG_INDEX index
+	unsigned int index;
+	unsigned int nmodifies;		// Modifiers, from IMG_MODIFY modify
+	unsigned int modify;
+	unsigned int npivots;		// Pivots, from IMG_PIVOT pivot
+	unsigned int pivot;
+	unsigned int disc_start;
+	unsigned int disc_length;
+	unsigned int shard;
+	unsigned int timeout;
+	unsigned int groupcommit;
+	unsigned long long fingerprint;
+} IMG_SCHEMA;
+
+typedef struct IMG_COLUMN_T {
+	unsigned int name;
+	unsigned int params;
+	unsigned int startpos;
+	unsigned int length;
+	unsigned int codelength;
+	unsigned int datatype;
+	unsigned int is_phantom;
+} IMG_COLUMN;
+
+typedef struct IMG_INDEX_T {
+	unsigned int name;
+	unsigned int is_unique;
+	int num;
+	unsigned int ncols;			// Index columns, from icolumn
+	unsigned int icolumn;
+} IMG_INDEX;
+
+typedef struct IMG_MODIFY_T {
+	unsigned int definition;
+} IMG_MODIFY;
+
+typedef struct IMG_PIVOT_T {
+	unsigned int value;
+	unsigned int target;
+} IMG_PIVOT;
+
+/*
+ * IMGBUF
+ * Growable section while an image is built
+ */
+typedef struct IMGBUF_T {
+	char *data;
+	size_t size;
+	size_t alloc;
+	bool failed;		// Could not grow (the image is not written)
+} IMGBUF;
+
+// External data
+extern bool append_convert;				// in schema.c
+
+// Static data
+static char *image = NULL;				// The mapped image
+static size_t image_size = 0;
+
+// Static function prototypes
+static char * image_path (char * preload_def, char * file);
+static bool image_valid (IMG_HEADER * h);
+static bool image_current (IMG_HEADER * h, char * preload_def);
+static char * image_str (IMG_HEADER * h, unsigned int ref, bool * bad);
+static SCHEMA * image_schema (IMG_HEADER * h, IMG_SCHEMA * is);
+static size_t imgbuf_add (IMGBUF * b, const void * data, size_t len);
+static unsigned int imgbuf_str (IMGBUF * b, const char * str);
+static bool imgbuf_def (IMGBUF * defs, IMGBUF * strings, char * preload_def,
+	char * file, time_t parsed);
+
+
+// CODE STARTS HERE
+
+
+// _____/ SCHIMAGE functions \__________
+/*
+ * SCHIMAGE_load
+ * Build a schema list from the image, if it is current
+ * schema		Receives the schema list (must be empty)
+ * preload_def	Path of preload.def
+ */
+bool SCHIMAGE_load (SCHEMA ** schema, char * preload_def)
+{
+	IMG_HEADER *h;
+	IMG_SCHEMA *is;
+	SCHEMA *tail = NULL;
+	char *path;
+	struct stat st;
+	unsigned int x;
+	int fd;
+
+__STACK(SCHIMAGE_load)
+
+	// Image pgnames never carry the _conv suffix
+	if (append_convert || image) {
+		__return false;
+	}
+
+	path = image_path(preload_def, "preload.img");
+	fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		pgout(mDEBUG2, "no schema image [%s]", path);
+		str_free(&path);
+		__return false;
+	}
+
+	if (fstat(fd, &st) || st.st_size < sizeof(IMG_HEADER)) {
+		close(fd);
+		str_free(&path);
+		__return false;
+	}
+
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (image == MAP_FAILED) {
+		pgout(mSYS, "mmap failed for [%s]", path);
+		image = NULL;
+		str_free(&path);
+		__return false;
+	}
+
+	image_size = st.st_size;
+	h = (IMG_HEADER *)image;
+
+	if (! image_valid(h)) {
+		pgout(0, "schema image [%s] is invalid; parsing definitions", path);
+		goto unload;
+	}
+
+	if (! image_current(h, preload_def)) {
+		goto unload;
+	}
+
+	is = (IMG_SCHEMA *)(image + h->schemas);
+
+	for (x=0; x < h->nschemas; x++) {
+		SCHEMA *s = image_schema(h, &is[x]);
+
+		if (! s) {
+			pgout(0, "schema image [%s] is invalid; parsing definitions", path);
+			SCHEMA_delete(schema);
+			goto unload;
+		}
+
+		if (tail) {
+			tail->next = s;
+		} else {
+			*schema = s;
+		}
+		tail = s;
+	}
+
+	pgout(mDEBUG2, "mapped schema image [%s] (%u bytes)", path, h->size);
+	str_free(&path);
+
+	__return true;
+
+unload:
+	str_free(&path);
+	SCHIMAGE_unload();
+	__return false;
+
+} /* SCHIMAGE_load */
+
+
+/*
+ * SCHIMAGE_save
+ * Write the image of a schema list parsed from preload_def
+ * schema		Schema list (as built by SCHEMA_push)
+ * preload_def	Path of preload.def
+ * parsed		When parsing started (definitions changed since are
+ *				not trusted and the image is not written)
+ */
+void SCHIMAGE_save (SCHEMA * schema, char * preload_def, time_t parsed)
+{
+	IMGBUF defs = {0}, schemas = {0}, columns = {0}, indexes = {0},
+		icolumns = {0}, modifies = {0}, pivots = {0}, strings = {0};
+	IMG_HEADER h;
+	SCHEMA *s;
+	char *path = NULL, *tmp = NULL;
+	FILE *fd;
+	bool ok = false;
+
+__STACK(SCHIMAGE_save)
+
+	if (append_convert) {
+		__return;
+	}
+
+	// String reference 0 is NULL
+	imgbuf_add(&strings, "", 1);
+
+	if (! imgbuf_def(&defs, &strings, preload_def, "preload.def", parsed)) {
+		goto done;
+	}
+
+	for (s = schema; s; s = s->next) {
+		IMG_SCHEMA is;
+		COLUMN *c;
+		INDEX *i;
+		MODIFY *m;
+		PIVOT *p;
+		char *file = NULL;
+		bool def_ok;
+
+		// The definition could not be read
+		if (! s->name) {
+			goto done;
+		}
+
+		str_append(&file, "%s.def", s->name);
+		def_ok = imgbuf_def(&defs, &strings, preload_def, file, parsed);
+		str_free(&file);
+
+		if (! def_ok) {
+			goto done;
+		}
+
+		memset(&is, 0, sizeof(is));
+		is.name = imgbuf_str(&strings, s->name);
+		is.pgname = imgbuf_str(&strings, s->pgname);
+		is.prefix = imgbuf_str(&strings, s->prefix);
+		is.shard = imgbuf_str(&strings, s->shard);
+		is.flags = (s->is_convertable ? IMG_CONVERTABLE : 0) |
+			(s->is_pivotable ? IMG_PIVOTABLE : 0) |
+			(s->nocreate ? IMG_NOCREATE : 0) |
+			(s->rawrecord ? IMG_RAWRECORD : 0) |
+			(s->pivot_byname ? IMG_PIVOTBYNAME : 0) |
+			(s->writebehind ? IMG_WRITEBEHIND : 0);
+		is.reclen = s->reclen;
+		is.disc_start = s->disc_start;
+		is.disc_length = s->disc_length;
+		is.timeout = (unsigned int)s->timeout;
+		is.groupcommit = (unsigned int)s->groupcommit;
+		is.fingerprint = s->fingerprint;
+
+		is.column = columns.size / sizeof(IMG_COLUMN);
+		for (c = s->column; c; c = c->next) {
+			IMG_COLUMN ic = {
+				imgbuf_str(&strings, c->name), imgbuf_str(&strings, c->params),
+				c->startpos, c->length, c->codelength, c->datatype,
+				c->is_phantom
+			};
+
+			imgbuf_add(&columns, &ic, sizeof(ic));
+			is.ncols++;
+		}
+
+		is.index = indexes.size / sizeof(IMG_INDEX);
+		for (i = s->index; i; i = i->next) {
+			IMG_INDEX ii;
+
+			memset(&ii, 0, sizeof(ii));
+			ii.name = imgbuf_str(&strings, i->name);
+			ii.is_unique = i->is_unique;
+			ii.num = i->num;
+			ii.icolumn = icolumns.size / sizeof(IMG_COLUMN);
+
+			for (c = i->column; c; c = c->next) {
+				IMG_COLUMN ic = {
+					imgbuf_str(&strings, c->name), imgbuf_str(&strings, c->params),
+					c->startpos, c->length, c->codelength, c->datatype,
+					c->is_phantom
+				};
+
+				imgbuf_add(&icolumns, &ic, sizeof(ic));
+				ii.ncols++;
+			}
+
+			imgbuf_add(&indexes, &ii, sizeof(ii));
+			is.nindexes++;
+		}
+
+		is.modify = modifies.size / sizeof(IMG_MODIFY);
+		for (m = s->modify; m; m = m->next) {
+			IMG_MODIFY im = { imgbuf_str(&strings, m->definition) };
+
+			imgbuf_add(&modifies, &im, sizeof(im));
+			is.nmodifies++;
+		}
+
+		is.pivot = pivots.size / sizeof(IMG_PIVOT);
+		for (p = s->pivot; p; p = p->next) {
+			IMG_PIVOT ip = {
+				imgbuf_str(&strings, p->value), imgbuf_str(&strings, p->target)
+			};
+
+			imgbuf_add(&pivots, &ip, sizeof(ip));
+			is.npivots++;
+		}
+
+		imgbuf_add(&schemas, &is, sizeof(is));
+	}
+
+	// A section could not grow: the image would be incomplete
+	if (defs.failed || schemas.failed || columns.failed || indexes.failed ||
+		icolumns.failed || modifies.failed || pivots.failed || strings.failed) {
+		pgout(mSYS, "out of memory; schema image not written");
+		goto done;
+	}
+
+	// Lay the sections out
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, IMG_MAGIC, sizeof(IMG_MAGIC));
+	h.version = IMG_VERSION;
+	h.byteorder = IMG_BYTEORDER;
+	h.ndefs = defs.size / sizeof(IMG_DEF);
+	h.nschemas = schemas.size / sizeof(IMG_SCHEMA);
+	h.ncolumns = columns.size / sizeof(IMG_COLUMN);
+	h.nindexes = indexes.size / sizeof(IMG_INDEX);
+	h.nicolumns = icolumns.size / sizeof(IMG_COLUMN);
+	h.nmodifies = modifies.size / sizeof(IMG_MODIFY);
+	h.npivots = pivots.size / sizeof(IMG_PIVOT);
+	h.nstrings = strings.size;
+
+	h.defs = IMG_ALIGN(sizeof(h));
+	h.schemas = IMG_ALIGN(h.defs + defs.size);
+	h.columns = IMG_ALIGN(h.schemas + schemas.size);
+	h.indexes = IMG_ALIGN(h.columns + columns.size);
+	h.icolumns = IMG_ALIGN(h.indexes + indexes.size);
+	h.modifies = IMG_ALIGN(h.icolumns + icolumns.size);
+	h.pivots = IMG_ALIGN(h.modifies + modifies.size);
+	h.strings = IMG_ALIGN(h.pivots + pivots.size);
+	h.size = h.strings + strings.size;
+
+	// Write a private copy and rename it over the old image
+	path = image_path(preload_def, "preload.img");
+	str_append(&tmp, "%s.%d", path, (int)getpid());
+
+	if (! (fd = fopen(tmp, "w"))) {
+		pgout(mDEBUG1, "cannot write schema image [%s]", tmp);
+		goto done;
+	}
+
+	{
+		IMGBUF *section[] = { &defs, &schemas, &columns, &indexes,
+			&icolumns, &modifies, &pivots, &strings };
+		unsigned int offset[] = { h.defs, h.schemas, h.columns, h.indexes,
+			h.icolumns, h.modifies, h.pivots, h.strings };
+		static const char zero[8];
+		size_t at = sizeof(h);
+		int x;
+
+		ok = (fwrite(&h, sizeof(h), 1, fd) == 1);
+
+		for (x=0; ok && x < sizeof(offset) / sizeof(offset[0]); x++) {
+			ok = (fwrite(zero, 1, offset[x] - at, fd) == offset[x] - at);
+
+			if (ok && section[x]->size) {
+				ok = (fwrite(section[x]->data, section[x]->size, 1, fd) == 1);
+			}
+
+			at = offset[x] + section[x]->size;
+		}
+	}
+
+	if (fclose(fd) || (! ok) || rename(tmp, path)) {
+		pgout(mSYS, "cannot write schema image [%s]", path);
+		unlink(tmp);
+		ok = false;
+	} else {
+		pgout(mDEBUG1, "wrote schema image [%s] (%u schemas, %u bytes)"
+			,path
+			,h.nschemas
+			,h.size
+			);
+	}
+
+done:
+	xfree(defs.data);
+	xfree(schemas.data);
+	xfree(columns.data);
+	xfree(indexes.data);
+	xfree(icolumns.data);
+	xfree(modifies.data);
+	xfree(pivots.data);
+	xfree(strings.data);
+	str_free(&tmp);
+	str_free(&path);
+
+	__return;
+
+} /* SCHIMAGE_save */
+
+
+/*
+ * SCHIMAGE_unload
+ * Unmap the image (after the schemas loaded from it are deleted)
+ */
+void SCHIMAGE_unload (void)
+{
+__STACK(SCHIMAGE_unload)
+
+	if (image) {
+		munmap(image, image_size);
+	}
+
+	image = NULL;
+	image_size = 0;
+
+	__return;
+
+} /* SCHIMAGE_unload */
+
+
+// _____/ image functions \__________
+/*
+ * image_path
+ * Path of a file next to preload.def
+ */
+static char * image_path (char * preload_def, char * file)
+{
+	char *path = NULL;
+	char *slash = strrchr(preload_def, '/');
+
+__STACK(image_path)
+
+	if (slash) {
+		str_append(&path, "%.*s/%s", (int)(slash - preload_def), preload_def,
+			file);
+	} else {
+		path = str_dup(file);
+	}
+
+	__return path;
+
+} /* image_path */
+
+
+/*
+ * image_valid
+ * Check the header and that every section lies within the image
+ */
+static bool image_valid (IMG_HEADER * h)
+{
+	struct {
+		unsigned int offset;
+		unsigned long long size;
+	} section[] = {
+		{ h->defs,		(unsigned long long)h->ndefs * sizeof(IMG_DEF) },
+		{ h->schemas,	(unsigned long long)h->nschemas * sizeof(IMG_SCHEMA) },
+		{ h->columns,	(unsigned long long)h->ncolumns * sizeof(IMG_COLUMN) },
+		{ h->indexes,	(unsigned long long)h->nindexes * sizeof(IMG_INDEX) },
+		{ h->icolumns,	(unsigned long long)h->nicolumns * sizeof(IMG_COLUMN) },
+		{ h->modifies,	(unsigned long long)h->nmodifies * sizeof(IMG_MODIFY) },
+		{ h->pivots,	(unsigned long long)h->npivots * sizeof(IMG_PIVOT) },
+		{ h->strings,	h->nstrings }
+	};
+	int x;
+
+__STACK(image_valid)
+
+	if (memcmp(h->magic, IMG_MAGIC, sizeof(IMG_MAGIC)) ||
+		h->version != IMG_VERSION ||
+		h->byteorder != IMG_BYTEORDER ||
+		h->size != image_size) {
+		__return false;
+	}
+
+	for (x=0; x < sizeof(section) / sizeof(section[0]); x++) {
+		if (section[x].offset & 7 ||
+			section[x].offset + section[x].size > h->size) {
+			__return false;
+		}
+	}
+
+	// Strings must be terminated
+	if (! h->nstrings || image[h->strings + h->nstrings - 1]) {
+		__return false;
+	}
+
+	__return true;
+
+} /* image_valid */
+
+
+/*
+ * image_current
+ * Are the definitions unchanged since the image was written?
+ */
+static bool image_current (IMG_HEADER * h, char * preload_def)
+{
+	IMG_DEF *d = (IMG_DEF *)(image + h->defs);
+	unsigned int x;
+	bool bad = false;
+
+__STACK(image_current)
+
+	for (x=0; x < h->ndefs; x++) {
+		char *file = image_str(h, d[x].file, &bad);
+		char *path;
+		struct stat st;
+
+		if (bad || ! file) {
+			__return false;
+		}
+
+		path = image_path(preload_def, file);
+
+		if (stat(path, &st) ||
+			(long long)st.st_mtime != d[x].mtime ||
+			(long long)st.st_size != d[x].size) {
+			pgout(mDEBUG1, "[%s] changed; rebuilding schema image", path);
+			str_free(&path);
+			__return false;
+		}
+
+		str_free(&path);
+	}
+
+	__return true;
+
+} /* image_current */
+
+
+/*
+ * image_str
+ * String in the mapped image (bad is set when ref is out of range)
+ */
+static char * image_str (IMG_HEADER * h, unsigned int ref, bool * bad)
+{
+__STACK(image_str)
+
+	if (ref >= h->nstrings) {
+		*bad = true;
+		__return NULL;
+	}
+
+	__return ref ? (image + h->strings + ref) : NULL;
+
+} /* image_str */
+
+
+/*
+ * image_schema
+ * Build a schema from the image; the SCHEMA, its colv and all of its
+ * COLUMN, INDEX, MODIFY and PIVOT nodes are one allocation (see
+ * SCHEMA_delete)
+ */
+static SCHEMA * image_schema (IMG_HEADER * h, IMG_SCHEMA * is)
+{
+	IMG_COLUMN *ic = (IMG_COLUMN *)(image + h->columns);
+	IMG_COLUMN *iic = (IMG_COLUMN *)(image + h->icolumns);
+	IMG_INDEX *ii = (IMG_INDEX *)(image + h->indexes);
+	IMG_MODIFY *im = (IMG_MODIFY *)(image + h->modifies);
+	IMG_PIVOT *ip = (IMG_PIVOT *)(image + h->pivots);
+	SCHEMA *s;
+	COLUMN *column, *icolumn;
+	INDEX *index;
+	MODIFY *modify;
+	PIVOT *pivot;
+	unsigned int nicols = 0, x, y;
+	bool bad = false;
+	char *p;
+
+__STACK(image_schema)
+
+	if ((unsigned long long)is->column + is->ncols > h->ncolumns ||
+		(unsigned long long)is->index + is->nindexes > h->nindexes ||
+		(unsigned long long)is->modify + is->nmodifies > h->nmodifies ||
+		(unsigned long long)is->pivot + is->npivots > h->npivots) {
+		__return NULL;
+	}
+
+	ic += is->column;
+	ii += is->index;
+	im += is->modify;
+	ip += is->pivot;
+
+	for (x=0; x < is->nindexes; x++) {
+		if ((unsigned long long)ii[x].icolumn + ii[x].ncols > h->nicolumns) {
+			__return NULL;
+		}
+		nicols += ii[x].ncols;
+	}
+
+	p = xalloc(sizeof(SCHEMA) +
+		sizeof(COLUMN *) * (is->ncols + 1) +
+		sizeof(COLUMN) * (is->ncols + nicols) +
+		sizeof(INDEX) * is->nindexes +
+		sizeof(MODIFY) * is->nmodifies +
+		sizeof(PIVOT) * is->npivots);
+
+	s = (SCHEMA *)p;
+	p += sizeof(SCHEMA);
+	s->colv = (COLUMN **)p;
+	p += sizeof(COLUMN *) * (is->ncols + 1);
+	column = (COLUMN *)p;
+	p += sizeof(COLUMN) * is->ncols;
+	icolumn = (COLUMN *)p;
+	p += sizeof(COLUMN) * nicols;
+	index = (INDEX *)p;
+	p += sizeof(INDEX) * is->nindexes;
+	modify = (MODIFY *)p;
+	p += sizeof(MODIFY) * is->nmodifies;
+	pivot = (PIVOT *)p;
+
+	s->in_image = true;
+	s->name = image_str(h, is->name, &bad);
+	s->pgname = image_str(h, is->pgname, &bad);
+	s->prefix = image_str(h, is->prefix, &bad);
+	s->shard = image_str(h, is->shard, &bad);
+	s->is_convertable = (is->flags & IMG_CONVERTABLE) ? true : false;
+	s->is_pivotable = (is->flags & IMG_PIVOTABLE) ? true : false;
+	s->nocreate = (is->flags & IMG_NOCREATE) ? true : false;
+	s->rawrecord = (is->flags & IMG_RAWRECORD) ? true : false;
+	s->pivot_byname = (is->flags & IMG_PIVOTBYNAME) ? true : false;
+	s->writebehind = (is->flags & IMG_WRITEBEHIND) ? true : false;
+	s->disc_start = is->disc_start;
+	s->disc_length = is->disc_length;
+	s->timeout = (int)is->timeout;
+	s->groupcommit = (int)is->groupcommit;
+	s->reclen = is->reclen;
+	s->fingerprint = is->fingerprint;
+	s->ncols = is->ncols;
+
+	for (x=0; x < is->ncols; x++) {
+		COLUMN *c = &column[x];
+
+		c->name = image_str(h, ic[x].name, &bad);
+		c->params = image_str(h, ic[x].params, &bad);
+		c->startpos = ic[x].startpos;
+		c->length = ic[x].length;
+		c->codelength = ic[x].codelength;
+		c->datatype = ic[x].datatype;
+		c->is_phantom = ic[x].is_phantom ? true : false;
+		c->next = (x + 1 < is->ncols) ? &column[x + 1] : NULL;
+		c->ordinal = x;
+
+		s->colv[x] = c;
+	}
+	s->column = is->ncols ? column : NULL;
+
+	for (x=0; x < is->nindexes; x++) {
+		INDEX *i = &index[x];
+		IMG_COLUMN *iicx = &iic[ii[x].icolumn];
+
+		i->name = image_str(h, ii[x].name, &bad);
+		i->is_unique = ii[x].is_unique ? true : false;
+		i->num = ii[x].num;
+		i->column = ii[x].ncols ? icolumn : NULL;
+		i->next = (x + 1 < is->nindexes) ? &index[x + 1] : NULL;
+
+		for (y=0; y < ii[x].ncols; y++) {
+			COLUMN *c = icolumn++;
+
+			c->name = image_str(h, iicx[y].name, &bad);
+			c->params = image_str(h, iicx[y].params, &bad);
+			c->startpos = iicx[y].startpos;
+			c->length = iicx[y].length;
+			c->codelength = iicx[y].codelength;
+			c->datatype = iicx[y].datatype;
+			c->is_phantom = iicx[y].is_phantom ? true : false;
+			c->next = (y + 1 < ii[x].ncols) ? icolumn : NULL;
+		}
+	}
+	s->index = is->nindexes ? index : NULL;
+
+	for (x=0; x < is->nmodifies; x++) {
+		modify[x].definition = image_str(h, im[x].definition, &bad);
+		modify[x].next = (x + 1 < is->nmodifies) ? &modify[x + 1] : NULL;
+	}
+	s->modify = is->nmodifies ? modify : NULL;
+
+	for (x=0; x < is->npivots; x++) {
+		pivot[x].value = image_str(h, ip[x].value, &bad);
+		pivot[x].target = image_str(h, ip[x].target, &bad);
+
+		if (! pivot[x].value || ! pivot[x].target) {
+			bad = true;
+		}
+		pivot[x].next = (x + 1 < is->npivots) ? &pivot[x + 1] : NULL;
+	}
+	s->pivot = is->npivots ? pivot : NULL;
+
+	if (bad || ! s->name || ! s->pgname) {
+		s->next = NULL;
+		SCHEMA_delete(&s);
+		__return NULL;
+	}
+
+	CODEC_attach(s);
+
+	__return s;
+
+} /* image_schema */
+
+
+// _____/ IMGBUF functions \__________
+/*
+ * imgbuf_add
+ * Append len bytes to a section; returns their offset in the section
+ *
+ * NOTE: if the section can not grow, it is marked failed and nothing more
+ * is added (SCHIMAGE_save then writes no image)
+ */
+static size_t imgbuf_add (IMGBUF * b, const void * data, size_t len)
+{
+	size_t at = b->size;
+	char *grown;
+
+__STACK(imgbuf_add)
+
+	if (b->failed) {
+		__return at;
+	}
+
+	if (b->size + len > b->alloc) {
+		size_t alloc = (b->size + len) * 2 + 256;
+
+		if ((grown = xrealloc(b->data, alloc)) == NULL) {
+			b->failed = true;
+			__return at;
+		}
+		b->data = grown;
+		b->alloc = alloc;
+	}
+
+	memcpy(b->data + b->size, data, len);
+	b->size += len;
+
+	__return at;
+
+} /* imgbuf_add */
+
+
+/*
+ * imgbuf_str
+ * Add a string to the string section; returns its reference
+ */
+static unsigned int imgbuf_str (IMGBUF * b, const char * str)
+{
+__STACK(imgbuf_str)
+
+	if (! str) {
+		__return 0;
+	}
+
+	__return (unsigned int)imgbuf_add(b, str, strlen(str) + 1);
+
+} /* imgbuf_str */
+
+
+/*
+ * imgbuf_def
+ * Record the mtime and size of a definition file
+ */
+static bool imgbuf_def (IMGBUF * defs, IMGBUF * strings, char * preload_def,
+	char * file, time_t parsed)
+{
+	IMG_DEF d;
+	struct stat st;
+	char *path = image_path(preload_def, file);
+
+__STACK(imgbuf_def)
+
+	if (stat(path, &st)) {
+		pgout(mDEBUG1, "cannot stat [%s]; schema image not written", path);
+		str_free(&path);
+		__return false;
+	}
+
+	// Changed while (or after) it was parsed
+	if (st.st_mtime >= parsed) {
+		pgout(mDEBUG1, "[%s] changed during load; schema image not written",
+			path);
+		str_free(&path);
+		__return false;
+	}
+
+	str_free(&path);
+
+	memset(&d, 0, sizeof(d));
+	d.file = imgbuf_str(strings, file);
+	d.mtime = (long long)st.st_mtime;
+	d.size = (long long)st.st_size;
+
+	imgbuf_add(defs, &d, sizeof(d));
+
+	__return true;
+
+} /* imgbuf_def */
@@ -0,0 +1,41 @@
+/*
+ * schimage.h: compiled schema image
+ *
+ * preload.def and every .def it names are parsed once into a flat image
+ * ($BRIDGE/preload.img).  Later processes mmap the image read-only and
+ * build their SCHEMA list from it: names, params and modifiers point into
+ * the mapping (shared through the page cache) and the nodes of a schema
+ * are a single allocation.  The image records the mtime and size of every
+ * .def it was built from and is rebuilt when any of them change.
+ */
+
+#ifndef _SCHIMAGE_H
+#define _SCHIMAGE_H
+
+/*
+ * SCHIMAGE_load
+ * Build a schema list from the image, if it is current
+ * schema		Receives the schema list (must be empty)
+ * preload_def	Path of preload.def
+ */
+bool SCHIMAGE_load (SCHEMA ** schema, char * preload_def);
+
+/*
+ * SCHIMAGE_save
+ * Write the image of a schema list parsed from preload_def
+ * schema		Schema list (as built by SCHEMA_push)
+ * preload_def	Path of preload.def
+ * parsed		When parsing started
+ *
+ * NOTE: failures are logged and ignored; the next process parses again.
+ * Definitions modified at or after parsed are not trusted.
+ */
+void SCHIMAGE_save (SCHEMA * schema, char * preload_def, time_t parsed);
+
+/*
+ * SCHIMAGE_unload
+ * Unmap the image (after the schemas loaded from it are deleted)
+ */
+void SCHIMAGE_unload (void);
+
+#endif // _SCHIMAGE_H
@@ -0,0 +1,816 @@
+/*
+ * session.c: bridge sessions
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+// For keydesc in schema.h
+#include <isam.h>
+
+#include <libpq-fe.h>
+
+#include "sys.h"
+#include "schema.h"
+#include "session.h"
+#include "shard.h"
+#include "writebehind.h"
+#include "pgres.h"
+#include "xstring.h"
+
+#define MAX_READERS 8
+
+// Static data
+static int readers = 0;					// Reader connections per session
+static int standby_lag = 5;				// Seconds reads stay on the primary after a write
+static time_t last_write = 0;			// When this process last wrote
+static int group_size = 0;				// Writes outside transactions grouped per transaction
+static int group_wait = 1000;			// ms a group stays open (0 = no limit)
+static pthread_key_t session_key;		// The calling thread's session
+static pthread_once_t session_once = PTHREAD_ONCE_INIT;
+
+// Static function prototypes
+static void session_init (void);
+static void session_exit (void * data);
+static bool session_replay (CONN * conn, char ** sql, int n);
+static void session_group_clear (SESSION * session);
+static double session_clock (void);
+
+
+// CODE STARTS HERE
+
+
+// _____/ SESSION functions \__________
+/*
+ * SESSION_new [X]
+ * Create a session and connect it (NULL = no connection)
+ */
+SESSION * SESSION_new (void)
+{
+	SESSION *session = xalloc(sizeof(SESSION));
+	CONN *current = CONN_current();
+	
+__STACK(SESSION_new)
+	
+	pgout(mDEBUG3, "opening session");
+	
+	session->conn = CONN_new();
+	
+	// CONN_new made it current; the session may be for another thread
+	CONN_use(current);
+	
+	if (! session->conn) {
+		pgout(0, "failed to connect session");
+		xfree(session);
+		__return (SESSION *)NULL;
+	}
+	
+	__return session;
+	
+} /* SESSION_new */
+
+
+/*
+ * SESSION_use [X]
+ * Make a session the calling thread's current session
+ * session		Session (NULL = none; the next call creates one)
+ */
+void SESSION_use (SESSION * session)
+{
+	SESSION *previous;
+	
+__STACK(SESSION_use)
+	
+	pthread_once(&session_once, session_init);
+	
+	previous = pthread_getspecific(session_key);
+	
+	pthread_setspecific(session_key, session);
+	CONN_use(session ? session->conn : NULL);
+	
+	// Nothing else can reach a thread's own session
+	if (previous && previous != session && previous->implicit) {
+		SESSION_delete(&previous);
+	}
+	
+	__return;
+	
+} /* SESSION_use */
+
+
+/*
+ * SESSION_current [X]
+ * Return the calling thread's session
+ * create		Create (and connect) one if the thread has none
+ *
+ * NOTE: NULL when the thread has none (or it could not connect)
+ */
+SESSION * SESSION_current (bool create)
+{
+	SESSION *session;
+	
+__STACK(SESSION_current)
+	
+	pthread_once(&session_once, session_init);
+	
+	if ((session = pthread_getspecific(session_key)) != (SESSION *)NULL) {
+		__return session;
+	}
+	
+	if (create && (session = SESSION_new()) != (SESSION *)NULL) {
+		session->implicit = true;
+		SESSION_use(session);
+	}
+	
+	__return session;
+	
+} /* SESSION_current */
+
+
+/*
+ * SESSION_conn [X]
+ * Connection for a context opened in a session
+ * session		Session
+ * mode			isopen mode (ISINPUT contexts may get a reader)
+ *
+ * NOTE: readers are connected on first use and handed out in turn
+ */
+CONN * SESSION_conn (SESSION * session, int mode)
+{
+	CONN *current, *conn;
+	bool has_standby = CONN_has_standby();
+	int n, x;
+	
+__STACK(SESSION_conn)
+	
+	// With standbys in conn.def there is at least one reader
+	n = (! readers && has_standby) ? 1 : readers;
+	
+	if ((mode & 0x03) != ISINPUT || ! n) {
+		__return session->conn;
+	}
+	
+	if (! session->reader) {
+		session->reader = xalloc(sizeof(CONN *) * MAX_READERS);
+	}
+	
+	x = session->next_reader;
+	session->next_reader = (x + 1) % n;
+	
+	if (x < session->nreaders) {
+		__return session->reader[x];
+	}
+	
+	// Connect the next one (CONN_new makes it current)
+	current = CONN_current();
+	conn = has_standby ? CONN_new_standby() : CONN_new();
+	CONN_use(current);
+	
+	if (! conn) {
+		pgout(0, "failed to connect reader %d, using the session's", x);
+		session->next_reader = 0;
+		__return session->nreaders ? session->reader[0] : session->conn;
+	}
+	
+	pgout(mDEBUG2, "connecting reader %d", x);
+	
+	__return session->reader[session->nreaders++] = conn;
+	
+} /* SESSION_conn */
+
+
+/*
+ * SESSION_read_conn [X]
+ * Connection a read-only context reads with next
+ * session		Session
+ * context		Context
+ *
+ * NOTE: reads stay with the session's connection while it is in a
+ * transaction, and for standby_lag seconds after this process wrote
+ * (a standby may not have replayed the write yet)
+ */
+CONN * SESSION_read_conn (SESSION * session, CONTEXT * context)
+{
+	time_t last;
+	
+__STACK(SESSION_read_conn)
+	
+	if (! context->reader) {
+		__return context->conn;
+	}
+	
+	if (session->conn->in_transaction) {
+		__return session->conn;
+	}
+	
+	last = last_write;
+	
+	if (context->reader->is_standby && last
+		&& time(NULL) - last <= standby_lag) {
+		pgout(mDEBUG3, "wrote %lds ago, reading from the primary",
+			(long)(time(NULL) - last));
+		__return session->conn;
+	}
+	
+	__return context->reader;
+	
+} /* SESSION_read_conn */
+
+
+/*
+ * SESSION_wrote [X]
+ * Note that this process has written (see SESSION_read_conn)
+ */
+void SESSION_wrote (void)
+{
+__STACK(SESSION_wrote)
+	
+	__sync_lock_test_and_set(&last_write, time(NULL));
+	
+	__return;
+	
+} /* SESSION_wrote */
+
+
+/*
+ * SESSION_set_standby_lag [X]
+ * Seconds reads stay on the primary after a write (0 = none)
+ */
+void SESSION_set_standby_lag (int seconds)
+{
+__STACK(SESSION_set_standby_lag)
+	
+	standby_lag = (seconds < 0) ? 0 : seconds;
+	
+	__return;
+	
+} /* SESSION_set_standby_lag */
+
+
+/*
+ * SESSION_shard_conn [X]
+ * Connection of a session to a shard of the sharded tables
+ * session		Session
+ * n			Shard (0 = the session's connection)
+ *
+ * NOTE: shards are connected on first use, and join the session's
+ * transaction (isbegin) then; SESSION_shard_end ends it there
+ */
+CONN * SESSION_shard_conn (SESSION * session, int n)
+{
+	CONN *current, *conn;
+	
+__STACK(SESSION_shard_conn)
+	
+	if (n <= 0) {
+		__return session->conn;
+	}
+	
+	if (n >= session->nshards) {
+		CONN **grown = (CONN **)xrealloc(session->shard, sizeof(CONN *) * (n + 1));
+		
+		if (! grown) {
+			__return (CONN *)NULL;
+		}
+		
+		session->shard = grown;
+		memset(&session->shard[session->nshards], 0,
+			sizeof(CONN *) * (n + 1 - session->nshards));
+		session->nshards = n + 1;
+	}
+	
+	if (! (conn = session->shard[n])) {
+		
+		// CONN_new_shard makes it current
+		current = CONN_current();
+		conn = session->shard[n] = CONN_new_shard(n);
+		CONN_use(current);
+		
+		if (! conn) {
+			pgout(0, "failed to connect shard %d", n);
+			__return (CONN *)NULL;
+		}
+	}
+	
+	if (session->conn->in_transaction && ! conn->in_transaction) {
+		if (CONN_begin(conn) < 0) {
+			__return (CONN *)NULL;
+		}
+		conn->in_transaction = true;
+	}
+	
+	__return conn;
+	
+} /* SESSION_shard_conn */
+
+
+/*
+ * SESSION_shard_end [X]
+ * Commit or roll back the transactions of the session's shards
+ * session		Session
+ * commit		Commit (true) or roll back (false)
+ *
+ * NOTE: each shard commits on its own; a failure part way leaves the
+ * shards before it committed
+ */
+bool SESSION_shard_end (SESSION * session, bool commit)
+{
+	bool ret = true;
+	int n;
+	
+__STACK(SESSION_shard_end)
+	
+	for (n=1; n < session->nshards; n++) {
+		CONN *conn = session->shard[n];
+		
+		if (! conn || ! conn->in_transaction) {
+			continue;
+		}
+		
+		if ((commit ? CONN_commit(conn) : CONN_rollback(conn)) < 0) {
+			pgout(0, "shard %d failed to %s", n, commit ? "commit" : "roll back");
+			ret = false;
+		}
+		
+		conn->in_transaction = false;
+	}
+	
+	__return ret;
+	
+} /* SESSION_shard_end */
+
+
+/*
+ * SESSION_context_end [X]
+ * End what a context has running before it is deleted (CONTEXT_delete)
+ * context		Context
+ * close		Close its cursors (false: already gone with their transaction)
+ *
+ * NOTE: done here, not by CONTEXT_delete, so that schema.c needs neither
+ * shard.c nor writebehind.c (defgen links it alone)
+ */
+void SESSION_context_end (CONTEXT * context, bool close)
+{
+__STACK(SESSION_context_end)
+	
+	// Writes queued for the file are made first (see writebehind.c)
+	WB_close(&context->wb);
+	
+	// The cursors of a sharded schema, one per shard (see shard.c)
+	if (context->merge) {
+		MERGE_delete(&context->merge, close);
+		str_free(&context->cursor_name);
+	}
+	
+	__return;
+	
+} /* SESSION_context_end */
+
+
+/*
+ * SESSION_set_readers [X]
+ * Number of reader connections each session may open (0 = none)
+ */
+void SESSION_set_readers (int n)
+{
+__STACK(SESSION_set_readers)
+	
+	readers = (n < 0) ? 0 : (n > MAX_READERS) ? MAX_READERS : n;
+	
+	__return;
+	
+} /* SESSION_set_readers */
+
+
+/*
+ * SESSION_set_group_size [X]
+ * Writes outside transactions grouped per transaction (0 or 1 = none)
+ */
+void SESSION_set_group_size (int n)
+{
+__STACK(SESSION_set_group_size)
+	
+	group_size = (n < 0) ? 0 : n;
+	
+	__return;
+	
+} /* SESSION_set_group_size */
+
+
+/*
+ * SESSION_set_group_wait [X]
+ * Milliseconds a group stays open, at most (0 = no limit)
+ */
+void SESSION_set_group_wait (int ms)
+{
+__STACK(SESSION_set_group_wait)
+	
+	group_wait = (ms < 0) ? 0 : ms;
+	
+	__return;
+	
+} /* SESSION_set_group_wait */
+
+
+/*
+ * SESSION_group_size [X]
+ * Writes grouped per transaction for a file
+ * size			Its .def's groupcommit (0 = the option's)
+ */
+int SESSION_group_size (int size)
+{
+__STACK(SESSION_group_size)
+	
+	__return size ? size : group_size;
+	
+} /* SESSION_group_size */
+
+
+/*
+ * SESSION_group_due [X]
+ * Is the session's group to be committed before the next write joins it?
+ * session		Session
+ * size			Writes per group (see SESSION_group_size)
+ *
+ * NOTE: the age of a group is only looked at as writes are made: a
+ * program that stops writing leaves it open until its next call
+ */
+bool SESSION_group_due (SESSION * session, int size)
+{
+__STACK(SESSION_group_due)
+	
+	if (! session->ngroup) {
+		__return false;
+	}
+	
+	if (session->ngroup >= SESSION_group_size(size)) {
+		__return true;
+	}
+	
+	if (group_wait && session_clock() - session->group_opened >= group_wait) {
+		__return true;
+	}
+	
+	__return false;
+	
+} /* SESSION_group_due */
+
+
+/*
+ * SESSION_group_exec [X]
+ * Make a write in the session's group transaction (opened if none)
+ * session		Session
+ * sql			INSERT, UPDATE or DELETE statement
+ *
+ * NOTE: NULL if it failed; the writes before it in the group are made
+ * again (logged, and lost, only if one fails then)
+ */
+RES * SESSION_group_exec (SESSION * session, char * sql)
+{
+	RES *res;
+	char **grown;
+	
+__STACK(SESSION_group_exec)
+	
+	// Room to keep it for a replay first: not made without
+	if (! (grown = (char **)xrealloc(session->group,
+		sizeof(char *) * (session->ngroup + 1)))) {
+		__return (RES *)NULL;
+	}
+	session->group = grown;
+	
+	if (! session->ngroup) {
+		if (CONN_begin(session->conn) < 0) {
+			__return (RES *)NULL;
+		}
+		session->group_opened = session_clock();
+	}
+	
+	if ((res = pg_exec(session->conn, sql)) == (RES *)NULL) {
+		
+		// It aborted the group: the writes before it are made again
+		CONN_rollback(session->conn);
+		
+		if (session->ngroup) {
+			pgout(mDEBUG1, "write failed in a group: making the %d before it again",
+				session->ngroup);
+			session_replay(session->conn, session->group, session->ngroup);
+		}
+		
+		session_group_clear(session);
+		__return (RES *)NULL;
+	}
+	
+	session->group[session->ngroup++] = str_dup(sql);
+	
+	__return res;
+	
+} /* SESSION_group_exec */
+
+
+/*
+ * SESSION_group_end [X]
+ * Commit the session's group transaction, if one is open
+ * session		Session (NULL = none)
+ *
+ * NOTE: false if a write of the group could not be made (it is logged)
+ */
+bool SESSION_group_end (SESSION * session)
+{
+	bool ret = true;
+	
+__STACK(SESSION_group_end)
+	
+	if (! session || ! session->ngroup) {
+		__return true;
+	}
+	
+	pgout(mDEBUG3, "committing a group of %d writes", session->ngroup);
+	
+	// CONN_commit rolls back what it could not commit
+	if (CONN_commit(session->conn) < 0) {
+		pgout(0, "a group of %d writes failed to commit: making them again",
+			session->ngroup);
+		ret = session_replay(session->conn, session->group, session->ngroup);
+	}
+	
+	session_group_clear(session);
+	
+	__return ret;
+	
+} /* SESSION_group_end */
+
+
+/*
+ * SESSION_lock_begin [X]
+ * Start a transaction to hold row locks on a connection, unless it is in
+ * one (the session's transaction, or locks held already)
+ * session		Session
+ * conn			Connection the locks are taken on
+ */
+bool SESSION_lock_begin (SESSION * session, CONN * conn)
+{
+__STACK(SESSION_lock_begin)
+	
+	if (conn->in_transaction) {
+		__return true;
+	}
+	
+	pgout(mDEBUG3, "starting a transaction to hold row locks");
+	
+	if (CONN_begin(conn) < 0) {
+		__return false;
+	}
+	
+	conn->in_transaction = true;
+	session->locking = true;
+	
+	__return true;
+	
+} /* SESSION_lock_begin */
+
+
+/*
+ * SESSION_lock_end [X]
+ * End the transaction started to hold row locks, if there is one
+ * session		Session (NULL = none)
+ * commit		Commit (true) or roll back (false) what was written in it
+ *
+ * NOTE: false if it could not be committed (a statement in it failed),
+ * or if one was rolled back since the last commit (reported once)
+ */
+bool SESSION_lock_end (SESSION * session, bool commit)
+{
+	CONN *conn;
+	bool ret = true;
+	
+__STACK(SESSION_lock_end)
+	
+	if (! session) {
+		__return true;
+	}
+	
+	// What was written before the rollback was acknowledged, and is lost
+	if (commit && session->lock_lost) {
+		session->lock_lost = false;
+		ret = false;
+	}
+	
+	if (! session->locking) {
+		__return ret;
+	}
+	
+	pgout(mDEBUG3, "releasing row locks");
+	
+	// A locking read that failed lost no writes, unless some were made
+	session->locking = false;
+	session->lock_lost = (! commit && session->lock_wrote) ? true : false;
+	session->lock_wrote = false;
+	conn = session->conn;
+	
+	if (conn->in_transaction) {
+		
+		// COMMIT of a failed transaction would roll it back quietly
+		if (commit && PQtransactionStatus(conn->pgconn) == PQTRANS_INERROR) {
+			pgout(0, "a statement failed while row locks were held: "
+				"what was written since is rolled back");
+			commit = ret = false;
+		}
+		
+		if ((commit ? CONN_commit(conn) : CONN_rollback(conn)) < 0) {
+			ret = false;
+		}
+		
+		conn->in_transaction = false;
+	}
+	
+	// Shards the locks were taken on (see SESSION_shard_conn)
+	if (! SESSION_shard_end(session, commit)) {
+		ret = false;
+	}
+	
+	__return ret;
+	
+} /* SESSION_lock_end */
+
+
+/*
+ * SESSION_delete [X]
+ * Close a session's contexts and connection and delete it
+ * session		Pointer to the session
+ */
+void SESSION_delete (SESSION ** session)
+{
+	SESSION *s = *session;
+	CONTEXT *c;
+	
+__STACK(SESSION_delete)
+	
+	if (! s) {
+		__return;
+	}
+	
+	pgout(mDEBUG3, "closing session");
+	
+	pthread_once(&session_once, session_init);
+	
+	if (pthread_getspecific(session_key) == s) {
+		pthread_setspecific(session_key, NULL);
+	}
+	
+	// Writes grouped since the last call are committed, not lost, as
+	// are those made while row locks were held
+	SESSION_group_end(s);
+	SESSION_lock_end(s, true);
+	
+	while (s->async) {
+		ASYNC *a = s->async;
+		
+		s->async = a->next;
+		RES_delete(&a->res);
+		xfree(a);
+	}
+	
+	for (c = s->context; c; c = c->next) {
+		SESSION_context_end(c, false);
+	}
+	
+	CONTEXT_delete(&s->context);
+	CONN_delete(s->conn);
+	
+	while (s->nreaders) {
+		CONN_delete(s->reader[--s->nreaders]);
+	}
+	
+	while (s->nshards) {
+		CONN_delete(s->shard[--s->nshards]);
+	}
+	
+	free(s->shard);
+	xfree(s->reader);
+	xfree(s);
+	*session = NULL;
+	
+	__return;
+	
+} /* SESSION_delete */
+
+
+// _____/ static functions \__________
+/*
+ * session_init
+ * Create the thread key holding the current session
+ */
+static void session_init (void)
+{
+__STACK(session_init)
+	
+	pthread_key_create(&session_key, session_exit);
+	
+	__return;
+	
+} /* session_init */
+
+
+/*
+ * session_exit
+ * Delete the session a thread created for itself when it exits
+ * data			The thread's session
+ */
+static void session_exit (void * data)
+{
+	SESSION *session = (SESSION *)data;
+	
+__STACK(session_exit)
+	
+	if (session->implicit) {
+		SESSION_delete(&session);
+	}
+	
+	__return;
+	
+} /* session_exit */
+
+
+/*
+ * session_replay
+ * Make writes again outside a transaction: all in one statement (one
+ * implicit transaction) or, if that fails, one at a time
+ * conn			Connection
+ * sql			Statements
+ * n			How many
+ *
+ * NOTE: false if one could not be made (it is logged)
+ */
+static bool session_replay (CONN * conn, char ** sql, int n)
+{
+	char *all = NULL;
+	RES *res;
+	bool ret = true;
+	int x;
+	
+__STACK(session_replay)
+	
+	for (x=0; x < n; x++) {
+		str_append(&all, "%s%s", sql[x], (x < n - 1) ? ";\n" : "");
+	}
+	
+	res = pg_exec(conn, all);
+	str_free(&all);
+	
+	if (res) {
+		RES_delete(&res);
+		__return true;
+	}
+	
+	for (x=0; x < n; x++) {
+		if ((res = pg_exec(conn, sql[x])) == (RES *)NULL) {
+			pgout(0, "grouped write lost: [%s]", sql[x]);
+			ret = false;
+		}
+		RES_delete(&res);
+	}
+	
+	__return ret;
+	
+} /* session_replay */
+
+
+/*
+ * session_group_clear
+ * Forget the writes of the session's group (it is closed)
+ */
+static void session_group_clear (SESSION * session)
+{
+__STACK(session_group_clear)
+	
+	while (session->ngroup) {
+		str_free(&session->group[--session->ngroup]);
+	}
+	
+	free(session->group);
+	session->group = NULL;
+	
+	__return;
+	
+} /* session_group_clear */
+
+
+/*
+ * session_clock
+ * Milliseconds of a monotonic clock
+ */
+static double session_clock (void)
+{
+	struct timespec ts;
+	
+__STACK(session_clock)
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	__return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+	
+} /* session_clock */
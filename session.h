@@ -0,0 +1,229 @@
+/*
+ * session.h: bridge sessions
+ *
+ * A session owns a connection, the contexts (isfds) opened through it
+ * and the error state of its last call.  Every thread works in its own
+ * session: one is created on the first call a thread makes, or a thread
+ * adopts one explicitly with SESSION_use (e.g. a worker pool passing a
+ * session between threads, one thread at a time).  Schemas are shared by
+ * all sessions and are never written by an operation; the values of an
+ * operation live in its context (see CONTEXT_columns).
+ *
+ * Files opened read-only may be given connections of their own (see
+ * SESSION_set_readers), so that a scan and the lookups made while it
+ * runs are served by the database at the same time.  Transactions are
+ * the session connection's: read-only files see committed data only.
+ * The connections to the shards of sharded tables (see shard.h) join a
+ * transaction when first used in it.
+ *
+ * Lookups can be left running while the caller goes on (see
+ * x_isread_async): they are pipelined on their contexts' connections
+ * and held as ASYNCs until the caller waits for them.
+ *
+ * Writes made outside a transaction may be grouped into one on the
+ * session's connection (see SESSION_group_exec), so that many share a
+ * commit.  The group is committed after so many writes, after so long,
+ * or by the next call that is not such a write (see SESSION_group_end).
+ *
+ * Records locked by isread outside a transaction are held by one the
+ * read starts (see SESSION_lock_begin), until isrelease commits it.
+ */
+
+#ifndef _SESSION_H
+#define _SESSION_H
+
+/*
+ * ASYNC
+ * A lookup sent by x_isread_async, completed by x_iswait
+ */
+typedef struct ASYNC_T {
+	int ticket;				// Ticket handed to the caller
+	int isfd;				// File read
+	char *record;			// Caller's buffer, completed by x_iswait
+	SCHEMA *schema;			// Schema the record is read as (pivoted)
+	CONN *conn;				// Connection it was sent on (NULL = result in res)
+	RES *res;				// Its result (NULL = failed, or read synchronously)
+	int ret;				// Return of a read made synchronously
+	int iserrno;			// (and its iserrno)
+	struct ASYNC_T *next;	// Next, in the order sent
+} ASYNC;
+
+/*
+ * SESSION
+ * Holds the state of one bridge user
+ */
+typedef struct SESSION_T {
+	CONN *conn;				// Connection of transactions (and of writers)
+	CONN **reader;			// Connections of read-only contexts
+	int nreaders;			// Readers connected so far
+	int next_reader;		// Reader given to the next read-only context
+	CONN **shard;			// Connections of shards 1.. (0 is conn; see shard.c)
+	int nshards;			// Slots in shard
+	CONTEXT *context;		// Contexts opened in the session
+	int iserrno;			// iserrno of the session's last call
+	int timeout;			// Time budget of a call, ms (0 = the schema's; <0 = none)
+	ASYNC *async;			// Lookups not yet waited for
+	int next_ticket;		// Last ticket handed out
+	char **group;			// Writes made in the open group transaction (see SESSION_group_exec)
+	int ngroup;				// How many (0 = no group open)
+	double group_opened;	// When it was opened, ms
+	bool locking;			// In a transaction started to hold row locks (see SESSION_lock_begin)
+	bool lock_wrote;		// A write was made in it (see lock_write in pgbridge.c)
+	bool lock_lost;			// Its writes were rolled back since the last release (see SESSION_lock_end)
+	bool implicit;			// Created for a thread (deleted at thread exit)
+} SESSION;
+
+/*
+ * SESSION_new
+ * Create a session and connect it (NULL = no connection)
+ */
+SESSION * SESSION_new (void);
+
+/*
+ * SESSION_use
+ * Make a session the calling thread's current session
+ * session		Session (NULL = none; the next call creates one)
+ */
+void SESSION_use (SESSION * session);
+
+/*
+ * SESSION_current
+ * Return the calling thread's session
+ * create		Create (and connect) one if the thread has none
+ *
+ * NOTE: NULL when the thread has none (or it could not connect)
+ */
+SESSION * SESSION_current (bool create);
+
+/*
+ * SESSION_conn
+ * Connection for a context opened in a session
+ * session		Session
+ * mode			isopen mode (ISINPUT contexts may get a reader)
+ */
+CONN * SESSION_conn (SESSION * session, int mode);
+
+/*
+ * SESSION_read_conn
+ * Connection a read-only context reads with next
+ * session		Session
+ * context		Context
+ */
+CONN * SESSION_read_conn (SESSION * session, CONTEXT * context);
+
+/*
+ * SESSION_wrote
+ * Note that this process has written (see SESSION_read_conn)
+ */
+void SESSION_wrote (void);
+
+/*
+ * SESSION_set_standby_lag
+ * Seconds reads stay on the primary after a write (0 = none)
+ */
+void SESSION_set_standby_lag (int seconds);
+
+/*
+ * SESSION_shard_conn
+ * Connection of a session to a shard of the sharded tables
+ * session		Session
+ * n			Shard (0 = the session's connection)
+ */
+CONN * SESSION_shard_conn (SESSION * session, int n);
+
+/*
+ * SESSION_shard_end
+ * Commit or roll back the transactions of the session's shards
+ * session		Session
+ * commit		Commit (true) or roll back (false)
+ */
+bool SESSION_shard_end (SESSION * session, bool commit);
+
+/*
+ * SESSION_context_end
+ * End what a context has running before it is deleted (CONTEXT_delete)
+ * context		Context
+ * close		Close its cursors (false: already gone with their transaction)
+ */
+void SESSION_context_end (CONTEXT * context, bool close);
+
+/*
+ * SESSION_set_readers
+ * Number of reader connections each session may open (0 = none)
+ */
+void SESSION_set_readers (int n);
+
+/*
+ * SESSION_set_group_size
+ * Writes outside transactions grouped per transaction (0 or 1 = none)
+ */
+void SESSION_set_group_size (int n);
+
+/*
+ * SESSION_set_group_wait
+ * Milliseconds a group stays open, at most (0 = no limit)
+ */
+void SESSION_set_group_wait (int ms);
+
+/*
+ * SESSION_group_size
+ * Writes grouped per transaction for a file
+ * size			Its .def's groupcommit (0 = the option's)
+ */
+int SESSION_group_size (int size);
+
+/*
+ * SESSION_group_due
+ * Is the session's group to be committed before the next write joins it?
+ * session		Session
+ * size			Writes per group (see SESSION_group_size)
+ */
+bool SESSION_group_due (SESSION * session, int size);
+
+/*
+ * SESSION_group_exec
+ * Make a write in the session's group transaction (opened if none)
+ * session		Session
+ * sql			INSERT, UPDATE or DELETE statement
+ *
+ * NOTE: NULL if it failed; the writes before it in the group are made
+ * again (logged, and lost, only if one fails then)
+ */
+RES * SESSION_group_exec (SESSION * session, char * sql);
+
+/*
+ * SESSION_group_end
+ * Commit the session's group transaction, if one is open
+ * session		Session (NULL = none)
+ *
+ * NOTE: false if a write of the group could not be made (it is logged)
+ */
+bool SESSION_group_end (SESSION * session);
+
+/*
+ * SESSION_lock_begin
+ * Start a transaction to hold row locks on a connection, unless it is in
+ * one (the session's transaction, or locks held already)
+ * session		Session
+ * conn			Connection the locks are taken on
+ */
+bool SESSION_lock_begin (SESSION * session, CONN * conn);
+
+/*
+ * SESSION_lock_end
+ * End the transaction started to hold row locks, if there is one
+ * session		Session (NULL = none)
+ * commit		Commit (true) or roll back (false) what was written in it
+ *
+ * NOTE: false if it could not be committed (a statement in it failed)
+ */
+bool SESSION_lock_end (SESSION * session, bool commit);
+
+/*
+ * SESSION_delete
+ * Close a session's contexts and connection and delete it
+ * session		Pointer to the session
+ */
+void SESSION_delete (SESSION ** session);
+
+#endif // _SESSION_H
@@ -0,0 +1,646 @@
+/*
+ * shard.c: tables sharded across servers
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// For keydesc in schema.h
+#include <isam.h>
+
+#include <libpq-fe.h>
+
+#include "pgisam.h"
+#include "sys.h"
+#include "schema.h"
+#include "session.h"
+#include "shard.h"
+#include "pgres.h"
+#include "codec.h"
+#include "xstring.h"
+
+#define MAXKEYSZ 1024
+
+// Static function prototypes
+static unsigned int SHARD_key (SCHEMA * schema, char * record, char * key);
+static char * SHARD_number (SCHEMA * schema, char * record);
+static RES * MERGE_row (MERGE * merge, int shard, char * direction);
+static int MERGE_compare (MERGE * merge, RES * a, RES * b);
+static RES * MERGE_step (MERGE * merge, int dir);
+static RES * MERGE_pick (MERGE * merge);
+
+
+// CODE STARTS HERE
+
+
+// _____/ SHARD functions \__________
+/*
+ * SHARD_count [X]
+ * Number of shards of a schema (0 = not sharded)
+ * schema		Schema
+ *
+ * NOTE: a range with more bounds than conn.def has shards is cut short
+ */
+int SHARD_count (SCHEMA * schema)
+{
+	int n, bounds;
+	char *p;
+	
+__STACK(SHARD_count)
+	
+	if (! schema->shard) {
+		__return 0;
+	}
+	
+	n = CONN_shards();
+	
+	if (! strncmp(schema->shard, "range:", 6)) {
+		for (bounds = 1, p = &schema->shard[6]; *p; p++) {
+			if (*p == ',') bounds++;
+		}
+	
+		if (bounds + 1 < n) {
+			n = bounds + 1;
+		}
+	}
+	
+	__return n;
+	
+} /* SHARD_count */
+
+
+/*
+ * SHARD_of [X]
+ * Shard of a record
+ * schema		Sharded schema
+ * record		Record (its primary key is read)
+ *
+ * NOTE: range bounds are compared with the key as it is in the record,
+ * or as a number with the value of a numeric first key column
+ */
+int SHARD_of (SCHEMA * schema, char * record)
+{
+	char key[MAXKEYSZ];
+	unsigned int len;
+	char *number;
+	int n = SHARD_count(schema), shard;
+	
+__STACK(SHARD_of)
+	
+	if (n <= 1) {
+		__return 0;
+	}
+	
+	if (! strcmp(schema->shard, "hash")) {
+		__return (int)(SHARD_hash(schema, record) % (unsigned int)n);
+	}
+	
+	len = SHARD_key(schema, record, key);
+	number = SHARD_number(schema, record);
+	
+	shard = SHARD_range(&schema->shard[6], n, key, len, number);
+	
+	str_free(&number);
+	
+	__return shard;
+	
+} /* SHARD_of */
+
+
+/*
+ * SHARD_range [X]
+ * Shard of a key under shard=range: the last shard whose bound is at or
+ * below the key
+ * bounds		Bounds (b1,b2,... as they follow range:)
+ * n			Shards (bounds past n - 1 are not used)
+ * key			Key, as it is in the record
+ * len			Its length
+ * number		Value of a numeric first key column (NULL = compare the key)
+ */
+int SHARD_range (char * bounds, int n, char * key, unsigned int len,
+	char * number)
+{
+	char *bound, *end;
+	int shard = 0;
+	
+__STACK(SHARD_range)
+	
+	for (bound = bounds; shard + 1 < n; bound = end + 1) {
+		size_t blen;
+		int cmp;
+	
+		end = strchr(bound, ',');
+		blen = end ? (size_t)(end - bound) : strlen(bound);
+	
+		if (number) {
+			cmp = SHARD_numcmp(number, strlen(number), bound, (int)blen);
+		} else {
+			cmp = memcmp(key, bound, blen < len ? blen : len);
+			cmp = (cmp == 0 && len < blen) ? -1 : cmp;
+		}
+	
+		if (cmp < 0) {
+			break;
+		}
+	
+		shard++;
+	
+		if (! end) {
+			break;
+		}
+	}
+	
+	__return shard;
+	
+} /* SHARD_range */
+
+
+/*
+ * SHARD_hash [X]
+ * Hash of a record's primary key
+ * schema		Schema
+ * record		Record
+ */
+unsigned int SHARD_hash (SCHEMA * schema, char * record)
+{
+	unsigned int hash = 2166136261u;	// FNV-1a
+	char key[MAXKEYSZ];
+	unsigned int len, x;
+	
+__STACK(SHARD_hash)
+	
+	len = SHARD_key(schema, record, key);
+	
+	for (x=0; x < len; x++) {
+		hash = (hash ^ (unsigned char)key[x]) * 16777619u;
+	}
+	
+	__return hash;
+	
+} /* SHARD_hash */
+
+
+/*
+ * SHARD_numcmp [X]
+ * Compare two decimal numbers written out in text, exactly
+ * a, b			Numbers ([-+]digits[.digits])
+ * alen, blen	Their lengths
+ */
+int SHARD_numcmp (const char * a, int alen, const char * b, int blen)
+{
+	const char *num[2], *ip[2], *fp[2];
+	int len[2], ilen[2], flen[2], neg[2], x, cmp;
+	
+__STACK(SHARD_numcmp)
+	
+	num[0] = a; len[0] = alen;
+	num[1] = b; len[1] = blen;
+	
+	for (x=0; x < 2; x++) {
+		const char *p = num[x], *end = num[x] + len[x];
+	
+		while (p < end && isspace((unsigned char)*p)) p++;
+	
+		neg[x] = (p < end && *p == '-') ? 1 : 0;
+		if (p < end && (*p == '-' || *p == '+')) p++;
+	
+		// Leading zeros of the integer part and trailing ones of the
+		// fraction don't count
+		while (p < end && *p == '0') p++;
+		for (ip[x] = p; p < end && isdigit((unsigned char)*p); p++);
+		ilen[x] = (int)(p - ip[x]);
+	
+		if (p < end && *p == '.') p++;
+		for (fp[x] = p; p < end && isdigit((unsigned char)*p); p++);
+		flen[x] = (int)(p - fp[x]);
+		while (flen[x] && fp[x][flen[x]-1] == '0') flen[x]--;
+	
+		// -0 is 0
+		if (! ilen[x] && ! flen[x]) {
+			neg[x] = 0;
+		}
+	}
+	
+	if (neg[0] != neg[1]) {
+		__return neg[0] ? -1 : 1;
+	}
+	
+	if (ilen[0] != ilen[1]) {
+		cmp = (ilen[0] < ilen[1]) ? -1 : 1;
+	} else
+	if ((cmp = memcmp(ip[0], ip[1], ilen[0])) == 0) {
+		cmp = memcmp(fp[0], fp[1], (flen[0] < flen[1]) ? flen[0] : flen[1]);
+		if (cmp == 0) {
+			cmp = flen[0] - flen[1];
+		}
+	}
+	
+	cmp = (cmp < 0) ? -1 : (cmp > 0) ? 1 : 0;
+	
+	__return neg[0] ? -cmp : cmp;
+	
+} /* SHARD_numcmp */
+
+
+// _____/ MERGE functions \__________
+/*
+ * MERGE_new [X]
+ * Declare a cursor on every shard of a schema
+ * session		Session owning the shard connections
+ * schema		Sharded schema
+ * index		Index the cursors are ordered by
+ * reverse		The cursors are in descending key order
+ * cursor_name	Cursor name
+ * declare		DECLARE statement
+ * with_hold	Declared WITH HOLD (each in a transaction of its own)
+ */
+MERGE * MERGE_new (SESSION * session, SCHEMA * schema, INDEX * index,
+	bool reverse, char * cursor_name, char * declare, bool with_hold)
+{
+	MERGE *merge = xalloc(sizeof(MERGE));
+	RES *res;
+	int x;
+	
+__STACK(MERGE_new)
+	
+	merge->n = SHARD_count(schema);
+	merge->conn = xalloc(sizeof(CONN *) * merge->n);
+	merge->head = xalloc(sizeof(RES *) * merge->n);
+	merge->last = -1;
+	merge->reverse = reverse;
+	merge->schema = schema;
+	merge->index = index;
+	merge->cursor_name = str_dup(cursor_name);
+	merge->row = MERGE_row;
+	
+	for (x=0; x < merge->n; x++) {
+		CONN *conn = SESSION_shard_conn(session, x);
+	
+		if (! conn) {
+			goto retbad;
+		}
+	
+		if (with_hold) {
+			CONN_begin(conn);
+		}
+	
+		if ((res = pg_exec(conn, declare)) == (RES *)NULL) {
+			if (with_hold) {
+				CONN_rollback(conn);
+			}
+			goto retbad;
+		}
+	
+		RES_delete(&res);
+	
+		if (with_hold) {
+			CONN_commit(conn);
+		}
+	
+		merge->conn[x] = conn;
+	}
+	
+	__return merge;
+	
+retbad:
+	pgout(0, "unable to declare [%s] on shard %d", cursor_name, x);
+	MERGE_delete(&merge, true);
+	
+	__return (MERGE *)NULL;
+	
+} /* MERGE_new */
+
+
+/*
+ * MERGE_fetch [X]
+ * Read the next row of the merged cursors (NULL = none)
+ * merge		Merge
+ * mode			isread mode (ISFIRST, ISLAST, ISNEXT, ISPREV, ISCURR)
+ *
+ * NOTE: rows are ordered by key, then by shard.  Each cursor but the
+ * current row's is left on its head, the next row it has to offer in
+ * the direction read, so turning round re-reads one row per shard.
+ */
+RES * MERGE_fetch (MERGE * merge, int mode)
+{
+	RES *res;
+	int x;
+	
+__STACK(MERGE_fetch)
+	
+	switch (mode) {
+		case ISFIRST:
+		case ISLAST:
+		for (x=0; x < merge->n; x++) {
+			RES_delete(&merge->head[x]);
+			merge->head[x] = merge->row(merge, x,
+				(mode == ISFIRST) ? "FIRST" : "LAST");
+		}
+		merge->dir = (mode == ISFIRST) ? 1 : -1;
+		res = MERGE_pick(merge);
+		break;
+	
+		case ISPREV:
+		res = MERGE_step(merge, -1);
+		break;
+	
+		case ISCURR:
+		if (merge->last >= 0) {
+			res = merge->row(merge, merge->last, "RELATIVE 0");
+			break;
+		}
+	
+		// No current row yet: the first one (as isread does)
+		default:
+		res = MERGE_step(merge, 1);
+	}
+	
+	__return res;
+	
+} /* MERGE_fetch */
+
+
+/*
+ * MERGE_conn [X]
+ * Connection of the current row's shard (NULL = no current row)
+ */
+CONN * MERGE_conn (MERGE * merge)
+{
+__STACK(MERGE_conn)
+	
+	__return (merge->last >= 0) ? merge->conn[merge->last] : (CONN *)NULL;
+	
+} /* MERGE_conn */
+
+
+/*
+ * MERGE_delete [X]
+ * Delete a merge
+ * merge		Pointer to the merge
+ * close		Close the cursors (false: already gone with their transaction)
+ */
+void MERGE_delete (MERGE ** merge, bool close)
+{
+	MERGE *m = *merge;
+	char *sql = NULL;
+	RES *res;
+	int x;
+	
+__STACK(MERGE_delete)
+	
+	if (! m) {
+		__return;
+	}
+	
+	str_append(&sql, "CLOSE %s", m->cursor_name);
+	
+	for (x=0; x < m->n; x++) {
+		if (close && m->conn[x]) {
+			if ((res = pg_exec(m->conn[x], sql)) == (RES *)NULL) {
+				pgout(0, "unable to close cursor [%s] on shard %d",
+					m->cursor_name, x);
+			}
+			RES_delete(&res);
+		}
+		RES_delete(&m->head[x]);
+	}
+	
+	str_free(&sql);
+	str_free(&m->cursor_name);
+	xfree(m->head);
+	xfree(m->conn);
+	xfree(m);
+	*merge = NULL;
+	
+	__return;
+	
+} /* MERGE_delete */
+
+
+// _____/ static functions \__________
+/*
+ * SHARD_key
+ * Copy a record's primary key, as it is in the record (its length)
+ * schema		Schema
+ * record		Record
+ * key			Receives the key (MAXKEYSZ bytes)
+ */
+static unsigned int SHARD_key (SCHEMA * schema, char * record, char * key)
+{
+	INDEX *i = INDEX_get(schema->index, 1);
+	COLUMN *ic, *c;
+	unsigned int len = 0;
+	
+__STACK(SHARD_key)
+	
+	for (ic = i ? i->column : NULL; ic; ic = ic->next) {
+		if ((c = SCHEMA_column(schema, ic->name)) == (COLUMN *)NULL
+			|| len + c->length > MAXKEYSZ) {
+			continue;
+		}
+		memcpy(&key[len], &record[c->startpos], c->length);
+		len += c->length;
+	}
+	
+	__return len;
+	
+} /* SHARD_key */
+
+
+/*
+ * SHARD_number
+ * Value of the first primary key column if it is numeric (NULL if not,
+ * or blank); str_free it
+ * schema		Schema
+ * record		Record
+ */
+static char * SHARD_number (SCHEMA * schema, char * record)
+{
+	INDEX *i = INDEX_get(schema->index, 1);
+	COLUMN *c;
+	
+__STACK(SHARD_number)
+	
+	if ((! i) || (! i->column) ||
+		(c = SCHEMA_column(schema, i->column->name)) == (COLUMN *)NULL) {
+		__return (char *)NULL;
+	}
+	
+	switch (c->datatype) {
+		case ISAM_TYPE_DECIMAL:
+		__return (char *)CODEC_decimal_from_record(&record[c->startpos],
+			c->length);
+	
+		case ISAM_TYPE_INTEGER:
+		__return (char *)CODEC_integer_from_record(&record[c->startpos],
+			c->length);
+	}
+	
+	__return (char *)NULL;
+	
+} /* SHARD_number */
+
+
+/*
+ * MERGE_row
+ * Fetch a row from one shard's cursor (NULL = none)
+ * merge		Merge
+ * shard		Shard
+ * direction	FETCH direction
+ */
+static RES * MERGE_row (MERGE * merge, int shard, char * direction)
+{
+	char *sql = NULL;
+	RES *res;
+	
+__STACK(MERGE_row)
+	
+	str_append(&sql, "FETCH %s FROM %s", direction, merge->cursor_name);
+	
+	res = pg_exec(merge->conn[shard], sql);
+	str_free(&sql);
+	
+	if (res && res->tuples != 1) {
+		RES_delete(&res);
+	}
+	
+	__return res;
+	
+} /* MERGE_row */
+
+
+/*
+ * MERGE_compare
+ * Compare two rows by the merge's index columns, as the cursors order them
+ * merge		Merge
+ * a, b			Rows
+ *
+ * NOTE: text is compared bytewise, the order of the "C" collation the
+ * cursors sort it in; numbers exactly, digit by digit
+ */
+static int MERGE_compare (MERGE * merge, RES * a, RES * b)
+{
+	COLUMN *ic, *c;
+	int cmp = 0;
+	
+__STACK(MERGE_compare)
+	
+	for (ic = merge->index->column; ic && ! cmp; ic = ic->next) {
+		int fa = PQfnumber(a->pgres, ic->name);
+		int fb = PQfnumber(b->pgres, ic->name);
+		bool na, nb;
+		char *va, *vb;
+	
+		if (fa < 0 || fb < 0) {
+			continue;
+		}
+	
+		na = PQgetisnull(a->pgres, 0, fa) ? true : false;
+		nb = PQgetisnull(b->pgres, 0, fb) ? true : false;
+	
+		// Nulls sort last (ASC) or first (DESC), as they do on the server
+		if (na || nb) {
+			cmp = (na == nb) ? 0 : na ? 1 : -1;
+			__return merge->reverse ? -cmp : cmp;
+		}
+	
+		va = PQgetvalue(a->pgres, 0, fa);
+		vb = PQgetvalue(b->pgres, 0, fb);
+		c = SCHEMA_column(merge->schema, ic->name);
+	
+		if (c && (c->datatype == ISAM_TYPE_DECIMAL ||
+			c->datatype == ISAM_TYPE_INTEGER)) {
+			cmp = SHARD_numcmp(va, strlen(va), vb, strlen(vb));
+		} else {
+			cmp = strcmp(va, vb);
+			cmp = (cmp < 0) ? -1 : (cmp > 0) ? 1 : 0;
+		}
+	}
+	
+	__return merge->reverse ? -cmp : cmp;
+	
+} /* MERGE_compare */
+
+
+/*
+ * MERGE_step
+ * Move one row on in a direction
+ * merge		Merge
+ * dir			1 (forward) or -1 (backward)
+ */
+static RES * MERGE_step (MERGE * merge, int dir)
+{
+	int x;
+	
+__STACK(MERGE_step)
+	
+	// Turning round: the other cursors sit on their heads, one row
+	// past the current one; the row before is their new head
+	if (merge->dir != dir) {
+		for (x=0; x < merge->n; x++) {
+			if (x == merge->last) {
+				continue;
+			}
+			RES_delete(&merge->head[x]);
+			merge->head[x] = merge->row(merge, x, (dir > 0) ? "NEXT" : "PRIOR");
+		}
+	}
+	
+	if (merge->last >= 0) {
+		merge->head[merge->last] = merge->row(merge, merge->last,
+			(dir > 0) ? "NEXT" : "PRIOR");
+	}
+	
+	merge->dir = dir;
+	
+	__return MERGE_pick(merge);
+	
+} /* MERGE_step */
+
+
+/*
+ * MERGE_pick
+ * Take the head that comes next in the merge's direction
+ * merge		Merge
+ */
+static RES * MERGE_pick (MERGE * merge)
+{
+	RES *res;
+	int x, best = -1;
+	
+__STACK(MERGE_pick)
+	
+	for (x=0; x < merge->n; x++) {
+		int cmp;
+	
+		if (! merge->head[x]) {
+			continue;
+		}
+	
+		if (best < 0) {
+			best = x;
+			continue;
+		}
+	
+		// Equal keys: lower shards first (going forward)
+		cmp = MERGE_compare(merge, merge->head[x], merge->head[best]);
+	
+		if ((merge->dir > 0) ? (cmp < 0) : (cmp >= 0)) {
+			best = x;
+		}
+	}
+	
+	merge->last = best;
+	
+	if (best < 0) {
+		__return (RES *)NULL;
+	}
+	
+	res = merge->head[best];
+	merge->head[best] = NULL;
+	
+	__return res;
+	
+} /* MERGE_pick */
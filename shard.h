@@ -0,0 +1,120 @@
+/*
+ * shard.h: tables sharded across servers
+ *
+ * A schema with a shard= directive keeps its records on the servers of
+ * conn.def: shard 0 is the EDATA entry, shards 1.. its EDATA:shard lines.
+ * The shard of a record is chosen by its primary key:
+ *
+ *   shard=hash					hash of the key, over every shard
+ *   shard=range:<b1>,<b2>,...	b1 is the lowest key of shard 1, b2 of
+ *								shard 2 ... (keys compared bytewise)
+ *
+ * Operations on a record go to its shard; isstart declares its cursor on
+ * every shard and isread merges them in key order (see MERGE_fetch).
+ */
+
+#ifndef _SHARD_H
+#define _SHARD_H
+
+/*
+ * MERGE
+ * The cursors of a sharded context, read as one
+ */
+typedef struct MERGE_T {
+	int n;					// Shards
+	CONN **conn;			// Connection of each shard's cursor
+	RES **head;				// Next row of each shard in direction dir (NULL = none)
+	int dir;				// Direction the heads were read in (1, -1; 0 = none yet)
+	int last;				// Shard of the current row (-1 = none)
+	bool reverse;			// Cursors are in descending key order
+	SCHEMA *schema;			// Schema of the rows
+	INDEX *index;			// Index the rows are ordered by
+	char *cursor_name;		// Cursor name (the same on every shard)
+	struct RES_T *(*row) (struct MERGE_T *, int, char *);	// FETCHes a shard's row
+} MERGE;
+
+// FUNCTION PROTOTYPES
+
+
+// _____/ SHARD functions \__________
+/*
+ * SHARD_count
+ * Number of shards of a schema (0 = not sharded)
+ */
+int SHARD_count (SCHEMA * schema);
+
+/*
+ * SHARD_of
+ * Shard of a record
+ * schema		Sharded schema
+ * record		Record (its primary key is read)
+ */
+int SHARD_of (SCHEMA * schema, char * record);
+
+/*
+ * SHARD_range
+ * Shard of a key under shard=range: (see SHARD_of)
+ * bounds		Bounds (b1,b2,... as they follow range:)
+ * n			Shards
+ * key			Key, as it is in the record
+ * len			Its length
+ * number		Value of a numeric first key column (NULL = compare the key)
+ */
+int SHARD_range (char * bounds, int n, char * key, unsigned int len,
+	char * number);
+
+/*
+ * SHARD_numcmp
+ * Compare two decimal numbers written out in text, exactly (-1, 0, 1)
+ * a, b			Numbers ([-+]digits[.digits])
+ * alen, blen	Their lengths
+ */
+int SHARD_numcmp (const char * a, int alen, const char * b, int blen);
+
+/*
+ * SHARD_hash
+ * Hash of a record's primary key (see writebehind.c)
+ * schema		Schema
+ * record		Record
+ */
+unsigned int SHARD_hash (SCHEMA * schema, char * record);
+
+
+// _____/ MERGE functions \__________
+/*
+ * MERGE_new
+ * Declare a cursor on every shard of a schema
+ * session		Session owning the shard connections
+ * schema		Sharded schema
+ * index		Index the cursors are ordered by
+ * reverse		The cursors are in descending key order
+ * cursor_name	Cursor name
+ * declare		DECLARE statement
+ * with_hold	Declared WITH HOLD (each in a transaction of its own)
+ */
+MERGE * MERGE_new (struct SESSION_T * session, SCHEMA * schema, INDEX * index,
+	bool reverse, char * cursor_name, char * declare, bool with_hold);
+
+/*
+ * MERGE_fetch
+ * Read the next row of the merged cursors (NULL = none)
+ * merge		Merge
+ * mode			isread mode (ISFIRST, ISLAST, ISNEXT, ISPREV, ISCURR)
+ */
+RES * MERGE_fetch (MERGE * merge, int mode);
+
+/*
+ * MERGE_conn
+ * Connection of the current row's shard (NULL = no current row)
+ */
+CONN * MERGE_conn (MERGE * merge);
+
+/*
+ * MERGE_delete
+ * Delete a merge
+ * merge		Pointer to the merge
+ * close		Close the cursors (false: already gone with their transaction)
+ */
+void MERGE_delete (MERGE ** merge, bool close);
+
+#endif // _SHARD_H
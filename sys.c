@@ -54,6 +54,25 @@ __STACK(xalloc)
 } /* xalloc */
 
 
+/*
+ * xrealloc
+ * Resize memory from xalloc; NULL (value still allocated) on failure
+ */
+void * xrealloc (void * value, size_t size)
+{
+	void *grown = realloc(value, size);
+
+__STACK(xrealloc)
+	
+	if (! grown)
+		pgout(mNORMAL, "failed to resize virtual memory (%lu bytes)",
+			(unsigned long)size);
+	
+	__return grown;
+
+} /* xrealloc */
+
+
 /*
  * xfree
  */
@@ -13,6 +13,9 @@ typedef enum bool bool;
 // Memory allocation
 void * xalloc(size_t size);
 
+// Memory reallocation (NULL on failure; value is left allocated)
+void * xrealloc(void * value, size_t size);
+
 // Free memory
 void xfree(void * value);
 
@@ -0,0 +1,491 @@
+/*
+ * writebehind.c: autocommit writes made by background workers
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// For keydesc in schema.h
+#include <isam.h>
+
+#include <libpq-fe.h>
+
+#include "pgisam.h"
+#include "sys.h"
+#include "schema.h"
+#include "shard.h"
+#include "writebehind.h"
+#include "pgres.h"
+#include "xstring.h"
+
+#define WB_BATCH 100			// Writes committed together by a worker
+#define WB_QUEUE (WB_BATCH * 10)	// Writes queued to a worker before WB_write waits
+#define WB_ERRNO 903			// Error of a failed write (903 = deferred write failed)
+
+/*
+ * WBITEM
+ * A queued write
+ */
+typedef struct WBITEM_T {
+	WBFILE *file;			// File it was queued for
+	char *sql;				// INSERT statement
+	char *record;			// Copy of the record (for the callback)
+	struct WBITEM_T *next;
+} WBITEM;
+
+/*
+ * WBWORKER
+ * A worker thread and its queue
+ */
+typedef struct WBWORKER_T {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;	// Signalled as writes are queued (or on stop)
+	pthread_cond_t room;	// Signalled as the worker takes writes off the queue
+	WBITEM *head, *tail;	// Queue, oldest first
+	int queued;				// Writes in the queue (at most WB_QUEUE)
+	bool stop;				// Finish the queue and exit
+} WBWORKER;
+
+// Static data
+static int workers = 0;					// Workers asked for (writebehind=N)
+static int nworker = 0;					// Workers running
+static WBWORKER *worker = NULL;
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pgWriteCallback write_callback = NULL;
+
+// Static function prototypes
+static bool WB_start (void);
+static void * WB_run (void * data);
+static void WB_commit (CONN * conn, WBITEM * batch);
+static void WB_done (WBITEM * item, bool ok);
+
+
+// CODE STARTS HERE
+
+
+// _____/ WB functions \__________
+/*
+ * WB_set_workers [X]
+ * Set the number of worker threads (0 = no writes behind; the default)
+ * n			Workers (taken when the first write is queued)
+ */
+void WB_set_workers (int n)
+{
+__STACK(WB_set_workers)
+	
+	workers = (n < 0) ? 0 : n;
+	
+	__return;
+	
+} /* WB_set_workers */
+
+
+/*
+ * WB_workers [X]
+ * Number of worker threads (0 = no writes behind)
+ */
+int WB_workers (void)
+{
+__STACK(WB_workers)
+	
+	__return nworker ? nworker : workers;
+	
+} /* WB_workers */
+
+
+/*
+ * WB_set_callback [X]
+ * Set the function told of writes that failed (in a worker thread)
+ */
+void WB_set_callback (pgWriteCallback callback)
+{
+__STACK(WB_set_callback)
+	
+	write_callback = callback;
+	
+	__return;
+	
+} /* WB_set_callback */
+
+
+/*
+ * WB_open [X]
+ * Create the writes behind of a file
+ * isfd			File descriptor
+ */
+WBFILE * WB_open (int isfd)
+{
+	WBFILE *file = (WBFILE *)xalloc(sizeof(WBFILE));
+	
+__STACK(WB_open)
+	
+	file->isfd = isfd;
+	pthread_mutex_init(&file->lock, NULL);
+	pthread_cond_init(&file->done, NULL);
+	
+	__return file;
+	
+} /* WB_open */
+
+
+/*
+ * WB_write [X]
+ * Queue a write
+ * file			File
+ * schema		Schema of the record
+ * record		Record (copied)
+ * sql			INSERT statement (the queue takes it, unless false)
+ *
+ * NOTE: waits while the worker has WB_QUEUE writes queued
+ */
+bool WB_write (WBFILE * file, SCHEMA * schema, char * record, char * sql)
+{
+	WBITEM *item;
+	WBWORKER *w;
+	
+__STACK(WB_write)
+	
+	// No workers: the caller makes the write (and keeps sql)
+	if (! nworker && ! WB_start()) {
+		__return false;
+	}
+	
+	item = (WBITEM *)xalloc(sizeof(WBITEM));
+	item->file = file;
+	item->sql = sql;
+	item->record = (char *)xalloc(schema->reclen);
+	memcpy(item->record, record, schema->reclen);
+	
+	pthread_mutex_lock(&file->lock);
+	file->pending++;
+	pthread_mutex_unlock(&file->lock);
+	
+	// The key's worker, so its writes stay in order
+	w = &worker[SHARD_hash(schema, record) % (unsigned int)nworker];
+	
+	pthread_mutex_lock(&w->lock);
+	
+	// A full queue holds the writer back until the worker catches up
+	while (w->queued >= WB_QUEUE) {
+		pthread_cond_wait(&w->room, &w->lock);
+	}
+	
+	if (w->tail) {
+		w->tail->next = item;
+	} else {
+		w->head = item;
+	}
+	w->tail = item;
+	w->queued++;
+	
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+	
+	__return true;
+	
+} /* WB_write */
+
+
+/*
+ * WB_flush [X]
+ * Wait until the writes queued for a file are made
+ * file			File (NULL = none)
+ */
+void WB_flush (WBFILE * file)
+{
+__STACK(WB_flush)
+	
+	if (! file) {
+		__return;
+	}
+	
+	pthread_mutex_lock(&file->lock);
+	
+	while (file->pending) {
+		pthread_cond_wait(&file->done, &file->lock);
+	}
+	
+	pthread_mutex_unlock(&file->lock);
+	
+	__return;
+	
+} /* WB_flush */
+
+
+/*
+ * WB_error [X]
+ * Take the iserrno of a write of the file that failed (0 = none)
+ * file			File (NULL = none)
+ */
+int WB_error (WBFILE * file)
+{
+	int ret;
+	
+__STACK(WB_error)
+	
+	if (! file) {
+		__return 0;
+	}
+	
+	pthread_mutex_lock(&file->lock);
+	ret = file->iserrno;
+	file->iserrno = 0;
+	pthread_mutex_unlock(&file->lock);
+	
+	__return ret;
+	
+} /* WB_error */
+
+
+/*
+ * WB_close [X]
+ * Wait for the writes of a file and delete it
+ * file			Pointer to the file
+ */
+void WB_close (WBFILE ** file)
+{
+	WBFILE *f = *file;
+	
+__STACK(WB_close)
+	
+	if (! f) {
+		__return;
+	}
+	
+	WB_flush(f);
+	
+	if (f->iserrno) {
+		pgout(0, "isfd=%d closed with a failed write behind", f->isfd);
+	}
+	
+	pthread_mutex_destroy(&f->lock);
+	pthread_cond_destroy(&f->done);
+	xfree(f);
+	*file = NULL;
+	
+	__return;
+	
+} /* WB_close */
+
+
+/*
+ * WB_shutdown [X]
+ * Make what is queued and stop the workers
+ */
+void WB_shutdown (void)
+{
+	int x;
+	
+__STACK(WB_shutdown)
+	
+	pthread_mutex_lock(&worker_lock);
+	
+	for (x=0; x < nworker; x++) {
+		pthread_mutex_lock(&worker[x].lock);
+		worker[x].stop = true;
+		pthread_cond_signal(&worker[x].ready);
+		pthread_mutex_unlock(&worker[x].lock);
+	}
+	
+	for (x=0; x < nworker; x++) {
+		pthread_join(worker[x].thread, NULL);
+		pthread_mutex_destroy(&worker[x].lock);
+		pthread_cond_destroy(&worker[x].ready);
+		pthread_cond_destroy(&worker[x].room);
+	}
+	
+	xfree(worker);
+	worker = NULL;
+	nworker = 0;
+	
+	pthread_mutex_unlock(&worker_lock);
+	
+	__return;
+	
+} /* WB_shutdown */
+
+
+// _____/ static functions \__________
+/*
+ * WB_start
+ * Start the workers (once, whichever thread queues first)
+ */
+static bool WB_start (void)
+{
+	int x;
+	
+__STACK(WB_start)
+	
+	pthread_mutex_lock(&worker_lock);
+	
+	if (! nworker && workers) {
+		worker = (WBWORKER *)xalloc(sizeof(WBWORKER) * workers);
+	
+		for (x=0; x < workers; x++) {
+			pthread_mutex_init(&worker[x].lock, NULL);
+			pthread_cond_init(&worker[x].ready, NULL);
+			pthread_cond_init(&worker[x].room, NULL);
+	
+			if (pthread_create(&worker[x].thread, NULL, WB_run, &worker[x])) {
+				pgout(mSYS, "unable to start write-behind worker %d", x);
+				pthread_mutex_destroy(&worker[x].lock);
+				pthread_cond_destroy(&worker[x].ready);
+				pthread_cond_destroy(&worker[x].room);
+				break;
+			}
+		}
+	
+		pgout(mDEBUG1, "started %d write-behind workers", x);
+	
+		// Published last: WB_write reads it without the lock
+		__sync_synchronize();
+		nworker = x;
+	}
+	
+	pthread_mutex_unlock(&worker_lock);
+	
+	__return nworker ? true : false;
+	
+} /* WB_start */
+
+
+/*
+ * WB_run
+ * Worker thread: commit the queue in batches until stopped
+ * data			Its WBWORKER
+ */
+static void * WB_run (void * data)
+{
+	WBWORKER *w = (WBWORKER *)data;
+	CONN *conn = CONN_new();
+	WBITEM *batch, *last;
+	int n;
+	
+__STACK(WB_run)
+	
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+	
+		while (! w->head && ! w->stop) {
+			pthread_cond_wait(&w->ready, &w->lock);
+		}
+	
+		if (! w->head) {
+			pthread_mutex_unlock(&w->lock);
+			break;
+		}
+	
+		// Up to WB_BATCH writes off the front of the queue
+		batch = last = w->head;
+	
+		for (n=1; n < WB_BATCH && last->next; n++) {
+			last = last->next;
+		}
+	
+		if ((w->head = last->next) == (WBITEM *)NULL) {
+			w->tail = NULL;
+		}
+		last->next = NULL;
+	
+		w->queued -= n;
+		pthread_cond_broadcast(&w->room);
+	
+		pthread_mutex_unlock(&w->lock);
+	
+		WB_commit(conn, batch);
+	}
+	
+	CONN_delete(conn);
+	
+	__return NULL;
+	
+} /* WB_run */
+
+
+/*
+ * WB_commit
+ * Make a batch of writes: one statement (an implicit transaction) for
+ * all, or, if that fails, one each to find those that fail
+ * conn			Worker's connection (NULL = none: every write fails)
+ * batch		Writes (deleted)
+ */
+static void WB_commit (CONN * conn, WBITEM * batch)
+{
+	WBITEM *item, *next;
+	char *sql = NULL;
+	RES *res = NULL;
+	
+__STACK(WB_commit)
+	
+	if (conn && batch->next) {
+		for (item = batch; item; item = item->next) {
+			str_append(&sql, "%s%s", item->sql, item->next ? ";\n" : "");
+		}
+	
+		res = pg_exec(conn, sql);
+		str_free(&sql);
+	
+		if (res) {
+			RES_delete(&res);
+			for (item = batch; item; item = next) {
+				next = item->next;
+				WB_done(item, true);
+			}
+			__return;
+		}
+	}
+	
+	for (item = batch; item; item = next) {
+		next = item->next;
+		res = conn ? pg_exec(conn, item->sql) : NULL;
+		WB_done(item, res ? true : false);
+		RES_delete(&res);
+	}
+	
+	__return;
+	
+} /* WB_commit */
+
+
+/*
+ * WB_done
+ * Account for a write made (or not) and delete it
+ * item			Write
+ * ok			Made
+ */
+static void WB_done (WBITEM * item, bool ok)
+{
+	WBFILE *file = item->file;
+	
+__STACK(WB_done)
+	
+	if (! ok) {
+		pgout(0, "write behind failed: isfd=%d [%s]", file->isfd, item->sql);
+	
+		if (write_callback) {
+			write_callback(file->isfd, item->record, WB_ERRNO);
+		}
+	}
+	
+	pthread_mutex_lock(&file->lock);
+	
+	if (! ok) {
+		file->iserrno = WB_ERRNO;
+	}
+	
+	if (--file->pending == 0) {
+		pthread_cond_broadcast(&file->done);
+	}
+	
+	pthread_mutex_unlock(&file->lock);
+	
+	str_free(&item->sql);
+	xfree(item->record);
+	xfree(item);
+	
+	__return;
+	
+} /* WB_done */
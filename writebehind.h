@@ -0,0 +1,99 @@
+/*
+ * writebehind.h: autocommit writes made by background workers
+ *
+ * The iswrite/iswrcurr of a file whose .def says writebehind, made
+ * outside a transaction, are queued to a pool of worker threads (the
+ * writebehind=N option) instead of being made by the caller.  Each worker
+ * has a connection of its own and commits what is queued to it in
+ * batches.  A record's worker is chosen by its primary key, so the writes
+ * of a key are made in the order they were queued.
+ *
+ * A write that fails is reported to the write callback, if one is set,
+ * and by the next call on its file (see WB_error).
+ */
+
+#ifndef _WRITEBEHIND_H
+#define _WRITEBEHIND_H
+
+#include <pthread.h>
+
+/*
+ * WBFILE
+ * The writes behind of one open file
+ */
+typedef struct WBFILE_T {
+	int isfd;				// File (for the callback)
+	int pending;			// Writes queued, not yet made
+	int iserrno;			// iserrno of a failed write, not yet reported (0 = none)
+	pthread_mutex_t lock;
+	pthread_cond_t done;	// Signalled as pending drops to 0
+} WBFILE;
+
+// FUNCTION PROTOTYPES
+
+
+// _____/ WB functions \__________
+/*
+ * WB_set_workers
+ * Set the number of worker threads (0 = no writes behind; the default)
+ * n			Workers (taken when the first write is queued)
+ */
+void WB_set_workers (int n);
+
+/*
+ * WB_workers
+ * Number of worker threads (0 = no writes behind)
+ */
+int WB_workers (void);
+
+/*
+ * WB_set_callback
+ * Set the function told of writes that failed (in a worker thread)
+ */
+void WB_set_callback (pgWriteCallback callback);
+
+/*
+ * WB_open
+ * Create the writes behind of a file
+ * isfd			File descriptor
+ */
+WBFILE * WB_open (int isfd);
+
+/*
+ * WB_write
+ * Queue a write
+ * file			File
+ * schema		Schema of the record
+ * record		Record (copied)
+ * sql			INSERT statement (the queue takes it, unless false)
+ */
+bool WB_write (WBFILE * file, SCHEMA * schema, char * record, char * sql);
+
+/*
+ * WB_flush
+ * Wait until the writes queued for a file are made
+ * file			File (NULL = none)
+ */
+void WB_flush (WBFILE * file);
+
+/*
+ * WB_error
+ * Take the iserrno of a write of the file that failed (0 = none)
+ * file			File (NULL = none)
+ */
+int WB_error (WBFILE * file);
+
+/*
+ * WB_close
+ * Wait for the writes of a file and delete it
+ * file			Pointer to the file
+ */
+void WB_close (WBFILE ** file);
+
+/*
+ * WB_shutdown
+ * Make what is queued and stop the workers
+ */
+void WB_shutdown (void);
+
+#endif // _WRITEBEHIND_H